@@ -27,26 +27,95 @@
 #include <ApplicationServices/ApplicationServices.h>
 
 #include <sys/types.h>
+#include <sys/param.h>
+#include <sys/event.h>
+#include <sys/time.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <libproc.h>
 #include <mach/mach.h>
 
-#define DEFAULT_MIN_TIMESTAMP_DIFF 20UL /* 20 ms */
-
-typedef struct _KeyData {
+#include "DeKeyBounceBreaker.h"
+#include "DeKeyBounceClock.h"
+#include "DeKeyBounceConfig.h"
+#include "DeKeyBounceEngine.h"
+#include "DeKeyBounceMemory.h"
+#include "DeKeyBounceProbes.h"
+#include "DeKeyBounceProfile.h"
+#include "DeKeyBounceRecorder.h"
+#include "DeKeyBounceSched.h"
+#include "DeKeyBounceSketch.h"
+#include "DeKeyBounceStats.h"
+#include "DeKeyBounceStore.h"
 
-	uint64_t nKeyCode;
-	uint64_t nLastKeyUpTimestamp;
-
-} KeyData;
+#define DEFAULT_MIN_TIMESTAMP_DIFF 20UL /* 20 ms */
+#define DEFAULT_QUEUE_BUDGET 100UL /* ms */
+#define DEFAULT_STATE_PATH "/var/db/DeKeyBounce.state"
+#define HOUSEKEEPING_INTERVAL 5 /* seconds from the first key event to the housekeeping of it and the next ones */
+#define HOUSEKEEPING_SLACK 1 /* seconds, work due this soon is done along with the work due now */
+#define DEFAULT_RECORD_PATH "/var/db/DeKeyBounce.flight"
+#define DEFAULT_SKETCH_PERIOD 300 /* seconds */
+#define MAX_RELEASE_COUNT 32 /* deferred key-ups posted at once */
+#define RELEASE_TIMER_IDLE_INTERVAL 1e9 /* seconds, the timer repeats only to stay valid between its deadlines */
 
 static CFMachPortRef theSignalPort = NULL;
 static CFRunLoopSourceRef theSignalSource = NULL;
 static mach_port_t theRawSignalPort = MACH_PORT_NULL;
 
-static CFMutableSetRef theKeySet = NULL;
+static DKBEngine theTransientEngine; // used when the state file is unavailable
+static DKBEngine *theEngine = NULL;
+static DKBStore theStore = { -1, NULL, 0, NULL, NULL };
+static const char *theStatePath = DEFAULT_STATE_PATH;
 static CFMachPortRef theEventTap = NULL;
 static CFRunLoopSourceRef theEventTapSource = NULL;
+static CFRunLoopTimerRef theReleaseTimer = NULL; // on the run loop of the tap, for the key-ups deferred in the hold window
+static CGEventTimestamp theReleaseTime = 0; // when the next deferred key-up is due, 0 for none
+static DKBClock theClock;
 static CGEventTimestamp theMinTimestampDiff = 0;
+static CGEventTimestamp theMinHoldDiff = 0;
+static DKBSchedOptions theSchedOptions = { DKB_SCHED_DEFAULT, DKB_SCHED_DEFAULT_PRIORITY, DKB_SCHED_ANY_CPU };
+static Boolean theFaultCheckIsEnabled = FALSE;
+static uint64_t theCallbackFaultCount = 0; // written by the tap callback only
+static uint64_t theCheckedEventCount = 0;
+static uint16_t theAlertBounceRate = DKB_DEFAULT_ALERT_BOUNCE_RATE;
+static uint64_t theQueueBudget = DEFAULT_QUEUE_BUDGET;
+static DKBBreaker theBreaker; // written by the tap callback only
+
+static DKBStats theStats; // owned by the housekeeping
+static DKBKeyCounters theSeenCounters[DKB_KEY_CODE_COUNT];
+static const char *theHeatmapPath = NULL;
+static int theStatsResetIsPending = 0;
+
+static const char *theConfigPath = NULL;
+static DKBConfigDomain theConfigDomain; // published by the housekeeping, read by the tap callback
+static DKBConfigReader *theConfigReader = NULL;
+static uint64_t theConfigGeneration = 0; // of the config last applied to the engine
+static int theConfigReloadIsPending = 0;
+
+static DKBProfileCache theProfileCache; // written by the tap callback only
+static int theAppliedProfile = DKB_PROFILE_NONE; // of the thresholds in the engine
+static int theProfileQueue = -1; // a kqueue telling the tap thread about the exits of the cached processes
+static CFFileDescriptorRef theProfileQueueDescriptor = NULL;
+static CFRunLoopSourceRef theProfileQueueSource = NULL;
+
+static DKBRecorder theRecorder; // added to by the tap callback, dumped by the housekeeping
+static size_t theRecordCount = 0; // 0 records nothing, the events are keystrokes
+static const char *theRecordPath = DEFAULT_RECORD_PATH;
+static int theRecordDumpIsPending = 0;
+
+static DKBSketch theSketch; // added to by the tap callback, exported by the housekeeping
+static const char *theSketchPath = NULL;
+static uint64_t theSketchPeriod = DEFAULT_SKETCH_PERIOD; // seconds, then ticks
+
+static pthread_t theHousekeepingThread;
+static pthread_mutex_t theHousekeepingMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t theHousekeepingCondition = PTHREAD_COND_INITIALIZER;
+static Boolean theHousekeepingIsRunning = FALSE;
+static Boolean theHousekeepingShouldStop = FALSE;
+static int theHousekeepingIsArmed = 1; // set by the tap callback, cleared by the housekeeping; a first round reads in the state file
+static Boolean theWakeupCountIsEnabled = FALSE;
+static DKBSchedWakeups theWakeups; // of the housekeeping thread
 
 static Boolean InitSignalHandling(void);
 static void DeinitSignalHandling(void);
@@ -54,13 +123,24 @@ static void SignalHandler(int nSignal);
 static void SignalCallBack(CFMachPortRef rPort, void *pMessage, CFIndex nSize, void *pInfo);
 
 static Boolean Init(void);
+static void PinEngine(Boolean isPinning);
+static DKBConfig *LoadConfig(void);
+static void ApplyConfig(const DKBConfig *pConfig, int nProfile);
+static Boolean InitProfiles(void);
+static void DeinitProfiles(void);
+static int FindProfile(const DKBConfig *pConfig, CGEventRef rEvent);
+static void OnProcessExit(CFFileDescriptorRef rDescriptor, CFOptionFlags nCallBackTypes, void *pInfo);
 static CGEventRef OnKeyEvent(CGEventTapProxy pProxy, CGEventType aEventType, CGEventRef rEvent, void *pInfo);
+static void ArmReleaseTimer(CGEventTimestamp nReleaseTime);
+static void OnReleaseTimer(CFRunLoopTimerRef rTimer, void *pInfo);
 static void Deinit(void);
 
-static const void *RetainKeyData(CFAllocatorRef rAllocator, const void *pValue);
-static void ReleaseKeyData(CFAllocatorRef rAllocator, const void *pValue);
-static Boolean IsKeyDataEqual(const void *pValue1, const void *pValue2);
-static CFHashCode KeyDataHash(const void *pValue);
+static Boolean InitHousekeeping(void);
+static void DeinitHousekeeping(void);
+static void *Housekeeping(void *pArgument);
+static void ArmHousekeeping(void);
+static void ExportSketch(uint64_t *pExportedCount);
+static void LogWakeups(void);
 
 int main (int argc, const char * argv[]) {
 
@@ -70,11 +150,74 @@ int main (int argc, const char * argv[]) {
 		return 1; // incorrect using
 	if(!InitSignalHandling())
 		return 1;
-	if(argc > 1)
-		theMinTimestampDiff = strtoul(argv[1], NULL, 10);
+	int nOption;
+	while((nOption = getopt(argc, (char * const *)argv, "a:B:C:c:fH:I:i:m:p:R:r:s:W")) != -1) {
+		switch(nOption) {
+		case 'a': { // the bounce rate of a key in % to complain about in the log
+			double fPercent = strtod(optarg, NULL);
+			theAlertBounceRate = (fPercent >= 100) ? DKB_RATE_ONE : (fPercent > 0) ? (uint16_t)(fPercent * DKB_RATE_ONE / 100) : 1;
+			break;
+		}
+		case 'B': // the queueing delay in ms over which key events bypass the filter
+			theQueueBudget = strtoul(optarg, NULL, 10);
+			break;
+		case 'C': // the file with the thresholds, read again on SIGHUP
+			theConfigPath = optarg;
+			break;
+		case 'c': // the CPU to pin the tap thread to
+			theSchedOptions.nCpu = strtol(optarg, NULL, 10);
+			break;
+		case 'f': // count page faults taken inside the tap callback
+			theFaultCheckIsEnabled = TRUE;
+			break;
+		case 'H': // the hold window in ms, key-ups sooner after the key-down are held back to its end
+			theMinHoldDiff = strtoul(optarg, NULL, 10);
+			break;
+		case 'I': // seconds between two writes of the interval sketches
+			theSketchPeriod = strtoul(optarg, NULL, 10);
+			break;
+		case 'i': // where to write the interval sketches, which keep no keystrokes
+			theSketchPath = optarg;
+			break;
+		case 'm': // where to keep the per-key heatmap, CSV if it ends with .csv, JSON otherwise
+			theHeatmapPath = optarg;
+			break;
+		case 'p': // fifo or rr asks for a time constraint policy of the tap thread
+			if(DKBSchedParsePolicy(&theSchedOptions, optarg) != 0) {
+				DeinitSignalHandling();
+				return 1; // incorrect using
+			}
+			break;
+		case 'R': // where SIGUSR1 dumps the flight record
+			theRecordPath = optarg;
+			break;
+		case 'r': // key events to keep in the flight record
+			theRecordCount = strtoul(optarg, NULL, 10);
+			break;
+		case 's': // an empty path disables the state file
+			theStatePath = optarg;
+			break;
+		case 'W': // log the wakeups per minute, idle and busy
+			theWakeupCountIsEnabled = TRUE;
+			break;
+		default:
+			DeinitSignalHandling();
+			return 1; // incorrect using
+		}
+	}
+	if(optind < argc)
+		theMinTimestampDiff = strtoul(argv[optind], NULL, 10);
 	if(theMinTimestampDiff == 0)
 		theMinTimestampDiff = DEFAULT_MIN_TIMESTAMP_DIFF;
-	theMinTimestampDiff *= 1000000; // from ms to ns
+	// event timestamps are mach absolute time, which is not nanoseconds on every Mac
+	if(DKBClockInitNative(&theClock) != 0) {
+		DeinitSignalHandling();
+		return 1;
+	}
+	theMinTimestampDiff = DKBClockFromNanoseconds(&theClock, theMinTimestampDiff * 1000000); // from ms
+	theMinHoldDiff = DKBClockFromNanoseconds(&theClock, theMinHoldDiff * 1000000);
+	DKBBreakerInit(&theBreaker, DKBClockFromNanoseconds(&theClock, theQueueBudget * 1000000));
+	theSketchPeriod = DKBClockFromNanoseconds(&theClock, theSketchPeriod * 1000000000);
 	if(!Init()) {
 		DeinitSignalHandling();
 		return 1;
@@ -109,6 +252,10 @@ static Boolean InitSignalHandling(void) {
 			break;
 		if(sigaction(SIGTERM, &aSignalAction, NULL) != 0)
 			break;
+		if(sigaction(SIGUSR1, &aSignalAction, NULL) != 0)
+			break;
+		if(sigaction(SIGUSR2, &aSignalAction, NULL) != 0)
+			break;
 		// ignored signals
 		aSignalAction.sa_handler = SIG_IGN;
 		if(sigaction(SIGPIPE, &aSignalAction, NULL) != 0)
@@ -129,6 +276,8 @@ static void DeinitSignalHandling(void) {
 	bzero(&aSignalAction, sizeof aSignalAction);
 	aSignalAction.sa_handler = SIG_DFL;
 	sigaction(SIGPIPE, &aSignalAction, NULL);
+	sigaction(SIGUSR2, &aSignalAction, NULL);
+	sigaction(SIGUSR1, &aSignalAction, NULL);
 	sigaction(SIGTERM, &aSignalAction, NULL);
 	sigaction(SIGINT, &aSignalAction, NULL);
 	sigaction(SIGHUP, &aSignalAction, NULL);
@@ -164,12 +313,30 @@ static void SignalCallBack(CFMachPortRef rPort, void *pMessage, CFIndex nSize, v
 
 	mach_msg_header_t *pMachHeader = (mach_msg_header_t *)pMessage;
 	switch(pMachHeader->msgh_id) {
-	case SIGHUP:
+	case SIGHUP: // the housekeeping reads the config file, the tap callback never waits for it
+		if(theConfigPath != NULL) {
+			pthread_mutex_lock(&theHousekeepingMutex);
+			theConfigReloadIsPending = 1;
+			pthread_cond_signal(&theHousekeepingCondition);
+			pthread_mutex_unlock(&theHousekeepingMutex);
+		}
 		break;
 	case SIGINT:
 	case SIGTERM:
 		CFRunLoopStop(CFRunLoopGetCurrent());
 		break;
+	case SIGUSR1: // the housekeeping writes the flight record, the tap callback keeps adding to it
+		pthread_mutex_lock(&theHousekeepingMutex);
+		theRecordDumpIsPending = 1;
+		pthread_cond_signal(&theHousekeepingCondition);
+		pthread_mutex_unlock(&theHousekeepingMutex);
+		break;
+	case SIGUSR2: // start counting anew, the housekeeping owns the stats
+		pthread_mutex_lock(&theHousekeepingMutex);
+		theStatsResetIsPending = 1;
+		pthread_cond_signal(&theHousekeepingCondition);
+		pthread_mutex_unlock(&theHousekeepingMutex);
+		break;
 	}
 
 }
@@ -178,9 +345,37 @@ static Boolean Init(void) {
 
 	Boolean isSuccess = FALSE;
 	do { // just for break
-		CFSetCallBacks aKeySetCallBacks = { 0, RetainKeyData, ReleaseKeyData, NULL, IsKeyDataEqual, KeyDataHash };
-		theKeySet = CFSetCreateMutable(NULL, 0, &aKeySetCallBacks);
-		if(!theKeySet)
+		DKBConfig *pConfig = LoadConfig();
+		if(pConfig == NULL)
+			break;
+		if(DKBConfigDomainInit(&theConfigDomain, pConfig) != 0) {
+			DKBConfigDestroy(pConfig);
+			break;
+		}
+		theConfigReader = DKBConfigAddReader(&theConfigDomain);
+		int isWarm = 0;
+		if(*theStatePath != '\0' && DKBStoreOpen(&theStore, theStatePath, theMinTimestampDiff, &isWarm) == 0) {
+			theEngine = theStore.pEngine;
+		} else {
+			DKBEngineInit(&theTransientEngine, theMinTimestampDiff);
+			theEngine = &theTransientEngine;
+		}
+		ApplyConfig(pConfig, DKB_PROFILE_NONE);
+		PinEngine(TRUE);
+		if(!InitProfiles())
+			syslog(LOG_WARNING, "cannot watch for process exits, the app thresholds are looked up for every key event: %m");
+		if(DKBRecorderInit(&theRecorder, theRecordCount) != 0)
+			break;
+		if(theRecorder.pEntries != NULL && DKBMemoryPin(theRecorder.pEntries, (theRecorder.nMask + 1) * sizeof(DKBRecorderEntry)) != 0)
+			syslog(LOG_WARNING, "cannot lock the flight record in memory: %m");
+		if(theSketchPath != NULL) {
+			if(DKBSketchInit(&theSketch, &theClock) != 0)
+				break;
+			if(DKBMemoryPin(theSketch.pCounts, DKB_SKETCH_KEY_COUNT * DKB_SKETCH_BUCKET_COUNT * sizeof(uint32_t)) != 0)
+				syslog(LOG_WARNING, "cannot lock the interval sketches in memory: %m");
+		}
+		DKBStatsReset(&theStats, DKBClockNow(&theClock));
+		if(!InitHousekeeping())
 			break;
 		CGEventMask aEventMask = CGEventMaskBit(kCGEventKeyDown) | CGEventMaskBit(kCGEventKeyUp);
 		theEventTap = CGEventTapCreate(kCGHIDEventTap, kCGHeadInsertEventTap, 0 /*kCGEventTapOptionDefault*/, aEventMask, OnKeyEvent, NULL);
@@ -190,6 +385,14 @@ static Boolean Init(void) {
 		if(!theEventTapSource)
 			break;
 		CFRunLoopAddSource(CFRunLoopGetCurrent(), theEventTapSource, kCFRunLoopDefaultMode);
+		theReleaseTimer = CFRunLoopTimerCreate(NULL, CFAbsoluteTimeGetCurrent() + RELEASE_TIMER_IDLE_INTERVAL,
+			RELEASE_TIMER_IDLE_INTERVAL, 0, 0, OnReleaseTimer, NULL);
+		if(!theReleaseTimer)
+			break;
+		CFRunLoopAddTimer(CFRunLoopGetCurrent(), theReleaseTimer, kCFRunLoopDefaultMode); // the engine keeps one writer
+		DKBMemoryPrefaultStack(); // the tap callback runs on this thread
+		if(DKBSchedApply(&theSchedOptions) != 0)
+			syslog(LOG_WARNING, "cannot apply the scheduling options to the tap thread: %m");
 		isSuccess = TRUE;
 	} while(0);
 	if(!isSuccess) {
@@ -200,49 +403,124 @@ static Boolean Init(void) {
 
 }
 
-static CGEventRef OnKeyEvent(CGEventTapProxy pProxy, CGEventType aEventType, CGEventRef rEvent, void *pInfo) {
+static void PinEngine(Boolean isPinning) {
 
-	KeyData aNewKeyData;
-	aNewKeyData.nKeyCode = CGEventGetIntegerValueField(rEvent, kCGKeyboardEventKeycode);
-	aNewKeyData.nLastKeyUpTimestamp = CGEventGetTimestamp(rEvent);
-	KeyData *pOldKeyData = (KeyData *)CFSetGetValue(theKeySet, &aNewKeyData);
+	// everything the tap callback touches must stay resident, a page fault there stalls every keystroke
+	void *pAddress = theEngine;
+	size_t nSize = sizeof(DKBEngine);
+	if(theEngine == theStore.pEngine) {
+		pAddress = theStore.pMapping;
+		nSize = theStore.nMappingSize;
+	}
+	if(!isPinning)
+		DKBMemoryUnpin(pAddress, nSize);
+	else if(DKBMemoryPin(pAddress, nSize) != 0)
+		syslog(LOG_WARNING, "cannot lock the key state in memory: %m");
 
-	switch(aEventType) {
+}
+
+static CGEventRef OnKeyEvent(CGEventTapProxy pProxy, CGEventType aEventType, CGEventRef rEvent, void *pInfo) {
 
+	if(aEventType == kCGEventTapDisabledByTimeout || aEventType == kCGEventTapDisabledByUserInput) {
+		// the window server switched the tap off, after a callback too slow or for secure input
+		DEKEYBOUNCE_TAP_REENABLE(aEventType);
+		syslog(LOG_WARNING, "the event tap was disabled %s, enabling it again",
+			(aEventType == kCGEventTapDisabledByTimeout) ? "for a timeout" : "by user input");
+		CGEventTapEnable(theEventTap, true);
+		return rEvent;
+	}
+	uint64_t nMinorFaults = 0, nMajorFaults = 0;
+	if(theFaultCheckIsEnabled)
+		DKBMemoryGetFaults(&nMinorFaults, &nMajorFaults);
+	DKBEvent aEvent;
+	bzero(&aEvent, sizeof aEvent);
+	aEvent.nTimestamp = CGEventGetTimestamp(rEvent);
+	aEvent.nKeyCode = CGEventGetIntegerValueField(rEvent, kCGKeyboardEventKeycode);
+	switch(aEventType) {
 	case kCGEventKeyDown:
-		if(!pOldKeyData)
-			break;
-		if(pOldKeyData->nLastKeyUpTimestamp == 0) {
-			rEvent = NULL;
-			break;
-		}
-		if(aNewKeyData.nLastKeyUpTimestamp < (pOldKeyData->nLastKeyUpTimestamp + theMinTimestampDiff)) {
-			pOldKeyData->nLastKeyUpTimestamp = 0;
-			rEvent = NULL;
-			break;
-		}
+		aEvent.nType = DKB_EVENT_KEY_DOWN;
 		break;
-
 	case kCGEventKeyUp:
-		if(!pOldKeyData) {
-			CFSetAddValue(theKeySet, &aNewKeyData);
-			break;
-		}
-		if(pOldKeyData->nLastKeyUpTimestamp == 0) {
-			pOldKeyData->nLastKeyUpTimestamp = aNewKeyData.nLastKeyUpTimestamp;
-			rEvent = NULL;
-			break;
-		}
-		pOldKeyData->nLastKeyUpTimestamp = aNewKeyData.nLastKeyUpTimestamp;
+		aEvent.nType = DKB_EVENT_KEY_UP;
 		break;
-
+	default:
+		return rEvent;
+	}
+	const DKBConfig *pConfig = DKBConfigAcquire(&theConfigDomain);
+	ApplyConfig(pConfig, FindProfile(pConfig, rEvent));
+	DKBSketchAdd(&theSketch, &aEvent, theEngine); // the interval to the key-up the engine holds, before judging
+	uint64_t nNow = (theBreaker.nBudget != 0 || theRecorder.pEntries != NULL) ? DKBClockNow(&theClock) : 0;
+	int nVerdict = DKB_VERDICT_PASS;
+	if(DKBBreakerCheck(&theBreaker, aEvent.nTimestamp, nNow)) // the tap thread got the event late, the window server holds the rest
+		DKBEngineTrackEvent(theEngine, &aEvent);
+	else
+		nVerdict = DKBEngineFilterEvent(theEngine, &aEvent);
+	DKBRecorderAdd(&theRecorder, &aEvent, nVerdict, theEngine, nNow);
+	if(nVerdict == DKB_VERDICT_DROP) {
+		rEvent = NULL;
+		if(theEngine->nDeferredCount != 0) { // a deferral is a drop
+			CGEventTimestamp nReleaseTime;
+			DKBEngineReleaseKeys(theEngine, 0, NULL, 0, &nReleaseTime); // releases nothing, only looks up the next one
+			if(theReleaseTime == 0 || nReleaseTime < theReleaseTime)
+				ArmReleaseTimer(nReleaseTime);
+		}
+	}
+	DKBConfigQuiesce(&theConfigDomain, theConfigReader); // the engine may point into a freed config until the next ApplyConfig
+	if(!__atomic_load_n(&theHousekeepingIsArmed, __ATOMIC_RELAXED))
+		ArmHousekeeping(); // once after a quiet spell, a load the rest of the time
+	if(theFaultCheckIsEnabled) {
+		uint64_t nMinorFaultsAfter, nMajorFaultsAfter;
+		DKBMemoryGetFaults(&nMinorFaultsAfter, &nMajorFaultsAfter);
+		uint64_t nFaults = (nMinorFaultsAfter - nMinorFaults) + (nMajorFaultsAfter - nMajorFaults);
+		__atomic_store_n(&theCallbackFaultCount, theCallbackFaultCount + nFaults, __ATOMIC_RELAXED);
+		__atomic_store_n(&theCheckedEventCount, theCheckedEventCount + 1, __ATOMIC_RELAXED);
 	}
 	return rEvent;
 
 }
 
+static void ArmReleaseTimer(CGEventTimestamp nReleaseTime) {
+
+	theReleaseTime = nReleaseTime;
+	if(nReleaseTime == 0)
+		return; // fired just now, it comes back in RELEASE_TIMER_IDLE_INTERVAL to find nothing due
+	uint64_t nNow = DKBClockNow(&theClock); // the ticks of the event timestamps
+	uint64_t nDelay = (nReleaseTime > nNow) ? DKBClockToNanoseconds(&theClock, nReleaseTime - nNow) : 0;
+	CFRunLoopTimerSetNextFireDate(theReleaseTimer, CFAbsoluteTimeGetCurrent() + nDelay / 1e9);
+
+}
+
+static void OnReleaseTimer(CFRunLoopTimerRef rTimer, void *pInfo) {
+
+	// the deferred key-ups are posted past the HID tap, so the callback does not judge them again
+	uint64_t nNow = DKBClockNow(&theClock);
+	CGEventTimestamp nNextTime = 0;
+	do {
+		DKBEvent aReleases[MAX_RELEASE_COUNT];
+		size_t nCount = DKBEngineReleaseKeys(theEngine, nNow, aReleases, MAX_RELEASE_COUNT, &nNextTime);
+		size_t i;
+		for(i = 0; i < nCount; i++) {
+			DKBRecorderAdd(&theRecorder, &aReleases[i], DKB_VERDICT_PASS, theEngine, nNow);
+			CGEventRef rRelease = CGEventCreateKeyboardEvent(NULL, (CGKeyCode)aReleases[i].nKeyCode, false);
+			if(rRelease == NULL) {
+				syslog(LOG_WARNING, "cannot release the key %d held in the hold window", aReleases[i].nKeyCode);
+				continue;
+			}
+			CGEventPost(kCGSessionEventTap, rRelease);
+			CFRelease(rRelease);
+		}
+	} while(nNextTime == nNow); // more were due than fit
+	ArmReleaseTimer(nNextTime);
+
+}
+
 static void Deinit(void) {
 
+	if(theReleaseTimer) {
+		CFRunLoopTimerInvalidate(theReleaseTimer);
+		CFRelease(theReleaseTimer);
+		theReleaseTimer = NULL;
+	}
 	if(theEventTapSource) {
 		CFRunLoopRemoveSource(CFRunLoopGetCurrent(), theEventTapSource, kCFRunLoopDefaultMode);
 		CFRelease(theEventTapSource);
@@ -252,38 +530,322 @@ static void Deinit(void) {
 		CFRelease(theEventTap);
 		theEventTap = NULL;
 	}
-	if(theKeySet) {
-		CFRelease(theKeySet);
-		theKeySet = NULL;
+	DeinitHousekeeping();
+	DeinitProfiles();
+	if(theRecorder.pEntries != NULL)
+		DKBMemoryUnpin(theRecorder.pEntries, (theRecorder.nMask + 1) * sizeof(DKBRecorderEntry));
+	DKBRecorderDeinit(&theRecorder);
+	if(theSketch.pCounts != NULL)
+		DKBMemoryUnpin(theSketch.pCounts, DKB_SKETCH_KEY_COUNT * DKB_SKETCH_BUCKET_COUNT * sizeof(uint32_t));
+	DKBSketchDeinit(&theSketch);
+	if(theEngine)
+		PinEngine(FALSE);
+	DKBStoreClose(&theStore);
+	theEngine = NULL;
+	if(theConfigReader != NULL) {
+		DKBConfigDomainDeinit(&theConfigDomain);
+		theConfigReader = NULL;
 	}
 
 }
 
-static const void *RetainKeyData(CFAllocatorRef rAllocator, const void *pValue) {
+static DKBConfig *LoadConfig(void) {
+
+	// the command line gives what the file does not say
+	DKBConfig *pConfig = DKBConfigCreate(NULL, theMinTimestampDiff, theAlertBounceRate);
+	if(pConfig == NULL)
+		return NULL;
+	pConfig->nMinHoldDiff = theMinHoldDiff;
+	if(theConfigPath == NULL)
+		return pConfig;
+	char aError[256];
+	if(DKBConfigParse(pConfig, theConfigPath, &theClock, aError, sizeof aError) != 0) {
+		syslog(LOG_ERR, "%s", aError);
+		DKBConfigDestroy(pConfig);
+		return NULL;
+	}
+	if(pConfig->nDeviceCount != 0)
+		syslog(LOG_WARNING, "the device thresholds of %s are not used here, the tap sees no devices", theConfigPath);
+	return pConfig;
+
+}
+
+static void ApplyConfig(const DKBConfig *pConfig, int nProfile) {
+
+	if(theConfigGeneration == pConfig->nGeneration && theAppliedProfile == nProfile)
+		return; // the usual case, two compares per key event
+	if(theConfigGeneration != pConfig->nGeneration) // not on a profile swap, the interval buckets keep their bounds
+		DKBEngineSetIntervalBase(theEngine, pConfig->nMinTimestampDiff);
+	if(nProfile != DKB_PROFILE_NONE) { // the threshold of the app stands for every key
+		DKBEngineSetMinTimestampDiff(theEngine, pConfig->aApps[nProfile].nMinTimestampDiff);
+		DKBEngineSetKeyMinTimestampDiffs(theEngine, NULL);
+	} else {
+		DKBEngineSetMinTimestampDiff(theEngine, pConfig->nMinTimestampDiff);
+		DKBEngineSetKeyMinTimestampDiffs(theEngine, pConfig->hasKeyMinTimestampDiffs ? pConfig->aKeyMinTimestampDiffs : NULL);
+	}
+	DKBEngineSetAlertBounceRate(theEngine, pConfig->nAlertBounceRate);
+	DKBEngineSetMinHoldDiff(theEngine, pConfig->nMinHoldDiff);
+	theConfigGeneration = pConfig->nGeneration;
+	theAppliedProfile = nProfile;
+
+}
+
+static Boolean InitProfiles(void) {
+
+	DKBProfileCacheInit(&theProfileCache);
+	theProfileQueue = kqueue();
+	if(theProfileQueue < 0)
+		return FALSE;
+	theProfileQueueDescriptor = CFFileDescriptorCreate(NULL, theProfileQueue, false, OnProcessExit, NULL);
+	if(!theProfileQueueDescriptor) {
+		DeinitProfiles();
+		return FALSE;
+	}
+	theProfileQueueSource = CFFileDescriptorCreateRunLoopSource(NULL, theProfileQueueDescriptor, 0);
+	if(!theProfileQueueSource) {
+		DeinitProfiles();
+		return FALSE;
+	}
+	CFRunLoopAddSource(CFRunLoopGetCurrent(), theProfileQueueSource, kCFRunLoopDefaultMode); // the run loop of the tap, so the cache has one writer
+	CFFileDescriptorEnableCallBacks(theProfileQueueDescriptor, kCFFileDescriptorReadCallBack);
+	return TRUE;
+
+}
+
+static void DeinitProfiles(void) {
+
+	if(theProfileQueueSource) {
+		CFRunLoopRemoveSource(CFRunLoopGetCurrent(), theProfileQueueSource, kCFRunLoopDefaultMode);
+		CFRelease(theProfileQueueSource);
+		theProfileQueueSource = NULL;
+	}
+	if(theProfileQueueDescriptor) {
+		CFFileDescriptorInvalidate(theProfileQueueDescriptor);
+		CFRelease(theProfileQueueDescriptor);
+		theProfileQueueDescriptor = NULL;
+	}
+	if(theProfileQueue >= 0) {
+		close(theProfileQueue);
+		theProfileQueue = -1;
+	}
+
+}
 
-	KeyData *pNewKeyData = CFAllocatorAllocate(rAllocator, sizeof(KeyData), 0);
-	if(pNewKeyData) {
-		pNewKeyData->nKeyCode = ((const KeyData *)pValue)->nKeyCode;
-		pNewKeyData->nLastKeyUpTimestamp = ((const KeyData *)pValue)->nLastKeyUpTimestamp;
+static int FindProfile(const DKBConfig *pConfig, CGEventRef rEvent) {
+
+	if(pConfig->nAppCount == 0)
+		return DKB_PROFILE_NONE; // nothing to look up
+	int32_t nPid = (int32_t)CGEventGetIntegerValueField(rEvent, kCGEventTargetUnixProcessID);
+	if(nPid <= 0)
+		return DKB_PROFILE_NONE; // the window server has not picked the process yet
+	int nProfile;
+	if(DKBProfileCacheLookup(&theProfileCache, nPid, pConfig->nGeneration, &nProfile))
+		return nProfile; // the usual case, a compare with the process of the last key event
+	char aName[2 * MAXCOMLEN + 1];
+	nProfile = (proc_name(nPid, aName, sizeof aName) > 0) ? DKBConfigFindApp(pConfig, aName) : DKB_PROFILE_NONE;
+	// a process stays in the cache only while its exit is watched for, its id may come back for another one
+	struct kevent aChange;
+	EV_SET(&aChange, nPid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, NULL);
+	if(theProfileQueue < 0 || kevent(theProfileQueue, &aChange, 1, NULL, 0, NULL) != 0)
+		return nProfile; // it has exited already
+	int32_t nEvictedPid = DKBProfileCacheStore(&theProfileCache, nPid, nProfile);
+	if(nEvictedPid != 0) {
+		EV_SET(&aChange, nEvictedPid, EVFILT_PROC, EV_DELETE, 0, 0, NULL);
+		kevent(theProfileQueue, &aChange, 1, NULL, 0, NULL); // fails if it has exited meanwhile, the exit is ignored then
 	}
-	return pNewKeyData;
+	return nProfile;
+
+}
+
+static void OnProcessExit(CFFileDescriptorRef rDescriptor, CFOptionFlags nCallBackTypes, void *pInfo) {
+
+	struct kevent aEvents[DKB_PROFILE_CACHE_SIZE];
+	struct timespec aTimeout = { 0, 0 };
+	int nCount = kevent(theProfileQueue, NULL, 0, aEvents, DKB_PROFILE_CACHE_SIZE, &aTimeout);
+	int i;
+	for(i = 0; i < nCount; i++)
+		DKBProfileCacheRemove(&theProfileCache, (int32_t)aEvents[i].ident);
+	CFFileDescriptorEnableCallBacks(rDescriptor, kCFFileDescriptorReadCallBack); // one-shot
 
 }
 
-static void ReleaseKeyData(CFAllocatorRef rAllocator, const void *pValue) {
+static Boolean InitHousekeeping(void) {
 
-	CFAllocatorDeallocate(rAllocator, (void *)pValue);
+	theHousekeepingShouldStop = FALSE;
+	if(pthread_create(&theHousekeepingThread, NULL, Housekeeping, NULL) != 0)
+		return FALSE;
+	theHousekeepingIsRunning = TRUE;
+	return TRUE;
+
+}
+
+static void DeinitHousekeeping(void) {
+
+	if(!theHousekeepingIsRunning)
+		return;
+	pthread_mutex_lock(&theHousekeepingMutex);
+	theHousekeepingShouldStop = TRUE;
+	pthread_cond_signal(&theHousekeepingCondition);
+	pthread_mutex_unlock(&theHousekeepingMutex);
+	pthread_join(theHousekeepingThread, NULL);
+	theHousekeepingIsRunning = FALSE;
+
+}
+
+static void ArmHousekeeping(void) {
+
+	// the housekeeping sleeps without a deadline when idle, it takes the deadline from here
+	if(__atomic_exchange_n(&theHousekeepingIsArmed, 1, __ATOMIC_RELAXED))
+		return;
+	pthread_mutex_lock(&theHousekeepingMutex);
+	pthread_cond_signal(&theHousekeepingCondition);
+	pthread_mutex_unlock(&theHousekeepingMutex);
+
+}
+
+static void *Housekeeping(void *pArgument) {
+
+	// sleeps with no deadline while nothing is pending, the first key event after that arms it
+	uint64_t nReportedFaultCount = 0;
+	uint64_t nReportedTripCount = 0;
+	uint64_t nReportedMissCount = 0;
+	uint64_t nRoundTime = 0; // when the round for the key events is due, 0 for none
+	uint64_t nSketchTime = 0; // when the sketch counts not yet written are due, 0 for none
+	uint64_t nSketchExportTime = DKBClockNow(&theClock);
+	uint64_t nExportedSketchCount = 0;
+	uint64_t nInterval = DKBClockFromNanoseconds(&theClock, HOUSEKEEPING_INTERVAL * 1000000000ULL);
+	uint64_t nSlack = DKBClockFromNanoseconds(&theClock, HOUSEKEEPING_SLACK * 1000000000ULL);
+	if(theWakeupCountIsEnabled)
+		DKBSchedWakeupsInit(&theWakeups, DKB_SCHED_BUSY, DKBClockNow(&theClock));
+	pthread_mutex_lock(&theHousekeepingMutex);
+	while(!theHousekeepingShouldStop) {
+		if(nRoundTime == 0 && __atomic_load_n(&theHousekeepingIsArmed, __ATOMIC_RELAXED)) // read under the lock, so no signal is missed
+			nRoundTime = DKBClockNow(&theClock) + nInterval;
+		uint64_t nDeadline = (nSketchTime != 0 && (nRoundTime == 0 || nSketchTime < nRoundTime)) ? nSketchTime : nRoundTime;
+		if(theWakeupCountIsEnabled)
+			DKBSchedWakeupsSwitch(&theWakeups, (nDeadline != 0) ? DKB_SCHED_BUSY : DKB_SCHED_IDLE, DKBClockNow(&theClock));
+		if(!theConfigReloadIsPending && !theRecordDumpIsPending && !theStatsResetIsPending) {
+			if(nDeadline == 0) {
+				pthread_cond_wait(&theHousekeepingCondition, &theHousekeepingMutex);
+			} else {
+				uint64_t nNow = DKBClockNow(&theClock);
+				uint64_t nDelay = (nDeadline > nNow) ? DKBClockToNanoseconds(&theClock, nDeadline - nNow) : 0;
+				struct timespec aDeadline;
+				struct timeval aNow;
+				gettimeofday(&aNow, NULL);
+				uint64_t nNanoseconds = aNow.tv_usec * 1000ULL + nDelay;
+				aDeadline.tv_sec = aNow.tv_sec + nNanoseconds / 1000000000;
+				aDeadline.tv_nsec = nNanoseconds % 1000000000;
+				pthread_cond_timedwait(&theHousekeepingCondition, &theHousekeepingMutex, &aDeadline);
+			}
+		}
+		if(theHousekeepingShouldStop)
+			break;
+		int isConfigReloading = theConfigReloadIsPending;
+		theConfigReloadIsPending = 0;
+		int isRecordDumping = theRecordDumpIsPending;
+		theRecordDumpIsPending = 0;
+		int isStatsResetting = theStatsResetIsPending;
+		theStatsResetIsPending = 0;
+		pthread_mutex_unlock(&theHousekeepingMutex);
+		if(isRecordDumping) {
+			size_t nDumpedCount;
+			if(theRecorder.pEntries == NULL)
+				syslog(LOG_WARNING, "no flight record to dump, start with -r");
+			else if(DKBRecorderDump(&theRecorder, &theClock, theRecordPath, &nDumpedCount) != 0)
+				syslog(LOG_WARNING, "cannot dump the flight record to %s: %m", theRecordPath);
+			else
+				syslog(LOG_INFO, "dumped the last %zu key events to %s", nDumpedCount, theRecordPath);
+		}
+		if(isConfigReloading) {
+			DKBConfig *pConfig = LoadConfig();
+			if(pConfig != NULL) {
+				DKBConfigPublish(&theConfigDomain, pConfig); // the tap callback picks it up with the next key event
+				syslog(LOG_INFO, "read the settings from %s", theConfigPath);
+			} else {
+				syslog(LOG_WARNING, "keeping the settings in use");
+			}
+		}
+		uint64_t nNow = DKBClockNow(&theClock);
+		if(isStatsResetting)
+			DKBStatsReset(&theStats, nNow);
+		if(nRoundTime != 0 && nRoundTime <= nNow + nSlack) {
+			nRoundTime = 0;
+			__atomic_store_n(&theHousekeepingIsArmed, 0, __ATOMIC_RELAXED); // the key events from now on arm it again
+			DKBConfigReclaim(&theConfigDomain); // the configs replaced before the last key event
+			DKBStoreSync(&theStore); // the kernel writes back only the pages dirtied since the last time
+			uint64_t nFaultCount = __atomic_load_n(&theCallbackFaultCount, __ATOMIC_RELAXED);
+			if(nFaultCount != nReportedFaultCount) {
+				syslog(LOG_WARNING, "%llu page faults inside the tap callback over %llu key events",
+					(unsigned long long)nFaultCount, (unsigned long long)__atomic_load_n(&theCheckedEventCount, __ATOMIC_RELAXED));
+				nReportedFaultCount = nFaultCount;
+			}
+			uint64_t nTripCount = __atomic_load_n(&theBreaker.nTripCount, __ATOMIC_RELAXED);
+			if(nTripCount != nReportedTripCount) {
+				syslog(LOG_WARNING, "the tap callback fell behind %llu times, %llu key events bypassed the filter for %.1f s in all",
+					(unsigned long long)nTripCount, (unsigned long long)__atomic_load_n(&theBreaker.nBypassCount, __ATOMIC_RELAXED),
+					DKBClockToNanoseconds(&theClock, DKBBreakerGetBypassTime(&theBreaker, DKBClockNow(&theClock))) / 1e9);
+				nReportedTripCount = nTripCount;
+			}
+			uint64_t nMissCount = __atomic_load_n(&theProfileCache.nMissCount, __ATOMIC_RELAXED);
+			if(nMissCount != nReportedMissCount) { // quiet while no process comes in new
+				uint64_t nSameCount = __atomic_load_n(&theProfileCache.nSameCount, __ATOMIC_RELAXED);
+				uint64_t nHitCount = __atomic_load_n(&theProfileCache.nHitCount, __ATOMIC_RELAXED);
+				uint64_t nLookupCount = nSameCount + nHitCount + nMissCount;
+				syslog(LOG_INFO, "app thresholds: %.2f%% of %llu key events found their process cached, %llu as the last one, %llu as another; %llu looked up, %llu exits",
+					100.0 * (nSameCount + nHitCount) / nLookupCount, (unsigned long long)nLookupCount,
+					(unsigned long long)nSameCount, (unsigned long long)nHitCount, (unsigned long long)nMissCount,
+					(unsigned long long)__atomic_load_n(&theProfileCache.nExitCount, __ATOMIC_RELAXED));
+				nReportedMissCount = nMissCount;
+			}
+			DKBStatsCollect(&theStats, theEngine, theSeenCounters); // the counts kept in the state file come in once
+			DKBStatsReportAlerts(&theStats, &theClock);
+			if(theHeatmapPath != NULL && DKBStatsExport(&theStats, &theClock, nNow, theHeatmapPath) != 0)
+				syslog(LOG_WARNING, "cannot write the heatmap to %s: %m", theHeatmapPath);
+			if(nSketchTime == 0 && theSketch.pCounts != NULL && DKBSketchGetCount(&theSketch) != nExportedSketchCount)
+				nSketchTime = nSketchExportTime + theSketchPeriod; // the counts only change with key events
+		}
+		if(nSketchTime != 0 && nSketchTime <= nNow + nSlack) {
+			ExportSketch(&nExportedSketchCount);
+			nSketchTime = 0;
+			nSketchExportTime = nNow;
+		}
+		if(theWakeupCountIsEnabled && nRoundTime == 0 && nSketchTime == 0 && !__atomic_load_n(&theHousekeepingIsArmed, __ATOMIC_RELAXED)) {
+			DKBSchedWakeupsSwitch(&theWakeups, DKB_SCHED_IDLE, nNow); // going idle
+			LogWakeups();
+		}
+		pthread_mutex_lock(&theHousekeepingMutex);
+	}
+	pthread_mutex_unlock(&theHousekeepingMutex);
+	ExportSketch(&nExportedSketchCount); // the tap is gone, nothing comes after this
+	if(theWakeupCountIsEnabled) {
+		DKBSchedWakeupsSwitch(&theWakeups, !theWakeups.nState, DKBClockNow(&theClock)); // to count the span going on
+		LogWakeups();
+	}
+	return NULL;
 
 }
 
-static Boolean IsKeyDataEqual(const void *pValue1, const void *pValue2) {
+static void ExportSketch(uint64_t *pExportedCount) {
 
-	return (((const KeyData *)pValue1)->nKeyCode == ((const KeyData *)pValue2)->nKeyCode);
+	if(theSketch.pCounts == NULL)
+		return;
+	uint64_t nCount = DKBSketchGetCount(&theSketch);
+	if(nCount == *pExportedCount)
+		return; // the file already says it
+	if(DKBSketchExport(&theSketch, theSketchPath) != 0)
+		syslog(LOG_WARNING, "cannot write the interval sketches to %s: %m", theSketchPath);
+	else
+		*pExportedCount = nCount;
 
 }
 
-static CFHashCode KeyDataHash(const void *pValue) {
+static void LogWakeups(void) {
 
-	return (CFHashCode)((const KeyData *)pValue)->nKeyCode;
+	double fIdleMinutes = DKBClockToNanoseconds(&theClock, theWakeups.aTimes[DKB_SCHED_IDLE]) / 60e9;
+	double fBusyMinutes = DKBClockToNanoseconds(&theClock, theWakeups.aTimes[DKB_SCHED_BUSY]) / 60e9;
+	syslog(LOG_INFO, "wakeups per minute: %.2f idle over %.1f minutes, %.2f busy over %.1f minutes",
+		(fIdleMinutes > 0) ? theWakeups.aWakeupCounts[DKB_SCHED_IDLE] / fIdleMinutes : 0, fIdleMinutes,
+		(fBusyMinutes > 0) ? theWakeups.aWakeupCounts[DKB_SCHED_BUSY] / fBusyMinutes : 0, fBusyMinutes);
 
 }
@@ -0,0 +1,1156 @@
+/*
+ * DeKeyBounce
+ * A tool that packs traces into a columnar archive and queries it.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * An archive keeps many traces (sources, e.g. one per machine) in blocks
+ * of at most -b events of one source each, column by column:
+ *
+ *   key codes     a sorted dictionary of the codes in the block, then the
+ *                 index of every event's code, bit-packed
+ *   devices       the same for nSession << 8 | nDevice
+ *   timestamps    the first one and the first delta, then the zigzagged
+ *                 delta of every delta, bit-packed as wide as the widest
+ *   types         bit-packed, one bit for key-downs and key-ups
+ *   flags         run-length encoded (DKB_TRACE_FLAG_DROPPED of a flight
+ *                 record is a verdict, the labels are runs as well)
+ *
+ * Typing is regular enough that most deltas of deltas fit in some 30 bits
+ * and a block of a few dozen keys in 6, so an event takes about 5 bytes
+ * against 16 in a trace. The index at the end of the file keeps, for every
+ * block, the span of its timestamps, the range of its key codes and a bit
+ * per key code under DKB_KEY_CODE_COUNT, so a query reads only the blocks
+ * which may hold what it asks for, and decodes them on one worker per core,
+ * a round of blocks at a time, keeping the order of the blocks.
+ *
+ *   DeKeyBounceArchive -o archive trace...     packs traces or flight records
+ *   DeKeyBounceArchive archive                 lists the sources
+ *   DeKeyBounceArchive -x source -o trace archive
+ *   DeKeyBounceArchive -k code archive         bounce intervals of a key
+ *
+ * A bounce interval is from a key-up to the next key-down of the key on the
+ * same device shorter than -t; events of one key only follow each other
+ * within the blocks holding that key, so skipping the others loses none.
+ * The files are in host byte order, as the traces.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "DeKeyBounceClock.h"
+#include "DeKeyBounceEngine.h"
+#include "DeKeyBounceTrace.h"
+
+#define ARCHIVE_MAGIC 0x41424B44UL /* "DKBA" */
+#define ARCHIVE_VERSION 1
+#define DEFAULT_BLOCK_EVENT_COUNT 16384
+#define MAX_BLOCK_EVENT_COUNT 1048576
+#define DEFAULT_BOUNCE_THRESHOLD 20.0 /* ms */
+#define KEY_MASK_WORD_COUNT (DKB_KEY_CODE_COUNT / 64)
+#define ROUND_BLOCK_COUNT 4 /* per worker, the blocks decoded before they are used in order */
+#define READ_BUFFER_COUNT 65536
+#define HISTOGRAM_BUCKET_COUNT 16 /* of the bounce intervals, by powers of 2 from 1/8 ms */
+
+typedef struct _ArchiveHeader {
+
+	uint32_t nMagic;
+	uint16_t nVersion;
+	uint16_t nBlockRecordSize; /* sizeof(ArchiveBlock) */
+	uint32_t nSourceCount;
+	uint32_t nBlockCount;
+	uint64_t nEventCount;
+	uint64_t nIndexOffset; /* the sources, then the blocks */
+
+} ArchiveHeader;
+
+typedef struct _ArchiveSource {
+
+	uint32_t nTicksNumer; /* of the trace header */
+	uint32_t nTicksDenom;
+	uint64_t nSeed;
+	uint64_t nEventCount;
+	uint32_t nFirstBlock;
+	uint32_t nBlockCount;
+
+} ArchiveSource;
+
+typedef struct _ArchiveBlock {
+
+	uint64_t nOffset; /* from the start of the file */
+	uint64_t nSize;
+	uint64_t nMinTimestamp;
+	uint64_t nMaxTimestamp;
+	uint64_t aKeyMask[KEY_MASK_WORD_COUNT]; /* key codes under DKB_KEY_CODE_COUNT in the block */
+	uint32_t nEventCount;
+	uint32_t nSource;
+	uint32_t nKeyCount; /* in the dictionary */
+	uint32_t nDeviceCount;
+	uint32_t nFlagRunCount;
+	uint16_t nMinKeyCode;
+	uint16_t nMaxKeyCode;
+	uint8_t nTimestampBits; /* of the deltas of deltas */
+	uint8_t nKeyBits;
+	uint8_t nDeviceBits;
+	uint8_t nTypeBits;
+	uint32_t nReserved;
+
+} ArchiveBlock;
+
+// where the columns of a block are, in the file or in the buffer of the packer
+typedef struct _BlockColumns {
+
+	uint16_t *pKeys;
+	uint32_t *pDevices;
+	uint64_t *pTimestampBase; // the first timestamp and the first delta
+	uint64_t *pDeltas;
+	uint64_t *pKeyIndexes;
+	uint64_t *pDeviceIndexes;
+	uint64_t *pTypes;
+	uint16_t *pFlagValues;
+	uint32_t *pFlagLengths;
+
+} BlockColumns;
+
+typedef struct _Archive {
+
+	void *pMapping;
+	size_t nSize;
+	const ArchiveHeader *pHeader;
+	const ArchiveSource *pSources;
+	const ArchiveBlock *pBlocks;
+	uint32_t nMaxBlockEventCount;
+
+} Archive;
+
+typedef struct _Packer {
+
+	FILE *pFile;
+	uint64_t nOffset;
+	ArchiveSource *pSources;
+	ArchiveBlock *pBlocks;
+	size_t nBlockCapacity;
+	uint32_t nBlockCount;
+	uint64_t nEventCount;
+	uint32_t *pValues; // scratch of the dictionaries
+	uint32_t *pKeyDictionary;
+	uint32_t *pDeviceDictionary;
+	uint64_t *pBuffer; // the block being packed
+	size_t nBufferSize;
+
+} Packer;
+
+typedef struct _DecodeRun {
+
+	const Archive *pArchive;
+	const uint32_t *pBlocks; // of the round
+	size_t nBlockCount;
+	size_t nNextBlock; // taken by the workers with an atomic add
+	int nKeyCode; // -1 for every event
+	DKBEvent **pOutputs; // per block of the round
+	size_t *pOutputCounts;
+	int isCorrupt;
+
+} DecodeRun;
+
+typedef struct _DecodeWorker {
+
+	DecodeRun *pRun;
+	uint64_t *pTimestamps; // scratch, a block long
+	pthread_t aThread;
+
+} DecodeWorker;
+
+typedef struct _Decoder {
+
+	DecodeRun aRun;
+	DecodeWorker *pWorkers;
+	long nWorkerCount;
+	uint32_t *pRoundBlocks;
+	size_t nRoundCapacity;
+	uint64_t nDecodedEventCount;
+
+} Decoder;
+
+static int Pack(char * const *pPaths, size_t nPathCount, const char *pOutputPath, size_t nBlockEventCount);
+static int PackTrace(Packer *pPacker, const char *pPath, uint32_t nSource, DKBEvent *pEvents, size_t nBlockEventCount);
+static int PackBlock(Packer *pPacker, const DKBEvent *pEvents, size_t nCount, uint32_t nSource);
+static size_t BuildDictionary(uint32_t *pValues, size_t nCount);
+static uint32_t FindInDictionary(const uint32_t *pDictionary, size_t nCount, uint32_t nValue);
+static size_t LayOutBlock(const ArchiveBlock *pBlock, char *pBase, BlockColumns *pColumns);
+static void PackBits(uint64_t *pWords, unsigned nBits, size_t nIndex, uint64_t nValue);
+static uint64_t UnpackBits(const uint64_t *pWords, unsigned nBits, size_t nIndex);
+static unsigned CountBits(uint64_t nValue);
+
+static int OpenArchive(Archive *pArchive, const char *pPath);
+static void CloseArchive(Archive *pArchive);
+static int InitDecoder(Decoder *pDecoder, const Archive *pArchive, long nWorkerCount, int nKeyCode);
+static void DeinitDecoder(Decoder *pDecoder);
+static int DecodeRound(Decoder *pDecoder, const uint32_t *pBlocks, size_t nBlockCount);
+static void *DecodeBlocks(void *pArgument);
+static ssize_t DecodeBlock(const Archive *pArchive, uint32_t nBlock, int nKeyCode, uint64_t *pTimestamps, DKBEvent *pEvents);
+
+static int List(const Archive *pArchive, const char *pPath);
+static int Extract(const Archive *pArchive, uint32_t nSource, const char *pOutputPath, long nWorkerCount);
+static int Query(const Archive *pArchive, int nKeyCode, long nSource, double fFrom, double fUntil, double fThreshold, long nWorkerCount);
+static int IsBlockSelected(const ArchiveBlock *pBlock, int nKeyCode, uint64_t nFrom, uint64_t nUntil);
+static int CompareValues(const void *pValue1, const void *pValue2);
+static int CompareByDevice(const void *pValue1, const void *pValue2);
+static int CompareIntervals(const void *pValue1, const void *pValue2);
+static uint64_t GetNanoseconds(void);
+static void Usage(const char *pName);
+
+int main (int argc, char * const argv[]) {
+
+	const char *pOutputPath = NULL;
+	unsigned long nBlockEventCount = DEFAULT_BLOCK_EVENT_COUNT;
+	long nExtractSource = -1, nSource = -1;
+	long nKeyCode = -1;
+	long nWorkerCount = 0;
+	double fThreshold = DEFAULT_BOUNCE_THRESHOLD;
+	double fFrom = 0, fUntil = 0;
+	int nOption;
+	while((nOption = getopt(argc, argv, "o:b:x:k:s:t:T:j:")) != -1) {
+		switch(nOption) {
+		case 'o': pOutputPath = optarg; break;
+		case 'b': nBlockEventCount = strtoul(optarg, NULL, 10); break;
+		case 'x': nExtractSource = strtol(optarg, NULL, 10); break;
+		case 'k': nKeyCode = strtol(optarg, NULL, 10); break;
+		case 's': nSource = strtol(optarg, NULL, 10); break;
+		case 't': fThreshold = strtod(optarg, NULL); break;
+		case 'T':
+			if(sscanf(optarg, "%lf:%lf", &fFrom, &fUntil) != 2 || fFrom < 0 || fUntil <= fFrom) {
+				Usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'j': nWorkerCount = strtol(optarg, NULL, 10); break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if(optind == argc || nBlockEventCount == 0 || nBlockEventCount > MAX_BLOCK_EVENT_COUNT || fThreshold <= 0 || nKeyCode > UINT16_MAX) {
+		Usage(argv[0]);
+		return 1;
+	}
+	if(nWorkerCount <= 0)
+		nWorkerCount = sysconf(_SC_NPROCESSORS_ONLN);
+	if(pOutputPath != NULL && nExtractSource < 0)
+		return Pack(&argv[optind], argc - optind, pOutputPath, nBlockEventCount);
+	if(optind != argc - 1 || (nExtractSource >= 0 && pOutputPath == NULL)) {
+		Usage(argv[0]);
+		return 1;
+	}
+
+	Archive aArchive;
+	if(OpenArchive(&aArchive, argv[optind]) != 0) {
+		if(errno == EINVAL)
+			fprintf(stderr, "%s: not an archive or damaged\n", argv[optind]);
+		else
+			perror(argv[optind]);
+		return 1;
+	}
+	int nResult;
+	if(nExtractSource >= 0)
+		nResult = Extract(&aArchive, (uint32_t)nExtractSource, pOutputPath, nWorkerCount);
+	else if(nKeyCode >= 0)
+		nResult = Query(&aArchive, (int)nKeyCode, nSource, fFrom, fUntil, fThreshold, nWorkerCount);
+	else
+		nResult = List(&aArchive, argv[optind]);
+	CloseArchive(&aArchive);
+	return nResult;
+
+}
+
+static int Pack(char * const *pPaths, size_t nPathCount, const char *pOutputPath, size_t nBlockEventCount) {
+
+	char aTempPath[4096];
+	if(snprintf(aTempPath, sizeof aTempPath, "%s.tmp", pOutputPath) >= (int)sizeof aTempPath) {
+		fprintf(stderr, "%s: path too long\n", pOutputPath);
+		return 1;
+	}
+	Packer aPacker;
+	memset(&aPacker, 0, sizeof aPacker);
+	aPacker.pSources = calloc(nPathCount, sizeof(ArchiveSource));
+	aPacker.pValues = malloc(nBlockEventCount * sizeof(uint32_t));
+	aPacker.pKeyDictionary = malloc(nBlockEventCount * sizeof(uint32_t));
+	aPacker.pDeviceDictionary = malloc(nBlockEventCount * sizeof(uint32_t));
+	DKBEvent *pEvents = malloc(nBlockEventCount * sizeof(DKBEvent));
+	int isSuccess = 0;
+	size_t nFailedCount = 0;
+	uint64_t nStart = GetNanoseconds();
+	do { // just for break
+		if(aPacker.pSources == NULL || aPacker.pValues == NULL || aPacker.pKeyDictionary == NULL || aPacker.pDeviceDictionary == NULL || pEvents == NULL)
+			break;
+		aPacker.pFile = fopen(aTempPath, "wb");
+		if(aPacker.pFile == NULL)
+			break;
+		ArchiveHeader aHeader;
+		memset(&aHeader, 0, sizeof aHeader); // invalid until the index is written
+		if(fwrite(&aHeader, sizeof aHeader, 1, aPacker.pFile) != 1)
+			break;
+		aPacker.nOffset = sizeof aHeader;
+		uint32_t nSourceCount = 0;
+		size_t i;
+		for(i = 0; i < nPathCount; i++) {
+			if(PackTrace(&aPacker, pPaths[i], nSourceCount, pEvents, nBlockEventCount) == 0) {
+				nSourceCount++;
+				continue;
+			}
+			if(errno != EINVAL && errno != ENOENT && errno != EACCES)
+				break; // the archive itself failed
+			fprintf(stderr, "%s: %s\n", pPaths[i], (errno == EINVAL) ? "not a trace" : strerror(errno));
+			nFailedCount++;
+		}
+		if(i != nPathCount)
+			break;
+		aHeader.nMagic = ARCHIVE_MAGIC;
+		aHeader.nVersion = ARCHIVE_VERSION;
+		aHeader.nBlockRecordSize = sizeof(ArchiveBlock);
+		aHeader.nSourceCount = nSourceCount;
+		aHeader.nBlockCount = aPacker.nBlockCount;
+		aHeader.nEventCount = aPacker.nEventCount;
+		aHeader.nIndexOffset = aPacker.nOffset;
+		if(fwrite(aPacker.pSources, sizeof(ArchiveSource), nSourceCount, aPacker.pFile) != nSourceCount)
+			break;
+		if(fwrite(aPacker.pBlocks, sizeof(ArchiveBlock), aPacker.nBlockCount, aPacker.pFile) != aPacker.nBlockCount)
+			break;
+		if(fflush(aPacker.pFile) != 0 || fseek(aPacker.pFile, 0, SEEK_SET) != 0)
+			break;
+		if(fwrite(&aHeader, sizeof aHeader, 1, aPacker.pFile) != 1 || fflush(aPacker.pFile) != 0)
+			break;
+		isSuccess = 1;
+	} while(0);
+	int nError = errno;
+	if(aPacker.pFile != NULL && fclose(aPacker.pFile) != 0 && isSuccess) {
+		nError = errno;
+		isSuccess = 0;
+	}
+	if(isSuccess && rename(aTempPath, pOutputPath) != 0) {
+		nError = errno;
+		isSuccess = 0;
+	}
+	if(!isSuccess && aPacker.pFile != NULL)
+		unlink(aTempPath);
+	uint64_t nElapsed = GetNanoseconds() - nStart;
+	if(isSuccess) {
+		uint64_t nSize = aPacker.nOffset + (nPathCount - nFailedCount) * sizeof(ArchiveSource) + aPacker.nBlockCount * sizeof(ArchiveBlock);
+		printf("%zu traces, %llu events in %u blocks, %llu bytes, %.2f bytes/event (%zu in a trace), %.1f Mevents/s\n",
+			nPathCount - nFailedCount, (unsigned long long)aPacker.nEventCount, aPacker.nBlockCount, (unsigned long long)nSize,
+			(aPacker.nEventCount != 0) ? (double)nSize / aPacker.nEventCount : 0.0, sizeof(DKBEvent),
+			(nElapsed != 0) ? aPacker.nEventCount * 1000.0 / nElapsed : 0.0);
+	} else {
+		errno = nError;
+		perror(pOutputPath);
+	}
+	free(aPacker.pSources);
+	free(aPacker.pBlocks);
+	free(aPacker.pValues);
+	free(aPacker.pKeyDictionary);
+	free(aPacker.pDeviceDictionary);
+	free(aPacker.pBuffer);
+	free(pEvents);
+	return (isSuccess && nFailedCount == 0) ? 0 : 1;
+
+}
+
+static int PackTrace(Packer *pPacker, const char *pPath, uint32_t nSource, DKBEvent *pEvents, size_t nBlockEventCount) {
+
+	// a flight record as well, its judgements stay behind, its verdicts are in the flags
+	FILE *pTrace = fopen(pPath, "rb");
+	if(pTrace == NULL)
+		return -1;
+	DKBTraceHeader aHeader;
+	if(DKBTraceReadHeader(pTrace, &aHeader) != 0) {
+		fclose(pTrace);
+		errno = EINVAL;
+		return -1;
+	}
+	ArchiveSource *pSource = &pPacker->pSources[nSource];
+	pSource->nTicksNumer = aHeader.nTicksNumer;
+	pSource->nTicksDenom = aHeader.nTicksDenom;
+	pSource->nSeed = aHeader.nSeed;
+	pSource->nFirstBlock = pPacker->nBlockCount;
+	uint64_t nReadCount = 0;
+	size_t nCount;
+	int nResult = 0;
+	while((nCount = DKBTraceReadEvents(pTrace, &aHeader, &nReadCount, pEvents, nBlockEventCount)) > 0) {
+		if(PackBlock(pPacker, pEvents, nCount, nSource) != 0) {
+			nResult = -1;
+			break;
+		}
+		pSource->nEventCount += nCount;
+	}
+	if(nResult == 0 && ferror(pTrace)) {
+		nResult = -1;
+		errno = EIO;
+	}
+	fclose(pTrace);
+	pSource->nBlockCount = pPacker->nBlockCount - pSource->nFirstBlock;
+	return nResult;
+
+}
+
+static int PackBlock(Packer *pPacker, const DKBEvent *pEvents, size_t nCount, uint32_t nSource) {
+
+	if(pPacker->nBlockCount == pPacker->nBlockCapacity) {
+		size_t nCapacity = (pPacker->nBlockCapacity != 0) ? pPacker->nBlockCapacity * 2 : 256;
+		ArchiveBlock *pBlocks = realloc(pPacker->pBlocks, nCapacity * sizeof(ArchiveBlock));
+		if(pBlocks == NULL)
+			return -1;
+		pPacker->pBlocks = pBlocks;
+		pPacker->nBlockCapacity = nCapacity;
+	}
+	ArchiveBlock *pBlock = &pPacker->pBlocks[pPacker->nBlockCount];
+	memset(pBlock, 0, sizeof *pBlock);
+	pBlock->nEventCount = (uint32_t)nCount;
+	pBlock->nSource = nSource;
+
+	// first the statistics which size the columns
+	size_t i;
+	pBlock->nMinTimestamp = UINT64_MAX;
+	pBlock->nMinKeyCode = UINT16_MAX;
+	uint64_t nMaxZigzag = 0;
+	unsigned nMaxType = 0;
+	uint16_t nFlags = pEvents[0].nFlags;
+	pBlock->nFlagRunCount = 1;
+	for(i = 0; i < nCount; i++) {
+		const DKBEvent *pEvent = &pEvents[i];
+		if(pEvent->nTimestamp < pBlock->nMinTimestamp)
+			pBlock->nMinTimestamp = pEvent->nTimestamp;
+		if(pEvent->nTimestamp > pBlock->nMaxTimestamp)
+			pBlock->nMaxTimestamp = pEvent->nTimestamp;
+		if(pEvent->nKeyCode < pBlock->nMinKeyCode)
+			pBlock->nMinKeyCode = pEvent->nKeyCode;
+		if(pEvent->nKeyCode > pBlock->nMaxKeyCode)
+			pBlock->nMaxKeyCode = pEvent->nKeyCode;
+		if(pEvent->nKeyCode < DKB_KEY_CODE_COUNT)
+			pBlock->aKeyMask[pEvent->nKeyCode / 64] |= 1ULL << (pEvent->nKeyCode % 64);
+		if(pEvent->nType > nMaxType)
+			nMaxType = pEvent->nType;
+		if(pEvent->nFlags != nFlags) {
+			nFlags = pEvent->nFlags;
+			pBlock->nFlagRunCount++;
+		}
+		if(i >= 2) {
+			int64_t nDelta = (int64_t)(pEvent->nTimestamp - pEvents[i - 1].nTimestamp - (pEvents[i - 1].nTimestamp - pEvents[i - 2].nTimestamp));
+			uint64_t nZigzag = ((uint64_t)nDelta << 1) ^ (uint64_t)(nDelta >> 63);
+			if(nZigzag > nMaxZigzag)
+				nMaxZigzag = nZigzag;
+		}
+	}
+	for(i = 0; i < nCount; i++)
+		pPacker->pValues[i] = pEvents[i].nKeyCode;
+	memcpy(pPacker->pKeyDictionary, pPacker->pValues, nCount * sizeof(uint32_t));
+	pBlock->nKeyCount = (uint32_t)BuildDictionary(pPacker->pKeyDictionary, nCount);
+	for(i = 0; i < nCount; i++)
+		pPacker->pDeviceDictionary[i] = (uint32_t)pEvents[i].nSession << 8 | pEvents[i].nDevice;
+	pBlock->nDeviceCount = (uint32_t)BuildDictionary(pPacker->pDeviceDictionary, nCount);
+	pBlock->nTimestampBits = CountBits(nMaxZigzag);
+	pBlock->nKeyBits = CountBits(pBlock->nKeyCount - 1);
+	pBlock->nDeviceBits = CountBits(pBlock->nDeviceCount - 1);
+	pBlock->nTypeBits = CountBits(nMaxType);
+	pBlock->nSize = LayOutBlock(pBlock, NULL, NULL);
+	pBlock->nOffset = pPacker->nOffset;
+	if(pBlock->nSize > pPacker->nBufferSize) {
+		uint64_t *pBuffer = realloc(pPacker->pBuffer, pBlock->nSize);
+		if(pBuffer == NULL)
+			return -1;
+		pPacker->pBuffer = pBuffer;
+		pPacker->nBufferSize = pBlock->nSize;
+	}
+	memset(pPacker->pBuffer, 0, pBlock->nSize);
+
+	// then the columns
+	BlockColumns aColumns;
+	LayOutBlock(pBlock, (char *)pPacker->pBuffer, &aColumns);
+	for(i = 0; i < pBlock->nKeyCount; i++)
+		aColumns.pKeys[i] = (uint16_t)pPacker->pKeyDictionary[i];
+	memcpy(aColumns.pDevices, pPacker->pDeviceDictionary, pBlock->nDeviceCount * sizeof(uint32_t));
+	aColumns.pTimestampBase[0] = pEvents[0].nTimestamp;
+	aColumns.pTimestampBase[1] = (nCount > 1) ? pEvents[1].nTimestamp - pEvents[0].nTimestamp : 0;
+	size_t nRun = 0;
+	aColumns.pFlagValues[0] = pEvents[0].nFlags;
+	for(i = 0; i < nCount; i++) {
+		const DKBEvent *pEvent = &pEvents[i];
+		if(i >= 2) {
+			int64_t nDelta = (int64_t)(pEvent->nTimestamp - pEvents[i - 1].nTimestamp - (pEvents[i - 1].nTimestamp - pEvents[i - 2].nTimestamp));
+			PackBits(aColumns.pDeltas, pBlock->nTimestampBits, i - 2, ((uint64_t)nDelta << 1) ^ (uint64_t)(nDelta >> 63));
+		}
+		PackBits(aColumns.pKeyIndexes, pBlock->nKeyBits, i, FindInDictionary(pPacker->pKeyDictionary, pBlock->nKeyCount, pEvent->nKeyCode));
+		PackBits(aColumns.pDeviceIndexes, pBlock->nDeviceBits, i, FindInDictionary(pPacker->pDeviceDictionary, pBlock->nDeviceCount,
+			(uint32_t)pEvent->nSession << 8 | pEvent->nDevice));
+		PackBits(aColumns.pTypes, pBlock->nTypeBits, i, pEvent->nType);
+		if(pEvent->nFlags != aColumns.pFlagValues[nRun])
+			aColumns.pFlagValues[++nRun] = pEvent->nFlags;
+		aColumns.pFlagLengths[nRun]++;
+	}
+	if(fwrite(pPacker->pBuffer, 1, pBlock->nSize, pPacker->pFile) != pBlock->nSize)
+		return -1;
+	pPacker->nOffset += pBlock->nSize;
+	pPacker->nEventCount += nCount;
+	pPacker->nBlockCount++;
+	return 0;
+
+}
+
+static size_t BuildDictionary(uint32_t *pValues, size_t nCount) {
+
+	// sorted and unique in place
+	qsort(pValues, nCount, sizeof(uint32_t), CompareValues);
+	size_t i, nUniqueCount = 0;
+	for(i = 0; i < nCount; i++) {
+		if(nUniqueCount == 0 || pValues[nUniqueCount - 1] != pValues[i])
+			pValues[nUniqueCount++] = pValues[i];
+	}
+	return nUniqueCount;
+
+}
+
+static uint32_t FindInDictionary(const uint32_t *pDictionary, size_t nCount, uint32_t nValue) {
+
+	size_t nLow = 0, nHigh = nCount;
+	while(nLow < nHigh) {
+		size_t nMiddle = (nLow + nHigh) / 2;
+		if(pDictionary[nMiddle] < nValue)
+			nLow = nMiddle + 1;
+		else
+			nHigh = nMiddle;
+	}
+	return (uint32_t)nLow;
+
+}
+
+static size_t LayOutBlock(const ArchiveBlock *pBlock, char *pBase, BlockColumns *pColumns) {
+
+	// every column starts on a word, the size is all the caller needs without a base
+	size_t nCount = pBlock->nEventCount;
+	size_t aSizes[9] = {
+		pBlock->nKeyCount * sizeof(uint16_t),
+		pBlock->nDeviceCount * sizeof(uint32_t),
+		2 * sizeof(uint64_t),
+		((nCount > 2 ? nCount - 2 : 0) * pBlock->nTimestampBits + 63) / 64 * sizeof(uint64_t),
+		(nCount * pBlock->nKeyBits + 63) / 64 * sizeof(uint64_t),
+		(nCount * pBlock->nDeviceBits + 63) / 64 * sizeof(uint64_t),
+		(nCount * pBlock->nTypeBits + 63) / 64 * sizeof(uint64_t),
+		pBlock->nFlagRunCount * sizeof(uint16_t),
+		pBlock->nFlagRunCount * sizeof(uint32_t)
+	};
+	void **pStarts[9];
+	if(pColumns != NULL) {
+		pStarts[0] = (void **)&pColumns->pKeys;
+		pStarts[1] = (void **)&pColumns->pDevices;
+		pStarts[2] = (void **)&pColumns->pTimestampBase;
+		pStarts[3] = (void **)&pColumns->pDeltas;
+		pStarts[4] = (void **)&pColumns->pKeyIndexes;
+		pStarts[5] = (void **)&pColumns->pDeviceIndexes;
+		pStarts[6] = (void **)&pColumns->pTypes;
+		pStarts[7] = (void **)&pColumns->pFlagValues;
+		pStarts[8] = (void **)&pColumns->pFlagLengths;
+	}
+	size_t nOffset = 0;
+	int i;
+	for(i = 0; i < 9; i++) {
+		if(pColumns != NULL)
+			*pStarts[i] = pBase + nOffset;
+		nOffset += (aSizes[i] + 7) & ~(size_t)7;
+	}
+	return nOffset;
+
+}
+
+static void PackBits(uint64_t *pWords, unsigned nBits, size_t nIndex, uint64_t nValue) {
+
+	// into zeroed words
+	if(nBits == 0)
+		return;
+	size_t nBit = nIndex * nBits;
+	unsigned nShift = nBit % 64;
+	pWords[nBit / 64] |= nValue << nShift;
+	if(nShift + nBits > 64)
+		pWords[nBit / 64 + 1] |= nValue >> (64 - nShift);
+
+}
+
+static uint64_t UnpackBits(const uint64_t *pWords, unsigned nBits, size_t nIndex) {
+
+	if(nBits == 0)
+		return 0;
+	size_t nBit = nIndex * nBits;
+	unsigned nShift = nBit % 64;
+	uint64_t nValue = pWords[nBit / 64] >> nShift;
+	if(nShift + nBits > 64)
+		nValue |= pWords[nBit / 64 + 1] << (64 - nShift);
+	return (nBits == 64) ? nValue : nValue & ((1ULL << nBits) - 1);
+
+}
+
+static unsigned CountBits(uint64_t nValue) {
+
+	return (nValue != 0) ? 64 - __builtin_clzll(nValue) : 0;
+
+}
+
+static int OpenArchive(Archive *pArchive, const char *pPath) {
+
+	memset(pArchive, 0, sizeof *pArchive);
+	int nFile = open(pPath, O_RDONLY);
+	if(nFile < 0)
+		return -1;
+	struct stat aStat;
+	void *pMapping = MAP_FAILED;
+	if(fstat(nFile, &aStat) != 0)
+		pMapping = MAP_FAILED;
+	else if((size_t)aStat.st_size < sizeof(ArchiveHeader))
+		errno = EINVAL;
+	else
+		pMapping = mmap(NULL, aStat.st_size, PROT_READ, MAP_PRIVATE, nFile, 0);
+	int nError = errno;
+	close(nFile);
+	if(pMapping == MAP_FAILED) {
+		errno = nError;
+		return -1;
+	}
+	pArchive->pMapping = pMapping;
+	pArchive->nSize = aStat.st_size;
+
+	// nothing is read past the file, nor past a column, however damaged
+	const ArchiveHeader *pHeader = pMapping;
+	int isValid = 0;
+	do { // just for break
+		if(pHeader->nMagic != ARCHIVE_MAGIC || pHeader->nVersion != ARCHIVE_VERSION || pHeader->nBlockRecordSize != sizeof(ArchiveBlock))
+			break;
+		if(pHeader->nIndexOffset < sizeof(ArchiveHeader) || pHeader->nIndexOffset > pArchive->nSize || pHeader->nIndexOffset % 8 != 0)
+			break;
+		if(((uint64_t)pHeader->nSourceCount * sizeof(ArchiveSource) + (uint64_t)pHeader->nBlockCount * sizeof(ArchiveBlock))
+			!= pArchive->nSize - pHeader->nIndexOffset)
+			break;
+		pArchive->pHeader = pHeader;
+		pArchive->pSources = (const ArchiveSource *)((const char *)pMapping + pHeader->nIndexOffset);
+		pArchive->pBlocks = (const ArchiveBlock *)(pArchive->pSources + pHeader->nSourceCount);
+		uint32_t i;
+		for(i = 0; i < pHeader->nSourceCount; i++) {
+			const ArchiveSource *pSource = &pArchive->pSources[i];
+			if(pSource->nTicksNumer == 0 || pSource->nTicksDenom == 0)
+				break;
+			if(pSource->nFirstBlock > pHeader->nBlockCount || pSource->nBlockCount > pHeader->nBlockCount - pSource->nFirstBlock)
+				break;
+		}
+		if(i != pHeader->nSourceCount)
+			break;
+		for(i = 0; i < pHeader->nBlockCount; i++) {
+			const ArchiveBlock *pBlock = &pArchive->pBlocks[i];
+			if(pBlock->nEventCount == 0 || pBlock->nEventCount > MAX_BLOCK_EVENT_COUNT || pBlock->nSource >= pHeader->nSourceCount)
+				break;
+			if(pBlock->nKeyCount == 0 || pBlock->nKeyCount > pBlock->nEventCount || pBlock->nDeviceCount == 0 || pBlock->nDeviceCount > pBlock->nEventCount)
+				break;
+			if(pBlock->nFlagRunCount == 0 || pBlock->nFlagRunCount > pBlock->nEventCount)
+				break;
+			if(pBlock->nTimestampBits > 64 || pBlock->nKeyBits > 32 || pBlock->nDeviceBits > 32 || pBlock->nTypeBits > 8)
+				break;
+			if(pBlock->nOffset < sizeof(ArchiveHeader) || pBlock->nOffset % 8 != 0 || pBlock->nOffset > pHeader->nIndexOffset
+				|| pBlock->nSize > pHeader->nIndexOffset - pBlock->nOffset || pBlock->nSize != LayOutBlock(pBlock, NULL, NULL))
+				break;
+			if(pBlock->nEventCount > pArchive->nMaxBlockEventCount)
+				pArchive->nMaxBlockEventCount = pBlock->nEventCount;
+		}
+		if(i != pHeader->nBlockCount)
+			break;
+		isValid = 1;
+	} while(0);
+	if(!isValid) {
+		CloseArchive(pArchive);
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+
+}
+
+static void CloseArchive(Archive *pArchive) {
+
+	if(pArchive->pMapping != NULL)
+		munmap(pArchive->pMapping, pArchive->nSize);
+	memset(pArchive, 0, sizeof *pArchive);
+
+}
+
+static int InitDecoder(Decoder *pDecoder, const Archive *pArchive, long nWorkerCount, int nKeyCode) {
+
+	memset(pDecoder, 0, sizeof *pDecoder);
+	pDecoder->aRun.pArchive = pArchive;
+	pDecoder->aRun.nKeyCode = nKeyCode;
+	pDecoder->nWorkerCount = nWorkerCount;
+	pDecoder->nRoundCapacity = nWorkerCount * ROUND_BLOCK_COUNT;
+	pDecoder->pWorkers = calloc(nWorkerCount, sizeof(DecodeWorker));
+	pDecoder->pRoundBlocks = malloc(pDecoder->nRoundCapacity * sizeof(uint32_t));
+	pDecoder->aRun.pOutputs = calloc(pDecoder->nRoundCapacity, sizeof(DKBEvent *));
+	pDecoder->aRun.pOutputCounts = calloc(pDecoder->nRoundCapacity, sizeof(size_t));
+	if(pDecoder->pWorkers == NULL || pDecoder->pRoundBlocks == NULL || pDecoder->aRun.pOutputs == NULL || pDecoder->aRun.pOutputCounts == NULL) {
+		DeinitDecoder(pDecoder);
+		return -1;
+	}
+	size_t nBlockEventCount = (pArchive->nMaxBlockEventCount != 0) ? pArchive->nMaxBlockEventCount : 1;
+	size_t i;
+	for(i = 0; i < pDecoder->nRoundCapacity; i++) {
+		pDecoder->aRun.pOutputs[i] = malloc(nBlockEventCount * sizeof(DKBEvent));
+		if(pDecoder->aRun.pOutputs[i] == NULL) {
+			DeinitDecoder(pDecoder);
+			return -1;
+		}
+	}
+	for(i = 0; i < (size_t)nWorkerCount; i++) {
+		pDecoder->pWorkers[i].pRun = &pDecoder->aRun;
+		pDecoder->pWorkers[i].pTimestamps = malloc(nBlockEventCount * sizeof(uint64_t));
+		if(pDecoder->pWorkers[i].pTimestamps == NULL) {
+			DeinitDecoder(pDecoder);
+			return -1;
+		}
+	}
+	return 0;
+
+}
+
+static void DeinitDecoder(Decoder *pDecoder) {
+
+	size_t i;
+	if(pDecoder->aRun.pOutputs != NULL) {
+		for(i = 0; i < pDecoder->nRoundCapacity; i++)
+			free(pDecoder->aRun.pOutputs[i]);
+	}
+	if(pDecoder->pWorkers != NULL) {
+		for(i = 0; i < (size_t)pDecoder->nWorkerCount; i++)
+			free(pDecoder->pWorkers[i].pTimestamps);
+	}
+	free(pDecoder->aRun.pOutputs);
+	free(pDecoder->aRun.pOutputCounts);
+	free(pDecoder->pWorkers);
+	free(pDecoder->pRoundBlocks);
+	memset(pDecoder, 0, sizeof *pDecoder);
+
+}
+
+static int DecodeRound(Decoder *pDecoder, const uint32_t *pBlocks, size_t nBlockCount) {
+
+	// the outputs of block i of the round are in pOutputs[i] when it returns
+	DecodeRun *pRun = &pDecoder->aRun;
+	pRun->pBlocks = pBlocks;
+	pRun->nBlockCount = nBlockCount;
+	pRun->nNextBlock = 0;
+	long nWorkerCount = pDecoder->nWorkerCount;
+	if((size_t)nWorkerCount > nBlockCount)
+		nWorkerCount = nBlockCount;
+	long nStartedCount;
+	for(nStartedCount = 0; nStartedCount < nWorkerCount && nWorkerCount > 1; nStartedCount++) {
+		if(pthread_create(&pDecoder->pWorkers[nStartedCount].aThread, NULL, DecodeBlocks, &pDecoder->pWorkers[nStartedCount]) != 0)
+			break;
+	}
+	if(nStartedCount == 0)
+		DecodeBlocks(&pDecoder->pWorkers[0]); // one block or no thread to spare, do it here
+	long i;
+	for(i = 0; i < nStartedCount; i++)
+		pthread_join(pDecoder->pWorkers[i].aThread, NULL);
+	size_t j;
+	for(j = 0; j < nBlockCount; j++)
+		pDecoder->nDecodedEventCount += pRun->pArchive->pBlocks[pBlocks[j]].nEventCount;
+	return pRun->isCorrupt ? -1 : 0;
+
+}
+
+static void *DecodeBlocks(void *pArgument) {
+
+	DecodeWorker *pWorker = pArgument;
+	DecodeRun *pRun = pWorker->pRun;
+	size_t nIndex;
+	while((nIndex = __atomic_fetch_add(&pRun->nNextBlock, 1, __ATOMIC_RELAXED)) < pRun->nBlockCount) {
+		ssize_t nCount = DecodeBlock(pRun->pArchive, pRun->pBlocks[nIndex], pRun->nKeyCode, pWorker->pTimestamps, pRun->pOutputs[nIndex]);
+		if(nCount < 0) {
+			__atomic_store_n(&pRun->isCorrupt, 1, __ATOMIC_RELAXED);
+			nCount = 0;
+		}
+		pRun->pOutputCounts[nIndex] = nCount;
+	}
+	return NULL;
+
+}
+
+static ssize_t DecodeBlock(const Archive *pArchive, uint32_t nBlock, int nKeyCode, uint64_t *pTimestamps, DKBEvent *pEvents) {
+
+	// the events of the key only, or all of them for -1; -1 for a damaged block
+	const ArchiveBlock *pBlock = &pArchive->pBlocks[nBlock];
+	BlockColumns aColumns;
+	LayOutBlock(pBlock, (char *)pArchive->pMapping + pBlock->nOffset, &aColumns); // read only, for all the pointers say
+	size_t nCount = pBlock->nEventCount;
+	uint64_t nKeyIndex = 0;
+	if(nKeyCode >= 0) {
+		size_t nLow = 0, nHigh = pBlock->nKeyCount;
+		while(nLow < nHigh) {
+			size_t nMiddle = (nLow + nHigh) / 2;
+			if(aColumns.pKeys[nMiddle] < nKeyCode)
+				nLow = nMiddle + 1;
+			else
+				nHigh = nMiddle;
+		}
+		if(nLow == pBlock->nKeyCount || aColumns.pKeys[nLow] != nKeyCode)
+			return 0;
+		nKeyIndex = nLow;
+	}
+
+	// the timestamps depend on all the earlier ones, the other columns are read only where the key is
+	size_t i;
+	uint64_t nTimestamp = aColumns.pTimestampBase[0], nDelta = aColumns.pTimestampBase[1];
+	pTimestamps[0] = nTimestamp;
+	for(i = 1; i < nCount; i++) {
+		if(i >= 2) {
+			uint64_t nZigzag = UnpackBits(aColumns.pDeltas, pBlock->nTimestampBits, i - 2);
+			nDelta += (nZigzag >> 1) ^ (0 - (nZigzag & 1));
+		}
+		nTimestamp += nDelta;
+		pTimestamps[i] = nTimestamp;
+	}
+	size_t nOutputCount = 0, nRun = 0;
+	uint64_t nRunEnd = aColumns.pFlagLengths[0];
+	for(i = 0; i < nCount; i++) {
+		while(i >= nRunEnd) {
+			if(++nRun == pBlock->nFlagRunCount)
+				return -1;
+			nRunEnd += aColumns.pFlagLengths[nRun];
+		}
+		uint64_t nIndex = UnpackBits(aColumns.pKeyIndexes, pBlock->nKeyBits, i);
+		if(nKeyCode >= 0 && nIndex != nKeyIndex)
+			continue;
+		uint64_t nDevice = UnpackBits(aColumns.pDeviceIndexes, pBlock->nDeviceBits, i);
+		if(nIndex >= pBlock->nKeyCount || nDevice >= pBlock->nDeviceCount)
+			return -1;
+		DKBEvent *pEvent = &pEvents[nOutputCount++];
+		pEvent->nTimestamp = pTimestamps[i];
+		pEvent->nKeyCode = aColumns.pKeys[nIndex];
+		pEvent->nType = (uint8_t)UnpackBits(aColumns.pTypes, pBlock->nTypeBits, i);
+		pEvent->nDevice = (uint8_t)aColumns.pDevices[nDevice];
+		pEvent->nSession = (uint16_t)(aColumns.pDevices[nDevice] >> 8);
+		pEvent->nFlags = aColumns.pFlagValues[nRun];
+	}
+	return nOutputCount;
+
+}
+
+static int List(const Archive *pArchive, const char *pPath) {
+
+	const ArchiveHeader *pHeader = pArchive->pHeader;
+	printf("%s: %u sources, %llu events in %u blocks, %zu bytes, %.2f bytes/event\n", pPath, pHeader->nSourceCount,
+		(unsigned long long)pHeader->nEventCount, pHeader->nBlockCount, pArchive->nSize,
+		(pHeader->nEventCount != 0) ? (double)pArchive->nSize / pHeader->nEventCount : 0.0);
+	uint32_t i;
+	for(i = 0; i < pHeader->nSourceCount; i++) {
+		const ArchiveSource *pSource = &pArchive->pSources[i];
+		DKBClock aClock;
+		DKBClockInitRatio(&aClock, pSource->nTicksNumer, pSource->nTicksDenom);
+		uint64_t nSpan = 0, nSize = 0;
+		unsigned nMaxKeyBits = 0, nMaxTimestampBits = 0;
+		if(pSource->nBlockCount != 0) {
+			nSpan = pArchive->pBlocks[pSource->nFirstBlock + pSource->nBlockCount - 1].nMaxTimestamp - pArchive->pBlocks[pSource->nFirstBlock].nMinTimestamp;
+			uint32_t j;
+			for(j = pSource->nFirstBlock; j < pSource->nFirstBlock + pSource->nBlockCount; j++) {
+				const ArchiveBlock *pBlock = &pArchive->pBlocks[j];
+				nSize += pBlock->nSize;
+				if(pBlock->nKeyBits > nMaxKeyBits)
+					nMaxKeyBits = pBlock->nKeyBits;
+				if(pBlock->nTimestampBits > nMaxTimestampBits)
+					nMaxTimestampBits = pBlock->nTimestampBits;
+			}
+		}
+		printf("source %u: %llu events in %u blocks over %.1f s, %.2f bytes/event, up to %u bits a key and %u a timestamp%s\n", i,
+			(unsigned long long)pSource->nEventCount, pSource->nBlockCount, DKBClockToNanoseconds(&aClock, nSpan) / 1e9,
+			(pSource->nEventCount != 0) ? (double)nSize / pSource->nEventCount : 0.0, nMaxKeyBits, nMaxTimestampBits,
+			(pSource->nSeed != 0) ? ", generated" : "");
+	}
+	return 0;
+
+}
+
+static int Extract(const Archive *pArchive, uint32_t nSource, const char *pOutputPath, long nWorkerCount) {
+
+	if(nSource >= pArchive->pHeader->nSourceCount) {
+		fprintf(stderr, "no source %u, the archive has %u\n", nSource, pArchive->pHeader->nSourceCount);
+		return 1;
+	}
+	const ArchiveSource *pSource = &pArchive->pSources[nSource];
+	Decoder aDecoder;
+	if(InitDecoder(&aDecoder, pArchive, nWorkerCount, -1) != 0) {
+		perror("DeKeyBounceArchive");
+		return 1;
+	}
+	FILE *pOutput = fopen(pOutputPath, "wb");
+	if(pOutput == NULL) {
+		perror(pOutputPath);
+		DeinitDecoder(&aDecoder);
+		return 1;
+	}
+	DKBTraceHeader aHeader;
+	DKBTraceHeaderInit(&aHeader, pSource->nTicksNumer, pSource->nTicksDenom);
+	aHeader.nSeed = pSource->nSeed;
+	int isSuccess = (DKBTraceWriteHeader(pOutput, &aHeader) == 0);
+	int isCorrupt = 0;
+	uint64_t nEventCount = 0;
+	uint32_t nBlock = pSource->nFirstBlock, nEnd = pSource->nFirstBlock + pSource->nBlockCount;
+	while(isSuccess && nBlock < nEnd) {
+		size_t nCount = 0;
+		while(nCount < aDecoder.nRoundCapacity && nBlock < nEnd)
+			aDecoder.pRoundBlocks[nCount++] = nBlock++;
+		if(DecodeRound(&aDecoder, aDecoder.pRoundBlocks, nCount) != 0) {
+			isCorrupt = 1;
+			break;
+		}
+		size_t i;
+		for(i = 0; i < nCount && isSuccess; i++) {
+			size_t nOutputCount = aDecoder.aRun.pOutputCounts[i];
+			if(fwrite(aDecoder.aRun.pOutputs[i], sizeof(DKBEvent), nOutputCount, pOutput) != nOutputCount)
+				isSuccess = 0;
+			nEventCount += nOutputCount;
+		}
+	}
+	if(isSuccess && !isCorrupt && DKBTraceFinish(pOutput, &aHeader, nEventCount) != 0)
+		isSuccess = 0;
+	if(fclose(pOutput) != 0)
+		isSuccess = 0;
+	DeinitDecoder(&aDecoder);
+	if(isCorrupt) {
+		fprintf(stderr, "source %u: damaged block\n", nSource);
+		return 1;
+	}
+	if(!isSuccess) {
+		perror(pOutputPath);
+		return 1;
+	}
+	printf("source %u: %llu events\n", nSource, (unsigned long long)nEventCount);
+	return 0;
+
+}
+
+static int Query(const Archive *pArchive, int nKeyCode, long nSource, double fFrom, double fUntil, double fThreshold, long nWorkerCount) {
+
+	const ArchiveHeader *pHeader = pArchive->pHeader;
+	if(nSource >= (long)pHeader->nSourceCount) {
+		fprintf(stderr, "no source %ld, the archive has %u\n", nSource, pHeader->nSourceCount);
+		return 1;
+	}
+	Decoder aDecoder;
+	if(InitDecoder(&aDecoder, pArchive, nWorkerCount, nKeyCode) != 0) {
+		perror("DeKeyBounceArchive");
+		return 1;
+	}
+	DKBEvent *pEvents = NULL; // of the key in the current source
+	size_t nEventCount = 0, nEventCapacity = 0;
+	uint64_t *pIntervals = NULL; // ns
+	size_t nIntervalCount = 0, nIntervalCapacity = 0;
+	uint64_t nPressCount = 0, nDroppedPressCount = 0;
+	uint64_t aHistogram[HISTOGRAM_BUCKET_COUNT];
+	memset(aHistogram, 0, sizeof aHistogram);
+	uint32_t nScannedCount = 0, nConsideredCount = 0;
+	int isSuccess = 1, isCorrupt = 0;
+	uint64_t nStart = GetNanoseconds();
+
+	uint32_t nFirstSource = (nSource >= 0) ? (uint32_t)nSource : 0;
+	uint32_t nEndSource = (nSource >= 0) ? (uint32_t)nSource + 1 : pHeader->nSourceCount;
+	uint32_t i;
+	for(i = nFirstSource; i < nEndSource && isSuccess && !isCorrupt; i++) {
+		const ArchiveSource *pSource = &pArchive->pSources[i];
+		DKBClock aClock;
+		DKBClockInitRatio(&aClock, pSource->nTicksNumer, pSource->nTicksDenom);
+		uint64_t nFrom = DKBClockFromNanoseconds(&aClock, (uint64_t)(fFrom * 1e9));
+		uint64_t nUntil = (fUntil > 0) ? DKBClockFromNanoseconds(&aClock, (uint64_t)(fUntil * 1e9)) : UINT64_MAX;
+		uint64_t nThreshold = DKBClockFromNanoseconds(&aClock, (uint64_t)(fThreshold * 1e6));
+		nEventCount = 0;
+		uint32_t nBlock = pSource->nFirstBlock, nEnd = pSource->nFirstBlock + pSource->nBlockCount;
+		nConsideredCount += pSource->nBlockCount;
+		while(nBlock < nEnd) {
+			size_t nCount = 0;
+			while(nCount < aDecoder.nRoundCapacity && nBlock < nEnd) {
+				if(IsBlockSelected(&pArchive->pBlocks[nBlock], nKeyCode, nFrom, nUntil))
+					aDecoder.pRoundBlocks[nCount++] = nBlock;
+				nBlock++;
+			}
+			if(nCount == 0)
+				continue;
+			nScannedCount += nCount;
+			if(DecodeRound(&aDecoder, aDecoder.pRoundBlocks, nCount) != 0) {
+				isCorrupt = 1;
+				break;
+			}
+			size_t j, k;
+			for(j = 0; j < nCount; j++) {
+				const DKBEvent *pOutput = aDecoder.aRun.pOutputs[j];
+				for(k = 0; k < aDecoder.aRun.pOutputCounts[j]; k++) {
+					if(pOutput[k].nTimestamp < nFrom || pOutput[k].nTimestamp >= nUntil)
+						continue;
+					if(nEventCount == nEventCapacity) {
+						size_t nCapacity = (nEventCapacity != 0) ? nEventCapacity * 2 : 4096;
+						DKBEvent *pNewEvents = realloc(pEvents, nCapacity * sizeof(DKBEvent));
+						if(pNewEvents == NULL) {
+							isSuccess = 0;
+							break;
+						}
+						pEvents = pNewEvents;
+						nEventCapacity = nCapacity;
+					}
+					pEvents[nEventCount++] = pOutput[k];
+				}
+			}
+		}
+
+		// every device on its own, in the order of the trace
+		qsort(pEvents, nEventCount, sizeof(DKBEvent), CompareByDevice);
+		size_t j;
+		for(j = 0; j < nEventCount && isSuccess; j++) {
+			const DKBEvent *pEvent = &pEvents[j];
+			if(pEvent->nType != DKB_EVENT_KEY_DOWN)
+				continue;
+			nPressCount++;
+			if(pEvent->nFlags & DKB_TRACE_FLAG_DROPPED)
+				nDroppedPressCount++;
+			if(j == 0 || pEvents[j - 1].nType != DKB_EVENT_KEY_UP || pEvents[j - 1].nDevice != pEvent->nDevice || pEvents[j - 1].nSession != pEvent->nSession)
+				continue;
+			uint64_t nInterval = pEvent->nTimestamp - pEvents[j - 1].nTimestamp;
+			if(nInterval >= nThreshold)
+				continue;
+			if(nIntervalCount == nIntervalCapacity) {
+				size_t nCapacity = (nIntervalCapacity != 0) ? nIntervalCapacity * 2 : 4096;
+				uint64_t *pNewIntervals = realloc(pIntervals, nCapacity * sizeof(uint64_t));
+				if(pNewIntervals == NULL) {
+					isSuccess = 0;
+					break;
+				}
+				pIntervals = pNewIntervals;
+				nIntervalCapacity = nCapacity;
+			}
+			uint64_t nNanoseconds = DKBClockToNanoseconds(&aClock, nInterval);
+			pIntervals[nIntervalCount++] = nNanoseconds;
+			int nBucket = 0;
+			while(nBucket < HISTOGRAM_BUCKET_COUNT - 1 && nNanoseconds >= (125000ULL << nBucket))
+				nBucket++;
+			aHistogram[nBucket]++;
+		}
+	}
+	uint64_t nElapsed = GetNanoseconds() - nStart;
+	uint64_t nDecodedEventCount = aDecoder.nDecodedEventCount;
+	DeinitDecoder(&aDecoder);
+	free(pEvents);
+	if(isCorrupt || !isSuccess) {
+		if(isCorrupt)
+			fprintf(stderr, "damaged block\n");
+		else
+			perror("DeKeyBounceArchive");
+		free(pIntervals);
+		return 1;
+	}
+
+	printf("key %d: %u of %u blocks read (%llu events) in %.3f s, %llu presses, %llu of them dropped\n", nKeyCode,
+		nScannedCount, nConsideredCount, (unsigned long long)nDecodedEventCount, nElapsed / 1e9,
+		(unsigned long long)nPressCount, (unsigned long long)nDroppedPressCount);
+	printf("%zu bounce intervals under %.3f ms", nIntervalCount, fThreshold);
+	if(nIntervalCount == 0) {
+		printf("\n");
+		free(pIntervals);
+		return 0;
+	}
+	qsort(pIntervals, nIntervalCount, sizeof(uint64_t), CompareIntervals);
+	printf(": p50 %.3f ms p90 %.3f ms p99 %.3f ms max %.3f ms\n", pIntervals[nIntervalCount / 2] / 1e6,
+		pIntervals[nIntervalCount * 9 / 10] / 1e6, pIntervals[nIntervalCount * 99 / 100] / 1e6, pIntervals[nIntervalCount - 1] / 1e6);
+	int nBucket;
+	for(nBucket = 0; nBucket < HISTOGRAM_BUCKET_COUNT; nBucket++) {
+		if(aHistogram[nBucket] == 0)
+			continue;
+		if(nBucket == 0)
+			printf("%10s %-9.3f %llu\n", "", 0.125, (unsigned long long)aHistogram[nBucket]);
+		else if(nBucket == HISTOGRAM_BUCKET_COUNT - 1)
+			printf("%9.3f- %9s %llu\n", (125000ULL << (nBucket - 1)) / 1e6, "", (unsigned long long)aHistogram[nBucket]);
+		else
+			printf("%9.3f- %-9.3f %llu\n", (125000ULL << (nBucket - 1)) / 1e6, (125000ULL << nBucket) / 1e6, (unsigned long long)aHistogram[nBucket]);
+	}
+	free(pIntervals);
+	return 0;
+
+}
+
+static int IsBlockSelected(const ArchiveBlock *pBlock, int nKeyCode, uint64_t nFrom, uint64_t nUntil) {
+
+	if(pBlock->nMaxTimestamp < nFrom || pBlock->nMinTimestamp >= nUntil)
+		return 0;
+	if(nKeyCode < pBlock->nMinKeyCode || nKeyCode > pBlock->nMaxKeyCode)
+		return 0;
+	if(nKeyCode < DKB_KEY_CODE_COUNT && !(pBlock->aKeyMask[nKeyCode / 64] & (1ULL << (nKeyCode % 64))))
+		return 0;
+	return 1;
+
+}
+
+static int CompareValues(const void *pValue1, const void *pValue2) {
+
+	uint32_t nValue1 = *(const uint32_t *)pValue1, nValue2 = *(const uint32_t *)pValue2;
+	return (nValue1 > nValue2) - (nValue1 < nValue2);
+
+}
+
+static int CompareByDevice(const void *pValue1, const void *pValue2) {
+
+	const DKBEvent *pEvent1 = pValue1, *pEvent2 = pValue2;
+	uint32_t nDevice1 = (uint32_t)pEvent1->nSession << 8 | pEvent1->nDevice, nDevice2 = (uint32_t)pEvent2->nSession << 8 | pEvent2->nDevice;
+	if(nDevice1 != nDevice2)
+		return (nDevice1 > nDevice2) - (nDevice1 < nDevice2);
+	return (pEvent1->nTimestamp > pEvent2->nTimestamp) - (pEvent1->nTimestamp < pEvent2->nTimestamp);
+
+}
+
+static int CompareIntervals(const void *pValue1, const void *pValue2) {
+
+	uint64_t nValue1 = *(const uint64_t *)pValue1, nValue2 = *(const uint64_t *)pValue2;
+	return (nValue1 > nValue2) - (nValue1 < nValue2);
+
+}
+
+static uint64_t GetNanoseconds(void) {
+
+	struct timespec aTime;
+	clock_gettime(CLOCK_MONOTONIC, &aTime);
+	return (uint64_t)aTime.tv_sec * 1000000000ULL + aTime.tv_nsec;
+
+}
+
+static void Usage(const char *pName) {
+
+	fprintf(stderr,
+		"usage: %s [-b events per block] -o archive trace...\n"
+		"       %s archive\n"
+		"       %s -x source -o trace [-j workers] archive\n"
+		"       %s -k key code [-s source] [-T from:until s] [-t bounce threshold ms] [-j workers] archive\n", pName, pName, pName, pName);
+
+}
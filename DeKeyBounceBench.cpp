@@ -0,0 +1,886 @@
+/*
+ * DeKeyBounce
+ * Benchmarks of the engine and the filter building blocks.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A small harness after google-benchmark: every benchmark runs its body
+ * a few times and the best repetition counts, in ns per event (or record)
+ * of wall and CPU time. The results go to the console and, with -o, to a
+ * JSON file in the format of google-benchmark --benchmark_out, so its
+ * compare.py can tell a regression between two releases.
+ *
+ *   TapPath/...           one event at a time, the way the tap callback judges it
+ *   Batch/...             DKBEngineFilter and DKBEngineFilterInPlace by batch size
+ *   Layout/...            the flat key table against the hash set of keys the daemon had
+ *   Sessions/threads:N    an engine per session, a thread each, all at once
+ *   Instrumentation/...   the tap path with the fault check or a stats collector running
+ *   Compact/...           the levels of DKBCompact against std::remove_if
+ *   Accuracy/...          DKBEngineFilter by filtering strategy, scored against the labels
+ *
+ * The events come from a simple typist with chatter on a few keys, the
+ * same for a seed, labeled genuine or chatter. The accuracy benchmarks
+ * run on a labeled trace instead with -L (e.g. of DeKeyBounceTraceGen),
+ * and add the precision, the recall and the latency the false drops add
+ * (see DeKeyBounceScore) to their results, so a speedup which costs
+ * accuracy shows in the same JSON. -f runs only the benchmarks with the
+ * given text in the name. Where perf_event_open lets the process count
+ * its own thread, the hardware counters of the best repetition are shown
+ * per event as well (see DeKeyBouncePerf), except for the sessions,
+ * which run on threads of their own.
+ * Build: cc -O2 -c DeKeyBounceMemory.c &&
+ *        c++ -O2 -std=c++17 -o DeKeyBounceBench DeKeyBounceBench.cpp DeKeyBounceMemory.o -L. -lDeKeyBounce -lpthread
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <CoreFoundation/CoreFoundation.h>
+#endif
+
+#include "DeKeyBounceClock.h"
+#include "DeKeyBounceCompact.h"
+#include "DeKeyBounceConfig.h"
+#include "DeKeyBounceEngine.h"
+#include "DeKeyBounceMemory.h"
+#include "DeKeyBouncePerf.h"
+#include "DeKeyBounceScore.h"
+#include "DeKeyBounceStats.h"
+#include "DeKeyBounceTrace.h"
+
+#define DEFAULT_EVENT_COUNT 1048576
+#define DEFAULT_REPEAT_COUNT 20
+#define MIN_TIMESTAMP_DIFF 20000000ULL /* 20 ms, the events are in ns */
+#define STATS_COLLECT_PERIOD 1000 /* us, far more often than the daemons, to make its cost visible */
+
+template <size_t nSize> struct Record {
+
+	uint64_t aWords[nSize / 8];
+
+};
+
+struct Timer {
+
+	uint64_t nRealStart, nCpuStart;
+	uint64_t nRealTime, nCpuTime;
+	bool isCounting;
+	DKBPerfSample aCountersStart;
+	DKBPerfSample aCounters; /* counted between Start and Stop */
+
+	void Start(bool isCounting = true);
+	void Stop(void);
+
+};
+
+struct Result {
+
+	std::string aName;
+	int nThreadCount;
+	uint64_t nItemCount; /* per repetition */
+	uint64_t nRealTime; /* ns of the best repetition */
+	uint64_t nCpuTime; /* ns of the same repetition, of all threads */
+	bool hasCounters;
+	DKBPerfSample aCounters; /* of the same repetition */
+	bool hasScore;
+	double fPrecision;
+	double fRecall;
+	double fAddedLatency; /* ms, the mean of the delayed transitions */
+	double fMaxAddedLatency; /* ms */
+	uint64_t nLostCount; /* transitions */
+
+};
+
+// the key table of the daemon before the flat table, an entry per key code seen
+struct KeyData {
+
+	uint64_t nKeyCode;
+	uint64_t nLastKeyUpTimestamp;
+
+};
+
+struct FlatKeyTable {
+
+	KeyData aKeys[DKB_KEY_CODE_COUNT];
+
+	FlatKeyTable() { for(size_t i = 0; i < DKB_KEY_CODE_COUNT; i++) aKeys[i].nKeyCode = UINT64_MAX; }
+	KeyData *Find(uint64_t nKeyCode) { return (aKeys[nKeyCode].nKeyCode == nKeyCode) ? &aKeys[nKeyCode] : NULL; }
+	void Add(const KeyData &aKeyData) { aKeys[aKeyData.nKeyCode] = aKeyData; }
+
+};
+
+struct MapKeyTable {
+
+	std::unordered_map<uint64_t, KeyData> aKeys;
+
+	KeyData *Find(uint64_t nKeyCode) { auto pKey = aKeys.find(nKeyCode); return (pKey != aKeys.end()) ? &pKey->second : NULL; }
+	void Add(const KeyData &aKeyData) { aKeys.emplace(aKeyData.nKeyCode, aKeyData); }
+
+};
+
+#ifdef __APPLE__
+struct CFSetKeyTable {
+
+	CFMutableSetRef rKeySet;
+
+	CFSetKeyTable();
+	~CFSetKeyTable() { CFRelease(rKeySet); }
+	KeyData *Find(uint64_t nKeyCode) { KeyData aProbe = { nKeyCode, 0 }; return (KeyData *)CFSetGetValue(rKeySet, &aProbe); }
+	void Add(const KeyData &aKeyData) { CFSetAddValue(rKeySet, &aKeyData); }
+
+};
+#endif
+
+struct Strategy {
+
+	const char *pName;
+	uint64_t nMinTimestampDiff; /* ms */
+	uint64_t nMinHoldDiff; /* ms, 0 for none */
+
+};
+
+// the daemon of the tap path, without the tap
+struct TapContext {
+
+	DKBEngine *pEngine;
+	DKBConfigDomain aConfigDomain;
+	DKBConfigReader *pConfigReader;
+	uint64_t nConfigGeneration;
+	bool isFaultCheckEnabled;
+	uint64_t nCallbackFaultCount;
+	uint64_t nCheckedEventCount;
+
+};
+
+static const double theDropRates[] = { 0.01, 0.05, 0.5 };
+static const size_t theBatchSizes[] = { 1, 4, 16, 64, 256, 1024, 4096 };
+static const Strategy theStrategies[] = {
+	{ "release:8ms", 8, 0 },
+	{ "release:20ms", 20, 0 },
+	{ "release:40ms", 40, 0 },
+	{ "release:20ms/hold:30ms", 20, 30 },
+};
+
+static int theRepeatCount = DEFAULT_REPEAT_COUNT;
+static const char *theFilter = NULL;
+static std::vector<Result> theResults;
+static DKBPerf thePerf; // of the main thread
+static bool theIsCounting = false;
+
+static std::vector<DKBEvent> MakeEvents(size_t nCount, unsigned *pSeed);
+static std::unique_ptr<DKBEngine> MakeEngine(void);
+static int ReadLabeledTrace(const char *pPath, std::vector<DKBEvent> *pEvents, DKBClock *pClock);
+template <typename Body> static Result *Run(const std::string &aName, int nThreadCount, uint64_t nItemCount, Body aBody);
+static void RunTapPath(const std::vector<DKBEvent> &aEvents);
+static void RunBatches(const std::vector<DKBEvent> &aEvents);
+static void RunLayouts(const std::vector<DKBEvent> &aEvents);
+template <typename Table> static void RunKeyTable(const char *pName, const std::vector<DKBEvent> &aEvents);
+template <typename Table> static int FilterWithKeyTable(Table *pTable, const DKBEvent *pEvent);
+static void RunSessions(const std::vector<DKBEvent> &aEvents, int nMaxThreadCount);
+static void RunInstrumentation(const std::vector<DKBEvent> &aEvents);
+static int InitTap(TapContext *pTap, DKBEngine *pEngine, bool isFaultCheckEnabled);
+static void DeinitTap(TapContext *pTap);
+static int OnTapEvent(TapContext *pTap, const DKBEvent *pSource);
+template <size_t nSize> static int RunCompaction(size_t nCount, unsigned *pSeed);
+static void RunAccuracy(const std::vector<DKBEvent> &aEvents, const DKBClock *pClock);
+static void OpenPerf(void);
+static int WriteJSON(const char *pPath, const char *pExecutable);
+static uint64_t GetNanoseconds(void);
+static uint64_t GetCpuNanoseconds(void);
+static void Usage(const char *pName);
+
+int main (int argc, char * const argv[]) {
+
+	size_t nCount = DEFAULT_EVENT_COUNT;
+	unsigned nSeed = 1;
+	const char *pOutputPath = NULL;
+	const char *pLabeledPath = NULL;
+	int nMaxThreadCount = (int)std::thread::hardware_concurrency();
+	int nOption;
+	while((nOption = getopt(argc, argv, "f:L:n:o:r:S:T:")) != -1) {
+		switch(nOption) {
+		case 'f': theFilter = optarg; break;
+		case 'L': pLabeledPath = optarg; break;
+		case 'n': nCount = strtoul(optarg, NULL, 10); break;
+		case 'o': pOutputPath = optarg; break;
+		case 'r': theRepeatCount = strtol(optarg, NULL, 10); break;
+		case 'S': nSeed = strtoul(optarg, NULL, 10); break;
+		case 'T': nMaxThreadCount = strtol(optarg, NULL, 10); break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if(optind != argc || nCount == 0 || theRepeatCount <= 0) {
+		Usage(argv[0]);
+		return 1;
+	}
+	if(nMaxThreadCount <= 0)
+		nMaxThreadCount = 1;
+
+	std::vector<DKBEvent> aEvents = MakeEvents(nCount, &nSeed);
+	std::vector<DKBEvent> aLabeledEvents;
+	DKBClock aLabeledClock;
+	DKBClockInitRatio(&aLabeledClock, 1, 1); // the events of MakeEvents are in ns
+	if(pLabeledPath != NULL && ReadLabeledTrace(pLabeledPath, &aLabeledEvents, &aLabeledClock) != 0) {
+		if(errno != 0)
+			perror(pLabeledPath);
+		else
+			fprintf(stderr, "%s: not a trace or empty\n", pLabeledPath);
+		return 1;
+	}
+	OpenPerf();
+	printf("%zu events, best of %d, this CPU has %s\n", nCount, theRepeatCount, DKBCompactGetLevelName(DKBCompactGetLevel()));
+	printf("%-40s %12s %12s %10s", "benchmark", "ns/event", "cpu ns/event", "Mevents/s");
+	for(int nCounter = 0; nCounter < DKB_PERF_COUNTER_COUNT; nCounter++) {
+		if(theIsCounting && DKBPerfHasCounter(&thePerf, nCounter))
+			printf(" %14s", DKBPerfGetCounterName(nCounter));
+	}
+	printf("\n");
+	RunTapPath(aEvents);
+	RunBatches(aEvents);
+	RunLayouts(aEvents);
+	RunSessions(aEvents, nMaxThreadCount);
+	RunInstrumentation(aEvents);
+	int isSuccess = (RunCompaction<8>(nCount, &nSeed) == 0);
+	isSuccess = isSuccess && (RunCompaction<16>(nCount, &nSeed) == 0);
+	isSuccess = isSuccess && (RunCompaction<24>(nCount, &nSeed) == 0);
+	if(isSuccess)
+		RunAccuracy((pLabeledPath != NULL) ? aLabeledEvents : aEvents, &aLabeledClock);
+	if(isSuccess && pOutputPath != NULL && WriteJSON(pOutputPath, argv[0]) != 0) {
+		perror(pOutputPath);
+		isSuccess = 0;
+	}
+	if(theIsCounting)
+		DKBPerfClose(&thePerf);
+	return isSuccess ? 0 : 1;
+
+}
+
+void Timer::Start(bool isCounting) {
+
+	// the counters follow the calling thread only
+	this->isCounting = isCounting && theIsCounting;
+	memset(&aCounters, 0, sizeof aCounters);
+	if(this->isCounting && DKBPerfRead(&thePerf, &aCountersStart) != 0)
+		this->isCounting = false;
+	nRealStart = GetNanoseconds();
+	nCpuStart = GetCpuNanoseconds();
+
+}
+
+void Timer::Stop(void) {
+
+	nCpuTime = GetCpuNanoseconds() - nCpuStart;
+	nRealTime = GetNanoseconds() - nRealStart;
+	DKBPerfSample aCountersEnd;
+	if(isCounting && DKBPerfRead(&thePerf, &aCountersEnd) == 0)
+		DKBPerfAdd(&aCounters, &aCountersStart, &aCountersEnd);
+	else
+		isCounting = false;
+
+}
+
+#ifdef __APPLE__
+static const void *RetainKeyData(CFAllocatorRef rAllocator, const void *pValue) {
+
+	KeyData *pNewKeyData = (KeyData *)CFAllocatorAllocate(rAllocator, sizeof(KeyData), 0);
+	if(pNewKeyData)
+		*pNewKeyData = *(const KeyData *)pValue;
+	return pNewKeyData;
+
+}
+
+static void ReleaseKeyData(CFAllocatorRef rAllocator, const void *pValue) {
+
+	CFAllocatorDeallocate(rAllocator, (void *)pValue);
+
+}
+
+static Boolean IsKeyDataEqual(const void *pValue1, const void *pValue2) {
+
+	return (((const KeyData *)pValue1)->nKeyCode == ((const KeyData *)pValue2)->nKeyCode);
+
+}
+
+static CFHashCode KeyDataHash(const void *pValue) {
+
+	return (CFHashCode)((const KeyData *)pValue)->nKeyCode;
+
+}
+
+CFSetKeyTable::CFSetKeyTable() {
+
+	CFSetCallBacks aKeySetCallBacks = { 0, RetainKeyData, ReleaseKeyData, NULL, IsKeyDataEqual, KeyDataHash };
+	rKeySet = CFSetCreateMutable(NULL, 0, &aKeySetCallBacks);
+	if(rKeySet == NULL)
+		abort();
+
+}
+#endif
+
+static std::vector<DKBEvent> MakeEvents(size_t nCount, unsigned *pSeed) {
+
+	// presses 30-230 ms apart held for 50-150 ms, one key in 16 chatters on 1 press in 4
+	std::vector<DKBEvent> aEvents;
+	aEvents.reserve(nCount + 4);
+	uint64_t nTime = 0;
+	while(aEvents.size() < nCount) {
+		DKBEvent aEvent;
+		memset(&aEvent, 0, sizeof aEvent);
+		int nRank = rand_r(pSeed) % 128;
+		aEvent.nKeyCode = (uint16_t)(nRank * nRank / 128); // the low codes are the common ones
+		aEvent.nFlags = DKB_TRACE_FLAG_LABELED;
+		int isChattering = (aEvent.nKeyCode % 16 == 1 && rand_r(pSeed) % 4 == 0);
+		nTime += 30000000 + rand_r(pSeed) % 200000000;
+		aEvent.nTimestamp = nTime;
+		aEvent.nType = DKB_EVENT_KEY_DOWN;
+		aEvents.push_back(aEvent);
+		nTime += 50000000 + rand_r(pSeed) % 100000000;
+		aEvent.nTimestamp = nTime;
+		aEvent.nType = DKB_EVENT_KEY_UP;
+		aEvents.push_back(aEvent);
+		if(isChattering) {
+			aEvent.nFlags |= DKB_TRACE_FLAG_CHATTER;
+			aEvent.nTimestamp = nTime + 1000000 + rand_r(pSeed) % 4000000;
+			aEvent.nType = DKB_EVENT_KEY_DOWN;
+			aEvents.push_back(aEvent);
+			aEvent.nTimestamp += 500000 + rand_r(pSeed) % 2000000;
+			aEvent.nType = DKB_EVENT_KEY_UP;
+			aEvents.push_back(aEvent);
+			nTime = aEvent.nTimestamp;
+		}
+	}
+	aEvents.resize(nCount);
+	return aEvents;
+
+}
+
+static std::unique_ptr<DKBEngine> MakeEngine(void) {
+
+	std::unique_ptr<DKBEngine> pEngine(new DKBEngine);
+	DKBEngineInit(pEngine.get(), MIN_TIMESTAMP_DIFF);
+	return pEngine;
+
+}
+
+template <typename Body> static Result *Run(const std::string &aName, int nThreadCount, uint64_t nItemCount, Body aBody) {
+
+	if(theFilter != NULL && aName.find(theFilter) == std::string::npos)
+		return NULL;
+	Result aBest = { aName, nThreadCount, nItemCount, UINT64_MAX, 0, false, {}, false, 0, 0, 0, 0, 0 };
+	for(int nRepeat = 0; nRepeat < theRepeatCount; nRepeat++) {
+		Timer aTimer;
+		aBody(aTimer);
+		if(aTimer.nRealTime < aBest.nRealTime) {
+			aBest.nRealTime = aTimer.nRealTime;
+			aBest.nCpuTime = aTimer.nCpuTime;
+			aBest.hasCounters = aTimer.isCounting;
+			aBest.aCounters = aTimer.aCounters;
+		}
+	}
+	printf("%-40s %12.3f %12.3f %10.2f", aName.c_str(), (double)aBest.nRealTime / nItemCount,
+		(double)aBest.nCpuTime / nItemCount, nItemCount * 1000.0 / aBest.nRealTime);
+	for(int nCounter = 0; nCounter < DKB_PERF_COUNTER_COUNT; nCounter++) {
+		if(!theIsCounting || !DKBPerfHasCounter(&thePerf, nCounter))
+			continue;
+		if(aBest.hasCounters)
+			printf(" %14.3f", (double)aBest.aCounters.aValues[nCounter] / nItemCount);
+		else
+			printf(" %14s", "-");
+	}
+	printf("\n");
+	fflush(stdout);
+	theResults.push_back(aBest);
+	return &theResults.back();
+
+}
+
+static void RunTapPath(const std::vector<DKBEvent> &aEvents) {
+
+	std::unique_ptr<DKBEngine> pEngine = MakeEngine();
+	Run("TapPath/engine", 1, aEvents.size(), [&](Timer &aTimer) {
+		DKBEngineInit(pEngine.get(), MIN_TIMESTAMP_DIFF);
+		aTimer.Start();
+		for(const DKBEvent &aEvent : aEvents)
+			DKBEngineFilterEvent(pEngine.get(), &aEvent);
+		aTimer.Stop();
+	});
+	Run("TapPath/config", 1, aEvents.size(), [&](Timer &aTimer) {
+		TapContext aTap;
+		if(InitTap(&aTap, pEngine.get(), false) != 0)
+			abort();
+		aTimer.Start();
+		for(const DKBEvent &aEvent : aEvents)
+			OnTapEvent(&aTap, &aEvent);
+		aTimer.Stop();
+		DeinitTap(&aTap);
+	});
+
+}
+
+static void RunBatches(const std::vector<DKBEvent> &aEvents) {
+
+	std::unique_ptr<DKBEngine> pEngine = MakeEngine();
+	std::vector<DKBEvent> aWork;
+	for(size_t nBatchSize : theBatchSizes) {
+		std::vector<uint64_t> aDropMask(DKB_DROP_MASK_SIZE(nBatchSize));
+		Run("Batch/Filter/" + std::to_string(nBatchSize), 1, aEvents.size(), [&](Timer &aTimer) {
+			DKBEngineInit(pEngine.get(), MIN_TIMESTAMP_DIFF);
+			aTimer.Start();
+			for(size_t i = 0; i < aEvents.size(); i += nBatchSize)
+				DKBEngineFilter(pEngine.get(), &aEvents[i], std::min(nBatchSize, aEvents.size() - i), aDropMask.data());
+			aTimer.Stop();
+		});
+		Run("Batch/FilterInPlace/" + std::to_string(nBatchSize), 1, aEvents.size(), [&](Timer &aTimer) {
+			aWork = aEvents;
+			DKBEngineInit(pEngine.get(), MIN_TIMESTAMP_DIFF);
+			aTimer.Start();
+			for(size_t i = 0; i < aWork.size(); i += nBatchSize)
+				DKBEngineFilterInPlace(pEngine.get(), &aWork[i], std::min(nBatchSize, aWork.size() - i));
+			aTimer.Stop();
+		});
+	}
+
+}
+
+static void RunLayouts(const std::vector<DKBEvent> &aEvents) {
+
+	// the engine does more than the old decision (health, counters), the bare table tells the layout apart
+	std::unique_ptr<DKBEngine> pEngine = MakeEngine();
+	Run("Layout/engine", 1, aEvents.size(), [&](Timer &aTimer) {
+		DKBEngineInit(pEngine.get(), MIN_TIMESTAMP_DIFF);
+		aTimer.Start();
+		for(const DKBEvent &aEvent : aEvents)
+			DKBEngineFilterEvent(pEngine.get(), &aEvent);
+		aTimer.Stop();
+	});
+	RunKeyTable<FlatKeyTable>("Layout/flat_array", aEvents);
+	RunKeyTable<MapKeyTable>("Layout/unordered_map", aEvents);
+#ifdef __APPLE__
+	RunKeyTable<CFSetKeyTable>("Layout/CFSet", aEvents);
+#endif
+
+}
+
+template <typename Table> static void RunKeyTable(const char *pName, const std::vector<DKBEvent> &aEvents) {
+
+	Run(pName, 1, aEvents.size(), [&](Timer &aTimer) {
+		std::unique_ptr<Table> pTable(new Table);
+		aTimer.Start();
+		for(const DKBEvent &aEvent : aEvents)
+			FilterWithKeyTable(pTable.get(), &aEvent);
+		aTimer.Stop();
+	});
+
+}
+
+template <typename Table> static int FilterWithKeyTable(Table *pTable, const DKBEvent *pEvent) {
+
+	// OnKeyEvent as it was with CFSet
+	KeyData *pOldKeyData = pTable->Find(pEvent->nKeyCode);
+	switch(pEvent->nType) {
+
+	case DKB_EVENT_KEY_DOWN:
+		if(!pOldKeyData)
+			break;
+		if(pOldKeyData->nLastKeyUpTimestamp == 0)
+			return DKB_VERDICT_DROP;
+		if(pEvent->nTimestamp < (pOldKeyData->nLastKeyUpTimestamp + MIN_TIMESTAMP_DIFF)) {
+			pOldKeyData->nLastKeyUpTimestamp = 0;
+			return DKB_VERDICT_DROP;
+		}
+		break;
+
+	case DKB_EVENT_KEY_UP:
+		if(!pOldKeyData) {
+			KeyData aNewKeyData = { pEvent->nKeyCode, pEvent->nTimestamp };
+			pTable->Add(aNewKeyData);
+			break;
+		}
+		if(pOldKeyData->nLastKeyUpTimestamp == 0) {
+			pOldKeyData->nLastKeyUpTimestamp = pEvent->nTimestamp;
+			return DKB_VERDICT_DROP;
+		}
+		pOldKeyData->nLastKeyUpTimestamp = pEvent->nTimestamp;
+		break;
+
+	}
+	return DKB_VERDICT_PASS;
+
+}
+
+static void RunSessions(const std::vector<DKBEvent> &aEvents, int nMaxThreadCount) {
+
+	for(int nThreadCount = 1; ; nThreadCount = std::min(nThreadCount * 2, nMaxThreadCount)) {
+		Run("Sessions/threads:" + std::to_string(nThreadCount), nThreadCount, aEvents.size() * nThreadCount, [&](Timer &aTimer) {
+			std::atomic<int> nReadyCount(0);
+			std::atomic<bool> isRunning(false);
+			std::vector<std::thread> aThreads;
+			for(int i = 0; i < nThreadCount; i++) {
+				aThreads.emplace_back([&]() {
+					std::unique_ptr<DKBEngine> pEngine = MakeEngine(); // first touched by its own thread
+					nReadyCount.fetch_add(1);
+					while(!isRunning.load(std::memory_order_acquire))
+						std::this_thread::yield();
+					for(const DKBEvent &aEvent : aEvents)
+						DKBEngineFilterEvent(pEngine.get(), &aEvent);
+				});
+			}
+			while(nReadyCount.load() != nThreadCount)
+				std::this_thread::yield();
+			aTimer.Start(false);
+			isRunning.store(true, std::memory_order_release);
+			for(std::thread &aThread : aThreads)
+				aThread.join();
+			aTimer.Stop();
+		});
+		if(nThreadCount == nMaxThreadCount)
+			break;
+	}
+
+}
+
+static void RunInstrumentation(const std::vector<DKBEvent> &aEvents) {
+
+	std::unique_ptr<DKBEngine> pEngine = MakeEngine();
+	for(int isFaultCheckEnabled = 0; isFaultCheckEnabled <= 1; isFaultCheckEnabled++) {
+		Run(isFaultCheckEnabled ? "Instrumentation/fault_check" : "Instrumentation/off", 1, aEvents.size(), [&](Timer &aTimer) {
+			TapContext aTap;
+			if(InitTap(&aTap, pEngine.get(), isFaultCheckEnabled) != 0)
+				abort();
+			aTimer.Start();
+			for(const DKBEvent &aEvent : aEvents)
+				OnTapEvent(&aTap, &aEvent);
+			aTimer.Stop();
+			DeinitTap(&aTap);
+		});
+	}
+
+	// the housekeeping reads the counters the filter writes, the lines bounce between the cores
+	std::unique_ptr<DKBStats> pStats(new DKBStats);
+	std::unique_ptr<DKBKeyCounters[]> pSeenCounters(new DKBKeyCounters[DKB_KEY_CODE_COUNT]);
+	Run("Instrumentation/stats_collector", 1, aEvents.size(), [&](Timer &aTimer) {
+		TapContext aTap;
+		if(InitTap(&aTap, pEngine.get(), false) != 0)
+			abort();
+		DKBStatsReset(pStats.get(), 0);
+		memset(pSeenCounters.get(), 0, DKB_KEY_CODE_COUNT * sizeof(DKBKeyCounters));
+		std::atomic<bool> isRunning(true);
+		std::thread aCollector([&]() {
+			while(isRunning.load(std::memory_order_relaxed)) {
+				DKBStatsCollect(pStats.get(), pEngine.get(), pSeenCounters.get());
+				usleep(STATS_COLLECT_PERIOD);
+			}
+		});
+		aTimer.Start();
+		for(const DKBEvent &aEvent : aEvents)
+			OnTapEvent(&aTap, &aEvent);
+		aTimer.Stop();
+		isRunning.store(false, std::memory_order_relaxed);
+		aCollector.join();
+		DeinitTap(&aTap);
+	});
+
+}
+
+static int InitTap(TapContext *pTap, DKBEngine *pEngine, bool isFaultCheckEnabled) {
+
+	memset(pTap, 0, sizeof *pTap);
+	pTap->pEngine = pEngine;
+	pTap->isFaultCheckEnabled = isFaultCheckEnabled;
+	DKBEngineInit(pEngine, MIN_TIMESTAMP_DIFF);
+	DKBConfig *pConfig = DKBConfigCreate(NULL, MIN_TIMESTAMP_DIFF, DKB_DEFAULT_ALERT_BOUNCE_RATE);
+	if(pConfig == NULL || DKBConfigDomainInit(&pTap->aConfigDomain, pConfig) != 0) {
+		DKBConfigDestroy(pConfig);
+		return -1;
+	}
+	pTap->pConfigReader = DKBConfigAddReader(&pTap->aConfigDomain);
+	return 0;
+
+}
+
+static void DeinitTap(TapContext *pTap) {
+
+	DKBConfigDomainDeinit(&pTap->aConfigDomain);
+
+}
+
+static int OnTapEvent(TapContext *pTap, const DKBEvent *pSource) {
+
+	// the work of OnKeyEvent in DeKeyBounce.c around the CGEvent calls
+	uint64_t nMinorFaults = 0, nMajorFaults = 0;
+	if(pTap->isFaultCheckEnabled)
+		DKBMemoryGetFaults(&nMinorFaults, &nMajorFaults);
+	DKBEvent aEvent;
+	memset(&aEvent, 0, sizeof aEvent);
+	aEvent.nTimestamp = pSource->nTimestamp;
+	aEvent.nKeyCode = pSource->nKeyCode;
+	aEvent.nType = pSource->nType;
+	const DKBConfig *pConfig = DKBConfigAcquire(&pTap->aConfigDomain);
+	if(pTap->nConfigGeneration != pConfig->nGeneration) {
+		DKBEngineSetMinTimestampDiff(pTap->pEngine, pConfig->nMinTimestampDiff);
+		DKBEngineSetIntervalBase(pTap->pEngine, pConfig->nMinTimestampDiff);
+		DKBEngineSetAlertBounceRate(pTap->pEngine, pConfig->nAlertBounceRate);
+		DKBEngineSetMinHoldDiff(pTap->pEngine, pConfig->nMinHoldDiff);
+		DKBEngineSetKeyMinTimestampDiffs(pTap->pEngine, pConfig->hasKeyMinTimestampDiffs ? pConfig->aKeyMinTimestampDiffs : NULL);
+		pTap->nConfigGeneration = pConfig->nGeneration;
+	}
+	int nVerdict = DKBEngineFilterEvent(pTap->pEngine, &aEvent);
+	DKBConfigQuiesce(&pTap->aConfigDomain, pTap->pConfigReader);
+	if(pTap->isFaultCheckEnabled) {
+		uint64_t nMinorFaultsAfter, nMajorFaultsAfter;
+		DKBMemoryGetFaults(&nMinorFaultsAfter, &nMajorFaultsAfter);
+		uint64_t nFaults = (nMinorFaultsAfter - nMinorFaults) + (nMajorFaultsAfter - nMajorFaults);
+		__atomic_store_n(&pTap->nCallbackFaultCount, pTap->nCallbackFaultCount + nFaults, __ATOMIC_RELAXED);
+		__atomic_store_n(&pTap->nCheckedEventCount, pTap->nCheckedEventCount + 1, __ATOMIC_RELAXED);
+	}
+	return nVerdict;
+
+}
+
+template <size_t nSize> static int RunCompaction(size_t nCount, unsigned *pSeed) {
+
+	typedef Record<nSize> RecordType;
+	std::vector<RecordType> aOriginal(nCount), aWork(nCount), aExpected;
+	size_t i;
+	for(i = 0; i < nCount; i++) {
+		for(size_t nWord = 0; nWord < nSize / 8; nWord++)
+			aOriginal[i].aWords[nWord] = (uint64_t)i << 8 | nWord; // every record unique
+	}
+	std::vector<uint64_t> aDropMask((nCount + 63) / 64);
+	int nSupportedLevel = DKBCompactGetLevel();
+
+	for(double fDropRate : theDropRates) {
+		std::fill(aDropMask.begin(), aDropMask.end(), 0);
+		for(i = 0; i < nCount; i++) {
+			if(rand_r(pSeed) < fDropRate * RAND_MAX)
+				aDropMask[i / 64] |= 1ULL << (i % 64);
+		}
+		const uint64_t *pDropMask = aDropMask.data();
+		std::string aPrefix = "Compact/" + std::to_string(nSize) + "/" + std::to_string((int)(fDropRate * 100)) + "%/";
+
+		// every level keeps what the plain loop does, the index of a record is where it still is when judged
+		aExpected.clear();
+		for(i = 0; i < nCount; i++) {
+			if(((pDropMask[i / 64] >> (i % 64)) & 1) == 0)
+				aExpected.push_back(aOriginal[i]);
+		}
+		size_t nPassCount = aExpected.size();
+		Run(aPrefix + "remove_if", 1, nCount, [&](Timer &aTimer) {
+			aWork = aOriginal;
+			const RecordType *pBase = aWork.data();
+			aTimer.Start();
+			std::remove_if(aWork.begin(), aWork.end(), [pBase, pDropMask](const RecordType &aRecord) {
+				size_t nIndex = &aRecord - pBase;
+				return ((pDropMask[nIndex / 64] >> (nIndex % 64)) & 1) != 0;
+			});
+			aTimer.Stop();
+		});
+
+		for(int nLevel = DKB_COMPACT_AUTO; nLevel <= nSupportedLevel; nLevel++) {
+			DKBCompactSetLevel(nLevel);
+			aWork = aOriginal;
+			size_t nCompactCount = DKBCompact(aWork.data(), aWork.data(), nSize, nCount, pDropMask);
+			if(nCompactCount != nPassCount || memcmp(aWork.data(), aExpected.data(), nPassCount * nSize) != 0) {
+				fprintf(stderr, "%s kept other records than remove_if for %zu bytes\n", DKBCompactGetLevelName(nLevel), nSize);
+				DKBCompactSetLevel(DKB_COMPACT_AUTO);
+				return -1;
+			}
+			Run(aPrefix + DKBCompactGetLevelName(nLevel), 1, nCount, [&](Timer &aTimer) {
+				aWork = aOriginal;
+				aTimer.Start();
+				DKBCompact(aWork.data(), aWork.data(), nSize, nCount, pDropMask);
+				aTimer.Stop();
+			});
+		}
+		DKBCompactSetLevel(DKB_COMPACT_AUTO);
+	}
+	return 0;
+
+}
+
+static void RunAccuracy(const std::vector<DKBEvent> &aEvents, const DKBClock *pClock) {
+
+	// the verdicts are the same in every repetition, the last one is scored
+	std::unique_ptr<DKBEngine> pEngine = MakeEngine();
+	std::unique_ptr<DKBScore> pScore(new DKBScore);
+	std::vector<uint64_t> aDropMask(DKB_DROP_MASK_SIZE(aEvents.size()));
+	for(const Strategy &aStrategy : theStrategies) {
+		uint64_t nMinTicksDiff = DKBClockFromNanoseconds(pClock, aStrategy.nMinTimestampDiff * 1000000ULL);
+		uint64_t nMinHoldTicksDiff = DKBClockFromNanoseconds(pClock, aStrategy.nMinHoldDiff * 1000000ULL);
+		Result *pResult = Run(std::string("Accuracy/") + aStrategy.pName, 1, aEvents.size(), [&](Timer &aTimer) {
+			DKBEngineInit(pEngine.get(), nMinTicksDiff);
+			DKBEngineSetMinHoldDiff(pEngine.get(), nMinHoldTicksDiff);
+			aTimer.Start();
+			DKBEngineFilter(pEngine.get(), aEvents.data(), aEvents.size(), aDropMask.data());
+			aTimer.Stop();
+		});
+		if(pResult == NULL)
+			continue;
+		DKBScoreInit(pScore.get());
+		DKBScoreAddBatch(pScore.get(), aEvents.data(), aEvents.size(), aDropMask.data());
+		DKBScoreFinish(pScore.get());
+		DKBKeyScore aTotal;
+		DKBScoreGetTotal(pScore.get(), &aTotal);
+		pResult->hasScore = true;
+		pResult->fPrecision = DKBScoreGetPrecision(&aTotal);
+		pResult->fRecall = DKBScoreGetRecall(&aTotal);
+		pResult->fAddedLatency = (aTotal.nDelayedCount != 0) ? DKBClockToNanoseconds(pClock, aTotal.nAddedLatencySum / aTotal.nDelayedCount) / 1e6 : 0.0;
+		pResult->fMaxAddedLatency = DKBClockToNanoseconds(pClock, aTotal.nMaxAddedLatency) / 1e6;
+		pResult->nLostCount = aTotal.nLostCount;
+		printf("%-40s precision %.4f recall %.4f added latency %.3f ms (max %.3f ms) lost %llu of %llu labeled\n", "",
+			pResult->fPrecision, pResult->fRecall, pResult->fAddedLatency, pResult->fMaxAddedLatency,
+			(unsigned long long)pResult->nLostCount, (unsigned long long)DKBScoreGetLabeledCount(&aTotal));
+	}
+
+}
+
+static int ReadLabeledTrace(const char *pPath, std::vector<DKBEvent> *pEvents, DKBClock *pClock) {
+
+	errno = 0;
+	FILE *pTrace = fopen(pPath, "rb");
+	if(pTrace == NULL)
+		return -1;
+	DKBTraceHeader aHeader;
+	int isSuccess = 0;
+	do { // just for break
+		if(DKBTraceReadHeader(pTrace, &aHeader) != 0)
+			break;
+		DKBClockInitRatio(pClock, aHeader.nTicksNumer, aHeader.nTicksDenom); // validated with the header
+		uint64_t nReadCount = 0;
+		DKBEvent aBuffer[4096];
+		size_t nCount;
+		while((nCount = DKBTraceReadEvents(pTrace, &aHeader, &nReadCount, aBuffer, sizeof aBuffer / sizeof aBuffer[0])) > 0)
+			pEvents->insert(pEvents->end(), aBuffer, aBuffer + nCount);
+		if(ferror(pTrace))
+			break;
+		errno = 0;
+		isSuccess = !pEvents->empty();
+	} while(0);
+	fclose(pTrace);
+	return isSuccess ? 0 : -1;
+
+}
+
+static void OpenPerf(void) {
+
+	if(DKBPerfOpen(&thePerf) == 0) {
+		theIsCounting = true;
+		return;
+	}
+	int nError = errno;
+	int nParanoidLevel;
+	if((nError == EACCES || nError == EPERM) && DKBPerfGetParanoidLevel(&nParanoidLevel) == 0)
+		fprintf(stderr, "no performance counters: %s, perf_event_paranoid is %d and should be 2 or less\n", strerror(nError), nParanoidLevel);
+	else
+		fprintf(stderr, "no performance counters: %s\n", strerror(nError));
+
+}
+
+static int WriteJSON(const char *pPath, const char *pExecutable) {
+
+	FILE *pFile = fopen(pPath, "w");
+	if(pFile == NULL)
+		return -1;
+	char aDate[64], aHostName[256];
+	time_t nNow = time(NULL);
+	struct tm aNow;
+	strftime(aDate, sizeof aDate, "%Y-%m-%dT%H:%M:%S%z", localtime_r(&nNow, &aNow));
+	if(gethostname(aHostName, sizeof aHostName) != 0)
+		strcpy(aHostName, "unknown");
+	aHostName[sizeof aHostName - 1] = '\0';
+	fprintf(pFile, "{\n\t\"context\": {\n\t\t\"date\": \"%s\",\n\t\t\"host_name\": \"%s\",\n\t\t\"executable\": \"%s\",\n"
+		"\t\t\"num_cpus\": %u,\n\t\t\"mhz_per_cpu\": 0,\n\t\t\"cpu_scaling_enabled\": false,\n"
+		"\t\t\"compaction_level\": \"%s\",\n\t\t\"repetitions_best_of\": %d,\n",
+		aDate, aHostName, pExecutable, std::thread::hardware_concurrency(),
+		DKBCompactGetLevelName(DKBCompactGetLevel()), theRepeatCount);
+#ifdef NDEBUG
+	fprintf(pFile, "\t\t\"library_build_type\": \"release\"\n\t},\n\t\"benchmarks\": [");
+#else
+	fprintf(pFile, "\t\t\"library_build_type\": \"debug\"\n\t},\n\t\"benchmarks\": [");
+#endif
+	for(size_t i = 0; i < theResults.size(); i++) {
+		const Result &aResult = theResults[i];
+		// an iteration is an event or a record, so compare.py sees times per event
+		fprintf(pFile, "%s\n\t\t{\n\t\t\t\"name\": \"%s\",\n\t\t\t\"family_index\": %zu,\n\t\t\t\"per_family_instance_index\": 0,\n"
+			"\t\t\t\"run_name\": \"%s\",\n\t\t\t\"run_type\": \"iteration\",\n\t\t\t\"repetitions\": 1,\n\t\t\t\"repetition_index\": 0,\n"
+			"\t\t\t\"threads\": %d,\n\t\t\t\"iterations\": %llu,\n\t\t\t\"real_time\": %.4f,\n\t\t\t\"cpu_time\": %.4f,\n"
+			"\t\t\t\"time_unit\": \"ns\",\n\t\t\t\"items_per_second\": %.1f",
+			(i == 0) ? "" : ",", aResult.aName.c_str(), i, aResult.aName.c_str(), aResult.nThreadCount,
+			(unsigned long long)aResult.nItemCount, (double)aResult.nRealTime / aResult.nItemCount,
+			(double)aResult.nCpuTime / aResult.nItemCount, aResult.nItemCount * 1e9 / aResult.nRealTime);
+		// the counters per event, as user counters
+		for(int nCounter = 0; nCounter < DKB_PERF_COUNTER_COUNT; nCounter++) {
+			if(aResult.hasCounters && DKBPerfHasCounter(&thePerf, nCounter)) {
+				fprintf(pFile, ",\n\t\t\t\"%s\": %.4f", DKBPerfGetCounterName(nCounter),
+					(double)aResult.aCounters.aValues[nCounter] / aResult.nItemCount);
+			}
+		}
+		if(aResult.hasScore) {
+			fprintf(pFile, ",\n\t\t\t\"precision\": %.6f,\n\t\t\t\"recall\": %.6f,\n\t\t\t\"added_latency_ms\": %.4f,\n"
+				"\t\t\t\"max_added_latency_ms\": %.4f,\n\t\t\t\"lost_transitions\": %llu",
+				aResult.fPrecision, aResult.fRecall, aResult.fAddedLatency, aResult.fMaxAddedLatency, (unsigned long long)aResult.nLostCount);
+		}
+		fprintf(pFile, "\n\t\t}");
+	}
+	fprintf(pFile, "\n\t]\n}\n");
+	int isSuccess = !ferror(pFile);
+	if(fclose(pFile) != 0)
+		isSuccess = 0;
+	return isSuccess ? 0 : -1;
+
+}
+
+static uint64_t GetNanoseconds(void) {
+
+	struct timespec aTime;
+	clock_gettime(CLOCK_MONOTONIC, &aTime);
+	return (uint64_t)aTime.tv_sec * 1000000000ULL + aTime.tv_nsec;
+
+}
+
+static uint64_t GetCpuNanoseconds(void) {
+
+	// of the whole process, the session threads included
+	struct timespec aTime;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &aTime);
+	return (uint64_t)aTime.tv_sec * 1000000000ULL + aTime.tv_nsec;
+
+}
+
+static void Usage(const char *pName) {
+
+	fprintf(stderr, "usage: %s [-n events] [-r repeats] [-S seed] [-T max threads] [-f name filter] [-L labeled trace] [-o results.json]\n", pName);
+
+}
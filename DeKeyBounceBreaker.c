@@ -0,0 +1,73 @@
+/*
+ * DeKeyBounce
+ * A circuit breaker letting key events through unfiltered while the filter lags.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceBreaker.h"
+#include "DeKeyBounceProbes.h"
+
+#include <string.h>
+
+void DKBBreakerInit(DKBBreaker *pBreaker, uint64_t nBudget) {
+
+	memset(pBreaker, 0, sizeof *pBreaker);
+	pBreaker->nBudget = nBudget;
+
+}
+
+int DKBBreakerCheck(DKBBreaker *pBreaker, uint64_t nTimestamp, uint64_t nNow) {
+
+	// returns 1 when the event has to bypass the filter
+	if(pBreaker->nBudget == 0)
+		return 0;
+	uint64_t nDelay = (nNow > nTimestamp) ? nNow - nTimestamp : 0;
+	if(!pBreaker->isOpen) {
+		if(nDelay <= pBreaker->nBudget)
+			return 0;
+		DEKEYBOUNCE_BREAKER(1, nDelay);
+		pBreaker->nOpenTime = nNow;
+		__atomic_store_n(&pBreaker->isOpen, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&pBreaker->nTripCount, pBreaker->nTripCount + 1, __ATOMIC_RELAXED);
+	} else if(nDelay < pBreaker->nBudget / 2) { // some hysteresis, a backlog drains with delays all over the budget
+		DEKEYBOUNCE_BREAKER(0, nDelay);
+		__atomic_store_n(&pBreaker->nBypassTime, pBreaker->nBypassTime + (nNow - pBreaker->nOpenTime), __ATOMIC_RELAXED);
+		__atomic_store_n(&pBreaker->isOpen, 0, __ATOMIC_RELAXED);
+		return 0;
+	}
+	__atomic_store_n(&pBreaker->nBypassCount, pBreaker->nBypassCount + 1, __ATOMIC_RELAXED);
+	return 1;
+
+}
+
+uint64_t DKBBreakerGetBypassTime(const DKBBreaker *pBreaker, uint64_t nNow) {
+
+	// of another thread too, then the open span may be a bit off
+	uint64_t nBypassTime = __atomic_load_n(&pBreaker->nBypassTime, __ATOMIC_RELAXED);
+	if(__atomic_load_n(&pBreaker->isOpen, __ATOMIC_RELAXED)) {
+		uint64_t nOpenTime = __atomic_load_n(&pBreaker->nOpenTime, __ATOMIC_RELAXED);
+		if(nNow > nOpenTime)
+			nBypassTime += nNow - nOpenTime;
+	}
+	return nBypassTime;
+
+}
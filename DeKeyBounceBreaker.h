@@ -0,0 +1,65 @@
+/*
+ * DeKeyBounce
+ * A circuit breaker letting key events through unfiltered while the filter lags.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_BREAKER_H
+#define DEKEYBOUNCE_BREAKER_H
+
+#include <stdint.h>
+
+/*
+ * A filter thread descheduled under load makes every keystroke wait, and
+ * the whole machine feels frozen; a few bounces getting through is the
+ * lesser evil. The breaker compares the queueing delay of every event,
+ * from its timestamp to the time the filter gets to it, with a budget.
+ * Over the budget it opens, and the events bypass the filter (see
+ * DKBEngineTrackEvent) until one comes in less than half the budget late.
+ * Only the filter thread writes it; others read the counts with relaxed
+ * atomic loads.
+ */
+
+typedef struct _DKBBreaker {
+
+	uint64_t nBudget; /* queueing delay in ticks of the event source, 0 for none */
+	int isOpen;
+	uint64_t nOpenTime; /* when it last opened */
+	uint64_t nTripCount; /* times it opened */
+	uint64_t nBypassTime; /* ticks spent open, up to the last close */
+	uint64_t nBypassCount; /* events let through unfiltered */
+
+} DKBBreaker;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void DKBBreakerInit(DKBBreaker *pBreaker, uint64_t nBudget);
+int DKBBreakerCheck(DKBBreaker *pBreaker, uint64_t nTimestamp, uint64_t nNow);
+uint64_t DKBBreakerGetBypassTime(const DKBBreaker *pBreaker, uint64_t nNow);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_BREAKER_H */
@@ -0,0 +1,103 @@
+/*
+ * DeKeyBounce
+ * The time base of event timestamps and conversions to and from it.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceClock.h"
+
+#include <time.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+static uint64_t MultiplyFixed(uint64_t nValue, uint64_t nFactor);
+
+int DKBClockInitNative(DKBClock *pClock) {
+
+#ifdef __APPLE__
+	mach_timebase_info_data_t aTimebase;
+	if(mach_timebase_info(&aTimebase) != KERN_SUCCESS)
+		return -1;
+	return DKBClockInitRatio(pClock, aTimebase.numer, aTimebase.denom);
+#else
+	return DKBClockInitRatio(pClock, 1, 1); // CLOCK_MONOTONIC in nanoseconds
+#endif
+
+}
+
+int DKBClockInitRatio(DKBClock *pClock, uint32_t nTicksNumer, uint32_t nTicksDenom) {
+
+	if(nTicksNumer == 0 || nTicksDenom == 0)
+		return -1;
+	pClock->nTicksNumer = nTicksNumer;
+	pClock->nTicksDenom = nTicksDenom;
+	// rounded up, so that whole milliseconds come out as whole ticks rather than one short
+	pClock->nNanosecondsToTicks = (((uint64_t)nTicksDenom << DKB_CLOCK_SHIFT) + nTicksNumer - 1) / nTicksNumer;
+	pClock->nTicksToNanoseconds = (((uint64_t)nTicksNumer << DKB_CLOCK_SHIFT) + nTicksDenom - 1) / nTicksDenom;
+	return 0;
+
+}
+
+uint64_t DKBClockNow(const DKBClock *pClock) {
+
+#ifdef __APPLE__
+	return mach_absolute_time();
+#else
+	struct timespec aTime;
+	clock_gettime(CLOCK_MONOTONIC, &aTime);
+	return DKBClockFromNanoseconds(pClock, (uint64_t)aTime.tv_sec * 1000000000ULL + aTime.tv_nsec);
+#endif
+
+}
+
+uint64_t DKBClockFromNanoseconds(const DKBClock *pClock, uint64_t nNanoseconds) {
+
+	return MultiplyFixed(nNanoseconds, pClock->nNanosecondsToTicks);
+
+}
+
+uint64_t DKBClockToNanoseconds(const DKBClock *pClock, uint64_t nTicks) {
+
+	return MultiplyFixed(nTicks, pClock->nTicksToNanoseconds);
+
+}
+
+uint64_t DKBClockFromTimeval(const DKBClock *pClock, uint64_t nSeconds, uint64_t nMicroseconds) {
+
+	uint64_t nNanoseconds = nSeconds * 1000000000ULL + nMicroseconds * 1000ULL;
+	if(pClock->nTicksNumer == pClock->nTicksDenom)
+		return nNanoseconds; // evdev with CLOCK_MONOTONIC, the case of every event
+	return DKBClockFromNanoseconds(pClock, nNanoseconds);
+
+}
+
+static uint64_t MultiplyFixed(uint64_t nValue, uint64_t nFactor) {
+
+	// (nValue * nFactor) >> 32 without a 128-bit product: the high half of
+	// nValue contributes whole units, only the low half needs the shift
+	uint64_t nHigh = nValue >> DKB_CLOCK_SHIFT;
+	uint64_t nLow = nValue & ((1ULL << DKB_CLOCK_SHIFT) - 1);
+	uint64_t nLowProduct = nLow * (nFactor & 0xFFFFFFFFULL);
+	return nHigh * nFactor + nLow * (nFactor >> DKB_CLOCK_SHIFT) + (nLowProduct >> DKB_CLOCK_SHIFT);
+
+}
@@ -0,0 +1,66 @@
+/*
+ * DeKeyBounce
+ * The time base of event timestamps and conversions to and from it.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_CLOCK_H
+#define DEKEYBOUNCE_CLOCK_H
+
+#include <stdint.h>
+
+/*
+ * The engine compares timestamps in the native ticks of their source:
+ * mach absolute time for Quartz events (nanoseconds on Intel, 125/3 ns
+ * on Apple silicon), nanoseconds of CLOCK_MONOTONIC for evdev, whatever
+ * a trace header says for a replay. A DKBClock is calibrated once and
+ * then converts with a multiply and a shift, so thresholds are turned
+ * into ticks up front and the filter itself never converts anything.
+ */
+
+#define DKB_CLOCK_SHIFT 32
+
+typedef struct _DKBClock {
+
+	uint32_t nTicksNumer; /* nanoseconds = ticks * nTicksNumer / nTicksDenom */
+	uint32_t nTicksDenom;
+	uint64_t nNanosecondsToTicks; /* nTicksDenom / nTicksNumer in 32.32 fixed point */
+	uint64_t nTicksToNanoseconds; /* nTicksNumer / nTicksDenom in 32.32 fixed point */
+
+} DKBClock;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int DKBClockInitNative(DKBClock *pClock);
+int DKBClockInitRatio(DKBClock *pClock, uint32_t nTicksNumer, uint32_t nTicksDenom);
+uint64_t DKBClockNow(const DKBClock *pClock);
+uint64_t DKBClockFromNanoseconds(const DKBClock *pClock, uint64_t nNanoseconds);
+uint64_t DKBClockToNanoseconds(const DKBClock *pClock, uint64_t nTicks);
+uint64_t DKBClockFromTimeval(const DKBClock *pClock, uint64_t nSeconds, uint64_t nMicroseconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_CLOCK_H */
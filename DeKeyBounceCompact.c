@@ -0,0 +1,310 @@
+/*
+ * DeKeyBounce
+ * Removing dropped records from an array, with SIMD where the CPU has it.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceCompact.h"
+
+#include <string.h>
+
+#define SPARSE_DROP_SHIFT 5 /* fewer than 1 in 32 dropped, memmove of the runs beats the vectors */
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define HAS_X86_VECTORS 1
+#endif
+
+static const char *theLevelNames[DKB_COMPACT_LEVEL_COUNT] = { "scalar", "sse2", "avx2", "avx512" };
+static int theSupportedLevel = -1; // not checked yet
+static int theLevel = DKB_COMPACT_AUTO;
+
+static size_t CompactRuns(unsigned char *pDest, const unsigned char *pSource, size_t nRecordSize, size_t nCount, const uint64_t *pDropMask);
+static int GetSupportedLevel(void);
+static size_t GetDropCount(size_t nCount, const uint64_t *pDropMask);
+#ifdef HAS_X86_VECTORS
+static uint32_t thePermutations8[16][8]; // AVX2, 4 records of 8 bytes, the dword indices of the kept ones first
+static uint32_t thePermutations16[4][8]; // AVX2, 2 records of 16 bytes
+static uint8_t theQwordMasks16[16]; // AVX-512, every record bit doubled
+static uint32_t theQwordMasks24[256]; // AVX-512, every record bit tripled
+
+static void InitTables(void);
+static size_t CompactEach(unsigned char *pDest, const unsigned char *pSource, size_t nRecordSize, size_t nFirst, size_t nCount, const uint64_t *pDropMask, size_t nPassCount);
+static size_t CompactAVX2(unsigned char *pDest, const unsigned char *pSource, size_t nRecordSize, size_t nCount, const uint64_t *pDropMask);
+static size_t CompactAVX512(unsigned char *pDest, const unsigned char *pSource, size_t nRecordSize, size_t nCount, const uint64_t *pDropMask);
+#endif
+
+size_t DKBCompact(void *pDest, const void *pSource, size_t nRecordSize, size_t nCount, const uint64_t *pDropMask) {
+
+	int nLevel = __atomic_load_n(&theLevel, __ATOMIC_RELAXED);
+	if(nLevel == DKB_COMPACT_AUTO) {
+		nLevel = GetSupportedLevel();
+		if(GetDropCount(nCount, pDropMask) < (nCount >> SPARSE_DROP_SHIFT))
+			nLevel = DKB_COMPACT_SCALAR;
+	}
+#ifdef HAS_X86_VECTORS
+	if(nRecordSize == 8 || nRecordSize == 16 || nRecordSize == 24) {
+		switch(nLevel) {
+		case DKB_COMPACT_AVX512:
+			return CompactAVX512(pDest, pSource, nRecordSize, nCount, pDropMask);
+		case DKB_COMPACT_AVX2:
+			if(nRecordSize != 24) // 3 records do not fit a register evenly, the branchless stores do as well
+				return CompactAVX2(pDest, pSource, nRecordSize, nCount, pDropMask);
+			// fall through
+		case DKB_COMPACT_SSE2:
+			return CompactEach(pDest, pSource, nRecordSize, 0, nCount, pDropMask, 0);
+		}
+	}
+#endif
+	return CompactRuns(pDest, pSource, nRecordSize, nCount, pDropMask);
+
+}
+
+int DKBCompactGetLevel(void) {
+
+	// the best one the CPU has
+	return GetSupportedLevel();
+
+}
+
+int DKBCompactSetLevel(int nLevel) {
+
+	if(nLevel < DKB_COMPACT_AUTO || nLevel > GetSupportedLevel())
+		return -1;
+	__atomic_store_n(&theLevel, nLevel, __ATOMIC_RELAXED);
+	return 0;
+
+}
+
+const char *DKBCompactGetLevelName(int nLevel) {
+
+	if(nLevel == DKB_COMPACT_AUTO)
+		return "auto";
+	return (nLevel >= 0 && nLevel < DKB_COMPACT_LEVEL_COUNT) ? theLevelNames[nLevel] : "unknown";
+
+}
+
+static size_t CompactRuns(unsigned char *pDest, const unsigned char *pSource, size_t nRecordSize, size_t nCount, const uint64_t *pDropMask) {
+
+	size_t nPassCount = 0;
+	size_t nBase;
+	for(nBase = 0; nBase < nCount; nBase += 64) {
+		uint64_t nKeep = ~pDropMask[nBase / 64];
+		if(nCount - nBase < 64)
+			nKeep &= (1ULL << (nCount - nBase)) - 1;
+		while(nKeep != 0) {
+			int nStart = __builtin_ctzll(nKeep);
+			uint64_t nRest = ~(nKeep >> nStart); // the zeros shifted in end the run at the latest
+			int nLength = __builtin_ctzll(nRest);
+			const unsigned char *pRun = pSource + (nBase + nStart) * nRecordSize;
+			unsigned char *pTo = pDest + nPassCount * nRecordSize;
+			if(pTo != pRun)
+				memmove(pTo, pRun, nLength * nRecordSize);
+			nPassCount += nLength;
+			nKeep = (nStart + nLength < 64) ? nKeep & ~((1ULL << (nStart + nLength)) - 1) : 0;
+		}
+	}
+	return nPassCount;
+
+}
+
+static int GetSupportedLevel(void) {
+
+	int nLevel = __atomic_load_n(&theSupportedLevel, __ATOMIC_ACQUIRE);
+	if(nLevel >= 0)
+		return nLevel;
+#ifdef HAS_X86_VECTORS
+	InitTables();
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		nLevel = DKB_COMPACT_AVX512;
+	else if(__builtin_cpu_supports("avx2"))
+		nLevel = DKB_COMPACT_AVX2;
+	else
+		nLevel = DKB_COMPACT_SSE2; // every x86-64 has it
+#else
+	nLevel = DKB_COMPACT_SCALAR;
+#endif
+	__atomic_store_n(&theSupportedLevel, nLevel, __ATOMIC_RELEASE); // after the tables
+	return nLevel;
+
+}
+
+static size_t GetDropCount(size_t nCount, const uint64_t *pDropMask) {
+
+	size_t nDropCount = 0;
+	size_t nWord;
+	for(nWord = 0; nWord < nCount / 64; nWord++)
+		nDropCount += __builtin_popcountll(pDropMask[nWord]);
+	if(nCount % 64 != 0)
+		nDropCount += __builtin_popcountll(pDropMask[nWord] & ((1ULL << (nCount % 64)) - 1));
+	return nDropCount;
+
+}
+
+#ifdef HAS_X86_VECTORS
+static void InitTables(void) {
+
+	// two threads getting here at once write the same values
+	int nKeep;
+	for(nKeep = 0; nKeep < 16; nKeep++) {
+		int nSlot = 0, nRecord;
+		for(nRecord = 0; nRecord < 4; nRecord++) {
+			if(nKeep & (1 << nRecord)) {
+				thePermutations8[nKeep][nSlot++] = 2 * nRecord;
+				thePermutations8[nKeep][nSlot++] = 2 * nRecord + 1;
+			}
+		}
+		while(nSlot < 8) // what lands after the kept records is overwritten later
+			thePermutations8[nKeep][nSlot++] = 0;
+		uint8_t nQwords = 0;
+		for(nRecord = 0; nRecord < 4; nRecord++) {
+			if(nKeep & (1 << nRecord))
+				nQwords |= 3 << (2 * nRecord);
+		}
+		theQwordMasks16[nKeep] = nQwords;
+	}
+	for(nKeep = 0; nKeep < 4; nKeep++) {
+		int nSlot = 0, nRecord, i;
+		for(nRecord = 0; nRecord < 2; nRecord++) {
+			if(nKeep & (1 << nRecord)) {
+				for(i = 0; i < 4; i++)
+					thePermutations16[nKeep][nSlot++] = 4 * nRecord + i;
+			}
+		}
+		while(nSlot < 8)
+			thePermutations16[nKeep][nSlot++] = 0;
+	}
+	for(nKeep = 0; nKeep < 256; nKeep++) {
+		uint32_t nQwords = 0;
+		int nRecord;
+		for(nRecord = 0; nRecord < 8; nRecord++) {
+			if(nKeep & (1 << nRecord))
+				nQwords |= 7U << (3 * nRecord);
+		}
+		theQwordMasks24[nKeep] = nQwords;
+	}
+
+}
+
+static size_t CompactEach(unsigned char *pDest, const unsigned char *pSource, size_t nRecordSize, size_t nFirst, size_t nCount, const uint64_t *pDropMask, size_t nPassCount) {
+
+	// every record is stored, only the kept ones move the destination on
+	size_t i;
+	switch(nRecordSize) {
+	case 8:
+		for(i = nFirst; i < nCount; i++) {
+			uint64_t nRecord;
+			memcpy(&nRecord, pSource + 8 * i, 8);
+			memcpy(pDest + 8 * nPassCount, &nRecord, 8);
+			nPassCount += 1 - ((pDropMask[i / 64] >> (i % 64)) & 1);
+		}
+		break;
+	case 16:
+		for(i = nFirst; i < nCount; i++) {
+			__m128i aRecord = _mm_loadu_si128((const __m128i *)(pSource + 16 * i));
+			_mm_storeu_si128((__m128i *)(pDest + 16 * nPassCount), aRecord);
+			nPassCount += 1 - ((pDropMask[i / 64] >> (i % 64)) & 1);
+		}
+		break;
+	case 24:
+		for(i = nFirst; i < nCount; i++) {
+			__m128i aHead = _mm_loadu_si128((const __m128i *)(pSource + 24 * i));
+			uint64_t nTail;
+			memcpy(&nTail, pSource + 24 * i + 16, 8);
+			_mm_storeu_si128((__m128i *)(pDest + 24 * nPassCount), aHead);
+			memcpy(pDest + 24 * nPassCount + 16, &nTail, 8);
+			nPassCount += 1 - ((pDropMask[i / 64] >> (i % 64)) & 1);
+		}
+		break;
+	}
+	return nPassCount;
+
+}
+
+__attribute__((target("avx2")))
+static size_t CompactAVX2(unsigned char *pDest, const unsigned char *pSource, size_t nRecordSize, size_t nCount, const uint64_t *pDropMask) {
+
+	// 32 bytes at a time: the kept records are shuffled to the front and the
+	// whole register stored, the next store starts where they end
+	size_t nRecordsPerVector = 32 / nRecordSize;
+	uint32_t nBlockMask = (1U << nRecordsPerVector) - 1;
+	const uint32_t (*pPermutations)[8] = (nRecordSize == 8) ? thePermutations8 : thePermutations16;
+	size_t nPassCount = 0;
+	size_t i;
+	for(i = 0; i + nRecordsPerVector <= nCount; i += nRecordsPerVector) {
+		uint32_t nKeep = ~(uint32_t)(pDropMask[i / 64] >> (i % 64)) & nBlockMask; // blocks never straddle two words
+		__m256i aRecords = _mm256_loadu_si256((const __m256i *)(pSource + nRecordSize * i));
+		__m256i aPermutation = _mm256_loadu_si256((const __m256i *)pPermutations[nKeep]);
+		_mm256_storeu_si256((__m256i *)(pDest + nRecordSize * nPassCount), _mm256_permutevar8x32_epi32(aRecords, aPermutation));
+		nPassCount += __builtin_popcount(nKeep);
+	}
+	return CompactEach(pDest, pSource, nRecordSize, i, nCount, pDropMask, nPassCount);
+
+}
+
+__attribute__((target("avx512f")))
+static size_t CompactAVX512(unsigned char *pDest, const unsigned char *pSource, size_t nRecordSize, size_t nCount, const uint64_t *pDropMask) {
+
+	// VPCOMPRESSQ packs the kept quadwords of a register; a record of 16 or
+	// 24 bytes keeps or loses its 2 or 3 quadwords together
+	size_t nPassCount = 0;
+	size_t i = 0;
+	switch(nRecordSize) {
+	case 8:
+		for(; i + 8 <= nCount; i += 8) {
+			__mmask8 nKeep = ~(uint8_t)(pDropMask[i / 64] >> (i % 64));
+			__m512i aRecords = _mm512_loadu_si512(pSource + 8 * i);
+			_mm512_storeu_si512(pDest + 8 * nPassCount, _mm512_maskz_compress_epi64(nKeep, aRecords));
+			nPassCount += __builtin_popcount(nKeep);
+		}
+		break;
+	case 16:
+		for(; i + 4 <= nCount; i += 4) {
+			uint32_t nKeep = ~(uint32_t)(pDropMask[i / 64] >> (i % 64)) & 0xF;
+			__m512i aRecords = _mm512_loadu_si512(pSource + 16 * i);
+			_mm512_storeu_si512(pDest + 16 * nPassCount, _mm512_maskz_compress_epi64(theQwordMasks16[nKeep], aRecords));
+			nPassCount += __builtin_popcount(nKeep);
+		}
+		break;
+	case 24:
+		for(; i + 8 <= nCount; i += 8) {
+			uint32_t nKeep = ~(uint32_t)(pDropMask[i / 64] >> (i % 64)) & 0xFF;
+			uint32_t nQwords = theQwordMasks24[nKeep];
+			// all three are loaded before the first store, which may overlap them
+			__m512i aRecords0 = _mm512_loadu_si512(pSource + 24 * i);
+			__m512i aRecords1 = _mm512_loadu_si512(pSource + 24 * i + 64);
+			__m512i aRecords2 = _mm512_loadu_si512(pSource + 24 * i + 128);
+			unsigned char *pTo = pDest + 24 * nPassCount;
+			_mm512_storeu_si512(pTo, _mm512_maskz_compress_epi64((__mmask8)nQwords, aRecords0));
+			pTo += 8 * __builtin_popcount(nQwords & 0xFF);
+			_mm512_storeu_si512(pTo, _mm512_maskz_compress_epi64((__mmask8)(nQwords >> 8), aRecords1));
+			pTo += 8 * __builtin_popcount((nQwords >> 8) & 0xFF);
+			_mm512_storeu_si512(pTo, _mm512_maskz_compress_epi64((__mmask8)(nQwords >> 16), aRecords2));
+			nPassCount += __builtin_popcount(nKeep);
+		}
+		break;
+	}
+	return CompactEach(pDest, pSource, nRecordSize, i, nCount, pDropMask, nPassCount);
+
+}
+#endif
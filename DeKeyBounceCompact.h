@@ -0,0 +1,64 @@
+/*
+ * DeKeyBounce
+ * Removing dropped records from an array, with SIMD where the CPU has it.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_COMPACT_H
+#define DEKEYBOUNCE_COMPACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * DKBCompact copies the records of pSource whose bit is clear in pDropMask
+ * (bit i % 64 of word i / 64, as DKBEngineFilter sets them) to pDest, in
+ * order, and returns how many it copied. pDest may be pSource or before it
+ * in the same array, so it compacts in place. Records of 8, 16 and 24
+ * bytes (64-bit words, DKBEvent, a struct input_event of a 64-bit kernel)
+ * go through vector code on x86-64, picked by what the CPU supports the
+ * first time; any other size, or another CPU, copies runs of kept records
+ * with memmove. Copying runs is also the fastest when drops are rare, so
+ * unless a level is forced a mask with few drops takes that way too.
+ */
+
+#define DKB_COMPACT_AUTO -1 /* by the CPU and the drop count of the mask */
+#define DKB_COMPACT_SCALAR 0 /* runs of kept records */
+#define DKB_COMPACT_SSE2 1 /* a branchless store of every record */
+#define DKB_COMPACT_AVX2 2 /* shuffle tables */
+#define DKB_COMPACT_AVX512 3 /* VPCOMPRESSQ */
+#define DKB_COMPACT_LEVEL_COUNT 4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t DKBCompact(void *pDest, const void *pSource, size_t nRecordSize, size_t nCount, const uint64_t *pDropMask);
+int DKBCompactGetLevel(void);
+int DKBCompactSetLevel(int nLevel); /* for benchmarks, fails if the CPU lacks it */
+const char *DKBCompactGetLevelName(int nLevel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_COMPACT_H */
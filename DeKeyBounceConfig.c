@@ -0,0 +1,264 @@
+/*
+ * DeKeyBounce
+ * Run-time settings published to the filter threads without locks.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceConfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct _DKBConfigRetired {
+
+	DKBConfig *pConfig;
+	uint64_t nEpoch; /* the epoch its replacement was published in */
+	DKBConfigRetired *pNext;
+
+};
+
+static uint64_t FromMilliseconds(const DKBClock *pClock, double fMilliseconds);
+
+DKBConfig *DKBConfigCreate(const DKBConfig *pBase, uint64_t nMinTimestampDiff, uint16_t nAlertBounceRate) {
+
+	DKBConfig *pConfig;
+	if(posix_memalign((void **)&pConfig, 64, sizeof(DKBConfig)) != 0)
+		return NULL;
+	if(pBase != NULL) {
+		*pConfig = *pBase;
+		return pConfig;
+	}
+	memset(pConfig, 0, sizeof *pConfig);
+	pConfig->nMinTimestampDiff = nMinTimestampDiff;
+	pConfig->nAlertBounceRate = nAlertBounceRate;
+	return pConfig;
+
+}
+
+void DKBConfigDestroy(DKBConfig *pConfig) {
+
+	free(pConfig);
+
+}
+
+int DKBConfigParse(DKBConfig *pConfig, const char *pPath, const DKBClock *pClock, char *pError, size_t nErrorSize) {
+
+	FILE *pFile = fopen(pPath, "r");
+	if(pFile == NULL) {
+		snprintf(pError, nErrorSize, "cannot open %s", pPath);
+		return -1;
+	}
+	char aLine[256];
+	int nLine = 0;
+	int isSuccess = 1;
+	while(isSuccess && fgets(aLine, sizeof aLine, pFile) != NULL) {
+		nLine++;
+		char *pComment = strchr(aLine, '#');
+		if(pComment != NULL)
+			*pComment = '\0';
+		char aWord[16], aName[64];
+		int nCode;
+		double fValue;
+		if(sscanf(aLine, "%15s", aWord) != 1)
+			continue; // empty
+		if(strcmp(aWord, "threshold") == 0 && sscanf(aLine, "%*s %lf", &fValue) == 1 && fValue > 0) {
+			pConfig->nMinTimestampDiff = FromMilliseconds(pClock, fValue);
+		} else if(strcmp(aWord, "key") == 0 && sscanf(aLine, "%*s %d %lf", &nCode, &fValue) == 2
+			&& nCode >= 0 && nCode < DKB_KEY_CODE_COUNT && fValue > 0) {
+			pConfig->aKeyMinTimestampDiffs[nCode] = FromMilliseconds(pClock, fValue);
+			pConfig->hasKeyMinTimestampDiffs = 1;
+		} else if(strcmp(aWord, "device") == 0 && sscanf(aLine, "%*s %63s %lf", aName, &fValue) == 2 && fValue > 0) {
+			if(pConfig->nDeviceCount == DKB_CONFIG_MAX_DEVICE_COUNT) {
+				snprintf(pError, nErrorSize, "%s:%d: too many devices", pPath, nLine);
+				isSuccess = 0;
+				break;
+			}
+			DKBDeviceConfig *pDevice = &pConfig->aDevices[pConfig->nDeviceCount++];
+			snprintf(pDevice->aNamePrefix, sizeof pDevice->aNamePrefix, "%s", aName);
+			pDevice->nMinTimestampDiff = FromMilliseconds(pClock, fValue);
+		} else if(strcmp(aWord, "app") == 0 && sscanf(aLine, "%*s %63s %lf", aName, &fValue) == 2 && fValue > 0) {
+			if(pConfig->nAppCount == DKB_CONFIG_MAX_APP_COUNT) {
+				snprintf(pError, nErrorSize, "%s:%d: too many apps", pPath, nLine);
+				isSuccess = 0;
+				break;
+			}
+			DKBAppConfig *pApp = &pConfig->aApps[pConfig->nAppCount++];
+			snprintf(pApp->aNamePrefix, sizeof pApp->aNamePrefix, "%s", aName);
+			pApp->nMinTimestampDiff = FromMilliseconds(pClock, fValue);
+		} else if(strcmp(aWord, "alert") == 0 && sscanf(aLine, "%*s %lf", &fValue) == 1 && fValue > 0 && fValue <= 100) {
+			pConfig->nAlertBounceRate = (uint16_t)(fValue * DKB_RATE_ONE / 100);
+		} else if(strcmp(aWord, "hold") == 0 && sscanf(aLine, "%*s %lf", &fValue) == 1 && fValue >= 0) {
+			pConfig->nMinHoldDiff = FromMilliseconds(pClock, fValue);
+		} else {
+			snprintf(pError, nErrorSize, "%s:%d: cannot understand it", pPath, nLine);
+			isSuccess = 0;
+		}
+	}
+	if(ferror(pFile)) {
+		snprintf(pError, nErrorSize, "cannot read %s", pPath);
+		isSuccess = 0;
+	}
+	fclose(pFile);
+	return isSuccess ? 0 : -1;
+
+}
+
+uint64_t DKBConfigGetDeviceMinTimestampDiff(const DKBConfig *pConfig, const char *pDeviceName) {
+
+	// the first matching prefix wins, so the more specific ones go first in the file
+	int i;
+	for(i = 0; i < pConfig->nDeviceCount; i++) {
+		const DKBDeviceConfig *pDevice = &pConfig->aDevices[i];
+		if(strncmp(pDeviceName, pDevice->aNamePrefix, strlen(pDevice->aNamePrefix)) == 0)
+			return pDevice->nMinTimestampDiff;
+	}
+	return pConfig->nMinTimestampDiff;
+
+}
+
+int DKBConfigFindApp(const DKBConfig *pConfig, const char *pProcessName) {
+
+	// the index into aApps, -1 when the process keeps the thresholds of the config; first match wins, as with devices
+	int i;
+	for(i = 0; i < pConfig->nAppCount; i++) {
+		const DKBAppConfig *pApp = &pConfig->aApps[i];
+		if(strncmp(pProcessName, pApp->aNamePrefix, strlen(pApp->aNamePrefix)) == 0)
+			return i;
+	}
+	return -1;
+
+}
+
+int DKBConfigDomainInit(DKBConfigDomain *pDomain, DKBConfig *pConfig) {
+
+	memset(pDomain, 0, sizeof *pDomain);
+	if(pthread_mutex_init(&pDomain->aWriterMutex, NULL) != 0)
+		return -1;
+	pDomain->nEpoch = 1;
+	pDomain->nGeneration = 1;
+	pConfig->nGeneration = 1;
+	pDomain->pCurrent = pConfig;
+	return 0;
+
+}
+
+void DKBConfigDomainDeinit(DKBConfigDomain *pDomain) {
+
+	// no reader may be inside a batch any more
+	while(pDomain->pRetired != NULL) {
+		DKBConfigRetired *pRetired = pDomain->pRetired;
+		pDomain->pRetired = pRetired->pNext;
+		DKBConfigDestroy(pRetired->pConfig);
+		free(pRetired);
+	}
+	DKBConfigDestroy(pDomain->pCurrent);
+	pDomain->pCurrent = NULL;
+	pthread_mutex_destroy(&pDomain->aWriterMutex);
+
+}
+
+DKBConfigReader *DKBConfigAddReader(DKBConfigDomain *pDomain) {
+
+	DKBConfigReader *pReader = NULL;
+	pthread_mutex_lock(&pDomain->aWriterMutex);
+	if(pDomain->nReaderCount < DKB_CONFIG_MAX_READER_COUNT) {
+		pReader = &pDomain->aReaders[pDomain->nReaderCount];
+		__atomic_store_n(&pReader->nQuiescentEpoch, __atomic_load_n(&pDomain->nEpoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+		__atomic_store_n(&pDomain->nReaderCount, pDomain->nReaderCount + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&pDomain->aWriterMutex);
+	return pReader;
+
+}
+
+const DKBConfig *DKBConfigAcquire(DKBConfigDomain *pDomain) {
+
+	return __atomic_load_n(&pDomain->pCurrent, __ATOMIC_ACQUIRE);
+
+}
+
+void DKBConfigQuiesce(DKBConfigDomain *pDomain, DKBConfigReader *pReader) {
+
+	// everything read from the config of the batch is done before a writer may see this
+	uint64_t nEpoch = __atomic_load_n(&pDomain->nEpoch, __ATOMIC_ACQUIRE);
+	if(pReader->nQuiescentEpoch != nEpoch)
+		__atomic_store_n(&pReader->nQuiescentEpoch, nEpoch, __ATOMIC_RELEASE);
+
+}
+
+void DKBConfigPublish(DKBConfigDomain *pDomain, DKBConfig *pConfig) {
+
+	DKBConfigRetired *pRetired = malloc(sizeof(DKBConfigRetired));
+	pthread_mutex_lock(&pDomain->aWriterMutex);
+	pConfig->nGeneration = ++pDomain->nGeneration;
+	DKBConfig *pOldConfig = __atomic_exchange_n(&pDomain->pCurrent, pConfig, __ATOMIC_SEQ_CST);
+	// a reader which sees this epoch at a quiescent point loads the new config in its next batch
+	uint64_t nEpoch = __atomic_add_fetch(&pDomain->nEpoch, 1, __ATOMIC_SEQ_CST);
+	if(pRetired != NULL) {
+		pRetired->pConfig = pOldConfig;
+		pRetired->nEpoch = nEpoch;
+		pRetired->pNext = pDomain->pRetired;
+		pDomain->pRetired = pRetired;
+	} else {
+		// out of memory: leaking the old config is the one safe thing left
+	}
+	pthread_mutex_unlock(&pDomain->aWriterMutex);
+	DKBConfigReclaim(pDomain);
+
+}
+
+size_t DKBConfigReclaim(DKBConfigDomain *pDomain) {
+
+	pthread_mutex_lock(&pDomain->aWriterMutex);
+	uint64_t nSafeEpoch = UINT64_MAX; // every reader has passed a quiescent point in it or later
+	int nReaderCount = __atomic_load_n(&pDomain->nReaderCount, __ATOMIC_ACQUIRE);
+	int i;
+	for(i = 0; i < nReaderCount; i++) {
+		uint64_t nEpoch = __atomic_load_n(&pDomain->aReaders[i].nQuiescentEpoch, __ATOMIC_ACQUIRE);
+		if(nEpoch < nSafeEpoch)
+			nSafeEpoch = nEpoch;
+	}
+	size_t nPendingCount = 0;
+	DKBConfigRetired **ppLink = &pDomain->pRetired;
+	while(*ppLink != NULL) {
+		DKBConfigRetired *pRetired = *ppLink;
+		if(pRetired->nEpoch > nSafeEpoch) {
+			ppLink = &pRetired->pNext;
+			nPendingCount++;
+			continue;
+		}
+		*ppLink = pRetired->pNext;
+		DKBConfigDestroy(pRetired->pConfig);
+		free(pRetired);
+		pDomain->nReclaimedCount++;
+	}
+	pthread_mutex_unlock(&pDomain->aWriterMutex);
+	return nPendingCount;
+
+}
+
+static uint64_t FromMilliseconds(const DKBClock *pClock, double fMilliseconds) {
+
+	return DKBClockFromNanoseconds(pClock, (uint64_t)(fMilliseconds * 1000000.0));
+
+}
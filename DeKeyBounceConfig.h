@@ -0,0 +1,133 @@
+/*
+ * DeKeyBounce
+ * Run-time settings published to the filter threads without locks.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_CONFIG_H
+#define DEKEYBOUNCE_CONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "DeKeyBounceClock.h"
+#include "DeKeyBounceEngine.h"
+
+/*
+ * A DKBConfig is never changed once published: a writer builds a new one
+ * and swaps the pointer of the domain. A filter thread loads that pointer
+ * with one acquire load at the start of a batch and reports a quiescent
+ * point at its end (quiescent-state-based reclamation). A replaced config
+ * is freed once every reader has passed a quiescent point after the swap,
+ * so a reader which is blocked waiting for input only delays freeing,
+ * never the writers. Writers are serialized by a mutex the filter threads
+ * never take.
+ *
+ * The file read by DKBConfigParse has one setting per line, # starts a
+ * comment:
+ *   threshold <ms>            the minimum time between a key-up and a key-down
+ *   key <code> <ms>           a threshold of one key code
+ *   device <name prefix> <ms> a threshold of the devices whose name starts so
+ *   app <name prefix> <ms>    a threshold of the key events going to the processes named so,
+ *                             in place of the threshold and key lines
+ *   alert <percent>           the bounce rate to raise a key alert at
+ *   hold <ms>                 the minimum time between a key-down and a key-up, 0 for none
+ */
+
+#define DKB_CONFIG_MAX_READER_COUNT 16
+#define DKB_CONFIG_MAX_DEVICE_COUNT 32
+#define DKB_CONFIG_MAX_APP_COUNT 32
+
+typedef struct _DKBDeviceConfig {
+
+	char aNamePrefix[64];
+	uint64_t nMinTimestampDiff;
+
+} DKBDeviceConfig;
+
+typedef struct _DKBAppConfig {
+
+	char aNamePrefix[64];
+	uint64_t nMinTimestampDiff;
+
+} DKBAppConfig;
+
+typedef struct _DKBConfig {
+
+	uint64_t nGeneration; /* set by DKBConfigPublish, unique for the domain */
+	uint64_t nMinTimestampDiff; /* in ticks */
+	uint64_t nMinHoldDiff; /* in ticks, 0 for no hold window */
+	uint16_t nAlertBounceRate; /* DKB_RATE_ONE based */
+	int hasKeyMinTimestampDiffs;
+	int nDeviceCount;
+	DKBDeviceConfig aDevices[DKB_CONFIG_MAX_DEVICE_COUNT];
+	int nAppCount;
+	DKBAppConfig aApps[DKB_CONFIG_MAX_APP_COUNT]; /* indexed by the profiles of DeKeyBounceProfile */
+	uint64_t aKeyMinTimestampDiffs[DKB_KEY_CODE_COUNT]; /* in ticks, 0 where the key has none of its own */
+
+} DKBConfig;
+
+typedef struct _DKBConfigReader {
+
+	uint64_t nQuiescentEpoch; /* the epoch of the domain seen at the last quiescent point */
+
+} __attribute__((aligned(64))) DKBConfigReader;
+
+typedef struct _DKBConfigRetired DKBConfigRetired;
+
+typedef struct _DKBConfigDomain {
+
+	DKBConfig *pCurrent;
+	uint64_t nEpoch; /* advanced by every publication */
+	int nReaderCount;
+	DKBConfigReader aReaders[DKB_CONFIG_MAX_READER_COUNT];
+	pthread_mutex_t aWriterMutex;
+	DKBConfigRetired *pRetired; /* replaced configs not freed yet, newest first */
+	uint64_t nGeneration;
+	uint64_t nReclaimedCount;
+
+} DKBConfigDomain;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+DKBConfig *DKBConfigCreate(const DKBConfig *pBase, uint64_t nMinTimestampDiff, uint16_t nAlertBounceRate);
+void DKBConfigDestroy(DKBConfig *pConfig);
+int DKBConfigParse(DKBConfig *pConfig, const char *pPath, const DKBClock *pClock, char *pError, size_t nErrorSize);
+uint64_t DKBConfigGetDeviceMinTimestampDiff(const DKBConfig *pConfig, const char *pDeviceName);
+int DKBConfigFindApp(const DKBConfig *pConfig, const char *pProcessName);
+
+int DKBConfigDomainInit(DKBConfigDomain *pDomain, DKBConfig *pConfig);
+void DKBConfigDomainDeinit(DKBConfigDomain *pDomain);
+DKBConfigReader *DKBConfigAddReader(DKBConfigDomain *pDomain);
+const DKBConfig *DKBConfigAcquire(DKBConfigDomain *pDomain);
+void DKBConfigQuiesce(DKBConfigDomain *pDomain, DKBConfigReader *pReader);
+void DKBConfigPublish(DKBConfigDomain *pDomain, DKBConfig *pConfig);
+size_t DKBConfigReclaim(DKBConfigDomain *pDomain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_CONFIG_H */
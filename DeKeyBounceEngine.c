@@ -0,0 +1,417 @@
+/*
+ * DeKeyBounce
+ * The debounce engine shared by the daemon and the trace tools.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceEngine.h"
+#include "DeKeyBounceCompact.h"
+#include "DeKeyBounceProbes.h"
+
+#include <string.h>
+
+#define FAST_RATE_SHIFT 6 /* the two fill the 16 bits of DKBKeyHealth.nBounceRateFractions */
+#define SLOW_RATE_SHIFT 10
+#define FAST_RATE_MASK ((1U << FAST_RATE_SHIFT) - 1)
+#define QUANTILE_STEP_SHIFT 6
+#define COMPACT_CHUNK_COUNT 256 /* events judged before they are compacted, the mask stays on the stack */
+
+static int IsKeyUpDeferred(uint64_t nLastTimestamp);
+static uint64_t GetReleaseTime(const DKBEngine *pEngine, uint64_t nLastTimestamp);
+static void ReleaseKey(DKBEngine *pEngine, DKBKeyState *pKeyState, uint64_t nReleaseTime);
+static void CountEvent(uint32_t *pCount);
+static void CountBounce(const DKBEngine *pEngine, DKBKeyCounters *pCounters, uint64_t nInterval);
+static void TrackPress(const DKBEngine *pEngine, DKBKeyHealth *pHealth, int isBounce, uint64_t nInterval);
+static uint32_t StepQuantile(uint32_t nQuantile, uint32_t nValue, uint32_t nUpWeight);
+static int GetLog2(uint64_t nValue);
+
+void DKBEngineInit(DKBEngine *pEngine, uint64_t nMinTimestampDiff) {
+
+	DKBEngineSetMinTimestampDiff(pEngine, nMinTimestampDiff);
+	DKBEngineSetIntervalBase(pEngine, nMinTimestampDiff);
+	pEngine->nMinHoldDiff = 0;
+	pEngine->nAlertBounceRate = DKB_DEFAULT_ALERT_BOUNCE_RATE;
+	pEngine->nDeferredCount = 0;
+	pEngine->pKeyMinTimestampDiffs = NULL;
+	int i;
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+		pEngine->aKeyStates[i].nLastTimestamp = DKB_TIMESTAMP_UNSEEN;
+		memset(&pEngine->aKeyStates[i].aCounters, 0, sizeof(DKBKeyCounters));
+		memset(&pEngine->aKeyStates[i].aHealth, 0, sizeof(DKBKeyHealth));
+	}
+
+}
+
+void DKBEngineResume(DKBEngine *pEngine, int isSameBoot) {
+
+	// The bounces swallowed by the previous process went through while it was
+	// gone, and the timestamps of another boot are not comparable with ours.
+	// A key held then may have been released since. The per-key thresholds
+	// it pointed to are gone with it, and so are the key-ups it deferred.
+	pEngine->pKeyMinTimestampDiffs = NULL;
+	pEngine->nDeferredCount = 0;
+	int i;
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+		uint64_t nLastTimestamp = pEngine->aKeyStates[i].nLastTimestamp;
+		if(!isSameBoot || nLastTimestamp == 0 || (nLastTimestamp & DKB_TIMESTAMP_KEY_DOWN))
+			pEngine->aKeyStates[i].nLastTimestamp = DKB_TIMESTAMP_UNSEEN;
+	}
+
+}
+
+void DKBEngineSetMinTimestampDiff(DKBEngine *pEngine, uint64_t nMinTimestampDiff) {
+
+	pEngine->nMinTimestampDiff = nMinTimestampDiff;
+
+}
+
+void DKBEngineSetIntervalBase(DKBEngine *pEngine, uint64_t nIntervalBase) {
+
+	// the last bucket ends at the base, each one before it at half of the next; a threshold
+	// swapped in for an app leaves them be, so the counts of all the apps share their bounds
+	pEngine->nIntervalBase = nIntervalBase;
+	pEngine->nIntervalShift = GetLog2(nIntervalBase) - (DKB_INTERVAL_BUCKET_COUNT - 1);
+
+}
+
+uint64_t DKBEngineGetIntervalBound(const DKBEngine *pEngine, int nBucket) {
+
+	// the upper bound of a bucket, exclusive
+	if(nBucket >= DKB_INTERVAL_BUCKET_COUNT - 1)
+		return pEngine->nIntervalBase;
+	int nShift = pEngine->nIntervalShift + nBucket + 1;
+	return (nShift > 0) ? (1ULL << nShift) : 1;
+
+}
+
+void DKBEngineSetAlertBounceRate(DKBEngine *pEngine, uint16_t nAlertBounceRate) {
+
+	pEngine->nAlertBounceRate = nAlertBounceRate;
+
+}
+
+void DKBEngineSetMinHoldDiff(DKBEngine *pEngine, uint64_t nMinHoldDiff) {
+
+	pEngine->nMinHoldDiff = nMinHoldDiff;
+
+}
+
+void DKBEngineSetKeyMinTimestampDiffs(DKBEngine *pEngine, const uint64_t *pKeyMinTimestampDiffs) {
+
+	pEngine->pKeyMinTimestampDiffs = pKeyMinTimestampDiffs;
+
+}
+
+int DKBEngineFilterEvent(DKBEngine *pEngine, const DKBEvent *pEvent) {
+
+	DEKEYBOUNCE_EVENT(pEvent->nKeyCode, pEvent->nType, pEvent->nTimestamp, pEvent->nDevice);
+	if(pEvent->nKeyCode >= DKB_KEY_CODE_COUNT) {
+		DEKEYBOUNCE_PASS(pEvent->nKeyCode, pEvent->nType, pEvent->nTimestamp);
+		return DKB_VERDICT_PASS; // not a key we keep track of
+	}
+	DKBKeyState *pKeyState = &pEngine->aKeyStates[pEvent->nKeyCode];
+	uint64_t nLastTimestamp = pKeyState->nLastTimestamp;
+	int nVerdict = DKB_VERDICT_PASS;
+	int nDropReason = 0; // for the probes only
+	uint64_t nDropInterval = 0;
+	int isDeferred = 0;
+	if(IsKeyUpDeferred(nLastTimestamp) && pEvent->nTimestamp >= GetReleaseTime(pEngine, nLastTimestamp)) {
+		// the deferred key-up came due before this event, released or not
+		nLastTimestamp = GetReleaseTime(pEngine, nLastTimestamp);
+		ReleaseKey(pEngine, pKeyState, nLastTimestamp);
+	}
+
+	switch(pEvent->nType) {
+
+	case DKB_EVENT_KEY_DOWN:
+		if(nLastTimestamp == DKB_TIMESTAMP_UNSEEN) {
+			DEKEYBOUNCE_KEY_INSERT(pEvent->nKeyCode, pEvent->nTimestamp);
+			TrackPress(pEngine, &pKeyState->aHealth, 0, 0);
+			pKeyState->nLastTimestamp = pEvent->nTimestamp | DKB_TIMESTAMP_KEY_DOWN;
+			break;
+		}
+		if(nLastTimestamp & DKB_TIMESTAMP_KEY_DOWN) {
+			if(nLastTimestamp & DKB_TIMESTAMP_PRESS_BOUNCE) { // the contact closing again, the deferred key-up goes too
+				CountEvent(&pKeyState->aCounters.nPressDropCount);
+				CountEvent(&pKeyState->aCounters.nPressDropCount);
+				CountEvent(&pKeyState->aCounters.nDropCount);
+				pEngine->nDeferredCount--;
+				pKeyState->nLastTimestamp = nLastTimestamp & ~DKB_TIMESTAMP_PRESS_BOUNCE;
+				nVerdict = DKB_VERDICT_DROP;
+				nDropReason = DKB_DROP_PRESS_BOUNCE;
+				break;
+			}
+			break; // held, an autorepeat or a lost key-up, not a press to count in the health
+		}
+		if(nLastTimestamp == 0) {
+			nVerdict = DKB_VERDICT_DROP;
+			nDropReason = DKB_DROP_SWALLOWING;
+			break;
+		}
+		uint64_t nMinTimestampDiff = pEngine->nMinTimestampDiff;
+		if(pEngine->pKeyMinTimestampDiffs != NULL && pEngine->pKeyMinTimestampDiffs[pEvent->nKeyCode] != 0)
+			nMinTimestampDiff = pEngine->pKeyMinTimestampDiffs[pEvent->nKeyCode];
+		if(pEvent->nTimestamp < (nLastTimestamp + nMinTimestampDiff)) {
+			uint64_t nInterval = pEvent->nTimestamp - nLastTimestamp;
+			CountBounce(pEngine, &pKeyState->aCounters, nInterval);
+			TrackPress(pEngine, &pKeyState->aHealth, 1, nInterval);
+			pKeyState->nLastTimestamp = 0;
+			nVerdict = DKB_VERDICT_DROP;
+			nDropReason = DKB_DROP_RELEASE_WINDOW;
+			nDropInterval = nInterval;
+			break;
+		}
+		TrackPress(pEngine, &pKeyState->aHealth, 0, 0);
+		pKeyState->nLastTimestamp = pEvent->nTimestamp | DKB_TIMESTAMP_KEY_DOWN;
+		break;
+
+	case DKB_EVENT_KEY_UP:
+		if(nLastTimestamp == 0) {
+			pKeyState->nLastTimestamp = pEvent->nTimestamp;
+			nVerdict = DKB_VERDICT_DROP;
+			nDropReason = DKB_DROP_SWALLOWING;
+			break;
+		}
+		if(IsKeyUpDeferred(nLastTimestamp)) { // one key-up is due already
+			CountEvent(&pKeyState->aCounters.nPressDropCount);
+			nVerdict = DKB_VERDICT_DROP;
+			nDropReason = DKB_DROP_HOLD_WINDOW;
+			nDropInterval = pEvent->nTimestamp - (nLastTimestamp & DKB_TIMESTAMP_MASK);
+			break;
+		}
+		if(nLastTimestamp != DKB_TIMESTAMP_UNSEEN && (nLastTimestamp & DKB_TIMESTAMP_KEY_DOWN)
+			&& pEvent->nTimestamp < (nLastTimestamp & DKB_TIMESTAMP_MASK) + pEngine->nMinHoldDiff) {
+			pKeyState->nLastTimestamp = nLastTimestamp | DKB_TIMESTAMP_PRESS_BOUNCE;
+			pEngine->nDeferredCount++;
+			isDeferred = 1; // counted when it is released or cancelled
+			nVerdict = DKB_VERDICT_DROP;
+			nDropReason = DKB_DROP_HOLD_WINDOW;
+			nDropInterval = pEvent->nTimestamp - (nLastTimestamp & DKB_TIMESTAMP_MASK);
+			break;
+		}
+		if(nLastTimestamp == DKB_TIMESTAMP_UNSEEN)
+			DEKEYBOUNCE_KEY_INSERT(pEvent->nKeyCode, pEvent->nTimestamp);
+		pKeyState->nLastTimestamp = pEvent->nTimestamp;
+		break;
+
+	}
+	if(nVerdict == DKB_VERDICT_DROP) {
+		if(!isDeferred)
+			CountEvent(&pKeyState->aCounters.nDropCount);
+		DEKEYBOUNCE_DROP(pEvent->nKeyCode, pEvent->nType, nDropReason, nDropInterval);
+	} else {
+		CountEvent(&pKeyState->aCounters.nPassCount);
+		DEKEYBOUNCE_PASS(pEvent->nKeyCode, pEvent->nType, pEvent->nTimestamp);
+	}
+	return nVerdict;
+
+}
+
+void DKBEngineTrackEvent(DKBEngine *pEngine, const DKBEvent *pEvent) {
+
+	// an event let through unjudged (see DeKeyBounceBreaker.h): the key state follows it, so the filter
+	// takes over where the key really is, and neither the counters nor the health are touched
+	if(pEvent->nKeyCode >= DKB_KEY_CODE_COUNT)
+		return;
+	DKBKeyState *pKeyState = &pEngine->aKeyStates[pEvent->nKeyCode];
+	if(IsKeyUpDeferred(pKeyState->nLastTimestamp))
+		pEngine->nDeferredCount--; // superseded, neither released nor counted
+	if(pEvent->nType == DKB_EVENT_KEY_DOWN)
+		pKeyState->nLastTimestamp = pEvent->nTimestamp | DKB_TIMESTAMP_KEY_DOWN;
+	else
+		pKeyState->nLastTimestamp = pEvent->nTimestamp;
+
+}
+
+size_t DKBEngineFilter(DKBEngine *pEngine, const DKBEvent *pEvents, size_t nCount, uint64_t *pDropMask) {
+
+	size_t nDropCount = 0;
+	size_t nWord;
+	for(nWord = 0; nWord < DKB_DROP_MASK_SIZE(nCount); nWord++) {
+		size_t nBase = nWord * 64;
+		size_t nEnd = (nCount - nBase < 64) ? nCount - nBase : 64;
+		uint64_t nMask = 0;
+		size_t i;
+		for(i = 0; i < nEnd; i++)
+			nMask |= (uint64_t)DKBEngineFilterEvent(pEngine, &pEvents[nBase + i]) << i; // DKB_VERDICT_DROP is 1
+		pDropMask[nWord] = nMask;
+		nDropCount += __builtin_popcountll(nMask);
+	}
+	return nDropCount;
+
+}
+
+size_t DKBEngineFilterInPlace(DKBEngine *pEngine, DKBEvent *pEvents, size_t nCount) {
+
+	// judging and moving are apart, so the moving goes through DKBCompact
+	uint64_t aDropMask[DKB_DROP_MASK_SIZE(COMPACT_CHUNK_COUNT)];
+	size_t nPassCount = 0;
+	size_t i;
+	for(i = 0; i < nCount; i += COMPACT_CHUNK_COUNT) {
+		size_t nChunkCount = (nCount - i < COMPACT_CHUNK_COUNT) ? nCount - i : COMPACT_CHUNK_COUNT;
+		if(DKBEngineFilter(pEngine, &pEvents[i], nChunkCount, aDropMask) == 0 && nPassCount == i) {
+			nPassCount += nChunkCount; // nothing to move
+			continue;
+		}
+		nPassCount += DKBCompact(&pEvents[nPassCount], &pEvents[i], sizeof(DKBEvent), nChunkCount, aDropMask);
+	}
+	return nPassCount;
+
+}
+
+size_t DKBEngineReleaseKeys(DKBEngine *pEngine, uint64_t nNow, DKBEvent *pEvents, size_t nCapacity, uint64_t *pNextTime) {
+
+	*pNextTime = 0;
+	size_t nReleaseCount = 0;
+	int i;
+	for(i = 0; i < DKB_KEY_CODE_COUNT && pEngine->nDeferredCount != 0; i++) {
+		DKBKeyState *pKeyState = &pEngine->aKeyStates[i];
+		if(!IsKeyUpDeferred(pKeyState->nLastTimestamp))
+			continue;
+		uint64_t nReleaseTime = GetReleaseTime(pEngine, pKeyState->nLastTimestamp);
+		if(nReleaseTime > nNow || nReleaseCount == nCapacity) {
+			uint64_t nNextTime = (nReleaseTime > nNow) ? nReleaseTime : nNow;
+			if(*pNextTime == 0 || nNextTime < *pNextTime)
+				*pNextTime = nNextTime;
+			continue;
+		}
+		ReleaseKey(pEngine, pKeyState, nReleaseTime);
+		DKBEvent *pEvent = &pEvents[nReleaseCount++];
+		memset(pEvent, 0, sizeof(DKBEvent));
+		pEvent->nTimestamp = nReleaseTime;
+		pEvent->nKeyCode = i;
+		pEvent->nType = DKB_EVENT_KEY_UP;
+		DEKEYBOUNCE_PASS(i, DKB_EVENT_KEY_UP, nReleaseTime);
+	}
+	return nReleaseCount;
+
+}
+
+static int IsKeyUpDeferred(uint64_t nLastTimestamp) {
+
+	return nLastTimestamp != DKB_TIMESTAMP_UNSEEN
+		&& (nLastTimestamp & (DKB_TIMESTAMP_KEY_DOWN | DKB_TIMESTAMP_PRESS_BOUNCE)) == (DKB_TIMESTAMP_KEY_DOWN | DKB_TIMESTAMP_PRESS_BOUNCE);
+
+}
+
+static uint64_t GetReleaseTime(const DKBEngine *pEngine, uint64_t nLastTimestamp) {
+
+	return (nLastTimestamp & DKB_TIMESTAMP_MASK) + pEngine->nMinHoldDiff;
+
+}
+
+static void ReleaseKey(DKBEngine *pEngine, DKBKeyState *pKeyState, uint64_t nReleaseTime) {
+
+	pKeyState->nLastTimestamp = nReleaseTime;
+	pEngine->nDeferredCount--;
+	CountEvent(&pKeyState->aCounters.nPassCount);
+
+}
+
+static void CountEvent(uint32_t *pCount) {
+
+	__atomic_store_n(pCount, *pCount + 1, __ATOMIC_RELAXED); // the only writer, readers just need whole values
+
+}
+
+static void CountBounce(const DKBEngine *pEngine, DKBKeyCounters *pCounters, uint64_t nInterval) {
+
+	int nBucket = GetLog2(nInterval) - pEngine->nIntervalShift;
+	if(nBucket < 0)
+		nBucket = 0;
+	else if(nBucket > DKB_INTERVAL_BUCKET_COUNT - 1)
+		nBucket = DKB_INTERVAL_BUCKET_COUNT - 1;
+	CountEvent(&pCounters->nBounceCount);
+	__atomic_store_n(&pCounters->aIntervalCounts[nBucket], (uint16_t)(pCounters->aIntervalCounts[nBucket] + 1), __ATOMIC_RELAXED);
+	__atomic_store_n(&pCounters->nIntervalSum, pCounters->nIntervalSum + nInterval, __ATOMIC_RELAXED);
+
+}
+
+static void TrackPress(const DKBEngine *pEngine, DKBKeyHealth *pHealth, int isBounce, uint64_t nInterval) {
+
+	DKBKeyHealth aHealth = *pHealth;
+	// the averages in 0.22 and 0.26 fixed point, so a step is never rounded to nothing above a rate of 1/65535
+	uint32_t nFastRate = ((uint32_t)aHealth.nFastBounceRate << FAST_RATE_SHIFT) | (aHealth.nBounceRateFractions & FAST_RATE_MASK);
+	uint32_t nSlowRate = ((uint32_t)aHealth.nSlowBounceRate << SLOW_RATE_SHIFT) | (aHealth.nBounceRateFractions >> FAST_RATE_SHIFT);
+	if(isBounce) {
+		nFastRate += (((uint32_t)DKB_RATE_ONE << FAST_RATE_SHIFT) - nFastRate) >> FAST_RATE_SHIFT;
+		nSlowRate += (((uint32_t)DKB_RATE_ONE << SLOW_RATE_SHIFT) - nSlowRate) >> SLOW_RATE_SHIFT;
+		uint32_t nValue = (nInterval < UINT32_MAX) ? (uint32_t)nInterval : UINT32_MAX;
+		if(aHealth.nIntervalMedian == 0) {
+			aHealth.nIntervalMedian = nValue;
+			aHealth.nIntervalHigh = nValue;
+		} else {
+			aHealth.nIntervalMedian = StepQuantile(aHealth.nIntervalMedian, nValue, 1);
+			aHealth.nIntervalHigh = StepQuantile(aHealth.nIntervalHigh, nValue, 9); // settles where 1 in 10 is above
+		}
+	} else {
+		nFastRate -= nFastRate >> FAST_RATE_SHIFT;
+		nSlowRate -= nSlowRate >> SLOW_RATE_SHIFT;
+	}
+	aHealth.nFastBounceRate = (uint16_t)(nFastRate >> FAST_RATE_SHIFT);
+	aHealth.nSlowBounceRate = (uint16_t)(nSlowRate >> SLOW_RATE_SHIFT);
+	aHealth.nBounceRateFractions = (uint16_t)(((nSlowRate & ((1U << SLOW_RATE_SHIFT) - 1)) << FAST_RATE_SHIFT) | (nFastRate & FAST_RATE_MASK));
+	if(aHealth.nPressCount < UINT8_MAX)
+		aHealth.nPressCount++;
+
+	if(aHealth.nPressCount >= DKB_HEALTH_WARMUP_PRESS_COUNT) {
+		uint32_t nFast = aHealth.nFastBounceRate, nSlow = aHealth.nSlowBounceRate, nAlert = pEngine->nAlertBounceRate;
+		if(nFast >= nAlert)
+			aHealth.nAlerts |= DKB_ALERT_BOUNCE_RATE;
+		else if(nFast < nAlert - nAlert / 4)
+			aHealth.nAlerts &= ~DKB_ALERT_BOUNCE_RATE;
+		if(nFast >= 2 * nSlow && nFast >= nAlert)
+			aHealth.nAlerts |= DKB_ALERT_RISING;
+		else if(nFast < nSlow + nSlow / 2 || nFast < nAlert / 2)
+			aHealth.nAlerts &= ~DKB_ALERT_RISING;
+	}
+
+	// the housekeeping reads these while we go on
+	__atomic_store_n(&pHealth->nIntervalMedian, aHealth.nIntervalMedian, __ATOMIC_RELAXED);
+	__atomic_store_n(&pHealth->nIntervalHigh, aHealth.nIntervalHigh, __ATOMIC_RELAXED);
+	__atomic_store_n(&pHealth->nFastBounceRate, aHealth.nFastBounceRate, __ATOMIC_RELAXED);
+	__atomic_store_n(&pHealth->nSlowBounceRate, aHealth.nSlowBounceRate, __ATOMIC_RELAXED);
+	pHealth->nBounceRateFractions = aHealth.nBounceRateFractions;
+	__atomic_store_n(&pHealth->nPressCount, aHealth.nPressCount, __ATOMIC_RELAXED);
+	__atomic_store_n(&pHealth->nAlerts, aHealth.nAlerts, __ATOMIC_RELAXED);
+
+}
+
+static uint32_t StepQuantile(uint32_t nQuantile, uint32_t nValue, uint32_t nUpWeight) {
+
+	// a step up nUpWeight times as big as a step down settles at the quantile 1 - 1 / (nUpWeight + 1)
+	uint32_t nStep = nQuantile >> QUANTILE_STEP_SHIFT;
+	if(nStep == 0)
+		nStep = 1;
+	if(nValue > nQuantile)
+		return (nQuantile < UINT32_MAX - nUpWeight * nStep) ? nQuantile + nUpWeight * nStep : UINT32_MAX;
+	if(nValue < nQuantile && nQuantile > nStep)
+		return nQuantile - nStep;
+	return nQuantile;
+
+}
+
+static int GetLog2(uint64_t nValue) {
+
+	return (nValue != 0) ? 63 - __builtin_clzll(nValue) : 0;
+
+}
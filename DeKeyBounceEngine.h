@@ -0,0 +1,193 @@
+/*
+ * DeKeyBounce
+ * The debounce engine shared by the daemon and the trace tools.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_ENGINE_H
+#define DEKEYBOUNCE_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DKB_KEY_CODE_COUNT 1024 /* enough for both CGKeyCode and evdev KEY_MAX */
+
+#define DKB_EVENT_KEY_DOWN 0
+#define DKB_EVENT_KEY_UP 1
+
+#define DKB_VERDICT_PASS 0
+#define DKB_VERDICT_DROP 1
+
+#define DKB_DROP_SWALLOWING 1 /* the state is the 0 sentinel, a release bounce goes on until its key-up */
+#define DKB_DROP_RELEASE_WINDOW 2 /* a key-down too soon after the key-up */
+#define DKB_DROP_HOLD_WINDOW 3 /* a key-up too soon after the key-down, deferred to the end of the window */
+#define DKB_DROP_PRESS_BOUNCE 4 /* a key-down before the deferred key-up was due, both are dropped */
+
+#define DKB_TIMESTAMP_UNSEEN UINT64_MAX /* no key-up was seen for this key yet */
+#define DKB_TIMESTAMP_KEY_DOWN (1ULL << 63) /* flags the timestamp of a passed key-down, the key is held */
+#define DKB_TIMESTAMP_PRESS_BOUNCE (1ULL << 62) /* with KEY_DOWN, a key-up inside the hold window is deferred */
+#define DKB_TIMESTAMP_MASK (DKB_TIMESTAMP_PRESS_BOUNCE - 1)
+
+#define DKB_INTERVAL_BUCKET_COUNT 8 /* bounce intervals by powers of 2 up to the base threshold */
+
+#define DKB_RATE_ONE 65535 /* bounce rates are fractions of the key-downs in 0.16 fixed point */
+#define DKB_DEFAULT_ALERT_BOUNCE_RATE (DKB_RATE_ONE / 20) /* 5% */
+#define DKB_HEALTH_WARMUP_PRESS_COUNT 64 /* key-downs before a key may raise an alert */
+
+#define DKB_ALERT_BOUNCE_RATE 0x1 /* the recent bounce rate is over the alert threshold */
+#define DKB_ALERT_RISING 0x2 /* the recent bounce rate is twice the long-term one */
+
+#define DKB_DROP_MASK_SIZE(nCount) (((nCount) + 63) / 64) /* uint64_t words of a drop mask for nCount events */
+
+typedef struct _DKBEvent {
+
+	uint64_t nTimestamp; /* in ticks of the event source */
+	uint16_t nKeyCode;
+	uint8_t nType; /* DKB_EVENT_KEY_DOWN or DKB_EVENT_KEY_UP */
+	uint8_t nDevice;
+	uint16_t nSession;
+	uint16_t nFlags;
+
+} DKBEvent;
+
+/*
+ * The counters share the cache line of the key state, so the filter
+ * updates them without touching any more memory. Only the thread running
+ * the engine writes them; others read them with relaxed atomic loads and
+ * keep their own totals (see DeKeyBounceStats), so the counts may wrap
+ * between two readings far apart, the 16-bit interval buckets the soonest.
+ */
+
+typedef struct _DKBKeyCounters {
+
+	uint64_t nIntervalSum; /* ticks from the key-up to the bouncing key-down */
+	uint32_t nPassCount;
+	uint32_t nDropCount;
+	uint32_t nBounceCount; /* key-downs which started swallowing a bounce */
+	uint32_t nPressDropCount; /* of nDropCount, the deferred key-ups cancelled by a key-down and those key-downs */
+	uint16_t aIntervalCounts[DKB_INTERVAL_BUCKET_COUNT];
+
+} DKBKeyCounters;
+
+/*
+ * The health of a switch is followed with a constant amount of work per
+ * key-down: two moving averages of the bounce rate, a fast one reacting
+ * within some 64 presses and a slow one over some 1024, and frugal
+ * streaming estimates of the median and the 90th percentile of the bounce
+ * interval, which step towards every new interval by 1/64 of themselves.
+ * The filter raises and clears the alert flags with some hysteresis.
+ * A step of 1/1024 of a 0.16 rate rounds to nothing below 1024/65535, so
+ * the averages keep 6 and 10 more bits below the rates others read, in
+ * nBounceRateFractions, the slow ones above the fast ones.
+ */
+
+typedef struct _DKBKeyHealth {
+
+	uint32_t nIntervalMedian; /* ticks */
+	uint32_t nIntervalHigh; /* ticks, the 90th percentile */
+	uint16_t nFastBounceRate; /* DKB_RATE_ONE based */
+	uint16_t nSlowBounceRate;
+	uint16_t nBounceRateFractions; /* of the filter only */
+	uint8_t nPressCount; /* saturated, for the warmup */
+	uint8_t nAlerts; /* DKB_ALERT_* */
+
+} DKBKeyHealth;
+
+/*
+ * A release bounce is a key-down too soon after the key-up, a press bounce
+ * a key-up too soon after the key-down (the hold window, off by default).
+ * One timestamp serves both: of the last passed key-up while the key is
+ * up, of the last passed key-down, flagged DKB_TIMESTAMP_KEY_DOWN, while
+ * it is held. A key-up inside the hold window is deferred, flagged
+ * DKB_TIMESTAMP_PRESS_BOUNCE: the key stays held and the key-up is due at
+ * the end of the window, unless the contact closes again before, when the
+ * key-up and the key-down are both dropped. A tap shorter than the window
+ * is only lengthened to it, a bounce on it is still swallowed.
+ */
+
+typedef struct _DKBKeyState {
+
+	uint64_t nLastTimestamp; /* 0 means that a release bounce is being swallowed */
+	DKBKeyCounters aCounters;
+	DKBKeyHealth aHealth;
+
+} __attribute__((aligned(64))) DKBKeyState;
+
+typedef struct _DKBEngine {
+
+	uint64_t nMinTimestampDiff; /* in the same ticks as DKBEvent.nTimestamp */
+	uint64_t nMinHoldDiff; /* the hold window, 0 for none */
+	uint64_t nIntervalBase; /* the bound of the last interval bucket, the base threshold of the config */
+	int nIntervalShift; /* log2 of the smallest interval bucket bound */
+	uint16_t nAlertBounceRate; /* DKB_RATE_ONE based */
+	uint32_t nDeferredCount; /* key-ups deferred in the hold window */
+	const uint64_t *pKeyMinTimestampDiffs; /* per key code, 0 for nMinTimestampDiff, NULL for none; owned by the caller */
+	DKBKeyState aKeyStates[DKB_KEY_CODE_COUNT];
+
+} DKBEngine;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void DKBEngineInit(DKBEngine *pEngine, uint64_t nMinTimestampDiff);
+void DKBEngineResume(DKBEngine *pEngine, int isSameBoot);
+void DKBEngineSetMinTimestampDiff(DKBEngine *pEngine, uint64_t nMinTimestampDiff);
+void DKBEngineSetIntervalBase(DKBEngine *pEngine, uint64_t nIntervalBase);
+uint64_t DKBEngineGetIntervalBound(const DKBEngine *pEngine, int nBucket);
+void DKBEngineSetAlertBounceRate(DKBEngine *pEngine, uint16_t nAlertBounceRate);
+void DKBEngineSetMinHoldDiff(DKBEngine *pEngine, uint64_t nMinHoldDiff);
+void DKBEngineSetKeyMinTimestampDiffs(DKBEngine *pEngine, const uint64_t *pKeyMinTimestampDiffs);
+int DKBEngineFilterEvent(DKBEngine *pEngine, const DKBEvent *pEvent);
+void DKBEngineTrackEvent(DKBEngine *pEngine, const DKBEvent *pEvent);
+
+/*
+ * The batch calls judge the events in order, as many DKBEngineFilterEvent
+ * calls would, and neither copy the events nor allocate. DKBEngineFilter
+ * sets bit i % 64 of pDropMask[i / 64] for every dropped event i and
+ * returns how many were dropped. DKBEngineFilterInPlace moves the passed
+ * events to the front of the array, keeping their order, and returns how
+ * many they are.
+ */
+
+size_t DKBEngineFilter(DKBEngine *pEngine, const DKBEvent *pEvents, size_t nCount, uint64_t *pDropMask);
+size_t DKBEngineFilterInPlace(DKBEngine *pEngine, DKBEvent *pEvents, size_t nCount);
+
+/*
+ * The deferred key-ups are the caller's to emit, as its clock reaches the
+ * end of their hold window. DKBEngineReleaseKeys writes up to nCapacity of
+ * those due by nNow to pEvents, stamped with the end of the window and
+ * with nDevice and nSession left 0, counts them as passed and returns how
+ * many it wrote; *pNextTime gets when the next one is due, nNow if more
+ * are due than fit, 0 if none is deferred. It only scans the keys while
+ * nDeferredCount is not 0. A caller which never releases them, as the
+ * trace tools, gets them counted as passed all the same when the next
+ * event of the key comes after the window.
+ */
+
+size_t DKBEngineReleaseKeys(DKBEngine *pEngine, uint64_t nNow, DKBEvent *pEvents, size_t nCapacity, uint64_t *pNextTime);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_ENGINE_H */
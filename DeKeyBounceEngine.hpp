@@ -0,0 +1,103 @@
+/*
+ * DeKeyBounce
+ * The debounce engine for C++ callers, over the C API of libDeKeyBounce.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_ENGINE_HPP
+#define DEKEYBOUNCE_ENGINE_HPP
+
+#if __cplusplus < 202002L
+#error "DeKeyBounceEngine.hpp needs C++20, use DeKeyBounceEngine.h from older C++"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "DeKeyBounceEngine.h"
+
+/*
+ * A thin C++20 face of DKBEngine: the calls take spans over the caller's
+ * events and go straight to the batch functions, no copy and no
+ * allocation. The engine is big (a cache line per key code), so it is
+ * neither copied nor moved; keep it where it is made, on the heap or in
+ * a static.
+ */
+
+namespace DKB {
+
+using Event = DKBEvent;
+
+class Engine {
+
+public:
+
+	explicit Engine(std::uint64_t nMinTimestampDiff) { DKBEngineInit(&aEngine, nMinTimestampDiff); }
+	Engine(const Engine &) = delete;
+	Engine &operator=(const Engine &) = delete;
+
+	void SetMinTimestampDiff(std::uint64_t nMinTimestampDiff) { DKBEngineSetMinTimestampDiff(&aEngine, nMinTimestampDiff); }
+	void SetIntervalBase(std::uint64_t nIntervalBase) { DKBEngineSetIntervalBase(&aEngine, nIntervalBase); }
+	void SetAlertBounceRate(std::uint16_t nAlertBounceRate) { DKBEngineSetAlertBounceRate(&aEngine, nAlertBounceRate); }
+	void SetMinHoldDiff(std::uint64_t nMinHoldDiff) { DKBEngineSetMinHoldDiff(&aEngine, nMinHoldDiff); }
+
+	int FilterEvent(const Event &aEvent) { return DKBEngineFilterEvent(&aEngine, &aEvent); }
+	void TrackEvent(const Event &aEvent) { DKBEngineTrackEvent(&aEngine, &aEvent); }
+
+	// aDropMask needs DKB_DROP_MASK_SIZE(aEvents.size()) words, returns the drop count
+	std::size_t Filter(std::span<const Event> aEvents, std::span<std::uint64_t> aDropMask) {
+
+		if(aDropMask.size() < DKB_DROP_MASK_SIZE(aEvents.size()))
+			aEvents = aEvents.first(aDropMask.size() * 64); // judge what the mask can take
+		return DKBEngineFilter(&aEngine, aEvents.data(), aEvents.size(), aDropMask.data());
+
+	}
+
+	// shrinks aEvents to the passed ones, moved to its front
+	void FilterInPlace(std::span<Event> &aEvents) {
+
+		aEvents = aEvents.first(DKBEngineFilterInPlace(&aEngine, aEvents.data(), aEvents.size()));
+
+	}
+
+	// shrinks aReleases to the deferred key-ups due by nNow, returns when the next one is due, 0 for none
+	std::uint64_t ReleaseKeys(std::uint64_t nNow, std::span<Event> &aReleases) {
+
+		std::uint64_t nNextTime;
+		aReleases = aReleases.first(DKBEngineReleaseKeys(&aEngine, nNow, aReleases.data(), aReleases.size(), &nNextTime));
+		return nNextTime;
+
+	}
+
+	DKBEngine *Get() { return &aEngine; } // for the rest of the C API, DeKeyBounceStats and the like
+	const DKBEngine *Get() const { return &aEngine; }
+
+private:
+
+	DKBEngine aEngine;
+
+};
+
+} // namespace DKB
+
+#endif /* DEKEYBOUNCE_ENGINE_HPP */
@@ -0,0 +1,722 @@
+/*
+ * DeKeyBounce
+ * The Linux event loop: epoll with read/write or io_uring.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceIO.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "DeKeyBounceMemory.h"
+
+#define MAX_READY_COUNT 64
+#define RING_ENTRY_COUNT 256
+#define BUFFER_COUNT 256 /* a power of 2 */
+#define BUFFER_GROUP 0
+#define SQPOLL_IDLE 1000 /* ms before the kernel submission thread sleeps */
+#define SINK_WAIT 10 /* ms to wait for a sink refusing a write before the batch is lost */
+
+#define IORING_OP_READ_MULTISHOT_ 49 /* IORING_OP_READ_MULTISHOT of Linux 6.7, older headers lack it */
+
+// the tag of a request is kept in the low bits of its user_data, objects are 8 bytes aligned at least
+#define KIND_WATCH 0
+#define KIND_SOURCE 1
+#define KIND_SINK 2
+#define KIND_WRITE 3
+#define KIND_CANCEL 4
+#define KIND_MASK 7
+
+typedef struct _DKBIOWatch DKBIOWatch;
+
+typedef struct _Tag {
+
+	int nKind;
+	void *pObject;
+
+} Tag;
+
+struct _DKBIOWatch {
+
+	int nFile;
+	DKBIOReadyCallBack pReady;
+	void *pInfo;
+	Tag aTag;
+	DKBIOWatch *pNext;
+
+};
+
+struct _DKBIOChannel {
+
+	int nSourceFile;
+	int nSinkFile;
+	DKBIOFilterCallBack pFilter;
+	DKBIOReadyCallBack pSinkReady;
+	DKBIOClosedCallBack pClosed;
+	void *pInfo;
+	int isRemoved;
+	int nArmedCount; // multishot requests the kernel still holds
+	Tag aSourceTag;
+	Tag aSinkTag;
+	DKBIOChannel *pNext;
+
+};
+
+struct _DKBIOLoop {
+
+	int nBackend;
+	int isPolling;
+	volatile int isStopping;
+	uint64_t nSyscallCount;
+	uint64_t nLostWriteCount; // batches the sink did not take whole
+	uint64_t nLostSize; // bytes of them it did not take
+	DKBIOWatch *pWatches;
+	DKBIOChannel *pChannels;
+	DKBIOChannel *pRemovedChannels;
+
+	int nEpollFile;
+	char aReadBuffer[DKB_IO_BATCH_SIZE];
+
+	int nRingFile;
+	void *pSqRing;
+	size_t nSqRingSize;
+	void *pCqRing;
+	size_t nCqRingSize;
+	struct io_uring_sqe *pSqes;
+	size_t nSqesSize;
+	unsigned *pSqHead;
+	unsigned *pSqTail;
+	unsigned *pSqFlags;
+	unsigned *pSqArray;
+	unsigned nSqMask;
+	unsigned nSqEntries;
+	unsigned nSqLocalTail;
+	unsigned nSqSubmittedTail;
+	unsigned *pCqHead;
+	unsigned *pCqTail;
+	unsigned nCqMask;
+	struct io_uring_cqe *pCqes;
+	char *pBuffers;
+	struct io_uring_buf_ring *pBufferRing;
+	unsigned short nBufferTail;
+	DKBIOChannel *pLastWriteChannel;
+	unsigned nLastWriteTail;
+
+};
+
+static int InitEpoll(DKBIOLoop *pLoop);
+static int RunEpoll(DKBIOLoop *pLoop);
+static void DrainSource(DKBIOLoop *pLoop, DKBIOChannel *pChannel);
+static void WriteSink(DKBIOLoop *pLoop, DKBIOChannel *pChannel, size_t nSize);
+
+static int InitUring(DKBIOLoop *pLoop);
+static void DeinitUring(DKBIOLoop *pLoop);
+static int RunUring(DKBIOLoop *pLoop);
+static void HandleCompletion(DKBIOLoop *pLoop, const struct io_uring_cqe *pCqe);
+static struct io_uring_sqe *GetSqe(DKBIOLoop *pLoop);
+static int Enter(DKBIOLoop *pLoop, unsigned nWaitCount);
+static void ArmSourceRead(DKBIOLoop *pLoop, DKBIOChannel *pChannel);
+static void ArmPoll(DKBIOLoop *pLoop, int nFile, uint64_t nUserData);
+static void QueueWrite(DKBIOLoop *pLoop, DKBIOChannel *pChannel, unsigned nBufferId, size_t nSize);
+static void RecycleBuffer(DKBIOLoop *pLoop, unsigned nBufferId);
+
+static void FreeRemovedChannels(DKBIOLoop *pLoop);
+
+DKBIOLoop *DKBIOLoopCreate(int nBackend, int isPolling) {
+
+	DKBIOLoop *pLoop = calloc(1, sizeof(DKBIOLoop));
+	if(pLoop == NULL)
+		return NULL;
+	pLoop->nBackend = nBackend;
+	pLoop->isPolling = isPolling;
+	pLoop->nEpollFile = -1;
+	pLoop->nRingFile = -1;
+	int nResult = (nBackend == DKB_IO_URING) ? InitUring(pLoop) : InitEpoll(pLoop);
+	if(nResult != 0) {
+		DKBIOLoopDestroy(pLoop);
+		return NULL;
+	}
+	return pLoop;
+
+}
+
+void DKBIOLoopDestroy(DKBIOLoop *pLoop) {
+
+	while(pLoop->pChannels != NULL)
+		DKBIOLoopRemoveChannel(pLoop, pLoop->pChannels);
+	if(pLoop->nRingFile >= 0) {
+		// closing the ring cancels what it still holds
+		DeinitUring(pLoop);
+	}
+	if(pLoop->nEpollFile >= 0)
+		close(pLoop->nEpollFile);
+	while(pLoop->pRemovedChannels != NULL) {
+		DKBIOChannel *pChannel = pLoop->pRemovedChannels;
+		pLoop->pRemovedChannels = pChannel->pNext;
+		free(pChannel);
+	}
+	while(pLoop->pWatches != NULL) {
+		DKBIOWatch *pWatch = pLoop->pWatches;
+		pLoop->pWatches = pWatch->pNext;
+		free(pWatch);
+	}
+	free(pLoop);
+
+}
+
+int DKBIOLoopGetBackend(const DKBIOLoop *pLoop) {
+
+	return pLoop->nBackend;
+
+}
+
+uint64_t DKBIOLoopGetSyscallCount(const DKBIOLoop *pLoop) {
+
+	return pLoop->nSyscallCount;
+
+}
+
+uint64_t DKBIOLoopGetLostWriteCount(const DKBIOLoop *pLoop, uint64_t *pLostSize) {
+
+	*pLostSize = pLoop->nLostSize;
+	return pLoop->nLostWriteCount;
+
+}
+
+int DKBIOLoopAddWatch(DKBIOLoop *pLoop, int nFile, DKBIOReadyCallBack pReady, void *pInfo) {
+
+	DKBIOWatch *pWatch;
+	if(posix_memalign((void **)&pWatch, 64, sizeof(DKBIOWatch)) != 0)
+		return -1;
+	pWatch->nFile = nFile;
+	pWatch->pReady = pReady;
+	pWatch->pInfo = pInfo;
+	pWatch->aTag.nKind = KIND_WATCH;
+	pWatch->aTag.pObject = pWatch;
+	if(pLoop->nBackend == DKB_IO_EPOLL) {
+		struct epoll_event aEvent;
+		aEvent.events = EPOLLIN;
+		aEvent.data.ptr = &pWatch->aTag;
+		if(epoll_ctl(pLoop->nEpollFile, EPOLL_CTL_ADD, nFile, &aEvent) != 0) {
+			free(pWatch);
+			return -1;
+		}
+	} else {
+		ArmPoll(pLoop, nFile, (uint64_t)(uintptr_t)pWatch | KIND_WATCH);
+	}
+	pWatch->pNext = pLoop->pWatches;
+	pLoop->pWatches = pWatch;
+	return 0;
+
+}
+
+DKBIOChannel *DKBIOLoopAddChannel(DKBIOLoop *pLoop, int nSourceFile, int nSinkFile, DKBIOFilterCallBack pFilter,
+	DKBIOReadyCallBack pSinkReady, DKBIOClosedCallBack pClosed, void *pInfo) {
+
+	DKBIOChannel *pChannel;
+	if(posix_memalign((void **)&pChannel, 64, sizeof(DKBIOChannel)) != 0)
+		return NULL;
+	memset(pChannel, 0, sizeof *pChannel);
+	pChannel->nSourceFile = nSourceFile;
+	pChannel->nSinkFile = nSinkFile;
+	pChannel->pFilter = pFilter;
+	pChannel->pSinkReady = pSinkReady;
+	pChannel->pClosed = pClosed;
+	pChannel->pInfo = pInfo;
+	pChannel->aSourceTag.nKind = KIND_SOURCE;
+	pChannel->aSourceTag.pObject = pChannel;
+	pChannel->aSinkTag.nKind = KIND_SINK;
+	pChannel->aSinkTag.pObject = pChannel;
+	if(pLoop->nBackend == DKB_IO_EPOLL) {
+		struct epoll_event aEvent;
+		aEvent.events = EPOLLIN;
+		aEvent.data.ptr = &pChannel->aSourceTag;
+		if(epoll_ctl(pLoop->nEpollFile, EPOLL_CTL_ADD, nSourceFile, &aEvent) != 0) {
+			free(pChannel);
+			return NULL;
+		}
+		aEvent.data.ptr = &pChannel->aSinkTag;
+		if(pSinkReady != NULL && epoll_ctl(pLoop->nEpollFile, EPOLL_CTL_ADD, nSinkFile, &aEvent) != 0) {
+			epoll_ctl(pLoop->nEpollFile, EPOLL_CTL_DEL, nSourceFile, NULL);
+			free(pChannel);
+			return NULL;
+		}
+	} else {
+		ArmSourceRead(pLoop, pChannel);
+		pChannel->nArmedCount++;
+		if(pSinkReady != NULL) {
+			ArmPoll(pLoop, nSinkFile, (uint64_t)(uintptr_t)pChannel | KIND_SINK);
+			pChannel->nArmedCount++;
+		}
+	}
+	pChannel->pNext = pLoop->pChannels;
+	pLoop->pChannels = pChannel;
+	return pChannel;
+
+}
+
+void DKBIOLoopRemoveChannel(DKBIOLoop *pLoop, DKBIOChannel *pChannel) {
+
+	// The channel stays allocated until the kernel and the batch being handled
+	// are done with it, the caller may close its descriptors right away.
+	if(pChannel->isRemoved)
+		return;
+	DKBIOChannel **ppLink = &pLoop->pChannels;
+	while(*ppLink != pChannel)
+		ppLink = &(*ppLink)->pNext;
+	*ppLink = pChannel->pNext;
+	pChannel->isRemoved = 1;
+	if(pLoop->nBackend == DKB_IO_EPOLL) {
+		if(pChannel->pSinkReady != NULL)
+			epoll_ctl(pLoop->nEpollFile, EPOLL_CTL_DEL, pChannel->nSinkFile, NULL);
+		epoll_ctl(pLoop->nEpollFile, EPOLL_CTL_DEL, pChannel->nSourceFile, NULL);
+	} else {
+		uint64_t aTargets[2] = { (uint64_t)(uintptr_t)pChannel | KIND_SOURCE, (uint64_t)(uintptr_t)pChannel | KIND_SINK };
+		int i;
+		for(i = 0; i < 2; i++) {
+			struct io_uring_sqe *pSqe = GetSqe(pLoop);
+			pSqe->opcode = IORING_OP_ASYNC_CANCEL;
+			pSqe->fd = -1;
+			pSqe->addr = aTargets[i];
+			pSqe->user_data = KIND_CANCEL;
+		}
+	}
+	pChannel->pNext = pLoop->pRemovedChannels;
+	pLoop->pRemovedChannels = pChannel;
+
+}
+
+int DKBIOLoopRun(DKBIOLoop *pLoop) {
+
+	pLoop->isStopping = 0;
+	return (pLoop->nBackend == DKB_IO_URING) ? RunUring(pLoop) : RunEpoll(pLoop);
+
+}
+
+void DKBIOLoopStop(DKBIOLoop *pLoop) {
+
+	pLoop->isStopping = 1;
+
+}
+
+static int InitEpoll(DKBIOLoop *pLoop) {
+
+	pLoop->nEpollFile = epoll_create1(EPOLL_CLOEXEC);
+	return (pLoop->nEpollFile >= 0) ? 0 : -1;
+
+}
+
+static int RunEpoll(DKBIOLoop *pLoop) {
+
+	struct epoll_event aReadyEvents[MAX_READY_COUNT];
+	while(!pLoop->isStopping) {
+		int nReadyCount = epoll_wait(pLoop->nEpollFile, aReadyEvents, MAX_READY_COUNT, -1);
+		pLoop->nSyscallCount++;
+		if(nReadyCount < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		int i;
+		for(i = 0; i < nReadyCount; i++) {
+			Tag *pTag = aReadyEvents[i].data.ptr;
+			switch(pTag->nKind) {
+			case KIND_WATCH: {
+				DKBIOWatch *pWatch = pTag->pObject;
+				pWatch->pReady(pWatch->nFile, pWatch->pInfo);
+				break;
+			}
+			case KIND_SOURCE: {
+				DKBIOChannel *pChannel = pTag->pObject;
+				if(!pChannel->isRemoved)
+					DrainSource(pLoop, pChannel);
+				break;
+			}
+			case KIND_SINK: {
+				DKBIOChannel *pChannel = pTag->pObject;
+				if(!pChannel->isRemoved)
+					pChannel->pSinkReady(pChannel->nSinkFile, pChannel->pInfo);
+				break;
+			}
+			}
+		}
+		FreeRemovedChannels(pLoop);
+	}
+	return 0;
+
+}
+
+static void DrainSource(DKBIOLoop *pLoop, DKBIOChannel *pChannel) {
+
+	for(;;) {
+		ssize_t nSize = read(pChannel->nSourceFile, pLoop->aReadBuffer, sizeof pLoop->aReadBuffer);
+		pLoop->nSyscallCount++;
+		if(nSize < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if(nSize <= 0) { // ENODEV when unplugged
+			pChannel->pClosed(pChannel, pChannel->pInfo);
+			return;
+		}
+		size_t nPassSize = pChannel->pFilter(pChannel, pLoop->aReadBuffer, nSize, pChannel->pInfo);
+		if(nPassSize > 0)
+			WriteSink(pLoop, pChannel, nPassSize);
+		if((size_t)nSize < sizeof pLoop->aReadBuffer)
+			return; // drained
+	}
+
+}
+
+static void WriteSink(DKBIOLoop *pLoop, DKBIOChannel *pChannel, size_t nSize) {
+
+	// the events were passed already, one left out may leave a key down on the mirror
+	size_t nOffset = 0;
+	while(nOffset < nSize) {
+		ssize_t nWritten = write(pChannel->nSinkFile, pLoop->aReadBuffer + nOffset, nSize - nOffset);
+		pLoop->nSyscallCount++;
+		if(nWritten > 0) {
+			nOffset += nWritten; // uinput takes whole events, the rest goes again
+			continue;
+		}
+		if(nWritten < 0 && errno == EINTR)
+			continue;
+		if(nWritten < 0 && errno == EAGAIN) {
+			struct pollfd aPoll = { pChannel->nSinkFile, POLLOUT, 0 };
+			if(poll(&aPoll, 1, SINK_WAIT) > 0)
+				continue;
+		}
+		pLoop->nLostWriteCount++;
+		pLoop->nLostSize += nSize - nOffset;
+		return;
+	}
+
+}
+
+static int InitUring(DKBIOLoop *pLoop) {
+
+	struct io_uring_params aParams;
+	memset(&aParams, 0, sizeof aParams);
+	if(pLoop->isPolling) {
+		aParams.flags |= IORING_SETUP_SQPOLL;
+		aParams.sq_thread_idle = SQPOLL_IDLE;
+	}
+	pLoop->nRingFile = syscall(__NR_io_uring_setup, RING_ENTRY_COUNT, &aParams);
+	if(pLoop->nRingFile < 0)
+		return -1;
+
+	// multishot reads need Linux 6.7
+	struct {
+		struct io_uring_probe aProbe;
+		struct io_uring_probe_op aOps[256];
+	} aProbe;
+	memset(&aProbe, 0, sizeof aProbe);
+	if(syscall(__NR_io_uring_register, pLoop->nRingFile, IORING_REGISTER_PROBE, &aProbe, 256) != 0
+		|| aProbe.aProbe.last_op < IORING_OP_READ_MULTISHOT_
+		|| !(aProbe.aOps[IORING_OP_READ_MULTISHOT_].flags & IO_URING_OP_SUPPORTED)
+		|| !(aProbe.aOps[IORING_OP_WRITE_FIXED].flags & IO_URING_OP_SUPPORTED))
+		return -1;
+
+	pLoop->nSqRingSize = aParams.sq_off.array + aParams.sq_entries * sizeof(unsigned);
+	pLoop->nCqRingSize = aParams.cq_off.cqes + aParams.cq_entries * sizeof(struct io_uring_cqe);
+	if(aParams.features & IORING_FEAT_SINGLE_MMAP) {
+		if(pLoop->nCqRingSize > pLoop->nSqRingSize)
+			pLoop->nSqRingSize = pLoop->nCqRingSize;
+		pLoop->nCqRingSize = 0;
+	}
+	pLoop->pSqRing = mmap(NULL, pLoop->nSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pLoop->nRingFile, IORING_OFF_SQ_RING);
+	if(pLoop->pSqRing == MAP_FAILED) {
+		pLoop->pSqRing = NULL;
+		return -1;
+	}
+	if(pLoop->nCqRingSize != 0) {
+		pLoop->pCqRing = mmap(NULL, pLoop->nCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pLoop->nRingFile, IORING_OFF_CQ_RING);
+		if(pLoop->pCqRing == MAP_FAILED) {
+			pLoop->pCqRing = NULL;
+			return -1;
+		}
+	} else {
+		pLoop->pCqRing = pLoop->pSqRing;
+	}
+	pLoop->nSqesSize = aParams.sq_entries * sizeof(struct io_uring_sqe);
+	pLoop->pSqes = mmap(NULL, pLoop->nSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pLoop->nRingFile, IORING_OFF_SQES);
+	if(pLoop->pSqes == MAP_FAILED) {
+		pLoop->pSqes = NULL;
+		return -1;
+	}
+	char *pSqRing = pLoop->pSqRing, *pCqRing = pLoop->pCqRing;
+	pLoop->pSqHead = (unsigned *)(pSqRing + aParams.sq_off.head);
+	pLoop->pSqTail = (unsigned *)(pSqRing + aParams.sq_off.tail);
+	pLoop->pSqFlags = (unsigned *)(pSqRing + aParams.sq_off.flags);
+	pLoop->pSqArray = (unsigned *)(pSqRing + aParams.sq_off.array);
+	pLoop->nSqMask = *(unsigned *)(pSqRing + aParams.sq_off.ring_mask);
+	pLoop->nSqEntries = aParams.sq_entries;
+	pLoop->nSqLocalTail = pLoop->nSqSubmittedTail = *pLoop->pSqTail;
+	pLoop->pCqHead = (unsigned *)(pCqRing + aParams.cq_off.head);
+	pLoop->pCqTail = (unsigned *)(pCqRing + aParams.cq_off.tail);
+	pLoop->nCqMask = *(unsigned *)(pCqRing + aParams.cq_off.ring_mask);
+	pLoop->pCqes = (struct io_uring_cqe *)(pCqRing + aParams.cq_off.cqes);
+
+	// one pool serves as the provided buffers of the reads and as the fixed buffer of the writes
+	size_t nPoolSize = BUFFER_COUNT * DKB_IO_BATCH_SIZE;
+	pLoop->pBuffers = mmap(NULL, nPoolSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(pLoop->pBuffers == MAP_FAILED) {
+		pLoop->pBuffers = NULL;
+		return -1;
+	}
+	DKBMemoryPin(pLoop->pBuffers, nPoolSize);
+	struct iovec aPool = { pLoop->pBuffers, nPoolSize };
+	if(syscall(__NR_io_uring_register, pLoop->nRingFile, IORING_REGISTER_BUFFERS, &aPool, 1) != 0)
+		return -1;
+	pLoop->pBufferRing = mmap(NULL, BUFFER_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(pLoop->pBufferRing == MAP_FAILED) {
+		pLoop->pBufferRing = NULL;
+		return -1;
+	}
+	DKBMemoryPin(pLoop->pBufferRing, BUFFER_COUNT * sizeof(struct io_uring_buf));
+	struct io_uring_buf_reg aBufferRing;
+	memset(&aBufferRing, 0, sizeof aBufferRing);
+	aBufferRing.ring_addr = (uint64_t)(uintptr_t)pLoop->pBufferRing;
+	aBufferRing.ring_entries = BUFFER_COUNT;
+	aBufferRing.bgid = BUFFER_GROUP;
+	if(syscall(__NR_io_uring_register, pLoop->nRingFile, IORING_REGISTER_PBUF_RING, &aBufferRing, 1) != 0)
+		return -1;
+	unsigned i;
+	for(i = 0; i < BUFFER_COUNT; i++)
+		RecycleBuffer(pLoop, i);
+	return 0;
+
+}
+
+static void DeinitUring(DKBIOLoop *pLoop) {
+
+	close(pLoop->nRingFile);
+	pLoop->nRingFile = -1;
+	if(pLoop->pBufferRing != NULL)
+		munmap(pLoop->pBufferRing, BUFFER_COUNT * sizeof(struct io_uring_buf));
+	if(pLoop->pBuffers != NULL)
+		munmap(pLoop->pBuffers, BUFFER_COUNT * DKB_IO_BATCH_SIZE);
+	if(pLoop->pSqes != NULL)
+		munmap(pLoop->pSqes, pLoop->nSqesSize);
+	if(pLoop->pCqRing != NULL && pLoop->pCqRing != pLoop->pSqRing)
+		munmap(pLoop->pCqRing, pLoop->nCqRingSize);
+	if(pLoop->pSqRing != NULL)
+		munmap(pLoop->pSqRing, pLoop->nSqRingSize);
+
+}
+
+static int RunUring(DKBIOLoop *pLoop) {
+
+	while(!pLoop->isStopping) {
+		unsigned nHead = *pLoop->pCqHead;
+		unsigned nTail = __atomic_load_n(pLoop->pCqTail, __ATOMIC_ACQUIRE);
+		if(nHead == nTail || (!pLoop->isPolling && pLoop->nSqLocalTail != pLoop->nSqSubmittedTail)) {
+			// nothing to handle, or submissions the kernel would not see otherwise
+			if(Enter(pLoop, (nHead == nTail) ? 1 : 0) != 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+				return -1;
+			nTail = __atomic_load_n(pLoop->pCqTail, __ATOMIC_ACQUIRE);
+		}
+		pLoop->pLastWriteChannel = NULL;
+		while(nHead != nTail) {
+			HandleCompletion(pLoop, &pLoop->pCqes[nHead & pLoop->nCqMask]);
+			nHead++;
+			__atomic_store_n(pLoop->pCqHead, nHead, __ATOMIC_RELEASE);
+		}
+		FreeRemovedChannels(pLoop);
+		if(pLoop->isPolling && pLoop->nSqLocalTail != pLoop->nSqSubmittedTail)
+			Enter(pLoop, 0); // publishes the tail and wakes the submission thread only if it sleeps
+	}
+	return 0;
+
+}
+
+static void HandleCompletion(DKBIOLoop *pLoop, const struct io_uring_cqe *pCqe) {
+
+	uint64_t nUserData = pCqe->user_data;
+	int hasMore = (pCqe->flags & IORING_CQE_F_MORE) != 0;
+	switch(nUserData & KIND_MASK) {
+
+	case KIND_WATCH: {
+		DKBIOWatch *pWatch = (DKBIOWatch *)(uintptr_t)(nUserData & ~(uint64_t)KIND_MASK);
+		pWatch->pReady(pWatch->nFile, pWatch->pInfo);
+		if(!hasMore)
+			ArmPoll(pLoop, pWatch->nFile, nUserData);
+		break;
+	}
+
+	case KIND_SINK: {
+		DKBIOChannel *pChannel = (DKBIOChannel *)(uintptr_t)(nUserData & ~(uint64_t)KIND_MASK);
+		if(!pChannel->isRemoved && pCqe->res > 0)
+			pChannel->pSinkReady(pChannel->nSinkFile, pChannel->pInfo);
+		if(hasMore)
+			break;
+		if(pChannel->isRemoved)
+			pChannel->nArmedCount--;
+		else
+			ArmPoll(pLoop, pChannel->nSinkFile, nUserData);
+		break;
+	}
+
+	case KIND_SOURCE: {
+		DKBIOChannel *pChannel = (DKBIOChannel *)(uintptr_t)(nUserData & ~(uint64_t)KIND_MASK);
+		if(pCqe->flags & IORING_CQE_F_BUFFER) {
+			unsigned nBufferId = pCqe->flags >> IORING_CQE_BUFFER_SHIFT;
+			size_t nPassSize = 0;
+			if(!pChannel->isRemoved && pCqe->res > 0)
+				nPassSize = pChannel->pFilter(pChannel, pLoop->pBuffers + nBufferId * DKB_IO_BATCH_SIZE, pCqe->res, pChannel->pInfo);
+			if(nPassSize > 0)
+				QueueWrite(pLoop, pChannel, nBufferId, nPassSize);
+			else
+				RecycleBuffer(pLoop, nBufferId);
+		}
+		if(!pChannel->isRemoved && (pCqe->res == 0 || (pCqe->res < 0 && pCqe->res != -ENOBUFS && pCqe->res != -ECANCELED)))
+			pChannel->pClosed(pChannel, pChannel->pInfo); // ENODEV when unplugged
+		if(hasMore)
+			break;
+		if(pChannel->isRemoved)
+			pChannel->nArmedCount--;
+		else
+			ArmSourceRead(pLoop, pChannel); // out of buffers for a moment or the kernel ended it
+		break;
+	}
+
+	case KIND_WRITE: {
+		size_t nSize = (size_t)(nUserData >> 19);
+		if(pCqe->res < 0 || (size_t)pCqe->res < nSize) { // ECANCELED for the writes linked after a failed one
+			pLoop->nLostWriteCount++;
+			pLoop->nLostSize += (pCqe->res > 0) ? nSize - pCqe->res : nSize;
+		}
+		RecycleBuffer(pLoop, (unsigned)((nUserData >> 3) & 0xFFFF));
+		break;
+	}
+
+	}
+
+}
+
+static struct io_uring_sqe *GetSqe(DKBIOLoop *pLoop) {
+
+	while(pLoop->nSqLocalTail - __atomic_load_n(pLoop->pSqHead, __ATOMIC_ACQUIRE) >= pLoop->nSqEntries)
+		Enter(pLoop, 0); // full, let the kernel consume some
+	unsigned nIndex = pLoop->nSqLocalTail & pLoop->nSqMask;
+	struct io_uring_sqe *pSqe = &pLoop->pSqes[nIndex];
+	memset(pSqe, 0, sizeof *pSqe);
+	pLoop->pSqArray[nIndex] = nIndex;
+	pLoop->nSqLocalTail++;
+	return pSqe;
+
+}
+
+static int Enter(DKBIOLoop *pLoop, unsigned nWaitCount) {
+
+	unsigned nSubmitCount = pLoop->nSqLocalTail - pLoop->nSqSubmittedTail;
+	__atomic_store_n(pLoop->pSqTail, pLoop->nSqLocalTail, __ATOMIC_RELEASE);
+	pLoop->nSqSubmittedTail = pLoop->nSqLocalTail;
+	unsigned nFlags = (nWaitCount > 0) ? IORING_ENTER_GETEVENTS : 0;
+	if(pLoop->isPolling) {
+		nSubmitCount = 0; // the submission thread picks them up
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(__atomic_load_n(pLoop->pSqFlags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+			nFlags |= IORING_ENTER_SQ_WAKEUP;
+		if(nFlags == 0)
+			return 0;
+	}
+	pLoop->nSyscallCount++;
+	return (syscall(__NR_io_uring_enter, pLoop->nRingFile, nSubmitCount, nWaitCount, nFlags, NULL, 0) < 0) ? -1 : 0;
+
+}
+
+static void ArmSourceRead(DKBIOLoop *pLoop, DKBIOChannel *pChannel) {
+
+	struct io_uring_sqe *pSqe = GetSqe(pLoop);
+	pSqe->opcode = IORING_OP_READ_MULTISHOT_;
+	pSqe->fd = pChannel->nSourceFile;
+	pSqe->off = (uint64_t)-1;
+	pSqe->flags = IOSQE_BUFFER_SELECT;
+	pSqe->buf_group = BUFFER_GROUP;
+	pSqe->user_data = (uint64_t)(uintptr_t)pChannel | KIND_SOURCE;
+
+}
+
+static void ArmPoll(DKBIOLoop *pLoop, int nFile, uint64_t nUserData) {
+
+	struct io_uring_sqe *pSqe = GetSqe(pLoop);
+	pSqe->opcode = IORING_OP_POLL_ADD;
+	pSqe->fd = nFile;
+	pSqe->poll32_events = POLLIN;
+	pSqe->len = IORING_POLL_ADD_MULTI;
+	pSqe->user_data = nUserData;
+
+}
+
+static void QueueWrite(DKBIOLoop *pLoop, DKBIOChannel *pChannel, unsigned nBufferId, size_t nSize) {
+
+	struct io_uring_sqe *pSqe = GetSqe(pLoop);
+	// batches of one device must reach its mirror in order, a chain needs adjacent entries not submitted yet
+	unsigned nTail = pLoop->nSqLocalTail - 1;
+	if(pLoop->pLastWriteChannel == pChannel && pLoop->nLastWriteTail + 1 == nTail
+		&& (int)(pLoop->nLastWriteTail - pLoop->nSqSubmittedTail) >= 0)
+		pLoop->pSqes[pLoop->nLastWriteTail & pLoop->nSqMask].flags |= IOSQE_IO_LINK;
+	pSqe->opcode = IORING_OP_WRITE_FIXED;
+	pSqe->fd = pChannel->nSinkFile;
+	pSqe->addr = (uint64_t)(uintptr_t)(pLoop->pBuffers + nBufferId * DKB_IO_BATCH_SIZE);
+	pSqe->len = (unsigned)nSize;
+	pSqe->off = (uint64_t)-1;
+	pSqe->buf_index = 0;
+	pSqe->user_data = ((((uint64_t)nSize << 16) | nBufferId) << 3) | KIND_WRITE; // the size to tell a short write
+	pLoop->pLastWriteChannel = pChannel;
+	pLoop->nLastWriteTail = nTail;
+
+}
+
+static void RecycleBuffer(DKBIOLoop *pLoop, unsigned nBufferId) {
+
+	struct io_uring_buf *pBuffer = &pLoop->pBufferRing->bufs[pLoop->nBufferTail & (BUFFER_COUNT - 1)];
+	pBuffer->addr = (uint64_t)(uintptr_t)(pLoop->pBuffers + nBufferId * DKB_IO_BATCH_SIZE);
+	pBuffer->len = DKB_IO_BATCH_SIZE;
+	pBuffer->bid = (unsigned short)nBufferId;
+	pLoop->nBufferTail++;
+	__atomic_store_n(&pLoop->pBufferRing->tail, pLoop->nBufferTail, __ATOMIC_RELEASE);
+
+}
+
+static void FreeRemovedChannels(DKBIOLoop *pLoop) {
+
+	DKBIOChannel **ppLink = &pLoop->pRemovedChannels;
+	while(*ppLink != NULL) {
+		DKBIOChannel *pChannel = *ppLink;
+		if(pChannel->nArmedCount > 0) {
+			ppLink = &pChannel->pNext;
+			continue;
+		}
+		*ppLink = pChannel->pNext;
+		free(pChannel);
+	}
+
+}
@@ -0,0 +1,78 @@
+/*
+ * DeKeyBounce
+ * The Linux event loop: epoll with read/write or io_uring.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_IO_H
+#define DEKEYBOUNCE_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A channel connects a source descriptor (a grabbed evdev node) to a sink
+ * descriptor (its uinput mirror): whatever is read from the source goes
+ * through the filter callback in place and what is left is written to the
+ * sink. A watch is a descriptor the loop only reports as readable.
+ *
+ * The epoll backend reads and writes every batch with plain syscalls. The
+ * io_uring backend keeps a multishot read armed on every source, reading
+ * into a ring of provided buffers which are also registered for fixed
+ * writes, so a batch is filtered and written back from the same memory,
+ * and with kernel-side submission polling it needs no syscall at all while
+ * completions keep coming.
+ */
+
+#define DKB_IO_EPOLL 0
+#define DKB_IO_URING 1
+
+#define DKB_IO_BATCH_SIZE 1536 /* 64 struct input_event of a 64-bit kernel */
+
+typedef struct _DKBIOLoop DKBIOLoop;
+typedef struct _DKBIOChannel DKBIOChannel;
+
+typedef size_t (*DKBIOFilterCallBack)(DKBIOChannel *pChannel, void *pData, size_t nSize, void *pInfo);
+typedef void (*DKBIOReadyCallBack)(int nFile, void *pInfo);
+typedef void (*DKBIOClosedCallBack)(DKBIOChannel *pChannel, void *pInfo);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+DKBIOLoop *DKBIOLoopCreate(int nBackend, int isPolling);
+void DKBIOLoopDestroy(DKBIOLoop *pLoop);
+int DKBIOLoopGetBackend(const DKBIOLoop *pLoop);
+uint64_t DKBIOLoopGetSyscallCount(const DKBIOLoop *pLoop);
+uint64_t DKBIOLoopGetLostWriteCount(const DKBIOLoop *pLoop, uint64_t *pLostSize);
+int DKBIOLoopAddWatch(DKBIOLoop *pLoop, int nFile, DKBIOReadyCallBack pReady, void *pInfo);
+DKBIOChannel *DKBIOLoopAddChannel(DKBIOLoop *pLoop, int nSourceFile, int nSinkFile, DKBIOFilterCallBack pFilter,
+	DKBIOReadyCallBack pSinkReady, DKBIOClosedCallBack pClosed, void *pInfo);
+void DKBIOLoopRemoveChannel(DKBIOLoop *pLoop, DKBIOChannel *pChannel);
+int DKBIOLoopRun(DKBIOLoop *pLoop);
+void DKBIOLoopStop(DKBIOLoop *pLoop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_IO_H */
@@ -0,0 +1,938 @@
+/*
+ * DeKeyBounce
+ * The Linux daemon: grabs keyboards via evdev and re-emits them via uinput.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Build: cc -O2 -c DeKeyBounceBreaker.c DeKeyBounceClock.c DeKeyBounceCompact.c
+ *        DeKeyBounceConfig.c DeKeyBounceEngine.c DeKeyBouncePerf.c DeKeyBounceRecorder.c
+ *        DeKeyBounceScore.c DeKeyBounceSketch.c DeKeyBounceStats.c DeKeyBounceStore.c
+ *        DeKeyBounceTrace.c
+ *        ar rcs libDeKeyBounce.a DeKeyBounceBreaker.o DeKeyBounceClock.o DeKeyBounceCompact.o
+ *        DeKeyBounceConfig.o DeKeyBounceEngine.o DeKeyBouncePerf.o
+ *        DeKeyBounceRecorder.o DeKeyBounceScore.o DeKeyBounceSketch.o DeKeyBounceStats.o
+ *        DeKeyBounceStore.o DeKeyBounceTrace.o
+ *        cc -O2 -o dekeybounce DeKeyBounceLinux.c DeKeyBounceIO.c
+ *        DeKeyBounceMemory.c DeKeyBounceSched.c -L. -lDeKeyBounce -lpthread
+ *
+ * Every keyboard-like /dev/input/event* device is grabbed and mirrored by
+ * a uinput device which gets the events the engine lets through; LED
+ * changes go the other way. Devices come and go while running: inotify on
+ * /dev/input reports new nodes and a read failing with ENODEV a removal.
+ * One event loop covers all of it, so a wakeup serves every ready device;
+ * with -u it runs on io_uring instead of epoll (-U adds kernel-side
+ * submission polling, which trades a busy kernel thread for no syscalls).
+ * With -C the settings of a file (see DeKeyBounceConfig.h) override the
+ * command line; SIGHUP reads it again without stopping the filter.
+ * With -D the hardware counters of the loop thread are read around every
+ * batch, and the cycles, instructions and cache and branch misses per key
+ * event are logged at every housekeeping (see DeKeyBouncePerf.h).
+ * Key events more than the -B budget late (100 ms by default, 0 for no
+ * limit) are let through unfiltered until the loop catches up again, so
+ * a starved daemon never holds the keyboard up (see DeKeyBounceBreaker.h).
+ * With -r the last key events of all devices, with their verdicts, are
+ * kept in memory, and SIGUSR1 dumps them as a trace to the -R path (see
+ * DeKeyBounceRecorder.h; DeKeyBounceReplay -d prints one).
+ * With -i the intervals from key-ups to key-downs are counted in sketches
+ * which keep no keystrokes, written to that path every -I seconds they
+ * changed, for DeKeyBounceMerge to sum over a fleet (see
+ * DeKeyBounceSketch.h).
+ * Nothing runs on a period: the housekeeping timer is armed by the first
+ * key event after a quiet spell, for all the work the events bring, and
+ * again while there are sketches to write, so an idle daemon is woken up
+ * by nothing but the kernel handing it an event. With -W the wakeups per
+ * minute of the process, idle and busy, are logged whenever it goes idle.
+ * Built where <sys/sdt.h> is at hand, the engine has USDT probes at every
+ * decision for bpftrace (see DeKeyBounceProbes.h, DeKeyBounceDrops.bt).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include "DeKeyBounceBreaker.h"
+#include "DeKeyBounceClock.h"
+#include "DeKeyBounceCompact.h"
+#include "DeKeyBounceConfig.h"
+#include "DeKeyBounceEngine.h"
+#include "DeKeyBounceIO.h"
+#include "DeKeyBounceMemory.h"
+#include "DeKeyBouncePerf.h"
+#include "DeKeyBounceRecorder.h"
+#include "DeKeyBounceSched.h"
+#include "DeKeyBounceSketch.h"
+#include "DeKeyBounceStats.h"
+
+#define DEFAULT_MIN_TIMESTAMP_DIFF 20UL /* 20 ms */
+#define DEFAULT_QUEUE_BUDGET 100UL /* ms */
+#define INPUT_DIRECTORY "/dev/input"
+#define UINPUT_PATH "/dev/uinput"
+#define DEVICE_NAME_PREFIX "DeKeyBounce "
+#define HOUSEKEEPING_INTERVAL 5 /* seconds from the first key event to the housekeeping of it and the next ones */
+#define HOUSEKEEPING_SLACK 1 /* seconds, work due this soon is done along with the work due now */
+#define DEFAULT_RECORD_PATH "/run/DeKeyBounce.flight"
+#define DEFAULT_SKETCH_PERIOD 300 /* seconds */
+
+#define MAX_BATCH_COUNT (DKB_IO_BATCH_SIZE / sizeof(struct input_event)) /* input events per read */
+#define MAX_RELEASE_COUNT 32 /* deferred key-ups written to a mirror at once */
+
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+#define BIT_ARRAY_SIZE(n) (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define IS_BIT_SET(a, n) (((a)[(n) / BITS_PER_LONG] >> ((n) % BITS_PER_LONG)) & 1)
+
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+typedef struct _Device Device;
+
+struct _Device {
+
+	DKBEngine aEngine; // key states are per device, a scanner must not disturb the keyboard
+	int nSourceFile;
+	int nSinkFile;
+	DKBIOChannel *pChannel;
+	DKBKeyCounters *pSeenCounters; // of the engine, at the last collection of the stats
+	uint64_t nConfigGeneration; // of the config last applied to the engine
+	char aPath[64];
+	char aName[256];
+	Device *pNext;
+
+};
+
+static DKBIOLoop *theLoop = NULL;
+static int theBackend = DKB_IO_EPOLL;
+static int theIsPolling = 0;
+static int theResult = 0;
+static int theSignalFile = -1;
+static int theHotplugFile = -1;
+static int theTimerFile = -1;
+static uint64_t theTimerTime = 0; // the deadline the timer is armed for, 0 when disarmed
+static uint64_t theRoundTime = 0; // when the housekeeping of the key events is due, 0 for none
+static uint64_t theReleaseTime = 0; // when the next key-up deferred in the hold window is due, 0 for none
+static DKBStats theStats; // of all devices together, by key code
+static const char *theHeatmapPath = NULL;
+static uint16_t theAlertBounceRate = DKB_DEFAULT_ALERT_BOUNCE_RATE;
+static Device *theDevices = NULL;
+static DKBClock theClock;
+static uint64_t theMinTimestampDiff = 0;
+static uint64_t theMinHoldDiff = 0;
+static const char *theConfigPath = NULL;
+static DKBConfigDomain theConfigDomain;
+static DKBConfigReader *theConfigReader = NULL; // the loop thread
+static int theIsDiagnosing = 0;
+static DKBPerf thePerf; // of the loop thread
+static DKBPerfSample theFilterCounters; // since the last housekeeping
+static uint64_t theFilterEventCount = 0;
+static uint64_t theQueueBudget = DEFAULT_QUEUE_BUDGET;
+static DKBBreaker theBreaker; // of the loop thread, for all devices
+static uint64_t theReportedTripCount = 0;
+static uint64_t theReportedLostWriteCount = 0;
+static DKBRecorder theRecorder; // the loop thread both adds and dumps
+static size_t theRecordCount = 0; // 0 records nothing, the events are keystrokes
+static const char *theRecordPath = DEFAULT_RECORD_PATH;
+static DKBSketch theSketch; // the loop thread both adds and exports
+static const char *theSketchPath = NULL;
+static uint64_t theSketchPeriod = DEFAULT_SKETCH_PERIOD; // seconds, then ticks
+static uint64_t theSketchExportTime = 0;
+static uint64_t theExportedSketchCount = 0;
+static uint64_t theSketchTime = 0; // when the counts not yet written are due, 0 for none
+static int theIsCountingWakeups = 0;
+static DKBSchedWakeups theWakeups; // of the loop thread
+static DKBSchedOptions theSchedOptions = { DKB_SCHED_DEFAULT, DKB_SCHED_DEFAULT_PRIORITY, DKB_SCHED_ANY_CPU };
+
+static int Init(void);
+static void Deinit(void);
+static void ScanDevices(void);
+static void OnSignal(int nFile, void *pInfo);
+static void OnHotplug(int nFile, void *pInfo);
+static void OnHousekeeping(int nFile, void *pInfo);
+static DKBConfig *LoadConfig(void);
+static void ReloadConfig(void);
+static void ApplyConfig(Device *pDevice, const DKBConfig *pConfig);
+static void LogDiagnostics(void);
+static void LogBreaker(void);
+static void LogLostWrites(void);
+static void DumpRecord(void);
+static void ExportSketch(uint64_t nNow, int isForced);
+static uint64_t ReleaseKeys(Device *pDevice, uint64_t nNow);
+static void ArmTimer(void);
+static void LogWakeups(void);
+static Device *OpenDevice(const char *pPath);
+static int CreateSink(int nSourceFile, const char *pName);
+static void CloseDevice(Device *pDevice);
+static size_t OnSourceData(DKBIOChannel *pChannel, void *pData, size_t nSize, void *pInfo);
+static void OnSinkReady(int nFile, void *pInfo);
+static void OnSourceClosed(DKBIOChannel *pChannel, void *pInfo);
+
+int main (int argc, char * const argv[]) {
+
+	if(geteuid() != 0) // 0 is root
+		return 1; // incorrect using
+	if(getppid() != 1) // 1 is init
+		return 1; // incorrect using
+	int nOption;
+	while((nOption = getopt(argc, argv, "a:B:C:c:DH:I:i:m:p:R:r:uUW")) != -1) {
+		switch(nOption) {
+		case 'U': // io_uring with a kernel thread polling the submissions
+			theIsPolling = 1;
+			// fall through
+		case 'u':
+			theBackend = DKB_IO_URING;
+			break;
+		case 'W': // log the wakeups per minute, idle and busy
+			theIsCountingWakeups = 1;
+			break;
+		case 'a': { // the bounce rate of a key in % to complain about in the log
+			double fPercent = strtod(optarg, NULL);
+			theAlertBounceRate = (fPercent >= 100) ? DKB_RATE_ONE : (fPercent > 0) ? (uint16_t)(fPercent * DKB_RATE_ONE / 100) : 1;
+			break;
+		}
+		case 'B': // the queueing delay in ms over which key events bypass the filter
+			theQueueBudget = strtoul(optarg, NULL, 10);
+			break;
+		case 'C': // the file with the thresholds, read again on SIGHUP
+			theConfigPath = optarg;
+			break;
+		case 'c': // the CPU to pin the event loop to
+			theSchedOptions.nCpu = strtol(optarg, NULL, 10);
+			break;
+		case 'D': // log the hardware counters of the filter
+			theIsDiagnosing = 1;
+			break;
+		case 'H': // the hold window in ms, key-ups sooner after the key-down are held back to its end
+			theMinHoldDiff = strtoul(optarg, NULL, 10);
+			break;
+		case 'I': // seconds between two writes of the interval sketches
+			theSketchPeriod = strtoul(optarg, NULL, 10);
+			break;
+		case 'i': // where to write the interval sketches
+			theSketchPath = optarg;
+			break;
+		case 'm': // where to keep the per-key heatmap, CSV if it ends with .csv, JSON otherwise
+			theHeatmapPath = optarg;
+			break;
+		case 'p': // fifo or rr, optionally with :priority
+			if(DKBSchedParsePolicy(&theSchedOptions, optarg) != 0)
+				return 1; // incorrect using
+			break;
+		case 'R': // where SIGUSR1 dumps the flight record
+			theRecordPath = optarg;
+			break;
+		case 'r': // key events to keep in the flight record
+			theRecordCount = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			return 1; // incorrect using
+		}
+	}
+	if(optind < argc)
+		theMinTimestampDiff = strtoul(argv[optind], NULL, 10);
+	if(theMinTimestampDiff == 0)
+		theMinTimestampDiff = DEFAULT_MIN_TIMESTAMP_DIFF;
+	DKBClockInitNative(&theClock); // evdev is switched to CLOCK_MONOTONIC
+	theMinTimestampDiff = DKBClockFromNanoseconds(&theClock, theMinTimestampDiff * 1000000); // from ms
+	theMinHoldDiff = DKBClockFromNanoseconds(&theClock, theMinHoldDiff * 1000000);
+	DKBBreakerInit(&theBreaker, DKBClockFromNanoseconds(&theClock, theQueueBudget * 1000000));
+	theSketchPeriod = DKBClockFromNanoseconds(&theClock, theSketchPeriod * 1000000000);
+	openlog("DeKeyBounce", LOG_PID, LOG_DAEMON);
+	if(Init() != 0) {
+		Deinit();
+		return 1;
+	}
+	if(DKBIOLoopRun(theLoop) != 0)
+		theResult = 1;
+	Deinit();
+	return theResult;
+
+}
+
+static int Init(void) {
+
+	sigset_t aSignals;
+	sigemptyset(&aSignals);
+	sigaddset(&aSignals, SIGHUP);
+	sigaddset(&aSignals, SIGINT);
+	sigaddset(&aSignals, SIGTERM);
+	sigaddset(&aSignals, SIGUSR1);
+	sigaddset(&aSignals, SIGUSR2);
+	if(sigprocmask(SIG_BLOCK, &aSignals, NULL) != 0)
+		return -1;
+	signal(SIGPIPE, SIG_IGN);
+	DKBConfig *pConfig = LoadConfig();
+	if(pConfig == NULL)
+		return -1;
+	if(DKBConfigDomainInit(&theConfigDomain, pConfig) != 0) {
+		DKBConfigDestroy(pConfig);
+		return -1;
+	}
+	theConfigReader = DKBConfigAddReader(&theConfigDomain);
+	theLoop = DKBIOLoopCreate(theBackend, theIsPolling);
+	if(theLoop == NULL && theBackend == DKB_IO_URING) {
+		syslog(LOG_WARNING, "io_uring is not usable here, falling back to epoll");
+		theLoop = DKBIOLoopCreate(DKB_IO_EPOLL, 0);
+	}
+	if(theLoop == NULL)
+		return -1;
+	theSignalFile = signalfd(-1, &aSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if(theSignalFile < 0)
+		return -1;
+	if(DKBIOLoopAddWatch(theLoop, theSignalFile, OnSignal, NULL) != 0)
+		return -1;
+	// watch before scanning, so that no device slips in between
+	theHotplugFile = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(theHotplugFile < 0)
+		return -1;
+	if(inotify_add_watch(theHotplugFile, INPUT_DIRECTORY, IN_CREATE | IN_ATTRIB) < 0)
+		return -1;
+	if(DKBIOLoopAddWatch(theLoop, theHotplugFile, OnHotplug, NULL) != 0)
+		return -1;
+	DKBStatsReset(&theStats, DKBClockNow(&theClock));
+	theTimerFile = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC); // armed only for pending work
+	if(theTimerFile < 0)
+		return -1;
+	if(DKBIOLoopAddWatch(theLoop, theTimerFile, OnHousekeeping, NULL) != 0)
+		return -1;
+	if(DKBSchedApply(&theSchedOptions) != 0)
+		syslog(LOG_WARNING, "cannot apply the scheduling options: %m");
+	if(theIsDiagnosing && DKBPerfOpen(&thePerf) != 0) {
+		int nError = errno;
+		int nParanoidLevel;
+		if((nError == EACCES || nError == EPERM) && DKBPerfGetParanoidLevel(&nParanoidLevel) == 0)
+			syslog(LOG_WARNING, "cannot count the hardware events: %s, perf_event_paranoid is %d", strerror(nError), nParanoidLevel);
+		else
+			syslog(LOG_WARNING, "cannot count the hardware events: %s", strerror(nError));
+		theIsDiagnosing = 0;
+	}
+	if(DKBRecorderInit(&theRecorder, theRecordCount) != 0)
+		return -1;
+	if(theRecorder.pEntries != NULL && DKBMemoryPin(theRecorder.pEntries, (theRecorder.nMask + 1) * sizeof(DKBRecorderEntry)) != 0)
+		syslog(LOG_WARNING, "cannot lock the flight record in memory: %m");
+	if(theSketchPath != NULL) {
+		if(DKBSketchInit(&theSketch, &theClock) != 0)
+			return -1;
+		if(DKBMemoryPin(theSketch.pCounts, DKB_SKETCH_KEY_COUNT * DKB_SKETCH_BUCKET_COUNT * sizeof(uint32_t)) != 0)
+			syslog(LOG_WARNING, "cannot lock the interval sketches in memory: %m");
+		theSketchExportTime = DKBClockNow(&theClock);
+	}
+	if(theIsCountingWakeups)
+		DKBSchedWakeupsInit(&theWakeups, DKB_SCHED_IDLE, DKBClockNow(&theClock));
+	DKBMemoryPrefaultStack();
+	ScanDevices();
+	return 0;
+
+}
+
+static void Deinit(void) {
+
+	while(theDevices != NULL)
+		CloseDevice(theDevices);
+	if(theTimerFile >= 0) {
+		close(theTimerFile);
+		theTimerFile = -1;
+	}
+	if(theHotplugFile >= 0) {
+		close(theHotplugFile);
+		theHotplugFile = -1;
+	}
+	if(theSignalFile >= 0) {
+		close(theSignalFile);
+		theSignalFile = -1;
+	}
+	if(theLoop != NULL) {
+		DKBIOLoopDestroy(theLoop);
+		theLoop = NULL;
+	}
+	if(theConfigReader != NULL) {
+		DKBConfigDomainDeinit(&theConfigDomain);
+		theConfigReader = NULL;
+	}
+	if(theIsDiagnosing) {
+		DKBPerfClose(&thePerf);
+		theIsDiagnosing = 0;
+	}
+	if(theRecorder.pEntries != NULL)
+		DKBMemoryUnpin(theRecorder.pEntries, (theRecorder.nMask + 1) * sizeof(DKBRecorderEntry));
+	DKBRecorderDeinit(&theRecorder);
+	if(theIsCountingWakeups) {
+		DKBSchedWakeupsSwitch(&theWakeups, !theWakeups.nState, DKBClockNow(&theClock)); // to count the span going on
+		LogWakeups();
+		theIsCountingWakeups = 0;
+	}
+	if(theSketch.pCounts != NULL) {
+		ExportSketch(DKBClockNow(&theClock), 1); // what came since the last write
+		DKBMemoryUnpin(theSketch.pCounts, DKB_SKETCH_KEY_COUNT * DKB_SKETCH_BUCKET_COUNT * sizeof(uint32_t));
+	}
+	DKBSketchDeinit(&theSketch);
+
+}
+
+static void ScanDevices(void) {
+
+	int i;
+	for(i = 0; i < 1024; i++) { // the kernel numbers event nodes from 0
+		char aPath[64];
+		snprintf(aPath, sizeof aPath, INPUT_DIRECTORY "/event%d", i);
+		if(access(aPath, F_OK) != 0)
+			continue;
+		OpenDevice(aPath);
+	}
+
+}
+
+static void OnSignal(int nFile, void *pInfo) {
+
+	struct signalfd_siginfo aSignal;
+	while(read(nFile, &aSignal, sizeof aSignal) == sizeof aSignal) {
+		switch(aSignal.ssi_signo) {
+		case SIGHUP:
+			ReloadConfig();
+			break;
+		case SIGINT:
+		case SIGTERM:
+			DKBIOLoopStop(theLoop);
+			break;
+		case SIGUSR1: // between two batches, so the record is whole
+			DumpRecord();
+			break;
+		case SIGUSR2: // start counting anew
+			DKBStatsReset(&theStats, DKBClockNow(&theClock));
+			break;
+		}
+	}
+
+}
+
+static void OnHotplug(int nFile, void *pInfo) {
+
+	char aBuffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t nSize;
+	while((nSize = read(nFile, aBuffer, sizeof aBuffer)) > 0) {
+		char *pPointer = aBuffer;
+		while(pPointer < aBuffer + nSize) {
+			struct inotify_event *pEvent = (struct inotify_event *)pPointer;
+			pPointer += sizeof(struct inotify_event) + pEvent->len;
+			if(pEvent->len == 0 || strncmp(pEvent->name, "event", 5) != 0)
+				continue;
+			char aPath[64];
+			snprintf(aPath, sizeof aPath, INPUT_DIRECTORY "/%s", pEvent->name);
+			// udev changes the node right after its creation, so it may be seen several times
+			OpenDevice(aPath);
+		}
+	}
+
+}
+
+static void OnHousekeeping(int nFile, void *pInfo) {
+
+	// the stats are collected on the loop thread too, between two batches
+	uint64_t nExpirations;
+	if(read(nFile, &nExpirations, sizeof nExpirations) != sizeof nExpirations)
+		return;
+	theTimerTime = 0; // one shot
+	uint64_t nNow = DKBClockNow(&theClock);
+	if(theReleaseTime != 0 && theReleaseTime <= nNow) {
+		theReleaseTime = 0; // no slack, the keys are held until then
+		Device *pDevice;
+		for(pDevice = theDevices; pDevice != NULL; pDevice = pDevice->pNext) {
+			uint64_t nReleaseTime = ReleaseKeys(pDevice, nNow);
+			if(nReleaseTime != 0 && (theReleaseTime == 0 || nReleaseTime < theReleaseTime))
+				theReleaseTime = nReleaseTime;
+		}
+	}
+	uint64_t nSlack = DKBClockFromNanoseconds(&theClock, HOUSEKEEPING_SLACK * 1000000000ULL);
+	if(theRoundTime != 0 && theRoundTime <= nNow + nSlack) {
+		theRoundTime = 0; // the key events from now on arm the timer again
+		Device *pDevice;
+		for(pDevice = theDevices; pDevice != NULL; pDevice = pDevice->pNext)
+			DKBStatsCollect(&theStats, &pDevice->aEngine, pDevice->pSeenCounters);
+		DKBStatsReportAlerts(&theStats, &theClock);
+		if(theHeatmapPath != NULL && DKBStatsExport(&theStats, &theClock, nNow, theHeatmapPath) != 0)
+			syslog(LOG_WARNING, "cannot write the heatmap to %s: %m", theHeatmapPath);
+		if(theIsDiagnosing)
+			LogDiagnostics();
+		LogBreaker();
+		LogLostWrites();
+		DKBConfigQuiesce(&theConfigDomain, theConfigReader); // not in a batch here
+		DKBConfigReclaim(&theConfigDomain);
+	}
+	ExportSketch(nNow, 0);
+	ArmTimer();
+	if(theIsCountingWakeups && theTimerTime == 0) {
+		DKBSchedWakeupsSwitch(&theWakeups, DKB_SCHED_IDLE, nNow);
+		LogWakeups();
+	}
+
+}
+
+static void LogDiagnostics(void) {
+
+	if(theFilterEventCount == 0)
+		return;
+	char aLine[256];
+	int nLength = snprintf(aLine, sizeof aLine, "per key event of %llu: %.1f ns",
+		(unsigned long long)theFilterEventCount, (double)theFilterCounters.nTimeEnabled / theFilterEventCount);
+	int i;
+	for(i = 0; i < DKB_PERF_COUNTER_COUNT && nLength < (int)sizeof aLine; i++) {
+		if(DKBPerfHasCounter(&thePerf, i)) {
+			nLength += snprintf(aLine + nLength, sizeof aLine - nLength, ", %.2f %s",
+				(double)theFilterCounters.aValues[i] / theFilterEventCount, DKBPerfGetCounterName(i));
+		}
+	}
+	if(theFilterCounters.nTimeRunning < theFilterCounters.nTimeEnabled)
+		syslog(LOG_INFO, "%s (scaled, the counters ran %.0f%% of the time)", aLine,
+			theFilterCounters.nTimeRunning * 100.0 / theFilterCounters.nTimeEnabled);
+	else
+		syslog(LOG_INFO, "%s", aLine);
+	memset(&theFilterCounters, 0, sizeof theFilterCounters);
+	theFilterEventCount = 0;
+
+}
+
+static void LogBreaker(void) {
+
+	if(theBreaker.nTripCount == theReportedTripCount)
+		return;
+	syslog(LOG_WARNING, "the filter fell behind %llu times, %llu key events bypassed it for %.1f s in all",
+		(unsigned long long)theBreaker.nTripCount, (unsigned long long)theBreaker.nBypassCount,
+		DKBClockToNanoseconds(&theClock, DKBBreakerGetBypassTime(&theBreaker, DKBClockNow(&theClock))) / 1e9);
+	theReportedTripCount = theBreaker.nTripCount;
+
+}
+
+static void LogLostWrites(void) {
+
+	uint64_t nLostSize;
+	uint64_t nLostWriteCount = DKBIOLoopGetLostWriteCount(theLoop, &nLostSize);
+	if(nLostWriteCount == theReportedLostWriteCount)
+		return;
+	syslog(LOG_WARNING, "the mirror devices did not take %llu writes, %llu passed key events were lost, a key may look held",
+		(unsigned long long)nLostWriteCount, (unsigned long long)(nLostSize / sizeof(struct input_event)));
+	theReportedLostWriteCount = nLostWriteCount;
+
+}
+
+static void DumpRecord(void) {
+
+	if(theRecorder.pEntries == NULL) {
+		syslog(LOG_WARNING, "no flight record to dump, start with -r");
+		return;
+	}
+	size_t nDumpedCount;
+	if(DKBRecorderDump(&theRecorder, &theClock, theRecordPath, &nDumpedCount) != 0)
+		syslog(LOG_WARNING, "cannot dump the flight record to %s: %m", theRecordPath);
+	else
+		syslog(LOG_INFO, "dumped the last %zu key events to %s", nDumpedCount, theRecordPath);
+
+}
+
+static void ExportSketch(uint64_t nNow, int isForced) {
+
+	// the counts only change with key events, which come with a round of the housekeeping
+	if(theSketch.pCounts == NULL)
+		return;
+	if(theSketchTime == 0 || isForced) {
+		if(DKBSketchGetCount(&theSketch) == theExportedSketchCount)
+			return; // the file already says it
+		theSketchTime = theSketchExportTime + theSketchPeriod;
+	}
+	if(!isForced && theSketchTime > nNow + DKBClockFromNanoseconds(&theClock, HOUSEKEEPING_SLACK * 1000000000ULL))
+		return; // ArmTimer wakes the loop for it
+	theSketchTime = 0;
+	theSketchExportTime = nNow;
+	uint64_t nCount = DKBSketchGetCount(&theSketch);
+	if(DKBSketchExport(&theSketch, theSketchPath) != 0)
+		syslog(LOG_WARNING, "cannot write the interval sketches to %s: %m", theSketchPath);
+	else
+		theExportedSketchCount = nCount;
+
+}
+
+static uint64_t ReleaseKeys(Device *pDevice, uint64_t nNow) {
+
+	// the deferred key-ups go to the mirror as the engine passed them, the timestamps are of uinput
+	uint64_t nNextTime = 0;
+	do {
+		DKBEvent aReleases[MAX_RELEASE_COUNT];
+		size_t nCount = DKBEngineReleaseKeys(&pDevice->aEngine, nNow, aReleases, MAX_RELEASE_COUNT, &nNextTime);
+		if(nCount == 0)
+			break;
+		struct input_event aEvents[MAX_RELEASE_COUNT + 1];
+		memset(aEvents, 0, sizeof aEvents);
+		size_t i;
+		for(i = 0; i < nCount; i++) {
+			aEvents[i].type = EV_KEY;
+			aEvents[i].code = aReleases[i].nKeyCode;
+			aEvents[i].value = 0;
+			DKBRecorderAdd(&theRecorder, &aReleases[i], DKB_VERDICT_PASS, &pDevice->aEngine, nNow);
+		}
+		aEvents[nCount].type = EV_SYN;
+		aEvents[nCount].code = SYN_REPORT;
+		if(write(pDevice->nSinkFile, aEvents, (nCount + 1) * sizeof(struct input_event)) < 0)
+			syslog(LOG_WARNING, "cannot release %zu keys held in the hold window on %s: %m", nCount, pDevice->aName);
+	} while(nNextTime == nNow); // more were due than fit
+	return nNextTime;
+
+}
+
+static void ArmTimer(void) {
+
+	// one deadline for all the pending work, none when there is none
+	uint64_t nTime = theRoundTime;
+	if(theReleaseTime != 0 && (nTime == 0 || theReleaseTime < nTime))
+		nTime = theReleaseTime;
+	if(theSketchTime != 0 && (nTime == 0 || theSketchTime < nTime))
+		nTime = theSketchTime;
+	if(nTime == theTimerTime)
+		return;
+	uint64_t nNanoseconds = DKBClockToNanoseconds(&theClock, nTime); // the ticks are of CLOCK_MONOTONIC too
+	struct itimerspec aDeadline;
+	memset(&aDeadline, 0, sizeof aDeadline);
+	aDeadline.it_value.tv_sec = nNanoseconds / 1000000000;
+	aDeadline.it_value.tv_nsec = nNanoseconds % 1000000000;
+	if(nTime != 0 && aDeadline.it_value.tv_sec == 0 && aDeadline.it_value.tv_nsec == 0)
+		aDeadline.it_value.tv_nsec = 1; // 0 would disarm it
+	if(timerfd_settime(theTimerFile, TFD_TIMER_ABSTIME, &aDeadline, NULL) != 0) {
+		syslog(LOG_WARNING, "cannot arm the housekeeping timer: %m");
+		return;
+	}
+	theTimerTime = nTime;
+
+}
+
+static void LogWakeups(void) {
+
+	double fIdleMinutes = DKBClockToNanoseconds(&theClock, theWakeups.aTimes[DKB_SCHED_IDLE]) / 60e9;
+	double fBusyMinutes = DKBClockToNanoseconds(&theClock, theWakeups.aTimes[DKB_SCHED_BUSY]) / 60e9;
+	syslog(LOG_INFO, "wakeups per minute: %.2f idle over %.1f minutes, %.2f busy over %.1f minutes",
+		(fIdleMinutes > 0) ? theWakeups.aWakeupCounts[DKB_SCHED_IDLE] / fIdleMinutes : 0, fIdleMinutes,
+		(fBusyMinutes > 0) ? theWakeups.aWakeupCounts[DKB_SCHED_BUSY] / fBusyMinutes : 0, fBusyMinutes);
+
+}
+
+static DKBConfig *LoadConfig(void) {
+
+	// the command line gives what the file does not say
+	DKBConfig *pConfig = DKBConfigCreate(NULL, theMinTimestampDiff, theAlertBounceRate);
+	if(pConfig == NULL)
+		return NULL;
+	pConfig->nMinHoldDiff = theMinHoldDiff;
+	if(theConfigPath == NULL)
+		return pConfig;
+	char aError[256];
+	if(DKBConfigParse(pConfig, theConfigPath, &theClock, aError, sizeof aError) != 0) {
+		syslog(LOG_ERR, "%s", aError);
+		DKBConfigDestroy(pConfig);
+		return NULL;
+	}
+	if(pConfig->nAppCount != 0)
+		syslog(LOG_WARNING, "the app thresholds of %s are not used here, input devices do not know the process a key goes to", theConfigPath);
+	return pConfig;
+
+}
+
+static void ReloadConfig(void) {
+
+	if(theConfigPath == NULL)
+		return;
+	DKBConfig *pConfig = LoadConfig();
+	if(pConfig == NULL) {
+		syslog(LOG_WARNING, "keeping the settings in use");
+		return;
+	}
+	// the devices pick it up with their next batch
+	DKBConfigPublish(&theConfigDomain, pConfig);
+	DKBConfigQuiesce(&theConfigDomain, theConfigReader);
+	DKBConfigReclaim(&theConfigDomain);
+	syslog(LOG_INFO, "read the settings from %s", theConfigPath);
+
+}
+
+static void ApplyConfig(Device *pDevice, const DKBConfig *pConfig) {
+
+	if(pDevice->nConfigGeneration == pConfig->nGeneration)
+		return; // the usual case, one compare per batch
+	DKBEngineSetMinTimestampDiff(&pDevice->aEngine, DKBConfigGetDeviceMinTimestampDiff(pConfig, pDevice->aName));
+	DKBEngineSetIntervalBase(&pDevice->aEngine, pConfig->nMinTimestampDiff); // the devices share the bucket bounds in the stats
+	DKBEngineSetAlertBounceRate(&pDevice->aEngine, pConfig->nAlertBounceRate);
+	DKBEngineSetMinHoldDiff(&pDevice->aEngine, pConfig->nMinHoldDiff);
+	DKBEngineSetKeyMinTimestampDiffs(&pDevice->aEngine, pConfig->hasKeyMinTimestampDiffs ? pConfig->aKeyMinTimestampDiffs : NULL);
+	pDevice->nConfigGeneration = pConfig->nGeneration;
+
+}
+
+static Device *OpenDevice(const char *pPath) {
+
+	Device *pDevice;
+	for(pDevice = theDevices; pDevice != NULL; pDevice = pDevice->pNext) {
+		if(strcmp(pDevice->aPath, pPath) == 0)
+			return pDevice; // already ours
+	}
+	int nSourceFile = open(pPath, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if(nSourceFile < 0)
+		return NULL;
+
+	// take only keyboards, a device has to report at least the letter keys or the keypad digits
+	char aName[256] = "";
+	unsigned long aKeyBits[BIT_ARRAY_SIZE(KEY_CNT)];
+	memset(aKeyBits, 0, sizeof aKeyBits);
+	if(ioctl(nSourceFile, EVIOCGNAME(sizeof aName - 1), aName) < 0
+		|| ioctl(nSourceFile, EVIOCGBIT(EV_KEY, sizeof aKeyBits), aKeyBits) < 0
+		|| strncmp(aName, DEVICE_NAME_PREFIX, strlen(DEVICE_NAME_PREFIX)) == 0 // one of our own
+		|| !((IS_BIT_SET(aKeyBits, KEY_A) && IS_BIT_SET(aKeyBits, KEY_Z)) || (IS_BIT_SET(aKeyBits, KEY_KP0) && IS_BIT_SET(aKeyBits, KEY_KP9)))) {
+		close(nSourceFile);
+		return NULL;
+	}
+
+	pDevice = NULL;
+	int nSinkFile = -1;
+	int isSuccess = 0;
+	do { // just for break
+		int nClock = CLOCK_MONOTONIC;
+		ioctl(nSourceFile, EVIOCSCLOCKID, &nClock); // old kernels stay with the wall clock
+		nSinkFile = CreateSink(nSourceFile, aName);
+		if(nSinkFile < 0)
+			break;
+		// pages of its own, pinning and unpinning it must not touch its neighbours on the heap
+		size_t nPageSize = (size_t)sysconf(_SC_PAGESIZE);
+		if(posix_memalign((void **)&pDevice, nPageSize, (sizeof(Device) + nPageSize - 1) & ~(nPageSize - 1)) != 0) {
+			pDevice = NULL;
+			break;
+		}
+		pDevice->pSeenCounters = calloc(DKB_KEY_CODE_COUNT, sizeof(DKBKeyCounters));
+		if(pDevice->pSeenCounters == NULL) {
+			free(pDevice);
+			pDevice = NULL;
+			break;
+		}
+		DKBEngineInit(&pDevice->aEngine, theMinTimestampDiff);
+		snprintf(pDevice->aName, sizeof pDevice->aName, "%s", aName);
+		pDevice->nConfigGeneration = 0;
+		ApplyConfig(pDevice, DKBConfigAcquire(&theConfigDomain));
+		if(DKBMemoryPin(pDevice, sizeof(Device)) != 0)
+			syslog(LOG_WARNING, "cannot lock the key state of %s in memory: %m", pPath);
+		pDevice->nSourceFile = nSourceFile;
+		pDevice->nSinkFile = nSinkFile;
+		snprintf(pDevice->aPath, sizeof pDevice->aPath, "%s", pPath);
+		if(ioctl(nSourceFile, EVIOCGRAB, 1) != 0) // somebody else has grabbed it
+			break;
+		pDevice->pChannel = DKBIOLoopAddChannel(theLoop, nSourceFile, nSinkFile, OnSourceData, OnSinkReady, OnSourceClosed, pDevice);
+		if(pDevice->pChannel == NULL) {
+			ioctl(nSourceFile, EVIOCGRAB, 0);
+			break;
+		}
+		isSuccess = 1;
+	} while(0);
+	if(!isSuccess) {
+		if(pDevice != NULL) {
+			free(pDevice->pSeenCounters);
+			DKBMemoryUnpin(pDevice, sizeof(Device));
+			free(pDevice);
+		}
+		if(nSinkFile >= 0) {
+			ioctl(nSinkFile, UI_DEV_DESTROY);
+			close(nSinkFile);
+		}
+		close(nSourceFile);
+		return NULL;
+	}
+	pDevice->pNext = theDevices;
+	theDevices = pDevice;
+	syslog(LOG_INFO, "filtering %s (%s)", pPath, aName);
+	return pDevice;
+
+}
+
+static int CreateSink(int nSourceFile, const char *pName) {
+
+	int nSinkFile = open(UINPUT_PATH, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if(nSinkFile < 0)
+		return -1;
+	unsigned long aKeyBits[BIT_ARRAY_SIZE(KEY_CNT)];
+	unsigned long aLedBits[BIT_ARRAY_SIZE(LED_CNT)];
+	memset(aKeyBits, 0, sizeof aKeyBits);
+	memset(aLedBits, 0, sizeof aLedBits);
+	ioctl(nSourceFile, EVIOCGBIT(EV_KEY, sizeof aKeyBits), aKeyBits);
+	ioctl(nSourceFile, EVIOCGBIT(EV_LED, sizeof aLedBits), aLedBits);
+	struct uinput_setup aSetup;
+	memset(&aSetup, 0, sizeof aSetup);
+	ioctl(nSourceFile, EVIOCGID, &aSetup.id);
+	snprintf(aSetup.name, sizeof aSetup.name, DEVICE_NAME_PREFIX "%s", pName);
+
+	int isSuccess = 0;
+	do { // just for break
+		// no EV_REP: the source repeats come through, the kernel must not add its own
+		if(ioctl(nSinkFile, UI_SET_EVBIT, EV_SYN) != 0 || ioctl(nSinkFile, UI_SET_EVBIT, EV_KEY) != 0
+			|| ioctl(nSinkFile, UI_SET_EVBIT, EV_MSC) != 0 || ioctl(nSinkFile, UI_SET_MSCBIT, MSC_SCAN) != 0
+			|| ioctl(nSinkFile, UI_SET_EVBIT, EV_LED) != 0)
+			break;
+		int i;
+		for(i = 0; i < KEY_CNT; i++) {
+			if(IS_BIT_SET(aKeyBits, i) && ioctl(nSinkFile, UI_SET_KEYBIT, i) != 0)
+				break;
+		}
+		if(i != KEY_CNT)
+			break;
+		for(i = 0; i < LED_CNT; i++) {
+			if(IS_BIT_SET(aLedBits, i) && ioctl(nSinkFile, UI_SET_LEDBIT, i) != 0)
+				break;
+		}
+		if(i != LED_CNT)
+			break;
+		if(ioctl(nSinkFile, UI_DEV_SETUP, &aSetup) != 0)
+			break;
+		if(ioctl(nSinkFile, UI_DEV_CREATE) != 0)
+			break;
+		isSuccess = 1;
+	} while(0);
+	if(!isSuccess) {
+		close(nSinkFile);
+		return -1;
+	}
+	return nSinkFile;
+
+}
+
+static void CloseDevice(Device *pDevice) {
+
+	Device **ppLink = &theDevices;
+	while(*ppLink != pDevice)
+		ppLink = &(*ppLink)->pNext;
+	*ppLink = pDevice->pNext;
+	DKBIOLoopRemoveChannel(theLoop, pDevice->pChannel);
+	ioctl(pDevice->nSourceFile, EVIOCGRAB, 0);
+	close(pDevice->nSourceFile);
+	ioctl(pDevice->nSinkFile, UI_DEV_DESTROY);
+	close(pDevice->nSinkFile);
+	syslog(LOG_INFO, "stopped filtering %s", pDevice->aPath);
+	DKBStatsCollect(&theStats, &pDevice->aEngine, pDevice->pSeenCounters); // what it counted stays in the totals
+	free(pDevice->pSeenCounters);
+	DKBMemoryUnpin(pDevice, sizeof(Device));
+	free(pDevice);
+
+}
+
+static size_t OnSourceData(DKBIOChannel *pChannel, void *pData, size_t nSize, void *pInfo) {
+
+	// the loop writes back what is left at the start of the buffer
+	Device *pDevice = pInfo;
+	ApplyConfig(pDevice, DKBConfigAcquire(&theConfigDomain));
+	struct input_event *pEvents = pData;
+	size_t nCount = nSize / sizeof(struct input_event);
+	uint64_t aDropMask[DKB_DROP_MASK_SIZE(MAX_BATCH_COUNT)];
+	memset(aDropMask, 0, sizeof aDropMask);
+	DKBPerfSample aCountersStart;
+	int isCounting = theIsDiagnosing && DKBPerfRead(&thePerf, &aCountersStart) == 0;
+	size_t nKeyEventCount = 0;
+	size_t nDropCount = 0;
+	// one reading per batch serves the breaker and the record, the events of a batch waited together
+	uint64_t nNow = (theBreaker.nBudget != 0 || theRecorder.pEntries != NULL) ? DKBClockNow(&theClock) : 0;
+	size_t i;
+	for(i = 0; i < nCount; i++) {
+		struct input_event *pInputEvent = &pEvents[i];
+		if(pInputEvent->type != EV_KEY || pInputEvent->value == 2) // autorepeats are passed as they are
+			continue;
+		DKBEvent aEvent;
+		memset(&aEvent, 0, sizeof aEvent);
+		aEvent.nTimestamp = DKBClockFromTimeval(&theClock, pInputEvent->input_event_sec, pInputEvent->input_event_usec);
+		aEvent.nKeyCode = pInputEvent->code;
+		aEvent.nType = (pInputEvent->value != 0) ? DKB_EVENT_KEY_DOWN : DKB_EVENT_KEY_UP;
+		nKeyEventCount++;
+		DKBSketchAdd(&theSketch, &aEvent, &pDevice->aEngine); // the interval to the key-up the engine holds, before judging
+		int nVerdict = DKB_VERDICT_PASS;
+		if(DKBBreakerCheck(&theBreaker, aEvent.nTimestamp, nNow))
+			DKBEngineTrackEvent(&pDevice->aEngine, &aEvent);
+		else
+			nVerdict = DKBEngineFilterEvent(&pDevice->aEngine, &aEvent);
+		if(nVerdict == DKB_VERDICT_DROP) {
+			aDropMask[i / 64] |= 1ULL << (i % 64);
+			nDropCount++;
+		}
+		DKBRecorderAdd(&theRecorder, &aEvent, nVerdict, &pDevice->aEngine, nNow);
+	}
+	size_t nPassCount = (nDropCount == 0) ? nCount : DKBCompact(pEvents, pEvents, sizeof(struct input_event), nCount, aDropMask);
+	if(isCounting) {
+		DKBPerfSample aCountersEnd;
+		if(DKBPerfRead(&thePerf, &aCountersEnd) == 0) {
+			DKBPerfAdd(&theFilterCounters, &aCountersStart, &aCountersEnd);
+			theFilterEventCount += nKeyEventCount;
+		}
+	}
+	DKBConfigQuiesce(&theConfigDomain, theConfigReader); // the engine may point into a freed config until the next ApplyConfig
+	if(nDropCount != 0 && pDevice->aEngine.nDeferredCount != 0) { // a deferral is a drop
+		uint64_t nReleaseTime;
+		DKBEngineReleaseKeys(&pDevice->aEngine, 0, NULL, 0, &nReleaseTime); // releases nothing, only looks up the next one
+		if(theReleaseTime == 0 || nReleaseTime < theReleaseTime) {
+			theReleaseTime = nReleaseTime;
+			ArmTimer();
+		}
+	}
+	if(nKeyEventCount != 0 && theRoundTime == 0) {
+		// the first key events after a quiet spell, the next ones until the housekeeping cost one compare
+		uint64_t nArmTime = DKBClockNow(&theClock);
+		theRoundTime = nArmTime + DKBClockFromNanoseconds(&theClock, HOUSEKEEPING_INTERVAL * 1000000000ULL);
+		ArmTimer();
+		if(theIsCountingWakeups)
+			DKBSchedWakeupsSwitch(&theWakeups, DKB_SCHED_BUSY, nArmTime);
+	}
+	return nPassCount * sizeof(struct input_event);
+
+}
+
+static void OnSinkReady(int nFile, void *pInfo) {
+
+	// LED changes requested from the mirror go back to the real keyboard
+	Device *pDevice = pInfo;
+	struct input_event aEvents[MAX_BATCH_COUNT];
+	ssize_t nSize;
+	while((nSize = read(nFile, aEvents, sizeof aEvents)) > 0) {
+		size_t nCount = nSize / sizeof(struct input_event);
+		size_t i;
+		for(i = 0; i < nCount; i++) {
+			if(aEvents[i].type == EV_LED || (aEvents[i].type == EV_SYN && aEvents[i].code == SYN_REPORT)) {
+				if(write(pDevice->nSourceFile, &aEvents[i], sizeof aEvents[i]) < 0)
+					break;
+			}
+		}
+	}
+
+}
+
+static void OnSourceClosed(DKBIOChannel *pChannel, void *pInfo) {
+
+	CloseDevice(pInfo); // unplugged
+
+}
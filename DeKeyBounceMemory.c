@@ -0,0 +1,96 @@
+/*
+ * DeKeyBounce
+ * Keeping the memory of the event path resident.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE /* for RUSAGE_THREAD */
+#endif
+
+#include "DeKeyBounceMemory.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+static void PageRange(void *pAddress, size_t nSize, uintptr_t *pStart, size_t *pLength);
+
+int DKBMemoryPin(void *pAddress, size_t nSize) {
+
+	uintptr_t nStart;
+	size_t nLength;
+	PageRange(pAddress, nSize, &nStart, &nLength);
+	size_t nPageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t nOffset;
+	for(nOffset = 0; nOffset < nLength; nOffset += nPageSize) {
+		// write the page back to itself, so copy-on-write and zero-fill faults happen now
+		volatile char *pPage = (volatile char *)(nStart + nOffset);
+		*pPage = *pPage;
+	}
+	return mlock((void *)nStart, nLength);
+
+}
+
+void DKBMemoryUnpin(void *pAddress, size_t nSize) {
+
+	uintptr_t nStart;
+	size_t nLength;
+	PageRange(pAddress, nSize, &nStart, &nLength);
+	munlock((void *)nStart, nLength);
+
+}
+
+void DKBMemoryPrefaultStack(void) {
+
+	volatile char aStack[DKB_STACK_PREFAULT_SIZE];
+	size_t nPageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t nOffset;
+	for(nOffset = 0; nOffset < sizeof aStack; nOffset += nPageSize)
+		aStack[nOffset] = 0;
+
+}
+
+void DKBMemoryGetFaults(uint64_t *pMinorFaults, uint64_t *pMajorFaults) {
+
+	struct rusage aUsage;
+#ifdef RUSAGE_THREAD
+	if(getrusage(RUSAGE_THREAD, &aUsage) != 0)
+#else
+	if(getrusage(RUSAGE_SELF, &aUsage) != 0) // process wide where there is nothing better
+#endif
+	{
+		*pMinorFaults = *pMajorFaults = 0;
+		return;
+	}
+	*pMinorFaults = aUsage.ru_minflt;
+	*pMajorFaults = aUsage.ru_majflt;
+
+}
+
+static void PageRange(void *pAddress, size_t nSize, uintptr_t *pStart, size_t *pLength) {
+
+	uintptr_t nPageMask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+	*pStart = (uintptr_t)pAddress & ~nPageMask;
+	*pLength = (((uintptr_t)pAddress + nSize + nPageMask) & ~nPageMask) - *pStart;
+
+}
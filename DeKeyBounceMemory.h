@@ -0,0 +1,54 @@
+/*
+ * DeKeyBounce
+ * Keeping the memory of the event path resident.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_MEMORY_H
+#define DEKEYBOUNCE_MEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DKB_STACK_PREFAULT_SIZE (64 * 1024)
+
+/*
+ * Pinning works on whole pages: it writes every page of the range back to
+ * itself and locks it, and unpinning unlocks every page. Whatever shares
+ * those pages is touched and unlocked along with it, so a pinned object
+ * gets pages of its own (page aligned, its size rounded up to pages).
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int DKBMemoryPin(void *pAddress, size_t nSize);
+void DKBMemoryUnpin(void *pAddress, size_t nSize);
+void DKBMemoryPrefaultStack(void);
+void DKBMemoryGetFaults(uint64_t *pMinorFaults, uint64_t *pMajorFaults);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_MEMORY_H */
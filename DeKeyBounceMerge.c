@@ -0,0 +1,305 @@
+/*
+ * DeKeyBounce
+ * A tool that merges the interval sketches of many daemons.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Every daemon started with -i writes the sketch of its intervals (see
+ * DeKeyBounceSketch.h); collected from a fleet, they are merged here by
+ * adding their counts, one worker per core each summing the files it
+ * takes into totals of its own, the totals summed at the end. A directory
+ * stands for the files in it, so tens of thousands of sketches need not
+ * be on the command line. The quantiles printed are those of the merged
+ * buckets, as good as those of a single sketch, in ms; the pauses longer
+ * than the bound of the last bucket read as that bound. -o writes the
+ * merge as a sketch again, to be merged further, and -k prints the
+ * buckets of one key.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "DeKeyBounceSketch.h"
+
+#define QUANTILE_COUNT 5
+
+typedef struct _MergeRun {
+
+	char **pPaths;
+	size_t nPathCount;
+	size_t nNextPath; // taken by the workers with an atomic add
+
+} MergeRun;
+
+typedef struct _MergeWorker {
+
+	MergeRun *pRun;
+	DKBSketchTotals *pTotals;
+	size_t nFileCount;
+	size_t nFailedCount;
+	pthread_t aThread;
+
+} MergeWorker;
+
+static const double theQuantiles[QUANTILE_COUNT] = { 0.5, 0.9, 0.99, 0.999, 1 };
+
+static void *Merge(void *pArgument);
+static int AddPath(MergeRun *pRun, size_t *pCapacity, const char *pPath);
+static int AddFile(MergeRun *pRun, size_t *pCapacity, char *pPath);
+static void PrintKey(const char *pName, const uint64_t *pCounts);
+static void PrintHistogram(const uint64_t *pCounts);
+static void Usage(const char *pName);
+
+int main (int argc, char * const argv[]) {
+
+	long nWorkerCount = 0;
+	long nKeyCode = -1;
+	const char *pOutputPath = NULL;
+	int nOption;
+	while((nOption = getopt(argc, argv, "j:k:o:")) != -1) {
+		switch(nOption) {
+		case 'j': nWorkerCount = strtol(optarg, NULL, 10); break;
+		case 'k': nKeyCode = strtol(optarg, NULL, 0); break;
+		case 'o': pOutputPath = optarg; break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if(optind == argc || nKeyCode >= DKB_SKETCH_KEY_COUNT) {
+		Usage(argv[0]);
+		return 1;
+	}
+	MergeRun aRun;
+	memset(&aRun, 0, sizeof aRun);
+	size_t nCapacity = 0;
+	int i;
+	for(i = optind; i < argc; i++) {
+		if(AddPath(&aRun, &nCapacity, argv[i]) != 0) {
+			perror(argv[i]);
+			return 1;
+		}
+	}
+	if(aRun.nPathCount == 0) {
+		fprintf(stderr, "DeKeyBounceMerge: no sketches\n");
+		return 1;
+	}
+	if(nWorkerCount <= 0)
+		nWorkerCount = sysconf(_SC_NPROCESSORS_ONLN);
+	if((size_t)nWorkerCount > aRun.nPathCount)
+		nWorkerCount = aRun.nPathCount;
+	MergeWorker *pWorkers = calloc(nWorkerCount, sizeof(MergeWorker));
+	if(pWorkers == NULL) {
+		perror("DeKeyBounceMerge");
+		return 1;
+	}
+	long j;
+	for(j = 0; j < nWorkerCount; j++) {
+		pWorkers[j].pRun = &aRun;
+		pWorkers[j].pTotals = calloc(1, sizeof(DKBSketchTotals));
+		if(pWorkers[j].pTotals == NULL) {
+			perror("DeKeyBounceMerge");
+			return 1;
+		}
+	}
+	long nStartedCount;
+	for(nStartedCount = 0; nStartedCount < nWorkerCount; nStartedCount++) {
+		if(pthread_create(&pWorkers[nStartedCount].aThread, NULL, Merge, &pWorkers[nStartedCount]) != 0)
+			break;
+	}
+	if(nStartedCount == 0)
+		Merge(&pWorkers[0]); // no thread to spare, do it here
+	for(j = 0; j < nStartedCount; j++)
+		pthread_join(pWorkers[j].aThread, NULL);
+
+	// the workers merged into the first one
+	MergeWorker *pTotal = &pWorkers[0];
+	for(j = 1; j < nWorkerCount; j++) {
+		DKBSketchMerge(pTotal->pTotals, pWorkers[j].pTotals);
+		pTotal->nFileCount += pWorkers[j].nFileCount;
+		pTotal->nFailedCount += pWorkers[j].nFailedCount;
+	}
+	int nResult = (pTotal->nFailedCount != 0) ? 1 : 0;
+	if(pOutputPath != NULL && DKBSketchWrite(pTotal->pTotals, pOutputPath) != 0) {
+		perror(pOutputPath);
+		nResult = 1;
+	}
+	uint64_t aAllCounts[DKB_SKETCH_BUCKET_COUNT];
+	memset(aAllCounts, 0, sizeof aAllCounts);
+	uint64_t nIntervalCount = 0;
+	size_t nCode, nBucket;
+	for(nCode = 0; nCode < DKB_SKETCH_KEY_COUNT; nCode++) {
+		for(nBucket = 0; nBucket < DKB_SKETCH_BUCKET_COUNT; nBucket++)
+			aAllCounts[nBucket] += pTotal->pTotals->aCounts[nCode][nBucket];
+	}
+	for(nBucket = 0; nBucket < DKB_SKETCH_BUCKET_COUNT; nBucket++)
+		nIntervalCount += aAllCounts[nBucket];
+	printf("%llu sketches from %zu files, %zu failed, %llu intervals\n", (unsigned long long)pTotal->pTotals->nSketchCount,
+		pTotal->nFileCount, pTotal->nFailedCount, (unsigned long long)nIntervalCount);
+	printf("%-6s %12s", "key", "intervals");
+	for(i = 0; i < QUANTILE_COUNT; i++)
+		printf(" %9.1f%%", theQuantiles[i] * 100);
+	printf("   (ms)\n");
+	if(nKeyCode >= 0) {
+		char aName[16];
+		snprintf(aName, sizeof aName, "%ld", nKeyCode);
+		PrintKey(aName, pTotal->pTotals->aCounts[nKeyCode]);
+		PrintHistogram(pTotal->pTotals->aCounts[nKeyCode]);
+	} else {
+		for(nCode = 0; nCode < DKB_SKETCH_KEY_COUNT; nCode++) {
+			char aName[16];
+			snprintf(aName, sizeof aName, "%zu", nCode);
+			PrintKey(aName, pTotal->pTotals->aCounts[nCode]);
+		}
+		PrintKey("all", aAllCounts);
+	}
+	for(j = 0; j < nWorkerCount; j++)
+		free(pWorkers[j].pTotals);
+	free(pWorkers);
+	for(nCode = 0; nCode < aRun.nPathCount; nCode++)
+		free(aRun.pPaths[nCode]);
+	free(aRun.pPaths);
+	return nResult;
+
+}
+
+static void *Merge(void *pArgument) {
+
+	MergeWorker *pWorker = pArgument;
+	MergeRun *pRun = pWorker->pRun;
+	size_t nIndex;
+	while((nIndex = __atomic_fetch_add(&pRun->nNextPath, 1, __ATOMIC_RELAXED)) < pRun->nPathCount) {
+		if(DKBSketchRead(pWorker->pTotals, pRun->pPaths[nIndex]) == 0) {
+			pWorker->nFileCount++;
+		} else {
+			fprintf(stderr, "%s: %s\n", pRun->pPaths[nIndex], (errno == EINVAL) ? "not a sketch" : strerror(errno));
+			pWorker->nFailedCount++;
+		}
+	}
+	return NULL;
+
+}
+
+static int AddPath(MergeRun *pRun, size_t *pCapacity, const char *pPath) {
+
+	struct stat aStat;
+	if(stat(pPath, &aStat) != 0)
+		return -1;
+	if(!S_ISDIR(aStat.st_mode))
+		return AddFile(pRun, pCapacity, strdup(pPath));
+	DIR *pDirectory = opendir(pPath);
+	if(pDirectory == NULL)
+		return -1;
+	int nResult = 0;
+	struct dirent *pEntry;
+	while((pEntry = readdir(pDirectory)) != NULL) {
+		size_t nLength = strlen(pEntry->d_name);
+		// no hidden files, nor the half-written ones of a daemon
+		if(pEntry->d_name[0] == '.' || (nLength > 4 && strcmp(pEntry->d_name + nLength - 4, ".tmp") == 0))
+			continue;
+		size_t nSize = strlen(pPath) + 1 + nLength + 1;
+		char *pEntryPath = malloc(nSize);
+		if(pEntryPath != NULL)
+			snprintf(pEntryPath, nSize, "%s/%s", pPath, pEntry->d_name);
+		if(AddFile(pRun, pCapacity, pEntryPath) != 0) {
+			nResult = -1;
+			break;
+		}
+	}
+	closedir(pDirectory);
+	return nResult;
+
+}
+
+static int AddFile(MergeRun *pRun, size_t *pCapacity, char *pPath) {
+
+	// takes the path, allocated by the caller
+	if(pPath == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if(pRun->nPathCount == *pCapacity) {
+		size_t nCapacity = (*pCapacity != 0) ? *pCapacity * 2 : 1024;
+		char **pPaths = realloc(pRun->pPaths, nCapacity * sizeof(char *));
+		if(pPaths == NULL) {
+			free(pPath);
+			errno = ENOMEM;
+			return -1;
+		}
+		pRun->pPaths = pPaths;
+		*pCapacity = nCapacity;
+	}
+	pRun->pPaths[pRun->nPathCount++] = pPath;
+	return 0;
+
+}
+
+static void PrintKey(const char *pName, const uint64_t *pCounts) {
+
+	uint64_t nCount = 0;
+	int i;
+	for(i = 0; i < DKB_SKETCH_BUCKET_COUNT; i++)
+		nCount += pCounts[i];
+	if(nCount == 0)
+		return;
+	printf("%-6s %12llu", pName, (unsigned long long)nCount);
+	for(i = 0; i < QUANTILE_COUNT; i++)
+		printf(" %10.3f", DKBSketchGetQuantile(pCounts, theQuantiles[i]) / 1000);
+	printf("\n");
+
+}
+
+static void PrintHistogram(const uint64_t *pCounts) {
+
+	uint64_t nMaxCount = 0;
+	int i;
+	for(i = 0; i < DKB_SKETCH_BUCKET_COUNT; i++) {
+		if(pCounts[i] > nMaxCount)
+			nMaxCount = pCounts[i];
+	}
+	if(nMaxCount == 0)
+		return;
+	printf("\n");
+	for(i = 0; i < DKB_SKETCH_BUCKET_COUNT; i++) {
+		if(pCounts[i] == 0)
+			continue;
+		char aBar[41];
+		int nLength = (int)(pCounts[i] * 40 / nMaxCount);
+		memset(aBar, '#', nLength);
+		aBar[nLength] = '\0';
+		printf("%10.3f ms %12llu %s\n", DKBSketchGetBucketValue(i) / 1000, (unsigned long long)pCounts[i], aBar);
+	}
+
+}
+
+static void Usage(const char *pName) {
+
+	fprintf(stderr, "usage: %s [-j workers] [-k code] [-o merged sketch] sketch|directory...\n", pName);
+
+}
@@ -0,0 +1,185 @@
+/*
+ * DeKeyBounce
+ * Hardware performance counters of the calling thread.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBouncePerf.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+typedef struct _CounterType {
+
+	const char *pName;
+	uint32_t nType;
+	uint64_t nConfig;
+
+} CounterType;
+
+#ifdef __linux__
+static const CounterType theCounterTypes[DKB_PERF_COUNTER_COUNT] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "l1d_misses", PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ "llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+};
+#else
+static const CounterType theCounterTypes[DKB_PERF_COUNTER_COUNT] = {
+	{ "cycles", 0, 0 },
+	{ "instructions", 0, 0 },
+	{ "branch_misses", 0, 0 },
+	{ "l1d_misses", 0, 0 },
+	{ "llc_misses", 0, 0 },
+};
+#endif
+
+int DKBPerfOpen(DKBPerf *pPerf) {
+
+	pPerf->nGroupFile = -1;
+	pPerf->nCounterCount = 0;
+	int i;
+	for(i = 0; i < DKB_PERF_COUNTER_COUNT; i++)
+		pPerf->aFiles[i] = -1;
+#ifdef __linux__
+	int nError = ENOENT;
+	for(i = 0; i < DKB_PERF_COUNTER_COUNT; i++) {
+		struct perf_event_attr aAttr;
+		memset(&aAttr, 0, sizeof aAttr);
+		aAttr.size = sizeof aAttr;
+		aAttr.type = theCounterTypes[i].nType;
+		aAttr.config = theCounterTypes[i].nConfig;
+		aAttr.disabled = (pPerf->nGroupFile < 0); // the leader starts the whole group
+		aAttr.exclude_kernel = 1;
+		aAttr.exclude_hv = 1;
+		aAttr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		int nFile = (int)syscall(__NR_perf_event_open, &aAttr, 0, -1, pPerf->nGroupFile, PERF_FLAG_FD_CLOEXEC);
+		if(nFile < 0) {
+			nError = errno; // not on this CPU, or no room left in the group
+			continue;
+		}
+		if(pPerf->nGroupFile < 0)
+			pPerf->nGroupFile = nFile;
+		pPerf->aFiles[i] = nFile;
+		pPerf->aOrder[pPerf->nCounterCount++] = i;
+	}
+	if(pPerf->nGroupFile < 0) {
+		errno = nError;
+		return -1;
+	}
+	if(ioctl(pPerf->nGroupFile, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP) != 0
+		|| ioctl(pPerf->nGroupFile, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) != 0) {
+		nError = errno;
+		DKBPerfClose(pPerf);
+		errno = nError;
+		return -1;
+	}
+	return 0;
+#else
+	errno = ENOSYS; // no public way to the PMU
+	return -1;
+#endif
+
+}
+
+void DKBPerfClose(DKBPerf *pPerf) {
+
+	int i;
+	for(i = 0; i < DKB_PERF_COUNTER_COUNT; i++) {
+		if(pPerf->aFiles[i] >= 0 && pPerf->aFiles[i] != pPerf->nGroupFile)
+			close(pPerf->aFiles[i]);
+		pPerf->aFiles[i] = -1;
+	}
+	if(pPerf->nGroupFile >= 0)
+		close(pPerf->nGroupFile); // the members first
+	pPerf->nGroupFile = -1;
+	pPerf->nCounterCount = 0;
+
+}
+
+int DKBPerfHasCounter(const DKBPerf *pPerf, int nCounter) {
+
+	return pPerf->aFiles[nCounter] >= 0;
+
+}
+
+int DKBPerfRead(const DKBPerf *pPerf, DKBPerfSample *pSample) {
+
+	memset(pSample, 0, sizeof *pSample);
+	if(pPerf->nGroupFile < 0)
+		return -1;
+	uint64_t aBuffer[3 + DKB_PERF_COUNTER_COUNT]; // the count, the two times, the values
+	ssize_t nSize = read(pPerf->nGroupFile, aBuffer, sizeof aBuffer);
+	if(nSize < (ssize_t)(3 * sizeof(uint64_t)) || aBuffer[0] != (uint64_t)pPerf->nCounterCount)
+		return -1;
+	pSample->nTimeEnabled = aBuffer[1];
+	pSample->nTimeRunning = aBuffer[2];
+	int i;
+	for(i = 0; i < pPerf->nCounterCount; i++)
+		pSample->aValues[pPerf->aOrder[i]] = aBuffer[3 + i];
+	return 0;
+
+}
+
+void DKBPerfAdd(DKBPerfSample *pTotal, const DKBPerfSample *pStart, const DKBPerfSample *pEnd) {
+
+	uint64_t nTimeEnabled = pEnd->nTimeEnabled - pStart->nTimeEnabled;
+	uint64_t nTimeRunning = pEnd->nTimeRunning - pStart->nTimeRunning;
+	pTotal->nTimeEnabled += nTimeEnabled;
+	pTotal->nTimeRunning += nTimeRunning;
+	if(nTimeRunning == 0)
+		return; // the group never got onto the PMU, nothing to scale up
+	int i;
+	for(i = 0; i < DKB_PERF_COUNTER_COUNT; i++) {
+		uint64_t nValue = pEnd->aValues[i] - pStart->aValues[i];
+		if(nTimeRunning < nTimeEnabled)
+			nValue = (uint64_t)((double)nValue * nTimeEnabled / nTimeRunning);
+		pTotal->aValues[i] += nValue;
+	}
+
+}
+
+const char *DKBPerfGetCounterName(int nCounter) {
+
+	return theCounterTypes[nCounter].pName;
+
+}
+
+int DKBPerfGetParanoidLevel(int *pLevel) {
+
+	FILE *pFile = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+	if(pFile == NULL)
+		return -1;
+	int isSuccess = (fscanf(pFile, "%d", pLevel) == 1);
+	fclose(pFile);
+	return isSuccess ? 0 : -1;
+
+}
@@ -0,0 +1,85 @@
+/*
+ * DeKeyBounce
+ * Hardware performance counters of the calling thread.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_PERF_H
+#define DEKEYBOUNCE_PERF_H
+
+#include <stdint.h>
+
+/*
+ * The counters are one perf_event_open group of the calling thread, so
+ * they are scheduled onto the PMU together and their ratios hold even
+ * when the kernel multiplexes. They count user space only, which needs
+ * no privilege while /proc/sys/kernel/perf_event_paranoid is 2 or less.
+ * A counter the CPU or the kernel does not offer is left out of the
+ * group; with none at all DKBPerfOpen fails. Elsewhere than on Linux
+ * DKBPerfOpen always fails.
+ *
+ * The group runs from DKBPerfOpen on, DKBPerfRead takes a snapshot and
+ * DKBPerfAdd adds what was counted between two snapshots to a total,
+ * scaled up if the group was off the PMU part of the time.
+ */
+
+#define DKB_PERF_CYCLES 0
+#define DKB_PERF_INSTRUCTIONS 1
+#define DKB_PERF_BRANCH_MISSES 2
+#define DKB_PERF_L1D_MISSES 3 /* data reads missing the first level cache */
+#define DKB_PERF_LLC_MISSES 4 /* references missing the last level cache */
+#define DKB_PERF_COUNTER_COUNT 5
+
+typedef struct _DKBPerfSample {
+
+	uint64_t nTimeEnabled; /* ns the thread ran with the group enabled */
+	uint64_t nTimeRunning; /* ns of them the group was on the PMU */
+	uint64_t aValues[DKB_PERF_COUNTER_COUNT];
+
+} DKBPerfSample;
+
+typedef struct _DKBPerf {
+
+	int nGroupFile; /* the group leader, -1 if closed */
+	int nCounterCount;
+	int aFiles[DKB_PERF_COUNTER_COUNT]; /* -1 for a counter left out */
+	int aOrder[DKB_PERF_COUNTER_COUNT]; /* the counter of every value of a group read */
+
+} DKBPerf;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int DKBPerfOpen(DKBPerf *pPerf);
+void DKBPerfClose(DKBPerf *pPerf);
+int DKBPerfHasCounter(const DKBPerf *pPerf, int nCounter);
+int DKBPerfRead(const DKBPerf *pPerf, DKBPerfSample *pSample);
+void DKBPerfAdd(DKBPerfSample *pTotal, const DKBPerfSample *pStart, const DKBPerfSample *pEnd);
+const char *DKBPerfGetCounterName(int nCounter);
+int DKBPerfGetParanoidLevel(int *pLevel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_PERF_H */
@@ -0,0 +1,64 @@
+/*
+ * DeKeyBounce
+ * The USDT probes of the engine and the daemons.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_PROBES_H
+#define DEKEYBOUNCE_PROBES_H
+
+/*
+ * The probes of DeKeyBounceProvider.d. A probe nobody traces is a nop
+ * in the code and its arguments are values at hand anyway, so they stay
+ * in release builds. On macOS they come from the header Xcode generates
+ * with dtrace -h, on Linux from the <sys/sdt.h> of systemtap
+ * (systemtap-sdt-dev or systemtap-sdt-devel), which bpftrace and perf
+ * attach to as usdt:...:dekeybounce:<probe>. Without either, or with
+ * DKB_NO_PROBES defined, they compile to nothing.
+ */
+
+#if defined(__APPLE__) && !defined(DKB_NO_PROBES)
+#include "DeKeyBounceProvider.h"
+#define DKB_HAS_PROBES 1
+#elif defined(__linux__) && defined(__has_include) && !defined(DKB_NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define DEKEYBOUNCE_EVENT(nKeyCode, nType, nTimestamp, nDevice) DTRACE_PROBE4(dekeybounce, event, nKeyCode, nType, nTimestamp, nDevice)
+#define DEKEYBOUNCE_PASS(nKeyCode, nType, nTimestamp) DTRACE_PROBE3(dekeybounce, pass, nKeyCode, nType, nTimestamp)
+#define DEKEYBOUNCE_DROP(nKeyCode, nType, nReason, nInterval) DTRACE_PROBE4(dekeybounce, drop, nKeyCode, nType, nReason, nInterval)
+#define DEKEYBOUNCE_KEY_INSERT(nKeyCode, nTimestamp) DTRACE_PROBE2(dekeybounce, key__insert, nKeyCode, nTimestamp)
+#define DEKEYBOUNCE_TAP_REENABLE(nEventType) DTRACE_PROBE1(dekeybounce, tap__reenable, nEventType)
+#define DEKEYBOUNCE_BREAKER(isOpen, nDelay) DTRACE_PROBE2(dekeybounce, breaker, isOpen, nDelay)
+#define DKB_HAS_PROBES 1
+#endif
+#endif
+
+#ifndef DKB_HAS_PROBES
+#define DEKEYBOUNCE_EVENT(nKeyCode, nType, nTimestamp, nDevice) do { (void)(nKeyCode); (void)(nType); (void)(nTimestamp); (void)(nDevice); } while(0)
+#define DEKEYBOUNCE_PASS(nKeyCode, nType, nTimestamp) do { (void)(nKeyCode); (void)(nType); (void)(nTimestamp); } while(0)
+#define DEKEYBOUNCE_DROP(nKeyCode, nType, nReason, nInterval) do { (void)(nKeyCode); (void)(nType); (void)(nReason); (void)(nInterval); } while(0)
+#define DEKEYBOUNCE_KEY_INSERT(nKeyCode, nTimestamp) do { (void)(nKeyCode); (void)(nTimestamp); } while(0)
+#define DEKEYBOUNCE_TAP_REENABLE(nEventType) do { (void)(nEventType); } while(0)
+#define DEKEYBOUNCE_BREAKER(isOpen, nDelay) do { (void)(isOpen); (void)(nDelay); } while(0)
+#endif
+
+#endif /* DEKEYBOUNCE_PROBES_H */
@@ -0,0 +1,87 @@
+/*
+ * DeKeyBounce
+ * The per-application profiles of the key events, by target process.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceProfile.h"
+
+#include <string.h>
+
+void DKBProfileCacheInit(DKBProfileCache *pCache) {
+
+	memset(pCache, 0, sizeof *pCache);
+	pCache->nProfile = DKB_PROFILE_NONE;
+
+}
+
+int DKBProfileCacheLookup(DKBProfileCache *pCache, int32_t nPid, uint64_t nGeneration, int *pProfile) {
+
+	// returns 0 when the caller has to look the process up and store it
+	if(nPid == pCache->nPid && nGeneration == pCache->nGeneration) {
+		__atomic_store_n(&pCache->nSameCount, pCache->nSameCount + 1, __ATOMIC_RELAXED);
+		*pProfile = pCache->nProfile;
+		return 1;
+	}
+	if(nGeneration != pCache->nGeneration) { // the profiles index the apps of another config
+		memset(pCache->aEntries, 0, sizeof pCache->aEntries);
+		pCache->nPid = 0; // the last process too, its profile is an index into the old apps
+		pCache->nGeneration = nGeneration;
+	}
+	DKBProfileCacheEntry *pEntry = &pCache->aEntries[nPid & (DKB_PROFILE_CACHE_SIZE - 1)];
+	if(nPid == 0 || pEntry->nPid != nPid) {
+		__atomic_store_n(&pCache->nMissCount, pCache->nMissCount + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	__atomic_store_n(&pCache->nHitCount, pCache->nHitCount + 1, __ATOMIC_RELAXED);
+	pCache->nPid = nPid;
+	pCache->nProfile = pEntry->nProfile;
+	*pProfile = pEntry->nProfile;
+	return 1;
+
+}
+
+int32_t DKBProfileCacheStore(DKBProfileCache *pCache, int32_t nPid, int nProfile) {
+
+	// returns the process pushed out of the cache, 0 for none
+	DKBProfileCacheEntry *pEntry = &pCache->aEntries[nPid & (DKB_PROFILE_CACHE_SIZE - 1)];
+	int32_t nEvictedPid = (pEntry->nPid != nPid) ? pEntry->nPid : 0;
+	pEntry->nPid = nPid;
+	pEntry->nProfile = nProfile;
+	pCache->nPid = nPid;
+	pCache->nProfile = nProfile;
+	return nEvictedPid;
+
+}
+
+void DKBProfileCacheRemove(DKBProfileCache *pCache, int32_t nPid) {
+
+	// the process exited, its id may come back for another one
+	DKBProfileCacheEntry *pEntry = &pCache->aEntries[nPid & (DKB_PROFILE_CACHE_SIZE - 1)];
+	if(pEntry->nPid == nPid) {
+		pEntry->nPid = 0;
+		__atomic_store_n(&pCache->nExitCount, pCache->nExitCount + 1, __ATOMIC_RELAXED);
+	}
+	if(pCache->nPid == nPid)
+		pCache->nPid = 0;
+
+}
@@ -0,0 +1,80 @@
+/*
+ * DeKeyBounce
+ * The per-application profiles of the key events, by target process.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_PROFILE_H
+#define DEKEYBOUNCE_PROFILE_H
+
+#include <stdint.h>
+
+/*
+ * A key event names the process it goes to, and the config may give that
+ * process a threshold of its own (an app line, see DeKeyBounceConfig).
+ * Finding it takes the name of the process, a system call too slow for
+ * every keystroke, so the filter thread keeps the profiles of the last few
+ * processes in a small direct-mapped cache. Almost all key events go to
+ * the same process as the one before, which costs a compare; switching
+ * between a few apps finds them in the cache. A process id stays valid
+ * until the process exits, so the cache is invalidated by exits and by a
+ * new config, never by the passing of time. Only the filter thread writes
+ * it; others read the counts with relaxed atomic loads.
+ */
+
+#define DKB_PROFILE_CACHE_SIZE 8 /* processes remembered, a power of 2 */
+#define DKB_PROFILE_NONE (-1) /* the thresholds of the config itself */
+
+typedef struct _DKBProfileCacheEntry {
+
+	int32_t nPid; /* 0 for a free entry */
+	int32_t nProfile;
+
+} DKBProfileCacheEntry;
+
+typedef struct _DKBProfileCache {
+
+	int32_t nPid; /* the process of the last key event */
+	int32_t nProfile; /* its profile */
+	uint64_t nGeneration; /* of the config the profiles index */
+	DKBProfileCacheEntry aEntries[DKB_PROFILE_CACHE_SIZE];
+	uint64_t nSameCount; /* key events to the process of the one before */
+	uint64_t nHitCount; /* key events to another process found in the cache */
+	uint64_t nMissCount; /* key events whose process had to be looked up */
+	uint64_t nExitCount; /* entries dropped for an exited process */
+
+} DKBProfileCache;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void DKBProfileCacheInit(DKBProfileCache *pCache);
+int DKBProfileCacheLookup(DKBProfileCache *pCache, int32_t nPid, uint64_t nGeneration, int *pProfile);
+int32_t DKBProfileCacheStore(DKBProfileCache *pCache, int32_t nPid, int nProfile);
+void DKBProfileCacheRemove(DKBProfileCache *pCache, int32_t nPid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_PROFILE_H */
@@ -0,0 +1,193 @@
+/*
+ * DeKeyBounce
+ * A flight recorder of the last key events, dumped as a trace on demand.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceRecorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "DeKeyBounceTrace.h"
+
+static void SortEntries(DKBRecorderEntry *pEntries, size_t nCount);
+static int WriteEntries(FILE *pFile, const DKBClock *pClock, const DKBRecorderEntry *pEntries, size_t nCount);
+
+int DKBRecorderInit(DKBRecorder *pRecorder, size_t nCount) {
+
+	memset(pRecorder, 0, sizeof *pRecorder);
+	if(nCount == 0)
+		return 0; // not recording
+	if(nCount > DKB_RECORDER_MAX_COUNT)
+		nCount = DKB_RECORDER_MAX_COUNT;
+	size_t nCapacity = 1;
+	while(nCapacity < nCount)
+		nCapacity <<= 1;
+	// pages of its own, the daemons pin it with DKBMemoryPin and unpinning must not touch its neighbours on the heap
+	size_t nPageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t nSize = (nCapacity * sizeof(DKBRecorderEntry) + nPageSize - 1) & ~(nPageSize - 1);
+	if(posix_memalign((void **)&pRecorder->pEntries, nPageSize, nSize) != 0) {
+		pRecorder->pEntries = NULL;
+		return -1;
+	}
+	memset(pRecorder->pEntries, 0, nSize);
+	pRecorder->nMask = nCapacity - 1;
+	return 0;
+
+}
+
+void DKBRecorderDeinit(DKBRecorder *pRecorder) {
+
+	free(pRecorder->pEntries);
+	memset(pRecorder, 0, sizeof *pRecorder);
+
+}
+
+void DKBRecorderAdd(DKBRecorder *pRecorder, const DKBEvent *pEvent, int nVerdict, const DKBEngine *pEngine, uint64_t nJudgedTime) {
+
+	if(pRecorder->pEntries == NULL)
+		return;
+	uint64_t nNext = pRecorder->nNext; // only this thread writes it
+	DKBRecorderEntry *pEntry = &pRecorder->pEntries[nNext & pRecorder->nMask];
+	pEntry->aEvent = *pEvent;
+	if(nVerdict == DKB_VERDICT_DROP)
+		pEntry->aEvent.nFlags |= DKB_TRACE_FLAG_DROPPED;
+	pEntry->nKeyState = (pEvent->nKeyCode < DKB_KEY_CODE_COUNT) ? pEngine->aKeyStates[pEvent->nKeyCode].nLastTimestamp : DKB_TIMESTAMP_UNSEEN;
+	pEntry->nJudgedTime = nJudgedTime;
+	__atomic_store_n(&pRecorder->nNext, nNext + 1, __ATOMIC_RELEASE);
+
+}
+
+int DKBRecorderDump(const DKBRecorder *pRecorder, const DKBClock *pClock, const char *pPath, size_t *pDumpedCount) {
+
+	*pDumpedCount = 0;
+	if(pRecorder->pEntries == NULL)
+		return 0;
+	size_t nCapacity = pRecorder->nMask + 1;
+	DKBRecorderEntry *pEntries = malloc(nCapacity * sizeof(DKBRecorderEntry));
+	if(pEntries == NULL)
+		return -1;
+	// the filter goes on meanwhile: an entry is whole if it was added before the copy and not overwritten during it
+	uint64_t nEnd = __atomic_load_n(&pRecorder->nNext, __ATOMIC_ACQUIRE);
+	uint64_t nStart = (nEnd > nCapacity) ? nEnd - nCapacity : 0;
+	size_t nFirst = nStart & pRecorder->nMask; // oldest first
+	size_t nCount = nEnd - nStart;
+	size_t nTailCount = (nFirst + nCount > nCapacity) ? nCapacity - nFirst : nCount;
+	memcpy(pEntries, &pRecorder->pEntries[nFirst], nTailCount * sizeof(DKBRecorderEntry));
+	memcpy(pEntries + nTailCount, pRecorder->pEntries, (nCount - nTailCount) * sizeof(DKBRecorderEntry));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	uint64_t nLaterEnd = __atomic_load_n(&pRecorder->nNext, __ATOMIC_RELAXED);
+	size_t nSkippedCount = 0;
+	if(nLaterEnd >= nStart + nCapacity) // the one being written at the end of the copy too
+		nSkippedCount = (nLaterEnd - nCapacity + 1 - nStart < nCount) ? nLaterEnd - nCapacity + 1 - nStart : nCount;
+	nCount -= nSkippedCount;
+	memmove(pEntries, pEntries + nSkippedCount, nCount * sizeof(DKBRecorderEntry));
+	SortEntries(pEntries, nCount);
+
+	char aTemporaryPath[1024];
+	snprintf(aTemporaryPath, sizeof aTemporaryPath, "%s.tmp", pPath);
+	int isSuccess = 0;
+	FILE *pFile = NULL;
+	do { // just for break
+		// the events are keystrokes: only the owner may read them, and no link may redirect them
+		int nFile = open(aTemporaryPath, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+		if(nFile < 0)
+			break;
+		pFile = fdopen(nFile, "wb");
+		if(pFile == NULL) {
+			close(nFile);
+			break;
+		}
+		if(WriteEntries(pFile, pClock, pEntries, nCount) != 0)
+			break;
+		int nResult = fclose(pFile);
+		pFile = NULL;
+		if(nResult != 0)
+			break;
+		if(rename(aTemporaryPath, pPath) != 0)
+			break;
+		isSuccess = 1;
+	} while(0);
+	if(pFile != NULL)
+		fclose(pFile);
+	free(pEntries);
+	if(!isSuccess) {
+		unlink(aTemporaryPath);
+		return -1;
+	}
+	*pDumpedCount = nCount;
+	return 0;
+
+}
+
+static void SortEntries(DKBRecorderEntry *pEntries, size_t nCount) {
+
+	// a trace is sorted by timestamp; the entries are already, but for the batches of several devices
+	// interleaving, so an insertion sort does about one compare per entry and keeps the filter order of ties
+	size_t i;
+	for(i = 1; i < nCount; i++) {
+		if(pEntries[i - 1].aEvent.nTimestamp <= pEntries[i].aEvent.nTimestamp)
+			continue;
+		DKBRecorderEntry aEntry = pEntries[i];
+		size_t j = i;
+		while(j > 0 && pEntries[j - 1].aEvent.nTimestamp > aEntry.aEvent.nTimestamp) {
+			pEntries[j] = pEntries[j - 1];
+			j--;
+		}
+		pEntries[j] = aEntry;
+	}
+
+}
+
+static int WriteEntries(FILE *pFile, const DKBClock *pClock, const DKBRecorderEntry *pEntries, size_t nCount) {
+
+	DKBTraceHeader aHeader;
+	DKBTraceHeaderInit(&aHeader, pClock->nTicksNumer, pClock->nTicksDenom);
+	aHeader.nEventCount = nCount;
+	if(DKBTraceWriteHeader(pFile, &aHeader) != 0)
+		return -1;
+	size_t i;
+	for(i = 0; i < nCount; i++) {
+		if(fwrite(&pEntries[i].aEvent, sizeof(DKBEvent), 1, pFile) != 1)
+			return -1;
+	}
+	DKBTraceJudgementHeader aJudgementHeader;
+	memset(&aJudgementHeader, 0, sizeof aJudgementHeader);
+	aJudgementHeader.nMagic = DKB_TRACE_JUDGEMENT_MAGIC;
+	aJudgementHeader.nRecordSize = sizeof(DKBTraceJudgement);
+	aJudgementHeader.nJudgementCount = nCount;
+	if(fwrite(&aJudgementHeader, sizeof aJudgementHeader, 1, pFile) != 1)
+		return -1;
+	for(i = 0; i < nCount; i++) {
+		DKBTraceJudgement aJudgement;
+		aJudgement.nKeyState = pEntries[i].nKeyState;
+		aJudgement.nJudgedTime = pEntries[i].nJudgedTime;
+		if(fwrite(&aJudgement, sizeof aJudgement, 1, pFile) != 1)
+			return -1;
+	}
+	return 0;
+
+}
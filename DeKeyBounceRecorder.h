@@ -0,0 +1,78 @@
+/*
+ * DeKeyBounce
+ * A flight recorder of the last key events, dumped as a trace on demand.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_RECORDER_H
+#define DEKEYBOUNCE_RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DeKeyBounceClock.h"
+#include "DeKeyBounceEngine.h"
+
+/*
+ * The recorder keeps the last events of the filter in a ring allocated
+ * once: each entry is the event with its verdict, the state the engine
+ * left for the key and the time the verdict was reached, so a dump shows
+ * what the filter saw and decided right before a complaint. One thread
+ * adds, with plain stores and a release store of the entry count; another
+ * may dump meanwhile, and drops the entries overwritten while it copied.
+ * The ring costs sizeof(DKBRecorderEntry) per event, the capacity being
+ * rounded up to a power of two and capped by DKB_RECORDER_MAX_COUNT, on
+ * whole pages of its own so that pinning it pins nothing else.
+ */
+
+#define DKB_RECORDER_MAX_COUNT (1UL << 20) /* 32 MB */
+
+typedef struct _DKBRecorderEntry {
+
+	DKBEvent aEvent; /* nFlags has DKB_TRACE_FLAG_DROPPED for a dropped one */
+	uint64_t nKeyState; /* DKBKeyState.nLastTimestamp right after the verdict */
+	uint64_t nJudgedTime; /* in the ticks of the event timestamps */
+
+} DKBRecorderEntry;
+
+typedef struct _DKBRecorder {
+
+	DKBRecorderEntry *pEntries; /* NULL when not recording */
+	size_t nMask; /* the capacity minus 1 */
+	uint64_t nNext; /* entries added since the start, released after each */
+
+} DKBRecorder;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int DKBRecorderInit(DKBRecorder *pRecorder, size_t nCount);
+void DKBRecorderDeinit(DKBRecorder *pRecorder);
+void DKBRecorderAdd(DKBRecorder *pRecorder, const DKBEvent *pEvent, int nVerdict, const DKBEngine *pEngine, uint64_t nJudgedTime);
+int DKBRecorderDump(const DKBRecorder *pRecorder, const DKBClock *pClock, const char *pPath, size_t *pDumpedCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_RECORDER_H */
@@ -0,0 +1,1265 @@
+/*
+ * DeKeyBounce
+ * A tool that replays a trace through the debounce engine.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "DeKeyBounceClock.h"
+#include "DeKeyBounceConfig.h" // the -s mode, build with DeKeyBounceConfig.c
+#include "DeKeyBounceEngine.h"
+#ifdef __linux__
+#include "DeKeyBounceIO.h" // the -i mode, build with DeKeyBounceIO.c
+#endif
+#include "DeKeyBounceSched.h"
+#include "DeKeyBounceScore.h" // the -e mode, build with DeKeyBounceScore.c
+#include "DeKeyBounceStats.h"
+#include "DeKeyBounceTrace.h"
+
+#define DEFAULT_MIN_TIMESTAMP_DIFF 20UL /* 20 ms */
+#define DEFAULT_LATENCY_RATE 2000 /* events per second */
+#define IO_CHANNEL_COUNT 4 /* stand-in devices of the -i mode */
+#define IO_WRITE_COUNT 16 /* events per write into a stand-in device */
+#define STRESS_READER_COUNT 4 /* filter threads of the -s mode */
+#define STRESS_BATCH_COUNT 64 /* events between two quiescent points */
+#define STRESS_ROUND_COUNT 64 /* times every filter thread goes through the events */
+
+#define CORPUS_VERDICT_SUFFIX ".verdicts" /* of the -W and -D files, after the trace file name */
+
+#define READ_BUFFER_COUNT 65536
+#define DEVICE_COUNT 256
+
+typedef struct _LatencyMessage {
+
+	DKBEvent aEvent;
+	uint64_t nSendTime;
+
+} LatencyMessage;
+
+typedef struct _LatencyRun {
+
+	const DKBSchedOptions *pSchedOptions;
+	DKBEngine *pEngine;
+	const DKBEvent *pEvents;
+	size_t nEventCount;
+	unsigned nRate;
+	int aPipe[2];
+	uint64_t *pLatencies;
+	int nSchedError;
+
+} LatencyRun;
+
+typedef struct _StressReader {
+
+	DKBConfigDomain *pDomain;
+	const DKBEvent *pEvents;
+	size_t nEventCount;
+	uint64_t nAppliedCount; // configs seen
+	uint64_t nErrorCount; // configs seen changing under the filter
+	pthread_t aThread;
+
+} StressReader;
+
+typedef struct _StressWriter {
+
+	DKBConfigDomain *pDomain;
+	uint64_t nMinTicksDiff;
+	unsigned nSeed;
+	uint64_t nPublishedCount;
+	pthread_t aThread;
+
+} StressWriter;
+
+typedef struct _CorpusTrace {
+
+	const char *pPath;
+	int nError; // errno, EINVAL for not a trace
+	int hasBaseline;
+	int isMerged; // into the stats, only traces with the clock of the first one are
+	uint64_t nEventCount;
+	uint64_t nDropCount[2]; // by event type
+	uint64_t nSpan; // ticks from the first event to the last
+	uint64_t nDiffCount; // verdicts other than in the baseline
+	uint64_t nFirstDiff;
+
+} CorpusTrace;
+
+typedef struct _CorpusRun {
+
+	CorpusTrace *pTraces;
+	size_t nTraceCount;
+	size_t nNextTrace; // taken by the workers with an atomic add
+	unsigned long nMinTimestampDiff; // ms, every trace has its own clock
+	unsigned long nMinHoldDiff;
+	uint16_t nAlertBounceRate;
+	const char *pVerdictDirectory;
+	const char *pBaselineDirectory;
+	uint32_t nTicksNumer; // of the merged stats
+	uint32_t nTicksDenom;
+
+} CorpusRun;
+
+typedef struct _CorpusWorker {
+
+	CorpusRun *pRun;
+	DKBEngine *pEngines[DEVICE_COUNT]; // allocated once, initialized again for every trace
+	DKBKeyCounters *pSeenCounters[DEVICE_COUNT];
+	DKBStats aStats;
+	uint64_t nSpan; // of the merged traces
+	pthread_t aThread;
+
+} CorpusWorker;
+
+#ifdef __linux__
+typedef struct _IOChannel {
+
+	DKBEngine aEngine;
+	int aPipe[2];
+	int nSinkFile;
+	uint64_t nEventCount;
+	uint64_t nPassCount;
+	DKBIOLoop *pLoop;
+	int *pOpenCount;
+
+} IOChannel;
+
+typedef struct _IOProducer {
+
+	IOChannel *pChannels;
+	const DKBEvent *pEvents;
+	size_t nEventCount;
+
+} IOProducer;
+#endif
+
+static DKBEvent theReadBuffer[READ_BUFFER_COUNT];
+static unsigned char theVerdicts[READ_BUFFER_COUNT];
+static DKBEngine *theEngines[DEVICE_COUNT]; // every device has its own key states
+static DKBStats theStats;
+static DKBKeyCounters *theSeenCounters[DEVICE_COUNT];
+static DKBScore *theScores[DEVICE_COUNT]; // the pending transitions are per device, as the key states
+static volatile int theBurnersShouldStop = 0;
+
+static int RunLatencyBenchmark(const DKBEvent *pEvents, size_t nEventCount, uint64_t nMinTicksDiff, unsigned nRate, unsigned nBurnerCount, const DKBSchedOptions *pSchedOptions);
+static int MeasureLatency(LatencyRun *pRun, const char *pName);
+static void *ProduceEvents(void *pArgument);
+static void *FilterEvents(void *pArgument);
+static void *BurnCpu(void *pArgument);
+#ifdef __linux__
+static int RunIOBenchmark(const DKBEvent *pEvents, size_t nEventCount, uint64_t nMinTicksDiff);
+static int MeasureIO(const DKBEvent *pEvents, size_t nEventCount, uint64_t nMinTicksDiff, int nBackend, int isPolling, const char *pName);
+static void *ProduceIOEvents(void *pArgument);
+static size_t OnIOData(DKBIOChannel *pChannel, void *pData, size_t nSize, void *pInfo);
+static void OnIOClosed(DKBIOChannel *pChannel, void *pInfo);
+#endif
+static int RunConfigStress(const DKBEvent *pEvents, size_t nEventCount, uint64_t nMinTicksDiff, unsigned nWriterCount);
+static int CheckStressConfig(const DKBConfig *pConfig);
+static void *ReadConfigs(void *pArgument);
+static void *WriteConfigs(void *pArgument);
+static volatile int theWritersShouldStop = 0;
+
+static int RunCorpus(char * const *pPaths, size_t nPathCount, CorpusRun *pRun, long nWorkerCount, const char *pHeatmapPath);
+static void *ReplayCorpus(void *pArgument);
+static void ReplayCorpusTrace(CorpusWorker *pWorker, CorpusTrace *pTrace);
+static int CompareBaseline(const CorpusRun *pRun, CorpusTrace *pTrace, const unsigned char *pVerdicts);
+static int WriteVerdicts(const CorpusRun *pRun, const CorpusTrace *pTrace, const unsigned char *pVerdicts);
+static void GetVerdictPath(const char *pDirectory, const char *pTracePath, char *pPath, size_t nSize);
+
+static int PrintFlightRecord(FILE *pTrace, const DKBTraceHeader *pHeader);
+static void PrintScore(const DKBScore *pScore, const DKBClock *pClock, unsigned long nMinTimestampDiff, unsigned long nMinHoldDiff);
+
+static int CompareLatencies(const void *pValue1, const void *pValue2);
+static uint64_t GetNanoseconds(void);
+static void Usage(const char *pName);
+
+int main (int argc, char * const argv[]) {
+
+	unsigned long nMinTimestampDiff = DEFAULT_MIN_TIMESTAMP_DIFF;
+	unsigned long nMinHoldDiff = 0;
+	const char *pVerdictPath = NULL;
+	const char *pHeatmapPath = NULL;
+	uint16_t nAlertBounceRate = DKB_DEFAULT_ALERT_BOUNCE_RATE;
+	size_t nLatencyEventCount = 0;
+	size_t nIOEventCount = 0;
+	unsigned nStressWriterCount = 0;
+	unsigned nLatencyRate = DEFAULT_LATENCY_RATE;
+	long nBurnerCount = -1;
+	int isPrintingRecord = 0;
+	int isScoring = 0;
+	long nWorkerCount = -1;
+	const char *pVerdictDirectory = NULL;
+	const char *pBaselineDirectory = NULL;
+	DKBSchedOptions aSchedOptions;
+	DKBSchedOptionsInit(&aSchedOptions);
+	int nOption;
+	while((nOption = getopt(argc, argv, "t:H:v:m:a:l:i:s:R:b:p:c:dej:W:D:")) != -1) {
+		switch(nOption) {
+		case 't': nMinTimestampDiff = strtoul(optarg, NULL, 10); break;
+		case 'H': nMinHoldDiff = strtoul(optarg, NULL, 10); break;
+		case 'v': pVerdictPath = optarg; break;
+		case 'm': pHeatmapPath = optarg; break;
+		case 'a': {
+			double fPercent = strtod(optarg, NULL);
+			nAlertBounceRate = (fPercent >= 100) ? DKB_RATE_ONE : (fPercent > 0) ? (uint16_t)(fPercent * DKB_RATE_ONE / 100) : 1;
+			break;
+		}
+		case 'l': nLatencyEventCount = strtoul(optarg, NULL, 10); break;
+		case 'i': nIOEventCount = strtoul(optarg, NULL, 10); break;
+		case 's': nStressWriterCount = strtoul(optarg, NULL, 10); break;
+		case 'R': nLatencyRate = strtoul(optarg, NULL, 10); break;
+		case 'b': nBurnerCount = strtol(optarg, NULL, 10); break;
+		case 'p':
+			if(DKBSchedParsePolicy(&aSchedOptions, optarg) != 0) {
+				Usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'c': aSchedOptions.nCpu = strtol(optarg, NULL, 10); break;
+		case 'd': isPrintingRecord = 1; break;
+		case 'e': isScoring = 1; break;
+		case 'j': nWorkerCount = strtol(optarg, NULL, 10); break;
+		case 'W': pVerdictDirectory = optarg; break;
+		case 'D': pBaselineDirectory = optarg; break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if(nLatencyEventCount > READ_BUFFER_COUNT) { // one read of the trace
+		fprintf(stderr, "%s: -l takes at most %d events\n", argv[0], READ_BUFFER_COUNT);
+		Usage(argv[0]);
+		return 1;
+	}
+	if(nIOEventCount > READ_BUFFER_COUNT) {
+		fprintf(stderr, "%s: -i takes at most %d events\n", argv[0], READ_BUFFER_COUNT);
+		Usage(argv[0]);
+		return 1;
+	}
+	if(nBurnerCount < 0)
+		nBurnerCount = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+	if(nMinTimestampDiff == 0 || nLatencyRate == 0 || optind == argc) {
+		Usage(argv[0]);
+		return 1;
+	}
+	if(optind < argc - 1 || nWorkerCount >= 0 || pVerdictDirectory != NULL || pBaselineDirectory != NULL) {
+		if(isScoring) {
+			Usage(argv[0]);
+			return 1;
+		}
+		CorpusRun aRun;
+		memset(&aRun, 0, sizeof aRun);
+		aRun.nMinTimestampDiff = nMinTimestampDiff;
+		aRun.nMinHoldDiff = nMinHoldDiff;
+		aRun.nAlertBounceRate = nAlertBounceRate;
+		aRun.pVerdictDirectory = pVerdictDirectory;
+		aRun.pBaselineDirectory = pBaselineDirectory;
+		return RunCorpus(&argv[optind], argc - optind, &aRun, nWorkerCount, pHeatmapPath);
+	}
+
+	FILE *pTrace = fopen(argv[optind], "rb");
+	if(pTrace == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+	DKBTraceHeader aHeader;
+	if(DKBTraceReadHeader(pTrace, &aHeader) != 0) {
+		fprintf(stderr, "%s: not a trace\n", argv[optind]);
+		fclose(pTrace);
+		return 1;
+	}
+	uint64_t nTraceReadCount = 0;
+	if(isPrintingRecord) {
+		int nResult = PrintFlightRecord(pTrace, &aHeader);
+		fclose(pTrace);
+		return nResult;
+	}
+	FILE *pVerdicts = NULL;
+	if(pVerdictPath != NULL && (pVerdicts = fopen(pVerdictPath, "wb")) == NULL) {
+		perror(pVerdictPath);
+		fclose(pTrace);
+		return 1;
+	}
+	DKBClock aClock;
+	DKBClockInitRatio(&aClock, aHeader.nTicksNumer, aHeader.nTicksDenom); // validated with the header
+	uint64_t nMinTicksDiff = DKBClockFromNanoseconds(&aClock, (uint64_t)nMinTimestampDiff * 1000000ULL); // from ms
+	uint64_t nMinHoldTicksDiff = DKBClockFromNanoseconds(&aClock, (uint64_t)nMinHoldDiff * 1000000ULL);
+	if(nLatencyEventCount > 0) {
+		nLatencyEventCount = DKBTraceReadEvents(pTrace, &aHeader, &nTraceReadCount, theReadBuffer, nLatencyEventCount);
+		fclose(pTrace);
+		if(pVerdicts != NULL)
+			fclose(pVerdicts);
+		return RunLatencyBenchmark(theReadBuffer, nLatencyEventCount, nMinTicksDiff, nLatencyRate, (unsigned)nBurnerCount, &aSchedOptions);
+	}
+	if(nIOEventCount > 0) {
+		nIOEventCount = DKBTraceReadEvents(pTrace, &aHeader, &nTraceReadCount, theReadBuffer, nIOEventCount);
+		fclose(pTrace);
+		if(pVerdicts != NULL)
+			fclose(pVerdicts);
+#ifdef __linux__
+		return RunIOBenchmark(theReadBuffer, nIOEventCount, nMinTicksDiff);
+#else
+		fprintf(stderr, "the I/O benchmark needs Linux\n");
+		return 1;
+#endif
+	}
+	if(nStressWriterCount > 0) {
+		size_t nStressEventCount = DKBTraceReadEvents(pTrace, &aHeader, &nTraceReadCount, theReadBuffer, READ_BUFFER_COUNT);
+		fclose(pTrace);
+		if(pVerdicts != NULL)
+			fclose(pVerdicts);
+		return RunConfigStress(theReadBuffer, nStressEventCount, nMinTicksDiff, nStressWriterCount);
+	}
+
+	uint64_t nEventCount = 0, nDropCount[2] = { 0, 0 }, nElapsed = 0;
+	uint64_t nLastTimestamp = 0;
+	int isSuccess = 1;
+	size_t nReadCount;
+	while((nReadCount = DKBTraceReadEvents(pTrace, &aHeader, &nTraceReadCount, theReadBuffer, READ_BUFFER_COUNT)) > 0) {
+		size_t i;
+		for(i = 0; i < nReadCount; i++) {
+			uint8_t nDevice = theReadBuffer[i].nDevice;
+			if(theEngines[nDevice] == NULL) {
+				if(posix_memalign((void **)&theEngines[nDevice], 64, sizeof(DKBEngine)) != 0) {
+					theEngines[nDevice] = NULL;
+					break;
+				}
+				theSeenCounters[nDevice] = calloc(DKB_KEY_CODE_COUNT, sizeof(DKBKeyCounters));
+				if(theSeenCounters[nDevice] == NULL)
+					break;
+				DKBEngineInit(theEngines[nDevice], nMinTicksDiff);
+				DKBEngineSetAlertBounceRate(theEngines[nDevice], nAlertBounceRate);
+				DKBEngineSetMinHoldDiff(theEngines[nDevice], nMinHoldTicksDiff);
+				if(isScoring) {
+					theScores[nDevice] = malloc(sizeof(DKBScore));
+					if(theScores[nDevice] == NULL)
+						break;
+					DKBScoreInit(theScores[nDevice]);
+				}
+			}
+		}
+		if(i != nReadCount) {
+			isSuccess = 0;
+			break;
+		}
+		uint64_t nStart = GetNanoseconds();
+		for(i = 0; i < nReadCount; i++)
+			theVerdicts[i] = DKBEngineFilterEvent(theEngines[theReadBuffer[i].nDevice], &theReadBuffer[i]);
+		nElapsed += GetNanoseconds() - nStart;
+		for(i = 0; i < nReadCount; i++) {
+			if(theVerdicts[i] == DKB_VERDICT_DROP)
+				nDropCount[theReadBuffer[i].nType & 1]++;
+		}
+		if(isScoring) {
+			for(i = 0; i < nReadCount; i++)
+				DKBScoreAdd(theScores[theReadBuffer[i].nDevice], &theReadBuffer[i], theVerdicts[i]);
+		}
+		if(nEventCount == 0)
+			DKBStatsReset(&theStats, theReadBuffer[0].nTimestamp);
+		nLastTimestamp = theReadBuffer[nReadCount - 1].nTimestamp;
+		nEventCount += nReadCount;
+		for(i = 0; i < DEVICE_COUNT; i++) { // often enough that no counter wraps in between
+			if(theEngines[i] != NULL)
+				DKBStatsCollect(&theStats, theEngines[i], theSeenCounters[i]);
+		}
+		if(pVerdicts != NULL && fwrite(theVerdicts, 1, nReadCount, pVerdicts) != nReadCount) {
+			isSuccess = 0;
+			break;
+		}
+	}
+	if(ferror(pTrace))
+		isSuccess = 0;
+	if(pVerdicts != NULL && fclose(pVerdicts) != 0)
+		isSuccess = 0;
+	fclose(pTrace);
+	DKBScore *pScore = NULL;
+	int i;
+	for(i = 0; i < DEVICE_COUNT; i++) {
+		free(theEngines[i]);
+		free(theSeenCounters[i]);
+		if(theScores[i] == NULL)
+			continue;
+		DKBScoreFinish(theScores[i]);
+		if(pScore == NULL) {
+			pScore = theScores[i];
+			continue;
+		}
+		DKBScoreMerge(pScore, theScores[i]);
+		free(theScores[i]);
+	}
+	if(isSuccess && pHeatmapPath != NULL && DKBStatsExport(&theStats, &aClock, nLastTimestamp, pHeatmapPath) != 0)
+		isSuccess = 0;
+	if(!isSuccess) {
+		perror("DeKeyBounceReplay");
+		return 1;
+	}
+
+	printf("events %llu passed %llu dropped %llu (down %llu up %llu)\n",
+		(unsigned long long)nEventCount, (unsigned long long)(nEventCount - nDropCount[0] - nDropCount[1]),
+		(unsigned long long)(nDropCount[0] + nDropCount[1]),
+		(unsigned long long)nDropCount[DKB_EVENT_KEY_DOWN], (unsigned long long)nDropCount[DKB_EVENT_KEY_UP]);
+	if(nMinHoldTicksDiff != 0) {
+		// a deferred key-up is dropped in the verdicts and counted passed once due, as the daemons emit it then
+		uint64_t nPressDropCount = 0, nCountedPassCount = 0;
+		for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+			nPressDropCount += theStats.aKeyTotals[i].nPressDropCount;
+			nCountedPassCount += theStats.aKeyTotals[i].nPassCount;
+		}
+		printf("of them in the hold window %llu, released after it %llu\n", (unsigned long long)nPressDropCount,
+			(unsigned long long)(nCountedPassCount - (nEventCount - nDropCount[0] - nDropCount[1])));
+	}
+	if(nEventCount > 0 && nElapsed > 0)
+		printf("%.2f ns/event %.1f Mevents/s\n", (double)nElapsed / nEventCount, nEventCount * 1000.0 / nElapsed);
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+		const DKBKeyHealth *pHealth = &theStats.aKeyTotals[i].aHealth;
+		if(pHealth->nAlerts == 0)
+			continue;
+		printf("key %d failing%s: recent bounce rate %.1f%% long-term %.1f%% median interval %.2f ms p90 %.2f ms\n", i,
+			(pHealth->nAlerts & DKB_ALERT_RISING) ? " and getting worse" : "",
+			pHealth->nFastBounceRate * 100.0 / DKB_RATE_ONE, pHealth->nSlowBounceRate * 100.0 / DKB_RATE_ONE,
+			DKBClockToNanoseconds(&aClock, pHealth->nIntervalMedian) / 1000000.0, DKBClockToNanoseconds(&aClock, pHealth->nIntervalHigh) / 1000000.0);
+	}
+	if(pScore != NULL) {
+		PrintScore(pScore, &aClock, nMinTimestampDiff, nMinHoldDiff);
+		free(pScore);
+	}
+	return 0;
+
+}
+
+static int RunLatencyBenchmark(const DKBEvent *pEvents, size_t nEventCount, uint64_t nMinTicksDiff, unsigned nRate, unsigned nBurnerCount, const DKBSchedOptions *pSchedOptions) {
+
+	// A producer writes the events into a pipe at a fixed rate, like the kernel
+	// does for an input device, and the filter thread reads, judges and notes
+	// how late it got to each one, while burner threads keep every CPU busy.
+	// The run is done with the default scheduling and then with the options.
+	if(nEventCount == 0)
+		return 1;
+	DKBEngine *pEngine = NULL;
+	if(posix_memalign((void **)&pEngine, 64, sizeof(DKBEngine)) != 0)
+		pEngine = NULL;
+	uint64_t *pLatencies = malloc(nEventCount * sizeof(uint64_t));
+	pthread_t *pBurners = calloc(nBurnerCount + 1, sizeof(pthread_t));
+	if(pEngine == NULL || pLatencies == NULL || pBurners == NULL) {
+		free(pEngine);
+		free(pLatencies);
+		free(pBurners);
+		return 1;
+	}
+	unsigned nStartedBurnerCount;
+	theBurnersShouldStop = 0;
+	for(nStartedBurnerCount = 0; nStartedBurnerCount < nBurnerCount; nStartedBurnerCount++) {
+		if(pthread_create(&pBurners[nStartedBurnerCount], NULL, BurnCpu, NULL) != 0)
+			break;
+	}
+	printf("%zu events at %u/s, %u CPU burners\n", nEventCount, nRate, nStartedBurnerCount);
+
+	DKBSchedOptions aDefaultOptions;
+	DKBSchedOptionsInit(&aDefaultOptions);
+	LatencyRun aRun = { &aDefaultOptions, pEngine, pEvents, nEventCount, nRate, { -1, -1 }, pLatencies, 0 };
+	DKBEngineInit(pEngine, nMinTicksDiff);
+	int isSuccess = (MeasureLatency(&aRun, "default") == 0);
+	if(isSuccess && (pSchedOptions->nPolicy != DKB_SCHED_DEFAULT || pSchedOptions->nCpu != DKB_SCHED_ANY_CPU)) {
+		aRun.pSchedOptions = pSchedOptions;
+		DKBEngineInit(pEngine, nMinTicksDiff);
+		isSuccess = (MeasureLatency(&aRun, "tuned") == 0);
+	}
+
+	theBurnersShouldStop = 1;
+	while(nStartedBurnerCount > 0)
+		pthread_join(pBurners[--nStartedBurnerCount], NULL);
+	free(pBurners);
+	free(pLatencies);
+	free(pEngine);
+	return isSuccess ? 0 : 1;
+
+}
+
+static int MeasureLatency(LatencyRun *pRun, const char *pName) {
+
+	if(pipe(pRun->aPipe) != 0)
+		return -1;
+	pthread_t aProducer, aFilter;
+	int isSuccess = 0;
+	if(pthread_create(&aFilter, NULL, FilterEvents, pRun) == 0) {
+		if(pthread_create(&aProducer, NULL, ProduceEvents, pRun) == 0) {
+			pthread_join(aProducer, NULL);
+			isSuccess = 1;
+		}
+		close(pRun->aPipe[1]); // the filter thread sees the end of file
+		pthread_join(aFilter, NULL);
+	} else {
+		close(pRun->aPipe[1]);
+	}
+	close(pRun->aPipe[0]);
+	if(!isSuccess)
+		return -1;
+	if(pRun->nSchedError != 0)
+		printf("%s: cannot apply the scheduling options: %s\n", pName, strerror(pRun->nSchedError));
+
+	size_t nCount = pRun->nEventCount;
+	qsort(pRun->pLatencies, nCount, sizeof(uint64_t), CompareLatencies);
+	printf("%s: added latency p50 %.1f us p99 %.1f us p99.9 %.1f us max %.1f us\n", pName,
+		pRun->pLatencies[nCount / 2] / 1000.0, pRun->pLatencies[(nCount * 99) / 100] / 1000.0,
+		pRun->pLatencies[(nCount * 999) / 1000] / 1000.0, pRun->pLatencies[nCount - 1] / 1000.0);
+	return 0;
+
+}
+
+static void *ProduceEvents(void *pArgument) {
+
+	LatencyRun *pRun = pArgument;
+	uint64_t nInterval = 1000000000ULL / pRun->nRate;
+	uint64_t nNextTime = GetNanoseconds();
+	size_t i;
+	for(i = 0; i < pRun->nEventCount; i++) {
+		nNextTime += nInterval;
+		uint64_t nNow = GetNanoseconds();
+		if(nNow < nNextTime) {
+			struct timespec aDelay = { (time_t)((nNextTime - nNow) / 1000000000ULL), (long)((nNextTime - nNow) % 1000000000ULL) };
+			nanosleep(&aDelay, NULL);
+		}
+		LatencyMessage aMessage;
+		aMessage.aEvent = pRun->pEvents[i];
+		aMessage.nSendTime = GetNanoseconds();
+		if(write(pRun->aPipe[1], &aMessage, sizeof aMessage) != sizeof aMessage)
+			break;
+	}
+	return NULL;
+
+}
+
+static void *FilterEvents(void *pArgument) {
+
+	LatencyRun *pRun = pArgument;
+	pRun->nSchedError = (DKBSchedApply(pRun->pSchedOptions) == 0) ? 0 : errno;
+	size_t nCount = 0;
+	LatencyMessage aMessage;
+	while(nCount < pRun->nEventCount && read(pRun->aPipe[0], &aMessage, sizeof aMessage) == sizeof aMessage) {
+		DKBEngineFilterEvent(pRun->pEngine, &aMessage.aEvent);
+		pRun->pLatencies[nCount++] = GetNanoseconds() - aMessage.nSendTime;
+	}
+	while(nCount < pRun->nEventCount)
+		pRun->pLatencies[nCount++] = UINT64_MAX; // lost, counts as infinitely late
+	return NULL;
+
+}
+
+static void *BurnCpu(void *pArgument) {
+
+	volatile uint64_t nCounter = 0;
+	while(!theBurnersShouldStop)
+		nCounter++;
+	return NULL;
+
+}
+
+#ifdef __linux__
+static int RunIOBenchmark(const DKBEvent *pEvents, size_t nEventCount, uint64_t nMinTicksDiff) {
+
+	// Pipes stand in for the devices and /dev/null for their mirrors; a
+	// producer pushes the events through them as fast as it can, so the
+	// loop sees the batches a busy set of keyboards would give it, and
+	// the backends are compared on throughput and syscalls per batch.
+	if(nEventCount == 0)
+		return 1;
+	printf("%zu events through %d channels, %d events per write\n", nEventCount, IO_CHANNEL_COUNT, IO_WRITE_COUNT);
+	int isSuccess = (MeasureIO(pEvents, nEventCount, nMinTicksDiff, DKB_IO_EPOLL, 0, "epoll") == 0);
+	if(isSuccess)
+		MeasureIO(pEvents, nEventCount, nMinTicksDiff, DKB_IO_URING, 0, "io_uring");
+	if(isSuccess)
+		MeasureIO(pEvents, nEventCount, nMinTicksDiff, DKB_IO_URING, 1, "io_uring sqpoll");
+	return isSuccess ? 0 : 1;
+
+}
+
+static int MeasureIO(const DKBEvent *pEvents, size_t nEventCount, uint64_t nMinTicksDiff, int nBackend, int isPolling, const char *pName) {
+
+	DKBIOLoop *pLoop = DKBIOLoopCreate(nBackend, isPolling);
+	if(pLoop == NULL) {
+		printf("%s: not available: %s\n", pName, strerror(errno));
+		return -1;
+	}
+	IOChannel *pChannels;
+	if(posix_memalign((void **)&pChannels, 64, IO_CHANNEL_COUNT * sizeof(IOChannel)) != 0) {
+		DKBIOLoopDestroy(pLoop);
+		return -1;
+	}
+	memset(pChannels, 0, IO_CHANNEL_COUNT * sizeof(IOChannel));
+	int nOpenCount = 0;
+	int isSuccess = 1;
+	int i;
+	for(i = 0; i < IO_CHANNEL_COUNT; i++) {
+		IOChannel *pChannel = &pChannels[i];
+		pChannel->aPipe[0] = pChannel->aPipe[1] = pChannel->nSinkFile = -1;
+		DKBEngineInit(&pChannel->aEngine, nMinTicksDiff);
+		pChannel->pLoop = pLoop;
+		pChannel->pOpenCount = &nOpenCount;
+		if(pipe(pChannel->aPipe) != 0 || (pChannel->nSinkFile = open("/dev/null", O_WRONLY | O_CLOEXEC)) < 0) {
+			isSuccess = 0;
+			break;
+		}
+		fcntl(pChannel->aPipe[0], F_SETFL, O_NONBLOCK); // the producer blocks when the loop falls behind
+		if(DKBIOLoopAddChannel(pLoop, pChannel->aPipe[0], pChannel->nSinkFile, OnIOData, NULL, OnIOClosed, pChannel) == NULL) {
+			isSuccess = 0;
+			break;
+		}
+		nOpenCount++;
+	}
+
+	pthread_t aProducer;
+	IOProducer aProducerArgument = { pChannels, pEvents, nEventCount };
+	uint64_t nStart = GetNanoseconds();
+	if(isSuccess && pthread_create(&aProducer, NULL, ProduceIOEvents, &aProducerArgument) == 0) {
+		isSuccess = (DKBIOLoopRun(pLoop) == 0);
+		pthread_join(aProducer, NULL);
+	} else {
+		isSuccess = 0;
+	}
+	uint64_t nElapsed = GetNanoseconds() - nStart;
+	uint64_t nSyscallCount = DKBIOLoopGetSyscallCount(pLoop);
+	DKBIOLoopDestroy(pLoop);
+
+	uint64_t nFilteredCount = 0, nPassCount = 0;
+	for(i = 0; i < IO_CHANNEL_COUNT; i++) {
+		nFilteredCount += pChannels[i].nEventCount;
+		nPassCount += pChannels[i].nPassCount;
+		if(pChannels[i].aPipe[0] >= 0)
+			close(pChannels[i].aPipe[0]);
+		if(pChannels[i].aPipe[1] >= 0)
+			close(pChannels[i].aPipe[1]);
+		if(pChannels[i].nSinkFile >= 0)
+			close(pChannels[i].nSinkFile);
+	}
+	free(pChannels);
+	if(!isSuccess) {
+		printf("%s: failed: %s\n", pName, strerror(errno));
+		return -1;
+	}
+	uint64_t nBatchCount = (nEventCount + IO_WRITE_COUNT - 1) / IO_WRITE_COUNT;
+	printf("%s: %llu events passed %llu, %.2f Mevents/s, %llu syscalls, %.3f per batch\n", pName,
+		(unsigned long long)nFilteredCount, (unsigned long long)nPassCount, nFilteredCount * 1000.0 / nElapsed,
+		(unsigned long long)nSyscallCount, (double)nSyscallCount / nBatchCount);
+	return 0;
+
+}
+
+static void *ProduceIOEvents(void *pArgument) {
+
+	IOProducer *pProducer = pArgument;
+	size_t nIndex = 0;
+	int nChannel = 0;
+	while(nIndex < pProducer->nEventCount) {
+		size_t nCount = pProducer->nEventCount - nIndex;
+		if(nCount > IO_WRITE_COUNT)
+			nCount = IO_WRITE_COUNT;
+		if(write(pProducer->pChannels[nChannel].aPipe[1], &pProducer->pEvents[nIndex], nCount * sizeof(DKBEvent)) < 0)
+			break;
+		nIndex += nCount;
+		nChannel = (nChannel + 1) % IO_CHANNEL_COUNT;
+	}
+	for(nChannel = 0; nChannel < IO_CHANNEL_COUNT; nChannel++) {
+		close(pProducer->pChannels[nChannel].aPipe[1]); // the loop sees the end of file
+		pProducer->pChannels[nChannel].aPipe[1] = -1;
+	}
+	return NULL;
+
+}
+
+static size_t OnIOData(DKBIOChannel *pChannel, void *pData, size_t nSize, void *pInfo) {
+
+	IOChannel *pIOChannel = pInfo;
+	DKBEvent *pEvents = pData;
+	size_t nCount = nSize / sizeof(DKBEvent);
+	size_t nPassCount = 0;
+	size_t i;
+	for(i = 0; i < nCount; i++) {
+		if(DKBEngineFilterEvent(&pIOChannel->aEngine, &pEvents[i]) == DKB_VERDICT_DROP)
+			continue;
+		if(nPassCount != i)
+			pEvents[nPassCount] = pEvents[i];
+		nPassCount++;
+	}
+	pIOChannel->nEventCount += nCount;
+	pIOChannel->nPassCount += nPassCount;
+	return nPassCount * sizeof(DKBEvent);
+
+}
+
+static void OnIOClosed(DKBIOChannel *pChannel, void *pInfo) {
+
+	IOChannel *pIOChannel = pInfo;
+	DKBIOLoopRemoveChannel(pIOChannel->pLoop, pChannel);
+	if(--*pIOChannel->pOpenCount == 0)
+		DKBIOLoopStop(pIOChannel->pLoop);
+
+}
+#endif
+
+static int RunConfigStress(const DKBEvent *pEvents, size_t nEventCount, uint64_t nMinTicksDiff, unsigned nWriterCount) {
+
+	// Filter threads go through the events in batches, taking the config at
+	// the start of each one, while writer threads publish new configs as fast
+	// as they can. Every config carries a pattern a reader checks before and
+	// after a batch, so one changed or freed under it shows up as an error
+	// (or as a use after free with -fsanitize=address).
+	if(nEventCount == 0)
+		return 1;
+	DKBConfigDomain aDomain;
+	DKBConfig *pConfig = DKBConfigCreate(NULL, nMinTicksDiff, DKB_DEFAULT_ALERT_BOUNCE_RATE);
+	if(pConfig == NULL || DKBConfigDomainInit(&aDomain, pConfig) != 0) {
+		DKBConfigDestroy(pConfig);
+		return 1;
+	}
+	StressReader aReaders[STRESS_READER_COUNT];
+	StressWriter *pWriters = calloc(nWriterCount, sizeof(StressWriter));
+	if(pWriters == NULL) {
+		DKBConfigDomainDeinit(&aDomain);
+		return 1;
+	}
+	uint64_t nStart = GetNanoseconds();
+	theWritersShouldStop = 0;
+	unsigned nStartedWriterCount, nStartedReaderCount;
+	for(nStartedWriterCount = 0; nStartedWriterCount < nWriterCount; nStartedWriterCount++) {
+		StressWriter *pWriter = &pWriters[nStartedWriterCount];
+		pWriter->pDomain = &aDomain;
+		pWriter->nMinTicksDiff = nMinTicksDiff;
+		pWriter->nSeed = nStartedWriterCount + 1;
+		if(pthread_create(&pWriter->aThread, NULL, WriteConfigs, pWriter) != 0)
+			break;
+	}
+	for(nStartedReaderCount = 0; nStartedReaderCount < STRESS_READER_COUNT; nStartedReaderCount++) {
+		StressReader *pReader = &aReaders[nStartedReaderCount];
+		memset(pReader, 0, sizeof *pReader);
+		pReader->pDomain = &aDomain;
+		pReader->pEvents = pEvents;
+		pReader->nEventCount = nEventCount;
+		if(pthread_create(&pReader->aThread, NULL, ReadConfigs, pReader) != 0)
+			break;
+	}
+	uint64_t nAppliedCount = 0, nErrorCount = 0;
+	unsigned i;
+	for(i = 0; i < nStartedReaderCount; i++) {
+		pthread_join(aReaders[i].aThread, NULL);
+		nAppliedCount += aReaders[i].nAppliedCount;
+		nErrorCount += aReaders[i].nErrorCount;
+	}
+	theWritersShouldStop = 1;
+	uint64_t nPublishedCount = 0;
+	for(i = 0; i < nStartedWriterCount; i++) {
+		pthread_join(pWriters[i].aThread, NULL);
+		nPublishedCount += pWriters[i].nPublishedCount;
+	}
+	uint64_t nElapsed = GetNanoseconds() - nStart;
+	size_t nPendingCount = DKBConfigReclaim(&aDomain);
+
+	printf("%u filter threads, %u writers, %.2f s\n", nStartedReaderCount, nStartedWriterCount, nElapsed / 1e9);
+	printf("published %llu configs, filters applied %llu, reclaimed %llu, pending %zu, errors %llu\n",
+		(unsigned long long)nPublishedCount, (unsigned long long)nAppliedCount,
+		(unsigned long long)aDomain.nReclaimedCount, nPendingCount, (unsigned long long)nErrorCount);
+	DKBConfigDomainDeinit(&aDomain);
+	free(pWriters);
+	return (nStartedReaderCount == STRESS_READER_COUNT && nStartedWriterCount == nWriterCount && nErrorCount == 0) ? 0 : 1;
+
+}
+
+static int CheckStressConfig(const DKBConfig *pConfig) {
+
+	// the writers give every key its own threshold from the one of the config
+	int i;
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i += 61) {
+		if(pConfig->aKeyMinTimestampDiffs[i] != pConfig->nMinTimestampDiff + (uint64_t)i)
+			return -1;
+	}
+	return 0;
+
+}
+
+static void *ReadConfigs(void *pArgument) {
+
+	StressReader *pReader = pArgument;
+	DKBConfigReader *pConfigReader = DKBConfigAddReader(pReader->pDomain);
+	DKBEngine *pEngine = NULL;
+	if(pConfigReader == NULL || posix_memalign((void **)&pEngine, 64, sizeof(DKBEngine)) != 0) {
+		pReader->nErrorCount++;
+		return NULL;
+	}
+	const DKBConfig *pConfig = DKBConfigAcquire(pReader->pDomain);
+	DKBEngineInit(pEngine, pConfig->nMinTimestampDiff);
+	uint64_t nGeneration = 0;
+	int nRound;
+	for(nRound = 0; nRound < STRESS_ROUND_COUNT; nRound++) {
+		size_t nOffset;
+		for(nOffset = 0; nOffset < pReader->nEventCount; nOffset += STRESS_BATCH_COUNT) {
+			pConfig = DKBConfigAcquire(pReader->pDomain);
+			if(pConfig->nGeneration != nGeneration) {
+				if(pConfig->nGeneration != 1 && CheckStressConfig(pConfig) != 0)
+					pReader->nErrorCount++;
+				DKBEngineSetMinTimestampDiff(pEngine, pConfig->nMinTimestampDiff);
+				DKBEngineSetIntervalBase(pEngine, pConfig->nMinTimestampDiff);
+				DKBEngineSetAlertBounceRate(pEngine, pConfig->nAlertBounceRate);
+				DKBEngineSetKeyMinTimestampDiffs(pEngine, pConfig->hasKeyMinTimestampDiffs ? pConfig->aKeyMinTimestampDiffs : NULL);
+				nGeneration = pConfig->nGeneration;
+				pReader->nAppliedCount++;
+			}
+			size_t nEnd = nOffset + STRESS_BATCH_COUNT;
+			if(nEnd > pReader->nEventCount)
+				nEnd = pReader->nEventCount;
+			size_t i;
+			for(i = nOffset; i < nEnd; i++)
+				DKBEngineFilterEvent(pEngine, &pReader->pEvents[i]);
+			if(pConfig->nGeneration != nGeneration || (nGeneration != 1 && CheckStressConfig(pConfig) != 0))
+				pReader->nErrorCount++;
+			DKBConfigQuiesce(pReader->pDomain, pConfigReader);
+		}
+	}
+	free(pEngine);
+	return NULL;
+
+}
+
+static void *WriteConfigs(void *pArgument) {
+
+	StressWriter *pWriter = pArgument;
+	while(!theWritersShouldStop) {
+		DKBConfig *pConfig = DKBConfigCreate(NULL, pWriter->nMinTicksDiff + rand_r(&pWriter->nSeed) % 1024, DKB_DEFAULT_ALERT_BOUNCE_RATE);
+		if(pConfig == NULL)
+			break;
+		int i;
+		for(i = 0; i < DKB_KEY_CODE_COUNT; i++)
+			pConfig->aKeyMinTimestampDiffs[i] = pConfig->nMinTimestampDiff + (uint64_t)i;
+		pConfig->hasKeyMinTimestampDiffs = 1;
+		DKBConfigPublish(pWriter->pDomain, pConfig);
+		pWriter->nPublishedCount++;
+	}
+	return NULL;
+
+}
+
+static int RunCorpus(char * const *pPaths, size_t nPathCount, CorpusRun *pRun, long nWorkerCount, const char *pHeatmapPath) {
+
+	// the traces go to the workers one by one, each replayed on fresh engines as if alone
+	if(nWorkerCount <= 0)
+		nWorkerCount = sysconf(_SC_NPROCESSORS_ONLN);
+	if((size_t)nWorkerCount > nPathCount)
+		nWorkerCount = nPathCount;
+	pRun->pTraces = calloc(nPathCount, sizeof(CorpusTrace));
+	CorpusWorker *pWorkers = calloc(nWorkerCount, sizeof(CorpusWorker));
+	if(pRun->pTraces == NULL || pWorkers == NULL) {
+		perror("DeKeyBounceReplay");
+		free(pRun->pTraces);
+		free(pWorkers);
+		return 1;
+	}
+	pRun->nTraceCount = nPathCount;
+	size_t i;
+	for(i = 0; i < nPathCount; i++)
+		pRun->pTraces[i].pPath = pPaths[i];
+	for(i = 0; i < nPathCount && pRun->nTicksNumer == 0; i++) { // the clock of the first trace is the one of the merged stats
+		FILE *pFirst = fopen(pPaths[i], "rb");
+		if(pFirst == NULL)
+			continue;
+		DKBTraceHeader aHeader;
+		if(DKBTraceReadHeader(pFirst, &aHeader) == 0) {
+			pRun->nTicksNumer = aHeader.nTicksNumer;
+			pRun->nTicksDenom = aHeader.nTicksDenom;
+		}
+		fclose(pFirst);
+	}
+
+	uint64_t nStart = GetNanoseconds();
+	long nStartedCount;
+	for(nStartedCount = 0; nStartedCount < nWorkerCount; nStartedCount++) {
+		pWorkers[nStartedCount].pRun = pRun;
+		DKBStatsReset(&pWorkers[nStartedCount].aStats, 0);
+		if(pthread_create(&pWorkers[nStartedCount].aThread, NULL, ReplayCorpus, &pWorkers[nStartedCount]) != 0)
+			break;
+	}
+	if(nStartedCount == 0)
+		ReplayCorpus(&pWorkers[0]); // no thread to spare, do it here
+	int j;
+	for(i = 0; i < (size_t)nStartedCount; i++)
+		pthread_join(pWorkers[i].aThread, NULL);
+	uint64_t nElapsed = GetNanoseconds() - nStart;
+	DKBStatsReset(&theStats, 0);
+	uint64_t nSpan = 0;
+	for(i = 0; i < (size_t)nWorkerCount; i++) {
+		DKBStatsMerge(&theStats, &pWorkers[i].aStats);
+		nSpan += pWorkers[i].nSpan;
+		for(j = 0; j < DEVICE_COUNT; j++) {
+			free(pWorkers[i].pEngines[j]);
+			free(pWorkers[i].pSeenCounters[j]);
+		}
+	}
+	free(pWorkers);
+
+	uint64_t nEventCount = 0, nDropCount[2] = { 0, 0 };
+	size_t nFailedCount = 0, nDifferingCount = 0, nUnmatchedCount = 0, nUnmergedCount = 0;
+	for(i = 0; i < nPathCount; i++) {
+		const CorpusTrace *pTrace = &pRun->pTraces[i];
+		if(pTrace->nError != 0) {
+			printf("%s: %s\n", pTrace->pPath, (pTrace->nError == EINVAL) ? "not a trace" : strerror(pTrace->nError));
+			nFailedCount++;
+			continue;
+		}
+		nEventCount += pTrace->nEventCount;
+		nDropCount[0] += pTrace->nDropCount[0];
+		nDropCount[1] += pTrace->nDropCount[1];
+		if(!pTrace->isMerged)
+			nUnmergedCount++;
+		printf("%s: events %llu passed %llu dropped %llu", pTrace->pPath, (unsigned long long)pTrace->nEventCount,
+			(unsigned long long)(pTrace->nEventCount - pTrace->nDropCount[0] - pTrace->nDropCount[1]),
+			(unsigned long long)(pTrace->nDropCount[0] + pTrace->nDropCount[1]));
+		if(pRun->pBaselineDirectory == NULL)
+			printf("\n");
+		else if(!pTrace->hasBaseline)
+			printf(", no baseline\n");
+		else if(pTrace->nDiffCount == 0)
+			printf(", as the baseline\n");
+		else
+			printf(", %llu verdicts differ from the baseline, the first at event %llu\n",
+				(unsigned long long)pTrace->nDiffCount, (unsigned long long)pTrace->nFirstDiff);
+		if(pTrace->nDiffCount != 0)
+			nDifferingCount++;
+		else if(pRun->pBaselineDirectory != NULL && !pTrace->hasBaseline)
+			nUnmatchedCount++;
+	}
+	printf("traces %zu events %llu passed %llu dropped %llu (down %llu up %llu)\n", nPathCount - nFailedCount,
+		(unsigned long long)nEventCount, (unsigned long long)(nEventCount - nDropCount[0] - nDropCount[1]),
+		(unsigned long long)(nDropCount[0] + nDropCount[1]),
+		(unsigned long long)nDropCount[DKB_EVENT_KEY_DOWN], (unsigned long long)nDropCount[DKB_EVENT_KEY_UP]);
+	if(nElapsed > 0)
+		printf("%ld workers %.3f s %.1f Mevents/s\n", nWorkerCount, nElapsed / 1e9, nEventCount * 1000.0 / nElapsed);
+	if(pRun->pBaselineDirectory != NULL)
+		printf("%zu traces differ from the baseline, %zu have none\n", nDifferingCount, nUnmatchedCount);
+	if(nUnmergedCount != 0)
+		printf("%zu traces with another clock are not in the stats\n", nUnmergedCount);
+	int nResult = (nFailedCount != 0 || nDifferingCount != 0) ? 1 : 0;
+	if(pHeatmapPath != NULL && pRun->nTicksNumer != 0) {
+		DKBClock aClock;
+		DKBClockInitRatio(&aClock, pRun->nTicksNumer, pRun->nTicksDenom);
+		if(DKBStatsExport(&theStats, &aClock, nSpan, pHeatmapPath) != 0) {
+			perror(pHeatmapPath);
+			nResult = 1;
+		}
+	}
+	free(pRun->pTraces);
+	return nResult;
+
+}
+
+static void *ReplayCorpus(void *pArgument) {
+
+	CorpusWorker *pWorker = pArgument;
+	CorpusRun *pRun = pWorker->pRun;
+	size_t nIndex;
+	while((nIndex = __atomic_fetch_add(&pRun->nNextTrace, 1, __ATOMIC_RELAXED)) < pRun->nTraceCount)
+		ReplayCorpusTrace(pWorker, &pRun->pTraces[nIndex]);
+	return NULL;
+
+}
+
+static void ReplayCorpusTrace(CorpusWorker *pWorker, CorpusTrace *pTrace) {
+
+	const CorpusRun *pRun = pWorker->pRun;
+	int nFile = open(pTrace->pPath, O_RDONLY);
+	if(nFile < 0) {
+		pTrace->nError = errno;
+		return;
+	}
+	struct stat aStat;
+	void *pMapping = MAP_FAILED;
+	if(fstat(nFile, &aStat) != 0)
+		pTrace->nError = errno;
+	else if((size_t)aStat.st_size < sizeof(DKBTraceHeader))
+		pTrace->nError = EINVAL;
+	else if((pMapping = mmap(NULL, aStat.st_size, PROT_READ, MAP_PRIVATE, nFile, 0)) == MAP_FAILED)
+		pTrace->nError = errno;
+	close(nFile);
+	if(pMapping == MAP_FAILED)
+		return;
+	madvise(pMapping, aStat.st_size, MADV_SEQUENTIAL);
+	const DKBTraceHeader *pHeader = pMapping;
+	unsigned char *pVerdicts = NULL;
+	do { // just for break
+		if(DKBTraceCheckHeader(pHeader) != 0) {
+			pTrace->nError = EINVAL;
+			break;
+		}
+		const DKBEvent *pEvents = (const DKBEvent *)(pHeader + 1);
+		size_t nCount = (aStat.st_size - sizeof(DKBTraceHeader)) / sizeof(DKBEvent);
+		if(pHeader->nEventCount != 0 && pHeader->nEventCount < nCount)
+			nCount = pHeader->nEventCount;
+		pTrace->nEventCount = nCount;
+		if(nCount > 0)
+			pTrace->nSpan = pEvents[nCount - 1].nTimestamp - pEvents[0].nTimestamp;
+		pTrace->isMerged = (pHeader->nTicksNumer == pRun->nTicksNumer && pHeader->nTicksDenom == pRun->nTicksDenom);
+		if(pRun->pVerdictDirectory != NULL || pRun->pBaselineDirectory != NULL) {
+			pVerdicts = malloc((nCount > 0) ? nCount : 1);
+			if(pVerdicts == NULL) {
+				pTrace->nError = errno;
+				break;
+			}
+		}
+		DKBClock aClock;
+		DKBClockInitRatio(&aClock, pHeader->nTicksNumer, pHeader->nTicksDenom);
+		uint64_t nMinTicksDiff = DKBClockFromNanoseconds(&aClock, (uint64_t)pRun->nMinTimestampDiff * 1000000ULL);
+		uint64_t nMinHoldTicksDiff = DKBClockFromNanoseconds(&aClock, (uint64_t)pRun->nMinHoldDiff * 1000000ULL);
+		unsigned char aIsInitialized[DEVICE_COUNT];
+		memset(aIsInitialized, 0, sizeof aIsInitialized);
+		size_t nChunk;
+		for(nChunk = 0; nChunk < nCount && pTrace->nError == 0; nChunk += READ_BUFFER_COUNT) {
+			size_t nChunkEnd = (nCount - nChunk < READ_BUFFER_COUNT) ? nCount : nChunk + READ_BUFFER_COUNT;
+			size_t i;
+			for(i = nChunk; i < nChunkEnd; i++) {
+				const DKBEvent *pEvent = &pEvents[i];
+				uint8_t nDevice = pEvent->nDevice;
+				if(!aIsInitialized[nDevice]) { // a trace never sees the key states of another
+					if(pWorker->pEngines[nDevice] == NULL) {
+						if(posix_memalign((void **)&pWorker->pEngines[nDevice], 64, sizeof(DKBEngine)) != 0) {
+							pWorker->pEngines[nDevice] = NULL;
+							pTrace->nError = ENOMEM;
+							break;
+						}
+						pWorker->pSeenCounters[nDevice] = malloc(DKB_KEY_CODE_COUNT * sizeof(DKBKeyCounters));
+						if(pWorker->pSeenCounters[nDevice] == NULL) {
+							pTrace->nError = ENOMEM;
+							break;
+						}
+					}
+					DKBEngineInit(pWorker->pEngines[nDevice], nMinTicksDiff);
+					DKBEngineSetAlertBounceRate(pWorker->pEngines[nDevice], pRun->nAlertBounceRate);
+					DKBEngineSetMinHoldDiff(pWorker->pEngines[nDevice], nMinHoldTicksDiff);
+					memset(pWorker->pSeenCounters[nDevice], 0, DKB_KEY_CODE_COUNT * sizeof(DKBKeyCounters));
+					aIsInitialized[nDevice] = 1;
+				}
+				int nVerdict = DKBEngineFilterEvent(pWorker->pEngines[nDevice], pEvent);
+				pTrace->nDropCount[pEvent->nType & 1] += nVerdict; // DKB_VERDICT_DROP is 1
+				if(pVerdicts != NULL)
+					pVerdicts[i] = nVerdict;
+			}
+			if(pTrace->isMerged) { // often enough that no counter wraps in between
+				for(i = 0; i < DEVICE_COUNT; i++) {
+					if(aIsInitialized[i])
+						DKBStatsCollect(&pWorker->aStats, pWorker->pEngines[i], pWorker->pSeenCounters[i]);
+				}
+			}
+		}
+		if(pTrace->nError != 0)
+			break;
+		if(pTrace->isMerged)
+			pWorker->nSpan += pTrace->nSpan;
+		if(pRun->pBaselineDirectory != NULL && CompareBaseline(pRun, pTrace, pVerdicts) != 0) {
+			pTrace->nError = errno;
+			break;
+		}
+		if(pRun->pVerdictDirectory != NULL && WriteVerdicts(pRun, pTrace, pVerdicts) != 0) {
+			pTrace->nError = errno;
+			break;
+		}
+	} while(0);
+	free(pVerdicts);
+	munmap(pMapping, aStat.st_size);
+
+}
+
+static int CompareBaseline(const CorpusRun *pRun, CorpusTrace *pTrace, const unsigned char *pVerdicts) {
+
+	// the baseline is what -v or -W wrote for the trace, a verdict byte per event
+	char aPath[1024];
+	GetVerdictPath(pRun->pBaselineDirectory, pTrace->pPath, aPath, sizeof aPath);
+	int nFile = open(aPath, O_RDONLY);
+	if(nFile < 0)
+		return (errno == ENOENT) ? 0 : -1; // hasBaseline stays 0
+	struct stat aStat;
+	if(fstat(nFile, &aStat) != 0) {
+		close(nFile);
+		return -1;
+	}
+	const unsigned char *pBaseline = NULL;
+	if(aStat.st_size > 0) {
+		pBaseline = mmap(NULL, aStat.st_size, PROT_READ, MAP_PRIVATE, nFile, 0);
+		if(pBaseline == MAP_FAILED) {
+			close(nFile);
+			return -1;
+		}
+	}
+	close(nFile);
+	pTrace->hasBaseline = 1;
+	uint64_t nCount = ((uint64_t)aStat.st_size < pTrace->nEventCount) ? (uint64_t)aStat.st_size : pTrace->nEventCount;
+	uint64_t i;
+	for(i = 0; i < nCount; i++) {
+		if(pVerdicts[i] != pBaseline[i]) {
+			if(pTrace->nDiffCount == 0)
+				pTrace->nFirstDiff = i;
+			pTrace->nDiffCount++;
+		}
+	}
+	if((uint64_t)aStat.st_size != pTrace->nEventCount) { // events missing on either side differ too
+		if(pTrace->nDiffCount == 0)
+			pTrace->nFirstDiff = nCount;
+		pTrace->nDiffCount += ((uint64_t)aStat.st_size > pTrace->nEventCount) ? aStat.st_size - pTrace->nEventCount : pTrace->nEventCount - aStat.st_size;
+	}
+	if(pBaseline != NULL)
+		munmap((void *)pBaseline, aStat.st_size);
+	return 0;
+
+}
+
+static int WriteVerdicts(const CorpusRun *pRun, const CorpusTrace *pTrace, const unsigned char *pVerdicts) {
+
+	char aPath[1024];
+	GetVerdictPath(pRun->pVerdictDirectory, pTrace->pPath, aPath, sizeof aPath);
+	FILE *pFile = fopen(aPath, "wb");
+	if(pFile == NULL)
+		return -1;
+	size_t nWrittenCount = fwrite(pVerdicts, 1, pTrace->nEventCount, pFile);
+	if((fclose(pFile) != 0) | (nWrittenCount != pTrace->nEventCount))
+		return -1;
+	return 0;
+
+}
+
+static void GetVerdictPath(const char *pDirectory, const char *pTracePath, char *pPath, size_t nSize) {
+
+	// by the file name alone, so a corpus and its baseline may live anywhere
+	const char *pName = strrchr(pTracePath, '/');
+	pName = (pName != NULL) ? pName + 1 : pTracePath;
+	snprintf(pPath, nSize, "%s/%s" CORPUS_VERDICT_SUFFIX, pDirectory, pName);
+
+}
+
+static int PrintFlightRecord(FILE *pTrace, const DKBTraceHeader *pHeader) {
+
+	// a dump of the daemon: the events with their verdicts and what the engine knew of the key then
+	if(pHeader->nEventCount == 0 || pHeader->nEventCount > READ_BUFFER_COUNT) {
+		fprintf(stderr, "not a flight record\n");
+		return 1;
+	}
+	uint64_t nReadCount = 0;
+	size_t nCount = DKBTraceReadEvents(pTrace, pHeader, &nReadCount, theReadBuffer, READ_BUFFER_COUNT);
+	DKBTraceJudgement *pJudgements = malloc(pHeader->nEventCount * sizeof(DKBTraceJudgement));
+	if(pJudgements == NULL) {
+		perror("DeKeyBounceReplay");
+		return 1;
+	}
+	if(nCount != pHeader->nEventCount || DKBTraceReadJudgements(pTrace, pHeader, pJudgements) != 0) {
+		fprintf(stderr, "not a flight record\n");
+		free(pJudgements);
+		return 1;
+	}
+	DKBClock aClock;
+	DKBClockInitRatio(&aClock, pHeader->nTicksNumer, pHeader->nTicksDenom);
+	size_t i;
+	for(i = 0; i < nCount; i++) {
+		const DKBEvent *pEvent = &theReadBuffer[i];
+		const DKBTraceJudgement *pJudgement = &pJudgements[i];
+		uint64_t nKeyTimestamp = pJudgement->nKeyState & DKB_TIMESTAMP_MASK;
+		char aKeyState[64];
+		if(pJudgement->nKeyState == DKB_TIMESTAMP_UNSEEN)
+			snprintf(aKeyState, sizeof aKeyState, "unseen");
+		else if(pJudgement->nKeyState == 0)
+			snprintf(aKeyState, sizeof aKeyState, "swallowing");
+		else
+			snprintf(aKeyState, sizeof aKeyState, "%s %.2f ms ago%s", (pJudgement->nKeyState & DKB_TIMESTAMP_KEY_DOWN) ? "down" : "up",
+				(pEvent->nTimestamp >= nKeyTimestamp) ? DKBClockToNanoseconds(&aClock, pEvent->nTimestamp - nKeyTimestamp) / 1000000.0 : 0.0,
+				(pJudgement->nKeyState & DKB_TIMESTAMP_PRESS_BOUNCE) ? ", press bounce" : "");
+		printf("%.3f ms device %u key %u %s %s, key %s, judged after %.1f us\n",
+			DKBClockToNanoseconds(&aClock, pEvent->nTimestamp - theReadBuffer[0].nTimestamp) / 1000000.0,
+			pEvent->nDevice, pEvent->nKeyCode, (pEvent->nType == DKB_EVENT_KEY_DOWN) ? "down" : "up",
+			(pEvent->nFlags & DKB_TRACE_FLAG_DROPPED) ? "dropped" : "passed", aKeyState,
+			(pJudgement->nJudgedTime >= pEvent->nTimestamp) ? DKBClockToNanoseconds(&aClock, pJudgement->nJudgedTime - pEvent->nTimestamp) / 1000.0 : 0.0);
+	}
+	free(pJudgements);
+	return 0;
+
+}
+
+static void PrintScore(const DKBScore *pScore, const DKBClock *pClock, unsigned long nMinTimestampDiff, unsigned long nMinHoldDiff) {
+
+	DKBKeyScore aTotal;
+	DKBScoreGetTotal(pScore, &aTotal);
+	if(DKBScoreGetLabeledCount(&aTotal) == 0) {
+		printf("no labeled events to score (%llu unlabeled)\n", (unsigned long long)pScore->nUnlabeledCount);
+		return;
+	}
+	printf("score of release %lu ms hold %lu ms: precision %.4f recall %.4f, %llu chatter passed, %llu genuine dropped"
+		" (and %llu the chatter had made already), %llu unlabeled\n",
+		nMinTimestampDiff, nMinHoldDiff, DKBScoreGetPrecision(&aTotal), DKBScoreGetRecall(&aTotal),
+		(unsigned long long)aTotal.nChatterPassCount, (unsigned long long)aTotal.nGenuineDropCount,
+		(unsigned long long)aTotal.nGenuineRedundantCount, (unsigned long long)pScore->nUnlabeledCount);
+	printf("added latency: %llu transitions delayed by %.2f ms on average, %.2f ms at most, %llu lost\n",
+		(unsigned long long)aTotal.nDelayedCount,
+		(aTotal.nDelayedCount != 0) ? DKBClockToNanoseconds(pClock, aTotal.nAddedLatencySum / aTotal.nDelayedCount) / 1000000.0 : 0.0,
+		DKBClockToNanoseconds(pClock, aTotal.nMaxAddedLatency) / 1000000.0, (unsigned long long)aTotal.nLostCount);
+	int i;
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+		const DKBKeyScore *pKeyScore = &pScore->aKeyScores[i];
+		if(DKBScoreGetLabeledCount(pKeyScore) == 0)
+			continue;
+		printf("key %d precision %.4f recall %.4f chatter %llu/%llu dropped genuine %llu/%llu dropped delayed %llu (max %.2f ms) lost %llu\n", i,
+			DKBScoreGetPrecision(pKeyScore), DKBScoreGetRecall(pKeyScore),
+			(unsigned long long)pKeyScore->nChatterDropCount, (unsigned long long)(pKeyScore->nChatterDropCount + pKeyScore->nChatterPassCount),
+			(unsigned long long)pKeyScore->nGenuineDropCount, (unsigned long long)(pKeyScore->nGenuineDropCount + pKeyScore->nGenuinePassCount),
+			(unsigned long long)pKeyScore->nDelayedCount, DKBClockToNanoseconds(pClock, pKeyScore->nMaxAddedLatency) / 1000000.0,
+			(unsigned long long)pKeyScore->nLostCount);
+	}
+
+}
+
+static int CompareLatencies(const void *pValue1, const void *pValue2) {
+
+	uint64_t nValue1 = *(const uint64_t *)pValue1, nValue2 = *(const uint64_t *)pValue2;
+	return (nValue1 > nValue2) - (nValue1 < nValue2);
+
+}
+
+static uint64_t GetNanoseconds(void) {
+
+	struct timespec aTime;
+	clock_gettime(CLOCK_MONOTONIC, &aTime);
+	return (uint64_t)aTime.tv_sec * 1000000000ULL + aTime.tv_nsec;
+
+}
+
+static void Usage(const char *pName) {
+
+	fprintf(stderr,
+		"usage: %s [-t min timestamp diff ms] [-H min hold ms] [-v verdicts] [-m heatmap.json|.csv] [-a alert bounce rate %%] [-e] trace\n"
+		"       %s -l events (up to 65536) [-R events per second] [-b burner threads]\n"
+		"\t[-p fifo|rr|other[:priority]] [-c cpu] [-t min timestamp diff ms] trace\n"
+		"       %s -i events (up to 65536) [-t min timestamp diff ms] trace\n"
+		"       %s -s config writers [-t min timestamp diff ms] trace\n"
+		"       %s -d flight record\n"
+		"       %s [-j workers] [-W verdict dir] [-D baseline verdict dir] [-t min timestamp diff ms] [-H min hold ms]\n"
+		"\t[-m heatmap.json|.csv] [-a alert bounce rate %%] trace...\n", pName, pName, pName, pName, pName, pName);
+
+}
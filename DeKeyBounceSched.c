@@ -0,0 +1,165 @@
+/*
+ * DeKeyBounce
+ * Scheduling policy and CPU placement of the filter thread.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE /* for pthread_setaffinity_np */
+#endif
+
+#include "DeKeyBounceSched.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#include <pthread/qos.h>
+#endif
+
+#define TIME_CONSTRAINT_COMPUTATION 500000ULL /* 0.5 ms of CPU per wakeup */
+#define TIME_CONSTRAINT_CONSTRAINT 1000000ULL /* done within 1 ms after the wakeup */
+
+void DKBSchedOptionsInit(DKBSchedOptions *pOptions) {
+
+	pOptions->nPolicy = DKB_SCHED_DEFAULT;
+	pOptions->nPriority = DKB_SCHED_DEFAULT_PRIORITY;
+	pOptions->nCpu = DKB_SCHED_ANY_CPU;
+
+}
+
+int DKBSchedParsePolicy(DKBSchedOptions *pOptions, const char *pSpec) {
+
+	// "fifo", "rr" or "other", optionally followed by ":priority"
+	size_t nLength = strcspn(pSpec, ":");
+	if(nLength == 4 && strncmp(pSpec, "fifo", 4) == 0)
+		pOptions->nPolicy = DKB_SCHED_FIFO;
+	else if(nLength == 2 && strncmp(pSpec, "rr", 2) == 0)
+		pOptions->nPolicy = DKB_SCHED_RR;
+	else if(nLength == 5 && strncmp(pSpec, "other", 5) == 0)
+		pOptions->nPolicy = DKB_SCHED_DEFAULT;
+	else
+		return -1;
+	if(pSpec[nLength] == ':') {
+		char *pEnd;
+		long nPriority = strtol(pSpec + nLength + 1, &pEnd, 10);
+		if(*pEnd != '\0' || nPriority < 1 || nPriority > 99)
+			return -1;
+		pOptions->nPriority = (int)nPriority;
+	}
+	return 0;
+
+}
+
+int DKBSchedApply(const DKBSchedOptions *pOptions) {
+
+#ifdef __APPLE__
+	if(pOptions->nCpu != DKB_SCHED_ANY_CPU) {
+		errno = ENOTSUP; // Darwin has affinity hints only, no pinning
+		return -1;
+	}
+	if(pOptions->nPolicy == DKB_SCHED_DEFAULT)
+		return 0;
+	pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+	mach_timebase_info_data_t aTimebase;
+	mach_timebase_info(&aTimebase);
+	thread_time_constraint_policy_data_t aPolicy;
+	aPolicy.period = 0; // key events are aperiodic
+	aPolicy.computation = (uint32_t)(TIME_CONSTRAINT_COMPUTATION * aTimebase.denom / aTimebase.numer);
+	aPolicy.constraint = (uint32_t)(TIME_CONSTRAINT_CONSTRAINT * aTimebase.denom / aTimebase.numer);
+	aPolicy.preemptible = TRUE;
+	mach_port_t aThread = pthread_mach_thread_np(pthread_self());
+	if(thread_policy_set(aThread, THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&aPolicy, THREAD_TIME_CONSTRAINT_POLICY_COUNT) != KERN_SUCCESS) {
+		errno = EPERM;
+		return -1;
+	}
+	return 0;
+#else
+	if(pOptions->nCpu != DKB_SCHED_ANY_CPU) {
+		cpu_set_t aCpuSet;
+		CPU_ZERO(&aCpuSet);
+		CPU_SET(pOptions->nCpu, &aCpuSet);
+		int nError = pthread_setaffinity_np(pthread_self(), sizeof aCpuSet, &aCpuSet);
+		if(nError != 0) {
+			errno = nError;
+			return -1;
+		}
+	}
+	if(pOptions->nPolicy == DKB_SCHED_DEFAULT)
+		return 0;
+	struct sched_param aParam;
+	memset(&aParam, 0, sizeof aParam);
+	aParam.sched_priority = pOptions->nPriority;
+	int nError = pthread_setschedparam(pthread_self(), (pOptions->nPolicy == DKB_SCHED_FIFO) ? SCHED_FIFO : SCHED_RR, &aParam);
+	if(nError != 0) {
+		errno = nError;
+		return -1;
+	}
+	return 0;
+#endif
+
+}
+
+uint64_t DKBSchedGetWakeupCount(void) {
+
+#ifdef __APPLE__
+	task_power_info_data_t aInfo;
+	mach_msg_type_number_t nCount = TASK_POWER_INFO_COUNT;
+	if(task_info(mach_task_self(), TASK_POWER_INFO, (task_info_t)&aInfo, &nCount) != KERN_SUCCESS)
+		return 0;
+	return aInfo.task_interrupt_wakeups + aInfo.task_platform_idle_wakeups;
+#else
+	struct rusage aUsage;
+	if(getrusage(RUSAGE_SELF, &aUsage) != 0)
+		return 0;
+	return aUsage.ru_nvcsw; // every wait for an event or a timer that blocked
+#endif
+
+}
+
+void DKBSchedWakeupsInit(DKBSchedWakeups *pWakeups, int nState, uint64_t nNow) {
+
+	memset(pWakeups, 0, sizeof *pWakeups);
+	pWakeups->nState = nState;
+	pWakeups->nStateTime = nNow;
+	pWakeups->nStateWakeupCount = DKBSchedGetWakeupCount();
+
+}
+
+void DKBSchedWakeupsSwitch(DKBSchedWakeups *pWakeups, int nState, uint64_t nNow) {
+
+	if(nState == pWakeups->nState)
+		return;
+	uint64_t nWakeupCount = DKBSchedGetWakeupCount();
+	pWakeups->aTimes[pWakeups->nState] += nNow - pWakeups->nStateTime;
+	pWakeups->aWakeupCounts[pWakeups->nState] += nWakeupCount - pWakeups->nStateWakeupCount;
+	pWakeups->nState = nState;
+	pWakeups->nStateTime = nNow;
+	pWakeups->nStateWakeupCount = nWakeupCount;
+
+}
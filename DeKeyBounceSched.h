@@ -0,0 +1,86 @@
+/*
+ * DeKeyBounce
+ * Scheduling policy and CPU placement of the filter thread.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_SCHED_H
+#define DEKEYBOUNCE_SCHED_H
+
+#include <stdint.h>
+
+#define DKB_SCHED_DEFAULT 0
+#define DKB_SCHED_FIFO 1
+#define DKB_SCHED_RR 2
+
+#define DKB_SCHED_DEFAULT_PRIORITY 50
+#define DKB_SCHED_ANY_CPU -1
+
+typedef struct _DKBSchedOptions {
+
+	int nPolicy; /* DKB_SCHED_*; on Darwin any real-time policy means a time constraint policy */
+	int nPriority;
+	int nCpu; /* DKB_SCHED_ANY_CPU or the CPU to pin to, not supported on Darwin */
+
+} DKBSchedOptions;
+
+/*
+ * DKBSchedGetWakeupCount tells how many times the threads of the process
+ * were woken up, as the kernel counts them: the voluntary context switches
+ * on Linux, the interrupt and idle exit wakeups of the task on Darwin, 0
+ * where neither is known. DKBSchedWakeups splits them between the spans a
+ * daemon is idle, with no work pending and so no timer armed, and the
+ * spans it is busy, from a key event until the work it brought is done,
+ * the wakeup for the key event which ends an idle span counting to it.
+ * DKBSchedWakeupsSwitch is called by one thread at every change, with the
+ * time in any ticks.
+ */
+
+#define DKB_SCHED_IDLE 0
+#define DKB_SCHED_BUSY 1
+
+typedef struct _DKBSchedWakeups {
+
+	int nState; /* DKB_SCHED_IDLE or DKB_SCHED_BUSY */
+	uint64_t nStateTime; /* when the current span started */
+	uint64_t nStateWakeupCount; /* the wakeups of the process then */
+	uint64_t aTimes[2]; /* of the spans before, by state */
+	uint64_t aWakeupCounts[2];
+
+} DKBSchedWakeups;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void DKBSchedOptionsInit(DKBSchedOptions *pOptions);
+int DKBSchedParsePolicy(DKBSchedOptions *pOptions, const char *pSpec);
+int DKBSchedApply(const DKBSchedOptions *pOptions);
+uint64_t DKBSchedGetWakeupCount(void);
+void DKBSchedWakeupsInit(DKBSchedWakeups *pWakeups, int nState, uint64_t nNow);
+void DKBSchedWakeupsSwitch(DKBSchedWakeups *pWakeups, int nState, uint64_t nNow);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_SCHED_H */
@@ -0,0 +1,178 @@
+/*
+ * DeKeyBounce
+ * Scoring the verdicts of the engine against the labels of a trace.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceScore.h"
+
+#include <string.h>
+
+#include "DeKeyBounceTrace.h"
+
+static void MakeUp(DKBKeyScore *pKeyScore, uint64_t *pPendingTimestamp, uint64_t nTimestamp);
+
+void DKBScoreInit(DKBScore *pScore) {
+
+	memset(pScore, 0, sizeof *pScore);
+	int i;
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+		pScore->aPendingTimestamps[i][DKB_EVENT_KEY_DOWN] = DKB_TIMESTAMP_UNSEEN;
+		pScore->aPendingTimestamps[i][DKB_EVENT_KEY_UP] = DKB_TIMESTAMP_UNSEEN;
+		pScore->aPassedTypes[i] = DKB_SCORE_TYPE_NONE;
+	}
+
+}
+
+void DKBScoreAdd(DKBScore *pScore, const DKBEvent *pEvent, int nVerdict) {
+
+	if(pEvent->nKeyCode >= DKB_KEY_CODE_COUNT)
+		return; // the engine passes them unjudged
+	DKBKeyScore *pKeyScore = &pScore->aKeyScores[pEvent->nKeyCode];
+	uint64_t *pPendingTimestamps = pScore->aPendingTimestamps[pEvent->nKeyCode];
+	int nType = pEvent->nType & 1;
+	int isDropped = (nVerdict == DKB_VERDICT_DROP);
+
+	if(!(pEvent->nFlags & DKB_TRACE_FLAG_LABELED)) {
+		pScore->nUnlabeledCount++;
+	} else if(pEvent->nFlags & DKB_TRACE_FLAG_CHATTER) {
+		if(isDropped)
+			pKeyScore->nChatterDropCount++;
+		else
+			pKeyScore->nChatterPassCount++;
+	} else {
+		// the typist went on, a transition still missing the other way is lost
+		if(pPendingTimestamps[!nType] != DKB_TIMESTAMP_UNSEEN) {
+			pKeyScore->nLostCount++;
+			pPendingTimestamps[!nType] = DKB_TIMESTAMP_UNSEEN;
+		}
+		if(isDropped && pScore->aPassedTypes[pEvent->nKeyCode] == nType) {
+			pKeyScore->nGenuineRedundantCount++;
+			return;
+		}
+		if(isDropped) {
+			pKeyScore->nGenuineDropCount++;
+			if(pPendingTimestamps[nType] == DKB_TIMESTAMP_UNSEEN)
+				pPendingTimestamps[nType] = pEvent->nTimestamp;
+			return;
+		}
+		pKeyScore->nGenuinePassCount++;
+	}
+	if(isDropped)
+		return;
+	pScore->aPassedTypes[pEvent->nKeyCode] = (uint8_t)nType;
+	if(pPendingTimestamps[nType] != DKB_TIMESTAMP_UNSEEN)
+		MakeUp(pKeyScore, &pPendingTimestamps[nType], pEvent->nTimestamp);
+
+}
+
+void DKBScoreAddBatch(DKBScore *pScore, const DKBEvent *pEvents, size_t nCount, const uint64_t *pDropMask) {
+
+	// the drop mask of DKBEngineFilter for the same events
+	size_t i;
+	for(i = 0; i < nCount; i++)
+		DKBScoreAdd(pScore, &pEvents[i], (int)((pDropMask[i / 64] >> (i % 64)) & 1));
+
+}
+
+void DKBScoreFinish(DKBScore *pScore) {
+
+	// at the end of the trace, whatever was not made up for is lost
+	int i, nType;
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+		for(nType = 0; nType < 2; nType++) {
+			if(pScore->aPendingTimestamps[i][nType] != DKB_TIMESTAMP_UNSEEN) {
+				pScore->aKeyScores[i].nLostCount++;
+				pScore->aPendingTimestamps[i][nType] = DKB_TIMESTAMP_UNSEEN;
+			}
+		}
+	}
+
+}
+
+void DKBScoreMerge(DKBScore *pScore, const DKBScore *pOther) {
+
+	// the finished score of another trace or device
+	pScore->nUnlabeledCount += pOther->nUnlabeledCount;
+	int i;
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++)
+		DKBScoreSum(&pScore->aKeyScores[i], &pOther->aKeyScores[i]);
+
+}
+
+void DKBScoreSum(DKBKeyScore *pTotal, const DKBKeyScore *pKeyScore) {
+
+	pTotal->nChatterDropCount += pKeyScore->nChatterDropCount;
+	pTotal->nChatterPassCount += pKeyScore->nChatterPassCount;
+	pTotal->nGenuineDropCount += pKeyScore->nGenuineDropCount;
+	pTotal->nGenuinePassCount += pKeyScore->nGenuinePassCount;
+	pTotal->nGenuineRedundantCount += pKeyScore->nGenuineRedundantCount;
+	pTotal->nDelayedCount += pKeyScore->nDelayedCount;
+	pTotal->nLostCount += pKeyScore->nLostCount;
+	pTotal->nAddedLatencySum += pKeyScore->nAddedLatencySum;
+	if(pKeyScore->nMaxAddedLatency > pTotal->nMaxAddedLatency)
+		pTotal->nMaxAddedLatency = pKeyScore->nMaxAddedLatency;
+
+}
+
+void DKBScoreGetTotal(const DKBScore *pScore, DKBKeyScore *pTotal) {
+
+	memset(pTotal, 0, sizeof *pTotal);
+	int i;
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++)
+		DKBScoreSum(pTotal, &pScore->aKeyScores[i]);
+
+}
+
+double DKBScoreGetPrecision(const DKBKeyScore *pKeyScore) {
+
+	// of the dropped events, how many were chatter; 1 when nothing was dropped
+	uint64_t nDropCount = pKeyScore->nChatterDropCount + pKeyScore->nGenuineDropCount;
+	return (nDropCount != 0) ? (double)pKeyScore->nChatterDropCount / nDropCount : 1.0;
+
+}
+
+double DKBScoreGetRecall(const DKBKeyScore *pKeyScore) {
+
+	// of the chatter, how much was dropped; 1 when there was none
+	uint64_t nChatterCount = pKeyScore->nChatterDropCount + pKeyScore->nChatterPassCount;
+	return (nChatterCount != 0) ? (double)pKeyScore->nChatterDropCount / nChatterCount : 1.0;
+
+}
+
+uint64_t DKBScoreGetLabeledCount(const DKBKeyScore *pKeyScore) {
+
+	return pKeyScore->nChatterDropCount + pKeyScore->nChatterPassCount + pKeyScore->nGenuineDropCount
+		+ pKeyScore->nGenuinePassCount + pKeyScore->nGenuineRedundantCount;
+
+}
+
+static void MakeUp(DKBKeyScore *pKeyScore, uint64_t *pPendingTimestamp, uint64_t nTimestamp) {
+
+	uint64_t nAddedLatency = nTimestamp - *pPendingTimestamp;
+	pKeyScore->nDelayedCount++;
+	pKeyScore->nAddedLatencySum += nAddedLatency;
+	if(nAddedLatency > pKeyScore->nMaxAddedLatency)
+		pKeyScore->nMaxAddedLatency = nAddedLatency;
+	*pPendingTimestamp = DKB_TIMESTAMP_UNSEEN;
+
+}
@@ -0,0 +1,92 @@
+/*
+ * DeKeyBounce
+ * Scoring the verdicts of the engine against the labels of a trace.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_SCORE_H
+#define DEKEYBOUNCE_SCORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DeKeyBounceEngine.h"
+
+#define DKB_SCORE_TYPE_NONE 2
+
+/*
+ * A labeled trace tells every genuine transition from chatter (see
+ * DKB_TRACE_FLAG_LABELED). A dropped chatter event is a true positive, a
+ * dropped genuine one a false positive, a passed chatter event a false
+ * negative, unless a passed chatter event already took the key the same
+ * way: the drop then only keeps the key from going that way twice, and
+ * is counted apart. The engine judges every event as it comes and holds none
+ * back, so it adds latency only by dropping a genuine transition: when a
+ * later event of the key in the same direction passes before the next
+ * genuine one in the other direction, the transition was delayed until
+ * then, otherwise it was lost. Unlabeled events are counted and skipped,
+ * but a passed one still makes up for a dropped transition.
+ */
+
+typedef struct _DKBKeyScore {
+
+	uint64_t nChatterDropCount; /* true positives */
+	uint64_t nChatterPassCount; /* false negatives */
+	uint64_t nGenuineDropCount; /* false positives */
+	uint64_t nGenuinePassCount;
+	uint64_t nGenuineRedundantCount; /* dropped genuine transitions the key had already made */
+	uint64_t nDelayedCount; /* dropped genuine transitions a later passed event made up for */
+	uint64_t nLostCount; /* dropped genuine transitions nothing made up for */
+	uint64_t nAddedLatencySum; /* ticks of the delayed transitions */
+	uint64_t nMaxAddedLatency;
+
+} DKBKeyScore;
+
+typedef struct _DKBScore {
+
+	uint64_t nUnlabeledCount;
+	uint64_t aPendingTimestamps[DKB_KEY_CODE_COUNT][2]; /* of a dropped genuine key-down and key-up not made up for, DKB_TIMESTAMP_UNSEEN for none */
+	uint8_t aPassedTypes[DKB_KEY_CODE_COUNT]; /* of the last passed event of the key, DKB_SCORE_TYPE_NONE before one */
+	DKBKeyScore aKeyScores[DKB_KEY_CODE_COUNT];
+
+} DKBScore;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void DKBScoreInit(DKBScore *pScore);
+void DKBScoreAdd(DKBScore *pScore, const DKBEvent *pEvent, int nVerdict);
+void DKBScoreAddBatch(DKBScore *pScore, const DKBEvent *pEvents, size_t nCount, const uint64_t *pDropMask);
+void DKBScoreFinish(DKBScore *pScore);
+void DKBScoreMerge(DKBScore *pScore, const DKBScore *pOther);
+void DKBScoreSum(DKBKeyScore *pTotal, const DKBKeyScore *pKeyScore);
+void DKBScoreGetTotal(const DKBScore *pScore, DKBKeyScore *pTotal);
+double DKBScoreGetPrecision(const DKBKeyScore *pKeyScore);
+double DKBScoreGetRecall(const DKBKeyScore *pKeyScore);
+uint64_t DKBScoreGetLabeledCount(const DKBKeyScore *pKeyScore);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_SCORE_H */
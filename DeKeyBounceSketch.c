@@ -0,0 +1,324 @@
+/*
+ * DeKeyBounce
+ * Mergeable fixed-size sketches of the key-up to key-down intervals.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceSketch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_VARINT_SIZE 10 /* bytes of a uint64_t in LEB128 */
+#define MAX_FILE_SIZE (sizeof(DKBSketchFileHeader) + DKB_SKETCH_KEY_COUNT * (4 + DKB_SKETCH_BUCKET_COUNT * MAX_VARINT_SIZE))
+
+static int ParseRecords(const unsigned char *pData, size_t nSize, size_t nKeyCount, DKBSketchTotals *pTotals);
+static size_t PutVarint(unsigned char *pBuffer, uint64_t nValue);
+
+int DKBSketchInit(DKBSketch *pSketch, const DKBClock *pClock) {
+
+	memset(pSketch, 0, sizeof *pSketch);
+	pSketch->pCounts = calloc(DKB_SKETCH_KEY_COUNT * DKB_SKETCH_BUCKET_COUNT, sizeof(uint32_t));
+	if(pSketch->pCounts == NULL)
+		return -1;
+	pSketch->nTicksToMicroseconds = pClock->nTicksToNanoseconds / 1000;
+	pSketch->nMaxTicks = DKBClockFromNanoseconds(pClock, (1ULL << DKB_SKETCH_MAX_SHIFT) * 1000);
+	return 0;
+
+}
+
+void DKBSketchDeinit(DKBSketch *pSketch) {
+
+	free(pSketch->pCounts);
+	memset(pSketch, 0, sizeof *pSketch);
+
+}
+
+void DKBSketchAdd(DKBSketch *pSketch, const DKBEvent *pEvent, const DKBEngine *pEngine) {
+
+	if(pSketch->pCounts == NULL || pEvent->nType != DKB_EVENT_KEY_DOWN || pEvent->nKeyCode >= DKB_SKETCH_KEY_COUNT)
+		return;
+	uint64_t nLastTimestamp = pEngine->aKeyStates[pEvent->nKeyCode].nLastTimestamp;
+	// DKB_TIMESTAMP_UNSEEN has the DKB_TIMESTAMP_KEY_DOWN bit too
+	if(nLastTimestamp == 0 || (nLastTimestamp & DKB_TIMESTAMP_KEY_DOWN) != 0 || pEvent->nTimestamp < nLastTimestamp)
+		return;
+	uint64_t nTicks = pEvent->nTimestamp - nLastTimestamp;
+	int nBucket = DKB_SKETCH_BUCKET_COUNT - 1;
+	if(nTicks < pSketch->nMaxTicks) // and so the product fits
+		nBucket = DKBSketchGetBucket((nTicks * pSketch->nTicksToMicroseconds) >> DKB_CLOCK_SHIFT);
+	uint32_t *pCount = &pSketch->pCounts[pEvent->nKeyCode * DKB_SKETCH_BUCKET_COUNT + nBucket];
+	__atomic_store_n(pCount, *pCount + 1, __ATOMIC_RELAXED); // only this thread writes it
+
+}
+
+uint64_t DKBSketchGetCount(const DKBSketch *pSketch) {
+
+	if(pSketch->pCounts == NULL)
+		return 0;
+	uint64_t nCount = 0;
+	size_t i;
+	for(i = 0; i < DKB_SKETCH_KEY_COUNT * DKB_SKETCH_BUCKET_COUNT; i++)
+		nCount += __atomic_load_n(&pSketch->pCounts[i], __ATOMIC_RELAXED);
+	return nCount;
+
+}
+
+int DKBSketchExport(const DKBSketch *pSketch, const char *pPath) {
+
+	if(pSketch->pCounts == NULL)
+		return 0;
+	DKBSketchTotals *pTotals = calloc(1, sizeof(DKBSketchTotals));
+	if(pTotals == NULL)
+		return -1;
+	pTotals->nSketchCount = 1;
+	size_t nCode, nBucket;
+	for(nCode = 0; nCode < DKB_SKETCH_KEY_COUNT; nCode++) {
+		for(nBucket = 0; nBucket < DKB_SKETCH_BUCKET_COUNT; nBucket++)
+			pTotals->aCounts[nCode][nBucket] = __atomic_load_n(&pSketch->pCounts[nCode * DKB_SKETCH_BUCKET_COUNT + nBucket], __ATOMIC_RELAXED);
+	}
+	int nResult = DKBSketchWrite(pTotals, pPath);
+	free(pTotals);
+	return nResult;
+
+}
+
+int DKBSketchRead(DKBSketchTotals *pTotals, const char *pPath) {
+
+	int nFile = open(pPath, O_RDONLY);
+	if(nFile < 0)
+		return -1;
+	unsigned char *pBuffer = NULL;
+	ssize_t nSize = -1;
+	struct stat aStat;
+	if(fstat(nFile, &aStat) != 0)
+		nSize = -1;
+	else if(aStat.st_size < (off_t)sizeof(DKBSketchFileHeader) || aStat.st_size > (off_t)MAX_FILE_SIZE)
+		errno = EINVAL;
+	else if((pBuffer = malloc(aStat.st_size)) == NULL)
+		errno = ENOMEM;
+	else
+		nSize = read(nFile, pBuffer, aStat.st_size);
+	int nError = errno;
+	close(nFile);
+	if(nSize < 0) {
+		free(pBuffer);
+		errno = nError;
+		return -1;
+	}
+
+	DKBSketchFileHeader aHeader;
+	int isValid = 0;
+	if((size_t)nSize >= sizeof aHeader) {
+		memcpy(&aHeader, pBuffer, sizeof aHeader);
+		isValid = (aHeader.nMagic == DKB_SKETCH_MAGIC && aHeader.nVersion == DKB_SKETCH_VERSION
+			&& aHeader.nMinShift == DKB_SKETCH_MIN_SHIFT && aHeader.nSubBucketBits == DKB_SKETCH_SUB_BUCKET_BITS
+			&& aHeader.nBucketCount == DKB_SKETCH_BUCKET_COUNT && aHeader.nKeyCount <= DKB_SKETCH_KEY_COUNT
+			&& aHeader.nDataSize == nSize - sizeof aHeader);
+	}
+	// checked whole before adding anything, the totals must not get half a file
+	if(isValid)
+		isValid = (ParseRecords(pBuffer + sizeof aHeader, aHeader.nDataSize, aHeader.nKeyCount, NULL) == 0);
+	if(isValid) {
+		ParseRecords(pBuffer + sizeof aHeader, aHeader.nDataSize, aHeader.nKeyCount, pTotals);
+		pTotals->nSketchCount += aHeader.nSketchCount;
+	}
+	free(pBuffer);
+	if(!isValid) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+
+}
+
+int DKBSketchWrite(const DKBSketchTotals *pTotals, const char *pPath) {
+
+	unsigned char *pBuffer = malloc(MAX_FILE_SIZE);
+	if(pBuffer == NULL)
+		return -1;
+	DKBSketchFileHeader aHeader;
+	memset(&aHeader, 0, sizeof aHeader);
+	aHeader.nMagic = DKB_SKETCH_MAGIC;
+	aHeader.nVersion = DKB_SKETCH_VERSION;
+	aHeader.nMinShift = DKB_SKETCH_MIN_SHIFT;
+	aHeader.nSubBucketBits = DKB_SKETCH_SUB_BUCKET_BITS;
+	aHeader.nBucketCount = DKB_SKETCH_BUCKET_COUNT;
+	aHeader.nSketchCount = pTotals->nSketchCount;
+	size_t nSize = sizeof aHeader;
+	size_t nCode;
+	for(nCode = 0; nCode < DKB_SKETCH_KEY_COUNT; nCode++) {
+		const uint64_t *pCounts = pTotals->aCounts[nCode];
+		int nFirst = 0, nLast = DKB_SKETCH_BUCKET_COUNT - 1;
+		while(nFirst <= nLast && pCounts[nFirst] == 0)
+			nFirst++;
+		if(nFirst > nLast)
+			continue; // the key was not pressed
+		while(pCounts[nLast] == 0)
+			nLast--;
+		uint16_t nKeyCode = nCode;
+		memcpy(pBuffer + nSize, &nKeyCode, sizeof nKeyCode);
+		pBuffer[nSize + 2] = nFirst;
+		pBuffer[nSize + 3] = nLast - nFirst + 1;
+		nSize += 4;
+		int nBucket;
+		for(nBucket = nFirst; nBucket <= nLast; nBucket++)
+			nSize += PutVarint(pBuffer + nSize, pCounts[nBucket]);
+		aHeader.nKeyCount++;
+	}
+	aHeader.nDataSize = nSize - sizeof aHeader;
+	memcpy(pBuffer, &aHeader, sizeof aHeader);
+
+	char aTemporaryPath[1024];
+	snprintf(aTemporaryPath, sizeof aTemporaryPath, "%s.tmp", pPath);
+	int isSuccess = 0;
+	do { // just for break
+		int nFile = open(aTemporaryPath, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644);
+		if(nFile < 0)
+			break;
+		ssize_t nWritten = write(nFile, pBuffer, nSize);
+		if(close(nFile) != 0 || nWritten != (ssize_t)nSize)
+			break;
+		if(rename(aTemporaryPath, pPath) != 0)
+			break;
+		isSuccess = 1;
+	} while(0);
+	free(pBuffer);
+	if(!isSuccess) {
+		unlink(aTemporaryPath);
+		return -1;
+	}
+	return 0;
+
+}
+
+void DKBSketchMerge(DKBSketchTotals *pTotals, const DKBSketchTotals *pOther) {
+
+	pTotals->nSketchCount += pOther->nSketchCount;
+	size_t nCode, nBucket;
+	for(nCode = 0; nCode < DKB_SKETCH_KEY_COUNT; nCode++) {
+		for(nBucket = 0; nBucket < DKB_SKETCH_BUCKET_COUNT; nBucket++)
+			pTotals->aCounts[nCode][nBucket] += pOther->aCounts[nCode][nBucket];
+	}
+
+}
+
+double DKBSketchGetQuantile(const uint64_t *pCounts, double fQuantile) {
+
+	uint64_t nCount = 0;
+	int i;
+	for(i = 0; i < DKB_SKETCH_BUCKET_COUNT; i++)
+		nCount += pCounts[i];
+	if(nCount == 0)
+		return -1;
+	// the rank of the quantile, 0 based, as the nearest rank method takes it
+	double fRank = (fQuantile <= 0) ? 0 : (fQuantile >= 1) ? nCount : fQuantile * nCount;
+	uint64_t nRank = (uint64_t)fRank;
+	if(nRank == fRank && nRank > 0)
+		nRank--;
+	if(nRank >= nCount)
+		nRank = nCount - 1;
+	uint64_t nBelow = 0;
+	for(i = 0; i < DKB_SKETCH_BUCKET_COUNT - 1; i++) {
+		nBelow += pCounts[i];
+		if(nBelow > nRank)
+			break;
+	}
+	return DKBSketchGetBucketValue(i);
+
+}
+
+int DKBSketchGetBucket(uint64_t nMicroseconds) {
+
+	if(nMicroseconds < (1ULL << DKB_SKETCH_MIN_SHIFT))
+		return 0;
+	if(nMicroseconds >= (1ULL << DKB_SKETCH_MAX_SHIFT))
+		return DKB_SKETCH_BUCKET_COUNT - 1;
+	int nExponent = 63 - __builtin_clzll(nMicroseconds);
+	int nSubBucket = (nMicroseconds >> (nExponent - DKB_SKETCH_SUB_BUCKET_BITS)) & ((1 << DKB_SKETCH_SUB_BUCKET_BITS) - 1);
+	return 1 + ((nExponent - DKB_SKETCH_MIN_SHIFT) << DKB_SKETCH_SUB_BUCKET_BITS) + nSubBucket;
+
+}
+
+double DKBSketchGetBucketValue(int nBucket) {
+
+	if(nBucket <= 0)
+		return (1 << DKB_SKETCH_MIN_SHIFT) / 2.0;
+	if(nBucket >= DKB_SKETCH_BUCKET_COUNT - 1)
+		return (double)(1ULL << DKB_SKETCH_MAX_SHIFT);
+	int nExponent = DKB_SKETCH_MIN_SHIFT + ((nBucket - 1) >> DKB_SKETCH_SUB_BUCKET_BITS);
+	int nSubBucket = (nBucket - 1) & ((1 << DKB_SKETCH_SUB_BUCKET_BITS) - 1);
+	double fWidth = (double)(1ULL << (nExponent - DKB_SKETCH_SUB_BUCKET_BITS));
+	return (double)(1ULL << nExponent) + (nSubBucket + 0.5) * fWidth;
+
+}
+
+static int ParseRecords(const unsigned char *pData, size_t nSize, size_t nKeyCount, DKBSketchTotals *pTotals) {
+
+	// with no totals, only checks
+	size_t nOffset = 0;
+	size_t i;
+	for(i = 0; i < nKeyCount; i++) {
+		if(nSize - nOffset < 4)
+			return -1;
+		uint16_t nKeyCode;
+		memcpy(&nKeyCode, pData + nOffset, sizeof nKeyCode);
+		int nFirst = pData[nOffset + 2];
+		int nSpan = pData[nOffset + 3];
+		nOffset += 4;
+		if(nKeyCode >= DKB_SKETCH_KEY_COUNT || nSpan == 0 || nFirst + nSpan > DKB_SKETCH_BUCKET_COUNT)
+			return -1;
+		int nBucket;
+		for(nBucket = nFirst; nBucket < nFirst + nSpan; nBucket++) {
+			uint64_t nCount = 0;
+			int nShift = 0;
+			unsigned char nByte;
+			do {
+				if(nOffset == nSize || nShift >= 64)
+					return -1;
+				nByte = pData[nOffset++];
+				nCount |= (uint64_t)(nByte & 0x7F) << nShift;
+				nShift += 7;
+			} while(nByte & 0x80);
+			if(pTotals != NULL)
+				pTotals->aCounts[nKeyCode][nBucket] += nCount;
+		}
+	}
+	return (nOffset == nSize) ? 0 : -1;
+
+}
+
+static size_t PutVarint(unsigned char *pBuffer, uint64_t nValue) {
+
+	size_t nSize = 0;
+	while(nValue >= 0x80) {
+		pBuffer[nSize++] = (nValue & 0x7F) | 0x80;
+		nValue >>= 7;
+	}
+	pBuffer[nSize++] = nValue;
+	return nSize;
+
+}
@@ -0,0 +1,130 @@
+/*
+ * DeKeyBounce
+ * Mergeable fixed-size sketches of the key-up to key-down intervals.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_SKETCH_H
+#define DEKEYBOUNCE_SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DeKeyBounceClock.h"
+#include "DeKeyBounceEngine.h"
+
+/*
+ * A sketch keeps, per key code, how many intervals from a key-up to the
+ * next key-down of the key fell in each of a fixed set of buckets, and
+ * nothing else: no order, no timestamps, no text, so it tells how the
+ * switches bounce without telling what was typed. The buckets are those
+ * of an HDR histogram, log-linear in microseconds: below 16 us, then
+ * every power of 2 up to some 4 s cut into 8 equal buckets, then the
+ * rest. Taking the middle of its bucket for a value is off by 1/16 of
+ * it at most, whatever the scale, and sketches merge by adding counts,
+ * so the quantiles of a fleet are as good as those of one machine.
+ *
+ * The filter adds an interval with a count of leading zeros, a few shifts
+ * and one increment, before judging the key-down, since the interval is
+ * the one to the key-up the engine last let through. A key-down while the
+ * engine swallows a bounce, or of a key not yet released, adds nothing.
+ * Only the key codes below DKB_SKETCH_KEY_COUNT are kept, which covers
+ * the keys of keyboards on both systems; the counts cost 146 kB, allocated
+ * once. One thread adds, with plain stores of 32-bit counts; another may
+ * export meanwhile, reading each count with a relaxed atomic load.
+ *
+ * The file is a DKBSketchFileHeader followed by a record for every key
+ * with counts: the uint16_t key code, the uint8_t first bucket with a
+ * count and the uint8_t number of buckets from it to the last, then the
+ * counts of those buckets as LEB128 varints, some 200 bytes per key in
+ * use. Files merged by DeKeyBounceMerge are written in the same format,
+ * with the number of sketches they sum in the header.
+ */
+
+#define DKB_SKETCH_KEY_COUNT 256
+#define DKB_SKETCH_MIN_SHIFT 4 /* log2 of the bound of the first bucket, in us */
+#define DKB_SKETCH_MAX_SHIFT 22 /* log2 of the bound of the last bucket, some 4.2 s */
+#define DKB_SKETCH_SUB_BUCKET_BITS 3 /* log2 of the buckets per power of 2 */
+#define DKB_SKETCH_BUCKET_COUNT (2 + ((DKB_SKETCH_MAX_SHIFT - DKB_SKETCH_MIN_SHIFT) << DKB_SKETCH_SUB_BUCKET_BITS))
+
+#define DKB_SKETCH_MAGIC 0x51424B44UL /* "DKBQ" */
+#define DKB_SKETCH_VERSION 1
+
+typedef struct _DKBSketchFileHeader {
+
+	uint32_t nMagic;
+	uint16_t nVersion;
+	uint8_t nMinShift; /* the geometry of the buckets, files of another one are refused */
+	uint8_t nSubBucketBits;
+	uint16_t nBucketCount;
+	uint16_t nKeyCount; /* of the records following */
+	uint32_t nDataSize; /* bytes of the records following */
+	uint64_t nSketchCount; /* 1 for the file of a daemon, the sum for a merged one */
+
+} DKBSketchFileHeader;
+
+typedef struct _DKBSketch {
+
+	uint32_t *pCounts; /* by key code then bucket, NULL when not sketching */
+	uint64_t nTicksToMicroseconds; /* 32.32 fixed point */
+	uint64_t nMaxTicks; /* the bound of the last bucket in ticks, longer intervals are not converted */
+
+} DKBSketch;
+
+typedef struct _DKBSketchTotals {
+
+	uint64_t nSketchCount;
+	uint64_t aCounts[DKB_SKETCH_KEY_COUNT][DKB_SKETCH_BUCKET_COUNT];
+
+} DKBSketchTotals;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int DKBSketchInit(DKBSketch *pSketch, const DKBClock *pClock);
+void DKBSketchDeinit(DKBSketch *pSketch);
+void DKBSketchAdd(DKBSketch *pSketch, const DKBEvent *pEvent, const DKBEngine *pEngine);
+uint64_t DKBSketchGetCount(const DKBSketch *pSketch);
+int DKBSketchExport(const DKBSketch *pSketch, const char *pPath);
+
+/*
+ * DKBSketchRead adds the counts of a file to the totals, or returns -1
+ * with errno EINVAL and leaves them as they were when the file is not a
+ * whole sketch. DKBSketchGetQuantile takes the counts of one key, or a
+ * sum of them, and returns the middle of the bucket of the quantile in
+ * us, the bound of the last bucket for that one, and -1 when there are
+ * no counts.
+ */
+
+int DKBSketchRead(DKBSketchTotals *pTotals, const char *pPath);
+int DKBSketchWrite(const DKBSketchTotals *pTotals, const char *pPath);
+void DKBSketchMerge(DKBSketchTotals *pTotals, const DKBSketchTotals *pOther);
+double DKBSketchGetQuantile(const uint64_t *pCounts, double fQuantile);
+int DKBSketchGetBucket(uint64_t nMicroseconds);
+double DKBSketchGetBucketValue(int nBucket);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_SKETCH_H */
@@ -0,0 +1,239 @@
+/*
+ * DeKeyBounce
+ * Per-key bounce totals gathered from the engine counters and their export.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceStats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+static uint64_t CollectCount(const uint32_t *pCount, uint32_t *pSeenCount);
+static uint64_t CollectSmallCount(const uint16_t *pCount, uint16_t *pSeenCount);
+static void WriteJSON(const DKBStats *pStats, const DKBClock *pClock, uint64_t nNow, FILE *pFile);
+static void WriteCSV(const DKBStats *pStats, const DKBClock *pClock, FILE *pFile);
+static void LoadHealth(DKBKeyHealth *pHealth, const DKBKeyHealth *pEngineHealth);
+static double ToMilliseconds(const DKBClock *pClock, uint64_t nTicks);
+
+void DKBStatsReset(DKBStats *pStats, uint64_t nNow) {
+
+	memset(pStats->aKeyTotals, 0, sizeof pStats->aKeyTotals);
+	pStats->nStartTime = nNow;
+
+}
+
+void DKBStatsCollect(DKBStats *pStats, const DKBEngine *pEngine, DKBKeyCounters *pSeenCounters) {
+
+	// pSeenCounters is what the previous call saw of this engine, all zeros the first time
+	pStats->nMinTimestampDiff = pEngine->nIntervalBase; // of the config, an app or a device may have its own
+	pStats->nMinHoldDiff = pEngine->nMinHoldDiff;
+	int i, j;
+	for(i = 0; i < DKB_INTERVAL_BUCKET_COUNT; i++)
+		pStats->aIntervalBounds[i] = DKBEngineGetIntervalBound(pEngine, i);
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+		const DKBKeyCounters *pCounters = &pEngine->aKeyStates[i].aCounters;
+		DKBKeyCounters *pSeen = &pSeenCounters[i];
+		DKBKeyTotals *pTotals = &pStats->aKeyTotals[i];
+		uint64_t nPassCount = CollectCount(&pCounters->nPassCount, &pSeen->nPassCount);
+		uint64_t nDropCount = CollectCount(&pCounters->nDropCount, &pSeen->nDropCount);
+		pTotals->nPassCount += nPassCount;
+		pTotals->nDropCount += nDropCount;
+		// with several keyboards the one typed on lately tells about the key
+		if(nPassCount + nDropCount > 0 || pTotals->aHealth.nPressCount == 0)
+			LoadHealth(&pTotals->aHealth, &pEngine->aKeyStates[i].aHealth);
+		pTotals->nPressDropCount += CollectCount(&pCounters->nPressDropCount, &pSeen->nPressDropCount);
+		pTotals->nBounceCount += CollectCount(&pCounters->nBounceCount, &pSeen->nBounceCount);
+		uint64_t nIntervalSum = __atomic_load_n(&pCounters->nIntervalSum, __ATOMIC_RELAXED);
+		pTotals->nIntervalSum += nIntervalSum - pSeen->nIntervalSum;
+		pSeen->nIntervalSum = nIntervalSum;
+		for(j = 0; j < DKB_INTERVAL_BUCKET_COUNT; j++)
+			pTotals->aIntervalCounts[j] += CollectSmallCount(&pCounters->aIntervalCounts[j], &pSeen->aIntervalCounts[j]);
+	}
+
+}
+
+void DKBStatsMerge(DKBStats *pStats, const DKBStats *pOther) {
+
+	// the totals of another collector, e.g. of another thread, with the same clock and thresholds
+	if(pOther->nMinTimestampDiff != 0) {
+		pStats->nMinTimestampDiff = pOther->nMinTimestampDiff;
+		pStats->nMinHoldDiff = pOther->nMinHoldDiff;
+		memcpy(pStats->aIntervalBounds, pOther->aIntervalBounds, sizeof pStats->aIntervalBounds);
+	}
+	int i, j;
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+		DKBKeyTotals *pTotals = &pStats->aKeyTotals[i];
+		const DKBKeyTotals *pOtherTotals = &pOther->aKeyTotals[i];
+		int isOtherBusier = (pOtherTotals->nPassCount + pOtherTotals->nDropCount > pTotals->nPassCount + pTotals->nDropCount);
+		pTotals->nPassCount += pOtherTotals->nPassCount;
+		pTotals->nDropCount += pOtherTotals->nDropCount;
+		pTotals->nPressDropCount += pOtherTotals->nPressDropCount;
+		pTotals->nBounceCount += pOtherTotals->nBounceCount;
+		pTotals->nIntervalSum += pOtherTotals->nIntervalSum;
+		for(j = 0; j < DKB_INTERVAL_BUCKET_COUNT; j++)
+			pTotals->aIntervalCounts[j] += pOtherTotals->aIntervalCounts[j];
+		// the health of the engine which saw the key the most, its press count saturates too soon to tell
+		if(isOtherBusier)
+			pTotals->aHealth = pOtherTotals->aHealth;
+	}
+
+}
+
+void DKBStatsReportAlerts(DKBStats *pStats, const DKBClock *pClock) {
+
+	int i;
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+		DKBKeyTotals *pTotals = &pStats->aKeyTotals[i];
+		const DKBKeyHealth *pHealth = &pTotals->aHealth;
+		uint16_t nNewAlerts = pHealth->nAlerts & ~pTotals->nReportedAlerts;
+		if(nNewAlerts != 0) {
+			syslog(LOG_WARNING, "key %d is failing: bounces on %.1f%% of recent presses (%.1f%% long-term%s), median interval %.2f ms, 90%% below %.2f ms",
+				i, pHealth->nFastBounceRate * 100.0 / DKB_RATE_ONE, pHealth->nSlowBounceRate * 100.0 / DKB_RATE_ONE,
+				(nNewAlerts & DKB_ALERT_RISING) ? ", rising" : "",
+				DKBClockToNanoseconds(pClock, pHealth->nIntervalMedian) / 1000000.0, DKBClockToNanoseconds(pClock, pHealth->nIntervalHigh) / 1000000.0);
+		} else if(pHealth->nAlerts == 0 && pTotals->nReportedAlerts != 0) {
+			syslog(LOG_NOTICE, "key %d has recovered: bounces on %.1f%% of recent presses", i, pHealth->nFastBounceRate * 100.0 / DKB_RATE_ONE);
+		}
+		pTotals->nReportedAlerts = pHealth->nAlerts;
+	}
+
+}
+
+int DKBStatsExport(const DKBStats *pStats, const DKBClock *pClock, uint64_t nNow, const char *pPath) {
+
+	// written aside and renamed, so that a reader never sees half of it
+	char aTemporaryPath[1024];
+	if(snprintf(aTemporaryPath, sizeof aTemporaryPath, "%s.tmp", pPath) >= (int)sizeof aTemporaryPath)
+		return -1;
+	FILE *pFile = fopen(aTemporaryPath, "w");
+	if(pFile == NULL)
+		return -1;
+	size_t nLength = strlen(pPath);
+	if(nLength >= 4 && strcmp(pPath + nLength - 4, ".csv") == 0)
+		WriteCSV(pStats, pClock, pFile);
+	else
+		WriteJSON(pStats, pClock, nNow, pFile);
+	if(ferror(pFile) | fclose(pFile)) {
+		remove(aTemporaryPath);
+		return -1;
+	}
+	return rename(aTemporaryPath, pPath);
+
+}
+
+static uint64_t CollectCount(const uint32_t *pCount, uint32_t *pSeenCount) {
+
+	uint32_t nCount = __atomic_load_n(pCount, __ATOMIC_RELAXED);
+	uint32_t nDelta = nCount - *pSeenCount; // right across a wrap as well
+	*pSeenCount = nCount;
+	return nDelta;
+
+}
+
+static uint64_t CollectSmallCount(const uint16_t *pCount, uint16_t *pSeenCount) {
+
+	uint16_t nCount = __atomic_load_n(pCount, __ATOMIC_RELAXED);
+	uint16_t nDelta = nCount - *pSeenCount;
+	*pSeenCount = nCount;
+	return nDelta;
+
+}
+
+static void WriteJSON(const DKBStats *pStats, const DKBClock *pClock, uint64_t nNow, FILE *pFile) {
+
+	int i, j;
+	fprintf(pFile, "{\n\t\"seconds\": %.0f,\n\t\"threshold_ms\": %.3f,\n\t\"hold_ms\": %.3f,\n\t\"interval_bounds_ms\": [",
+		ToMilliseconds(pClock, nNow - pStats->nStartTime) / 1000.0, ToMilliseconds(pClock, pStats->nMinTimestampDiff),
+		ToMilliseconds(pClock, pStats->nMinHoldDiff));
+	for(j = 0; j < DKB_INTERVAL_BUCKET_COUNT; j++)
+		fprintf(pFile, "%s%.3f", (j == 0) ? "" : ", ", ToMilliseconds(pClock, pStats->aIntervalBounds[j]));
+	fprintf(pFile, "],\n\t\"keys\": [");
+	int isFirst = 1;
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+		const DKBKeyTotals *pTotals = &pStats->aKeyTotals[i];
+		uint64_t nEventCount = pTotals->nPassCount + pTotals->nDropCount;
+		if(nEventCount == 0)
+			continue;
+		const DKBKeyHealth *pHealth = &pTotals->aHealth;
+		fprintf(pFile, "%s\n\t\t{ \"code\": %d, \"passed\": %llu, \"dropped\": %llu, \"release_dropped\": %llu, \"press_dropped\": %llu, \"bounces\": %llu, \"drop_rate\": %.6f, \"mean_interval_ms\": %.3f, \"intervals\": [",
+			isFirst ? "" : ",", i, (unsigned long long)pTotals->nPassCount, (unsigned long long)pTotals->nDropCount,
+			(unsigned long long)(pTotals->nDropCount - pTotals->nPressDropCount), (unsigned long long)pTotals->nPressDropCount,
+			(unsigned long long)pTotals->nBounceCount, (double)pTotals->nDropCount / nEventCount,
+			(pTotals->nBounceCount != 0) ? ToMilliseconds(pClock, pTotals->nIntervalSum / pTotals->nBounceCount) : 0.0);
+		for(j = 0; j < DKB_INTERVAL_BUCKET_COUNT; j++)
+			fprintf(pFile, "%s%llu", (j == 0) ? "" : ", ", (unsigned long long)pTotals->aIntervalCounts[j]);
+		fprintf(pFile, "], \"recent_bounce_rate\": %.4f, \"long_term_bounce_rate\": %.4f, \"median_interval_ms\": %.3f, \"p90_interval_ms\": %.3f, \"alerts\": [%s%s%s] }",
+			(double)pHealth->nFastBounceRate / DKB_RATE_ONE, (double)pHealth->nSlowBounceRate / DKB_RATE_ONE,
+			ToMilliseconds(pClock, pHealth->nIntervalMedian), ToMilliseconds(pClock, pHealth->nIntervalHigh),
+			(pHealth->nAlerts & DKB_ALERT_BOUNCE_RATE) ? "\"bounce_rate\"" : "",
+			(pHealth->nAlerts & DKB_ALERT_BOUNCE_RATE) && (pHealth->nAlerts & DKB_ALERT_RISING) ? ", " : "",
+			(pHealth->nAlerts & DKB_ALERT_RISING) ? "\"rising\"" : "");
+		isFirst = 0;
+	}
+	fprintf(pFile, "\n\t]\n}\n");
+
+}
+
+static void WriteCSV(const DKBStats *pStats, const DKBClock *pClock, FILE *pFile) {
+
+	int i, j;
+	fprintf(pFile, "code,passed,dropped,release_dropped,press_dropped,bounces,drop_rate,mean_interval_ms");
+	for(j = 0; j < DKB_INTERVAL_BUCKET_COUNT; j++)
+		fprintf(pFile, ",below_%.3f_ms", ToMilliseconds(pClock, pStats->aIntervalBounds[j]));
+	fprintf(pFile, ",recent_bounce_rate,long_term_bounce_rate,median_interval_ms,p90_interval_ms,alerts\n");
+	for(i = 0; i < DKB_KEY_CODE_COUNT; i++) {
+		const DKBKeyTotals *pTotals = &pStats->aKeyTotals[i];
+		uint64_t nEventCount = pTotals->nPassCount + pTotals->nDropCount;
+		if(nEventCount == 0)
+			continue;
+		fprintf(pFile, "%d,%llu,%llu,%llu,%llu,%llu,%.6f,%.3f", i, (unsigned long long)pTotals->nPassCount,
+			(unsigned long long)pTotals->nDropCount, (unsigned long long)(pTotals->nDropCount - pTotals->nPressDropCount),
+			(unsigned long long)pTotals->nPressDropCount, (unsigned long long)pTotals->nBounceCount, (double)pTotals->nDropCount / nEventCount,
+			(pTotals->nBounceCount != 0) ? ToMilliseconds(pClock, pTotals->nIntervalSum / pTotals->nBounceCount) : 0.0);
+		for(j = 0; j < DKB_INTERVAL_BUCKET_COUNT; j++)
+			fprintf(pFile, ",%llu", (unsigned long long)pTotals->aIntervalCounts[j]);
+		const DKBKeyHealth *pHealth = &pTotals->aHealth;
+		fprintf(pFile, ",%.4f,%.4f,%.3f,%.3f,%d\n", (double)pHealth->nFastBounceRate / DKB_RATE_ONE, (double)pHealth->nSlowBounceRate / DKB_RATE_ONE,
+			ToMilliseconds(pClock, pHealth->nIntervalMedian), ToMilliseconds(pClock, pHealth->nIntervalHigh), pHealth->nAlerts);
+	}
+
+}
+
+static void LoadHealth(DKBKeyHealth *pHealth, const DKBKeyHealth *pEngineHealth) {
+
+	// field by field, the filter may be in the middle of an update
+	pHealth->nIntervalMedian = __atomic_load_n(&pEngineHealth->nIntervalMedian, __ATOMIC_RELAXED);
+	pHealth->nIntervalHigh = __atomic_load_n(&pEngineHealth->nIntervalHigh, __ATOMIC_RELAXED);
+	pHealth->nFastBounceRate = __atomic_load_n(&pEngineHealth->nFastBounceRate, __ATOMIC_RELAXED);
+	pHealth->nSlowBounceRate = __atomic_load_n(&pEngineHealth->nSlowBounceRate, __ATOMIC_RELAXED);
+	pHealth->nPressCount = __atomic_load_n(&pEngineHealth->nPressCount, __ATOMIC_RELAXED);
+	pHealth->nAlerts = __atomic_load_n(&pEngineHealth->nAlerts, __ATOMIC_RELAXED);
+
+}
+
+static double ToMilliseconds(const DKBClock *pClock, uint64_t nTicks) {
+
+	return DKBClockToNanoseconds(pClock, nTicks) / 1000000.0;
+
+}
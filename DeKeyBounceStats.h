@@ -0,0 +1,81 @@
+/*
+ * DeKeyBounce
+ * Per-key bounce totals gathered from the engine counters and their export.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_STATS_H
+#define DEKEYBOUNCE_STATS_H
+
+#include <stdint.h>
+
+#include "DeKeyBounceClock.h"
+#include "DeKeyBounceEngine.h"
+
+/*
+ * The filter only bumps the 32-bit counters of its key states. A reader
+ * (the housekeeping) collects what they gained since its last look into
+ * 64-bit totals, so a reset is clearing the totals, and the filter never
+ * waits for it nor notices it.
+ */
+
+#define DKB_STATS_JSON 0
+#define DKB_STATS_CSV 1
+
+typedef struct _DKBKeyTotals {
+
+	uint64_t nPassCount;
+	uint64_t nDropCount;
+	uint64_t nPressDropCount; /* of nDropCount, by the hold window; the rest are release bounces */
+	uint64_t nBounceCount;
+	uint64_t nIntervalSum;
+	uint64_t aIntervalCounts[DKB_INTERVAL_BUCKET_COUNT];
+	DKBKeyHealth aHealth; /* as of the last engine which saw the key */
+	uint16_t nReportedAlerts;
+
+} DKBKeyTotals;
+
+typedef struct _DKBStats {
+
+	uint64_t nStartTime; /* DKBClockNow of the last reset */
+	uint64_t nMinTimestampDiff; /* the base threshold of the config, the bound of the last interval bucket */
+	uint64_t nMinHoldDiff;
+	uint64_t aIntervalBounds[DKB_INTERVAL_BUCKET_COUNT]; /* of the last collected engine */
+	DKBKeyTotals aKeyTotals[DKB_KEY_CODE_COUNT];
+
+} DKBStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void DKBStatsReset(DKBStats *pStats, uint64_t nNow);
+void DKBStatsCollect(DKBStats *pStats, const DKBEngine *pEngine, DKBKeyCounters *pSeenCounters);
+void DKBStatsMerge(DKBStats *pStats, const DKBStats *pOther);
+void DKBStatsReportAlerts(DKBStats *pStats, const DKBClock *pClock);
+int DKBStatsExport(const DKBStats *pStats, const DKBClock *pClock, uint64_t nNow, const char *pPath);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_STATS_H */
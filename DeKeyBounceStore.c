@@ -0,0 +1,144 @@
+/*
+ * DeKeyBounce
+ * A memory-mapped file keeping the engine state across daemon restarts.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceStore.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#endif
+
+static uint64_t GetBootTime(void);
+
+int DKBStoreOpen(DKBStore *pStore, const char *pPath, uint64_t nMinTimestampDiff, int *pIsWarm) {
+
+	memset(pStore, 0, sizeof *pStore);
+	pStore->nFile = -1;
+	*pIsWarm = 0;
+	size_t nPageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t nHeaderSize = (sizeof(DKBStoreHeader) + nPageSize - 1) & ~(nPageSize - 1);
+	pStore->nMappingSize = nHeaderSize + ((sizeof(DKBEngine) + nPageSize - 1) & ~(nPageSize - 1));
+
+	int isSuccess = 0;
+	int isSizeValid = 0;
+	do { // just for break
+		pStore->nFile = open(pPath, O_RDWR | O_CREAT, 0600);
+		if(pStore->nFile < 0)
+			break;
+		struct stat aStat;
+		if(fstat(pStore->nFile, &aStat) != 0)
+			break;
+		isSizeValid = ((size_t)aStat.st_size == pStore->nMappingSize);
+		if(!isSizeValid && ftruncate(pStore->nFile, pStore->nMappingSize) != 0)
+			break;
+		pStore->pMapping = mmap(NULL, pStore->nMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, pStore->nFile, 0);
+		if(pStore->pMapping == MAP_FAILED) {
+			pStore->pMapping = NULL;
+			break;
+		}
+		pStore->pHeader = (DKBStoreHeader *)pStore->pMapping;
+		pStore->pEngine = (DKBEngine *)((char *)pStore->pMapping + nHeaderSize);
+		isSuccess = 1;
+	} while(0);
+	if(!isSuccess) {
+		DKBStoreClose(pStore);
+		return -1;
+	}
+
+	DKBStoreHeader *pHeader = pStore->pHeader;
+	uint64_t nBootTime = GetBootTime();
+	if(isSizeValid && pHeader->nMagic == DKB_STORE_MAGIC && pHeader->nVersion == DKB_STORE_VERSION
+		&& pHeader->nHeaderSize == nHeaderSize && pHeader->nEngineSize == sizeof(DKBEngine)) {
+		DKBEngineResume(pStore->pEngine, nBootTime != 0 && pHeader->nBootTime == nBootTime);
+		DKBEngineSetMinTimestampDiff(pStore->pEngine, nMinTimestampDiff);
+		DKBEngineSetIntervalBase(pStore->pEngine, nMinTimestampDiff);
+		*pIsWarm = 1;
+	} else {
+		pHeader->nMagic = 0; // a crash before the end leaves the file invalid
+		DKBEngineInit(pStore->pEngine, nMinTimestampDiff);
+		pHeader->nVersion = DKB_STORE_VERSION;
+		pHeader->nHeaderSize = nHeaderSize;
+		pHeader->nEngineSize = sizeof(DKBEngine);
+		pHeader->nMagic = DKB_STORE_MAGIC;
+	}
+	pHeader->nBootTime = nBootTime;
+	return 0;
+
+}
+
+int DKBStoreSync(DKBStore *pStore) {
+
+	if(pStore->pMapping == NULL)
+		return -1;
+	return msync(pStore->pMapping, pStore->nMappingSize, MS_ASYNC);
+
+}
+
+void DKBStoreClose(DKBStore *pStore) {
+
+	if(pStore->pMapping != NULL) {
+		msync(pStore->pMapping, pStore->nMappingSize, MS_SYNC);
+		munmap(pStore->pMapping, pStore->nMappingSize);
+		pStore->pMapping = NULL;
+	}
+	pStore->pHeader = NULL;
+	pStore->pEngine = NULL;
+	if(pStore->nFile >= 0) {
+		close(pStore->nFile);
+		pStore->nFile = -1;
+	}
+
+}
+
+static uint64_t GetBootTime(void) {
+
+#ifdef __APPLE__
+	struct timeval aBootTime;
+	size_t nSize = sizeof aBootTime;
+	int aName[2] = { CTL_KERN, KERN_BOOTTIME };
+	if(sysctl(aName, 2, &aBootTime, &nSize, NULL, 0) != 0)
+		return 0;
+	return (uint64_t)aBootTime.tv_sec * 1000000 + aBootTime.tv_usec;
+#else
+	FILE *pStat = fopen("/proc/stat", "r");
+	if(pStat == NULL)
+		return 0;
+	char aLine[256];
+	unsigned long long nBootTime = 0;
+	while(fgets(aLine, sizeof aLine, pStat) != NULL) {
+		if(sscanf(aLine, "btime %llu", &nBootTime) == 1)
+			break;
+	}
+	fclose(pStat);
+	return nBootTime;
+#endif
+
+}
@@ -0,0 +1,75 @@
+/*
+ * DeKeyBounce
+ * A memory-mapped file keeping the engine state across daemon restarts.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_STORE_H
+#define DEKEYBOUNCE_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DeKeyBounceEngine.h"
+
+/*
+ * The file is a DKBStoreHeader page followed by the DKBEngine itself. The
+ * engine is used right in the shared mapping, so the kernel tracks which
+ * pages the filter dirtied and DKBStoreSync writes back only those.
+ */
+
+#define DKB_STORE_MAGIC 0x53424B44UL /* "DKBS" */
+#define DKB_STORE_VERSION 7
+
+typedef struct _DKBStoreHeader {
+
+	uint32_t nMagic;
+	uint16_t nVersion;
+	uint16_t nHeaderSize;
+	uint64_t nEngineSize; /* sizeof(DKBEngine) of the writer */
+	uint64_t nBootTime; /* key timestamps are only meaningful within one boot */
+
+} DKBStoreHeader;
+
+typedef struct _DKBStore {
+
+	int nFile;
+	void *pMapping;
+	size_t nMappingSize;
+	DKBStoreHeader *pHeader;
+	DKBEngine *pEngine;
+
+} DKBStore;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int DKBStoreOpen(DKBStore *pStore, const char *pPath, uint64_t nMinTimestampDiff, int *pIsWarm);
+int DKBStoreSync(DKBStore *pStore);
+void DKBStoreClose(DKBStore *pStore);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_STORE_H */
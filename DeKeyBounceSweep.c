@@ -0,0 +1,390 @@
+/*
+ * DeKeyBounce
+ * A tool that picks per-key thresholds by sweeping them over a trace corpus.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * One pass over every trace judges each key-down under all the candidate
+ * thresholds at once: a key keeps one release timestamp per candidate, in
+ * an array the inner loop walks without branches, so the compiler turns
+ * it into vector compares and selects. The traces are mapped and shared
+ * out to one worker per core. The model is the release window of the
+ * engine (DKBEngineFilterEvent without a hold window), checked against
+ * DeKeyBounceReplay: the key-downs dropped at a candidate are the ones
+ * replaying with that threshold drops.
+ *
+ * Chatter comes within a few ms of the key-up, genuine second presses of
+ * the same key are spread thinly over tens of ms, so the key-downs each
+ * step of the threshold adds to the drops fall off to a background level,
+ * which the upper half of the candidates tells (their mean step). Those
+ * added drops are chatter plus genuine presses; past the point where they
+ * are no more than twice the background, a step drops at least as many
+ * genuine presses as chatter. That first candidate, over a few steps not
+ * to stop on noise, is the recommendation. The output is a config file
+ * (see DeKeyBounceConfig.h) with a key line per key pressed often enough.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "DeKeyBounceClock.h"
+#include "DeKeyBounceEngine.h"
+#include "DeKeyBounceTrace.h"
+
+#define DEFAULT_MIN_THRESHOLD 1.0 /* ms */
+#define DEFAULT_MAX_THRESHOLD 60.0
+#define DEFAULT_THRESHOLD_STEP 1.0
+#define DEFAULT_MIN_PRESS_COUNT 200 /* of a key to recommend a threshold for */
+#define MAX_CANDIDATE_COUNT 1024
+#define WINDOW_STEP_COUNT 5 /* steps of the threshold the added drops are summed over */
+#define DEVICE_COUNT 256
+
+typedef struct _SweepRun {
+
+	char * const *pPaths;
+	size_t nPathCount;
+	size_t nNextPath; // taken by the workers with an atomic add
+	double aThresholds[MAX_CANDIDATE_COUNT]; // ms
+	size_t nCandidateCount;
+
+} SweepRun;
+
+typedef struct _SweepWorker {
+
+	SweepRun *pRun;
+	uint64_t *pLastTimestamps[DEVICE_COUNT]; // per key code and candidate, as DKBKeyState.nLastTimestamp
+	unsigned char *pIsDown[DEVICE_COUNT]; // per key code, unfiltered
+	uint64_t *pDropCounts; // key-downs dropped, per key code and candidate
+	uint64_t aPressCounts[DKB_KEY_CODE_COUNT]; // unfiltered key-downs of released keys
+	uint64_t nEventCount;
+	size_t nTraceCount;
+	size_t nFailedCount;
+	pthread_t aThread;
+
+} SweepWorker;
+
+static void *Sweep(void *pArgument);
+static int SweepTrace(SweepWorker *pWorker, const char *pPath);
+static void SweepKeyDown(uint64_t *pLastTimestamps, const uint64_t *pThresholds, uint64_t *pDropCounts, size_t nCount, uint64_t nTimestamp);
+static size_t FindBalance(const uint64_t *pDropCounts, size_t nCount);
+static int ParseRange(const char *pText, double *pMin, double *pMax, double *pStep);
+static void Usage(const char *pName);
+
+int main (int argc, char * const argv[]) {
+
+	double fMinThreshold = DEFAULT_MIN_THRESHOLD, fMaxThreshold = DEFAULT_MAX_THRESHOLD, fStep = DEFAULT_THRESHOLD_STEP;
+	unsigned long nMinPressCount = DEFAULT_MIN_PRESS_COUNT;
+	long nWorkerCount = 0;
+	const char *pOutputPath = NULL;
+	const char *pGridPath = NULL;
+	int nOption;
+	while((nOption = getopt(argc, argv, "r:n:j:o:g:")) != -1) {
+		switch(nOption) {
+		case 'r':
+			if(ParseRange(optarg, &fMinThreshold, &fMaxThreshold, &fStep) != 0) {
+				Usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'n': nMinPressCount = strtoul(optarg, NULL, 10); break;
+		case 'j': nWorkerCount = strtol(optarg, NULL, 10); break;
+		case 'o': pOutputPath = optarg; break;
+		case 'g': pGridPath = optarg; break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if(optind == argc) {
+		Usage(argv[0]);
+		return 1;
+	}
+	static SweepRun aRun;
+	aRun.pPaths = &argv[optind];
+	aRun.nPathCount = argc - optind;
+	for(aRun.nCandidateCount = 0; aRun.nCandidateCount < MAX_CANDIDATE_COUNT; aRun.nCandidateCount++) {
+		double fThreshold = fMinThreshold + aRun.nCandidateCount * fStep; // no accumulated rounding
+		if(fThreshold > fMaxThreshold + fStep / 1000)
+			break;
+		aRun.aThresholds[aRun.nCandidateCount] = fThreshold;
+	}
+	if(nWorkerCount <= 0)
+		nWorkerCount = sysconf(_SC_NPROCESSORS_ONLN);
+	if((size_t)nWorkerCount > aRun.nPathCount)
+		nWorkerCount = aRun.nPathCount;
+	SweepWorker *pWorkers = calloc(nWorkerCount, sizeof(SweepWorker));
+	if(pWorkers == NULL) {
+		perror("DeKeyBounceSweep");
+		return 1;
+	}
+	long i;
+	for(i = 0; i < nWorkerCount; i++) {
+		pWorkers[i].pRun = &aRun;
+		pWorkers[i].pDropCounts = calloc(DKB_KEY_CODE_COUNT * aRun.nCandidateCount, sizeof(uint64_t));
+		if(pWorkers[i].pDropCounts == NULL) {
+			perror("DeKeyBounceSweep");
+			return 1;
+		}
+	}
+	long nStartedCount;
+	for(nStartedCount = 0; nStartedCount < nWorkerCount; nStartedCount++) {
+		if(pthread_create(&pWorkers[nStartedCount].aThread, NULL, Sweep, &pWorkers[nStartedCount]) != 0)
+			break;
+	}
+	if(nStartedCount == 0)
+		Sweep(&pWorkers[0]); // no thread to spare, do it here
+	for(i = 0; i < nStartedCount; i++)
+		pthread_join(pWorkers[i].aThread, NULL);
+
+	// the workers merged into the first one
+	SweepWorker *pTotal = &pWorkers[0];
+	size_t nCode, nCandidate;
+	for(i = 1; i < nWorkerCount; i++) {
+		for(nCode = 0; nCode < DKB_KEY_CODE_COUNT * aRun.nCandidateCount; nCode++)
+			pTotal->pDropCounts[nCode] += pWorkers[i].pDropCounts[nCode];
+		for(nCode = 0; nCode < DKB_KEY_CODE_COUNT; nCode++)
+			pTotal->aPressCounts[nCode] += pWorkers[i].aPressCounts[nCode];
+		pTotal->nEventCount += pWorkers[i].nEventCount;
+		pTotal->nTraceCount += pWorkers[i].nTraceCount;
+		pTotal->nFailedCount += pWorkers[i].nFailedCount;
+	}
+	int nResult = (pTotal->nFailedCount != 0) ? 1 : 0;
+	if(pGridPath != NULL) {
+		FILE *pGrid = fopen(pGridPath, "w");
+		if(pGrid == NULL) {
+			perror(pGridPath);
+			nResult = 1;
+		} else {
+			fprintf(pGrid, "code,threshold_ms,presses,dropped\n");
+			for(nCode = 0; nCode < DKB_KEY_CODE_COUNT; nCode++) {
+				if(pTotal->aPressCounts[nCode] == 0)
+					continue;
+				for(nCandidate = 0; nCandidate < aRun.nCandidateCount; nCandidate++) {
+					fprintf(pGrid, "%zu,%.3f,%llu,%llu\n", nCode, aRun.aThresholds[nCandidate], (unsigned long long)pTotal->aPressCounts[nCode],
+						(unsigned long long)pTotal->pDropCounts[nCode * aRun.nCandidateCount + nCandidate]);
+				}
+			}
+			if(ferror(pGrid) | fclose(pGrid)) {
+				perror(pGridPath);
+				nResult = 1;
+			}
+		}
+	}
+	FILE *pOutput = stdout;
+	if(pOutputPath != NULL && (pOutput = fopen(pOutputPath, "w")) == NULL) {
+		perror(pOutputPath);
+		return 1;
+	}
+	fprintf(pOutput, "# DeKeyBounceSweep over %zu traces, %llu events, thresholds from %.3f to %.3f ms\n",
+		pTotal->nTraceCount, (unsigned long long)pTotal->nEventCount, aRun.aThresholds[0], aRun.aThresholds[aRun.nCandidateCount - 1]);
+	for(nCode = 0; nCode < DKB_KEY_CODE_COUNT; nCode++) {
+		uint64_t nPressCount = pTotal->aPressCounts[nCode];
+		if(nPressCount < nMinPressCount || nPressCount == 0)
+			continue;
+		const uint64_t *pDropCounts = &pTotal->pDropCounts[nCode * aRun.nCandidateCount];
+		nCandidate = FindBalance(pDropCounts, aRun.nCandidateCount);
+		fprintf(pOutput, "# %llu presses, %.2f%% dropped at %.3f ms, %.2f%% at %.3f ms\n", (unsigned long long)nPressCount,
+			pDropCounts[nCandidate] * 100.0 / nPressCount, aRun.aThresholds[nCandidate],
+			pDropCounts[aRun.nCandidateCount - 1] * 100.0 / nPressCount, aRun.aThresholds[aRun.nCandidateCount - 1]);
+		fprintf(pOutput, "key %zu %.3f\n", nCode, aRun.aThresholds[nCandidate]);
+	}
+	if(pOutput != stdout && (ferror(pOutput) | fclose(pOutput))) {
+		perror(pOutputPath);
+		nResult = 1;
+	}
+	for(i = 0; i < nWorkerCount; i++) {
+		int j;
+		for(j = 0; j < DEVICE_COUNT; j++) {
+			free(pWorkers[i].pLastTimestamps[j]);
+			free(pWorkers[i].pIsDown[j]);
+		}
+		free(pWorkers[i].pDropCounts);
+	}
+	free(pWorkers);
+	return nResult;
+
+}
+
+static void *Sweep(void *pArgument) {
+
+	SweepWorker *pWorker = pArgument;
+	SweepRun *pRun = pWorker->pRun;
+	size_t nIndex;
+	while((nIndex = __atomic_fetch_add(&pRun->nNextPath, 1, __ATOMIC_RELAXED)) < pRun->nPathCount) {
+		if(SweepTrace(pWorker, pRun->pPaths[nIndex]) == 0) {
+			pWorker->nTraceCount++;
+		} else {
+			fprintf(stderr, "%s: %s\n", pRun->pPaths[nIndex], (errno == EINVAL) ? "not a trace" : strerror(errno));
+			pWorker->nFailedCount++;
+		}
+	}
+	return NULL;
+
+}
+
+static int SweepTrace(SweepWorker *pWorker, const char *pPath) {
+
+	const SweepRun *pRun = pWorker->pRun;
+	size_t nCandidateCount = pRun->nCandidateCount;
+	int nFile = open(pPath, O_RDONLY);
+	if(nFile < 0)
+		return -1;
+	struct stat aStat;
+	void *pMapping = MAP_FAILED;
+	if(fstat(nFile, &aStat) != 0)
+		pMapping = MAP_FAILED;
+	else if((size_t)aStat.st_size < sizeof(DKBTraceHeader))
+		errno = EINVAL;
+	else
+		pMapping = mmap(NULL, aStat.st_size, PROT_READ, MAP_PRIVATE, nFile, 0);
+	int nError = errno;
+	close(nFile);
+	if(pMapping == MAP_FAILED) {
+		errno = nError;
+		return -1;
+	}
+	madvise(pMapping, aStat.st_size, MADV_SEQUENTIAL);
+	const DKBTraceHeader *pHeader = pMapping;
+	if(DKBTraceCheckHeader(pHeader) != 0) {
+		munmap(pMapping, aStat.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	const DKBEvent *pEvents = (const DKBEvent *)(pHeader + 1);
+	size_t nCount = (aStat.st_size - sizeof(DKBTraceHeader)) / sizeof(DKBEvent);
+	if(pHeader->nEventCount != 0 && pHeader->nEventCount < nCount)
+		nCount = pHeader->nEventCount;
+
+	DKBClock aClock;
+	DKBClockInitRatio(&aClock, pHeader->nTicksNumer, pHeader->nTicksDenom);
+	uint64_t aThresholds[MAX_CANDIDATE_COUNT]; // in the ticks of this trace
+	size_t nCandidate;
+	for(nCandidate = 0; nCandidate < nCandidateCount; nCandidate++)
+		aThresholds[nCandidate] = DKBClockFromNanoseconds(&aClock, (uint64_t)(pRun->aThresholds[nCandidate] * 1000000.0));
+	unsigned char aIsInitialized[DEVICE_COUNT];
+	memset(aIsInitialized, 0, sizeof aIsInitialized);
+	size_t i;
+	for(i = 0; i < nCount; i++) {
+		const DKBEvent *pEvent = &pEvents[i];
+		uint8_t nDevice = pEvent->nDevice;
+		if(!aIsInitialized[nDevice]) { // a trace starts with every key unseen
+			if(pWorker->pLastTimestamps[nDevice] == NULL) {
+				pWorker->pLastTimestamps[nDevice] = malloc(DKB_KEY_CODE_COUNT * nCandidateCount * sizeof(uint64_t));
+				pWorker->pIsDown[nDevice] = malloc(DKB_KEY_CODE_COUNT);
+				if(pWorker->pLastTimestamps[nDevice] == NULL || pWorker->pIsDown[nDevice] == NULL) {
+					munmap(pMapping, aStat.st_size);
+					errno = ENOMEM;
+					return -1;
+				}
+			}
+			size_t j;
+			for(j = 0; j < DKB_KEY_CODE_COUNT * nCandidateCount; j++)
+				pWorker->pLastTimestamps[nDevice][j] = DKB_TIMESTAMP_UNSEEN;
+			memset(pWorker->pIsDown[nDevice], 0, DKB_KEY_CODE_COUNT);
+			aIsInitialized[nDevice] = 1;
+		}
+		if(pEvent->nKeyCode >= DKB_KEY_CODE_COUNT)
+			continue; // passed by the engine under any threshold
+		uint64_t *pLastTimestamps = &pWorker->pLastTimestamps[nDevice][pEvent->nKeyCode * nCandidateCount];
+		unsigned char *pIsDown = &pWorker->pIsDown[nDevice][pEvent->nKeyCode];
+		if(pEvent->nType == DKB_EVENT_KEY_DOWN) {
+			if(!*pIsDown)
+				pWorker->aPressCounts[pEvent->nKeyCode]++;
+			*pIsDown = 1;
+			SweepKeyDown(pLastTimestamps, aThresholds, &pWorker->pDropCounts[pEvent->nKeyCode * nCandidateCount], nCandidateCount, pEvent->nTimestamp);
+		} else {
+			*pIsDown = 0;
+			for(nCandidate = 0; nCandidate < nCandidateCount; nCandidate++)
+				pLastTimestamps[nCandidate] = pEvent->nTimestamp; // what the engine does with every key-up but in the hold window
+		}
+	}
+	pWorker->nEventCount += nCount;
+	munmap(pMapping, aStat.st_size);
+	return 0;
+
+}
+
+static void SweepKeyDown(uint64_t *pLastTimestamps, const uint64_t *pThresholds, uint64_t *pDropCounts, size_t nCount, uint64_t nTimestamp) {
+
+	// the key-down branch of DKBEngineFilterEvent as selects, one lane per candidate
+	size_t i;
+	for(i = 0; i < nCount; i++) {
+		uint64_t nLastTimestamp = pLastTimestamps[i];
+		uint64_t isHeldOrUnseen = nLastTimestamp >> 63; // DKB_TIMESTAMP_UNSEEN has the DKB_TIMESTAMP_KEY_DOWN bit too
+		uint64_t isUnseen = (nLastTimestamp == DKB_TIMESTAMP_UNSEEN);
+		uint64_t isSwallowing = (nLastTimestamp == 0);
+		uint64_t isBounce = !isHeldOrUnseen & !isSwallowing & (nTimestamp < nLastTimestamp + pThresholds[i]);
+		uint64_t isDropped = isBounce | isSwallowing;
+		uint64_t nPressed = nTimestamp | DKB_TIMESTAMP_KEY_DOWN;
+		uint64_t nKept = (isHeldOrUnseen & !isUnseen) ? nLastTimestamp : nPressed; // held, an autorepeat
+		pLastTimestamps[i] = isDropped ? 0 : nKept;
+		pDropCounts[i] += isDropped;
+	}
+
+}
+
+static size_t FindBalance(const uint64_t *pDropCounts, size_t nCount) {
+
+	if(nCount < 2)
+		return 0;
+	size_t nMiddle = (nCount - 1) / 2;
+	double fBackground = (double)(pDropCounts[nCount - 1] - pDropCounts[nMiddle]) / (nCount - 1 - nMiddle); // per step
+	size_t i;
+	for(i = 0; i < nCount - 1; i++) {
+		size_t nEnd = (i + WINDOW_STEP_COUNT < nCount) ? i + WINDOW_STEP_COUNT : nCount - 1;
+		if(pDropCounts[nEnd] - pDropCounts[i] <= 2 * fBackground * (nEnd - i))
+			return i;
+	}
+	return nCount - 1;
+
+}
+
+static int ParseRange(const char *pText, double *pMin, double *pMax, double *pStep) {
+
+	// min:max or min:max:step, in ms
+	double fMin, fMax, fStep = *pStep;
+	int nFieldCount = sscanf(pText, "%lf:%lf:%lf", &fMin, &fMax, &fStep);
+	if(nFieldCount < 2 || fMin <= 0 || fMax < fMin || fStep <= 0)
+		return -1;
+	if((fMax - fMin) / fStep >= MAX_CANDIDATE_COUNT)
+		return -1;
+	*pMin = fMin;
+	*pMax = fMax;
+	*pStep = fStep;
+	return 0;
+
+}
+
+static void Usage(const char *pName) {
+
+	fprintf(stderr,
+		"usage: %s [-r min:max[:step] ms] [-n min presses] [-j workers] [-o config] [-g grid.csv] trace...\n", pName);
+
+}
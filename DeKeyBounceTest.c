@@ -0,0 +1,161 @@
+/*
+ * DeKeyBounce
+ * Checks of the engine, run after a change to it.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Every check prints its name and ok or FAIL, the exit status is 1 if one
+ * failed. The health checks feed a key presses bouncing at a known rate
+ * and compare the averages the engine keeps, taken over many presses,
+ * with that rate, and check that holding a key (its autorepeats) counts
+ * as one press. The hold window check taps a key shorter than the window
+ * and expects the key-up released at its end, or dropped with a re-press.
+ * Build: cc -O2 -o DeKeyBounceTest DeKeyBounceTest.c DeKeyBounceEngine.c DeKeyBounceCompact.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "DeKeyBounceEngine.h"
+
+#define TICKS_PER_MS 1000000ULL /* nanoseconds */
+#define PRESS_COUNT 400000
+#define KEY_CODE 4
+
+static int CheckBounceRate(double fRate);
+static int CheckAutorepeat(void);
+static int CheckHoldWindow(void);
+static int Feed(DKBEngine *pEngine, uint64_t nTimestamp, int nType);
+
+static DKBEngine theEngine;
+
+int main(int argc, const char * argv[]) {
+
+	int isFailed = 0;
+	static const double aRates[] = { 0.002, 0.005, 0.01, 0.05, 0.2 };
+	size_t i;
+	for(i = 0; i < sizeof aRates / sizeof aRates[0]; i++)
+		isFailed |= !CheckBounceRate(aRates[i]);
+	isFailed |= !CheckAutorepeat();
+	isFailed |= !CheckHoldWindow();
+	return isFailed;
+
+}
+
+static int CheckBounceRate(double fRate) {
+
+	// one key-down in 1 / fRate bounces, a clean press is one key-down and a bouncing one two
+	DKBEngineInit(&theEngine, 20 * TICKS_PER_MS);
+	unsigned nPeriod = (unsigned)(1 / fRate + 0.5);
+	const DKBKeyHealth *pHealth = &theEngine.aKeyStates[KEY_CODE].aHealth;
+	uint64_t nTimestamp = 0;
+	double fFastSum = 0, fSlowSum = 0;
+	unsigned nSampleCount = 0;
+	unsigned i;
+	for(i = 0; i < PRESS_COUNT; i++) {
+		nTimestamp += 100 * TICKS_PER_MS;
+		Feed(&theEngine, nTimestamp, DKB_EVENT_KEY_DOWN);
+		Feed(&theEngine, nTimestamp + 50 * TICKS_PER_MS, DKB_EVENT_KEY_UP);
+		if(i % (nPeriod - 1) == nPeriod - 2) {
+			Feed(&theEngine, nTimestamp + 52 * TICKS_PER_MS, DKB_EVENT_KEY_DOWN);
+			Feed(&theEngine, nTimestamp + 60 * TICKS_PER_MS, DKB_EVENT_KEY_UP);
+		}
+		if(i >= PRESS_COUNT / 2) { // settled long since
+			fFastSum += (double)pHealth->nFastBounceRate / DKB_RATE_ONE;
+			fSlowSum += (double)pHealth->nSlowBounceRate / DKB_RATE_ONE;
+			nSampleCount++;
+		}
+	}
+	double fTrueRate = 1.0 / nPeriod;
+	double fFastRate = fFastSum / nSampleCount, fSlowRate = fSlowSum / nSampleCount;
+	// within 5% of the rate, or of 1/65535 for the rates the 0.16 fixed point cannot tell
+	double fTolerance = fTrueRate / 20 + 1.0 / DKB_RATE_ONE;
+	int isPassed = (fFastRate > fTrueRate - fTolerance && fFastRate < fTrueRate + fTolerance
+		&& fSlowRate > fTrueRate - fTolerance && fSlowRate < fTrueRate + fTolerance);
+	printf("bounce rate %.3f%%: recent %.3f%%, long-term %.3f%% %s\n",
+		fTrueRate * 100, fFastRate * 100, fSlowRate * 100, isPassed ? "ok" : "FAIL");
+	return isPassed;
+
+}
+
+static int CheckAutorepeat(void) {
+
+	// a press held for 3 s, repeating every 30 ms after 500 ms, then 20 presses
+	DKBEngineInit(&theEngine, 20 * TICKS_PER_MS);
+	const DKBKeyHealth *pHealth = &theEngine.aKeyStates[KEY_CODE].aHealth;
+	uint64_t nTimestamp = 0;
+	Feed(&theEngine, nTimestamp, DKB_EVENT_KEY_DOWN);
+	uint64_t nRepeatTime;
+	for(nRepeatTime = 500 * TICKS_PER_MS; nRepeatTime < 3000 * TICKS_PER_MS; nRepeatTime += 30 * TICKS_PER_MS)
+		Feed(&theEngine, nTimestamp + nRepeatTime, DKB_EVENT_KEY_DOWN);
+	Feed(&theEngine, nTimestamp + 3000 * TICKS_PER_MS, DKB_EVENT_KEY_UP);
+	int i;
+	for(i = 0; i < 20; i++) {
+		nTimestamp += 4000 * TICKS_PER_MS;
+		Feed(&theEngine, nTimestamp, DKB_EVENT_KEY_DOWN);
+		Feed(&theEngine, nTimestamp + 50 * TICKS_PER_MS, DKB_EVENT_KEY_UP);
+	}
+	int isPassed = (pHealth->nPressCount == 21);
+	printf("autorepeat: %d presses counted of 21 %s\n", pHealth->nPressCount, isPassed ? "ok" : "FAIL");
+	return isPassed;
+
+}
+
+static int CheckHoldWindow(void) {
+
+	// taps of 10 ms in a window of 30 ms: released at its end, by the caller or by the next event, or cancelled by a re-press
+	DKBEngineInit(&theEngine, 20 * TICKS_PER_MS);
+	DKBEngineSetMinHoldDiff(&theEngine, 30 * TICKS_PER_MS);
+	const DKBKeyCounters *pCounters = &theEngine.aKeyStates[KEY_CODE].aCounters;
+	DKBEvent aRelease;
+	uint64_t nNextTime;
+	int isPassed = 1;
+	Feed(&theEngine, 0, DKB_EVENT_KEY_DOWN);
+	isPassed &= (Feed(&theEngine, 10 * TICKS_PER_MS, DKB_EVENT_KEY_UP) == DKB_VERDICT_DROP);
+	isPassed &= (DKBEngineReleaseKeys(&theEngine, 20 * TICKS_PER_MS, &aRelease, 1, &nNextTime) == 0 && nNextTime == 30 * TICKS_PER_MS);
+	isPassed &= (DKBEngineReleaseKeys(&theEngine, 30 * TICKS_PER_MS, &aRelease, 1, &nNextTime) == 1 && nNextTime == 0);
+	isPassed &= (aRelease.nKeyCode == KEY_CODE && aRelease.nType == DKB_EVENT_KEY_UP && aRelease.nTimestamp == 30 * TICKS_PER_MS);
+	Feed(&theEngine, 1000 * TICKS_PER_MS, DKB_EVENT_KEY_DOWN);
+	Feed(&theEngine, 1010 * TICKS_PER_MS, DKB_EVENT_KEY_UP);
+	isPassed &= (Feed(&theEngine, 1015 * TICKS_PER_MS, DKB_EVENT_KEY_DOWN) == DKB_VERDICT_DROP);
+	isPassed &= (Feed(&theEngine, 1100 * TICKS_PER_MS, DKB_EVENT_KEY_UP) == DKB_VERDICT_PASS);
+	Feed(&theEngine, 2000 * TICKS_PER_MS, DKB_EVENT_KEY_DOWN);
+	Feed(&theEngine, 2010 * TICKS_PER_MS, DKB_EVENT_KEY_UP);
+	isPassed &= (Feed(&theEngine, 2100 * TICKS_PER_MS, DKB_EVENT_KEY_DOWN) == DKB_VERDICT_PASS);
+	isPassed &= (theEngine.nDeferredCount == 0 && pCounters->nPassCount == 7 && pCounters->nDropCount == 2 && pCounters->nPressDropCount == 2);
+	printf("hold window: %u passed %u dropped %u in the window %s\n", pCounters->nPassCount, pCounters->nDropCount,
+		pCounters->nPressDropCount, isPassed ? "ok" : "FAIL");
+	return isPassed;
+
+}
+
+static int Feed(DKBEngine *pEngine, uint64_t nTimestamp, int nType) {
+
+	DKBEvent aEvent;
+	memset(&aEvent, 0, sizeof aEvent);
+	aEvent.nTimestamp = nTimestamp;
+	aEvent.nKeyCode = KEY_CODE;
+	aEvent.nType = (uint8_t)nType;
+	return DKBEngineFilterEvent(pEngine, &aEvent);
+
+}
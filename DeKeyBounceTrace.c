@@ -0,0 +1,105 @@
+/*
+ * DeKeyBounce
+ * The binary trace format used for capture, replay and synthetic load.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DeKeyBounceTrace.h"
+
+#include <string.h>
+
+void DKBTraceHeaderInit(DKBTraceHeader *pHeader, uint32_t nTicksNumer, uint32_t nTicksDenom) {
+
+	memset(pHeader, 0, sizeof *pHeader);
+	pHeader->nMagic = DKB_TRACE_MAGIC;
+	pHeader->nVersion = DKB_TRACE_VERSION;
+	pHeader->nRecordSize = sizeof(DKBEvent);
+	pHeader->nTicksNumer = nTicksNumer;
+	pHeader->nTicksDenom = nTicksDenom;
+
+}
+
+int DKBTraceWriteHeader(FILE *pFile, const DKBTraceHeader *pHeader) {
+
+	return (fwrite(pHeader, sizeof *pHeader, 1, pFile) == 1) ? 0 : -1;
+
+}
+
+int DKBTraceReadHeader(FILE *pFile, DKBTraceHeader *pHeader) {
+
+	if(fread(pHeader, sizeof *pHeader, 1, pFile) != 1)
+		return -1;
+	return DKBTraceCheckHeader(pHeader);
+
+}
+
+int DKBTraceCheckHeader(const DKBTraceHeader *pHeader) {
+
+	// for a header read some other way, e.g. from a mapped trace
+	if(pHeader->nMagic != DKB_TRACE_MAGIC)
+		return -1; // not a trace or written on the other endianness
+	if(pHeader->nVersion != DKB_TRACE_VERSION || pHeader->nRecordSize != sizeof(DKBEvent))
+		return -1;
+	if(pHeader->nTicksNumer == 0 || pHeader->nTicksDenom == 0)
+		return -1;
+	return 0;
+
+}
+
+int DKBTraceFinish(FILE *pFile, DKBTraceHeader *pHeader, uint64_t nEventCount) {
+
+	if(fflush(pFile) != 0)
+		return -1;
+	if(fseek(pFile, 0, SEEK_SET) != 0)
+		return 0; // not seekable, readers will run up to the end of file
+	pHeader->nEventCount = nEventCount;
+	if(DKBTraceWriteHeader(pFile, pHeader) != 0)
+		return -1;
+	return (fflush(pFile) == 0) ? 0 : -1;
+
+}
+
+size_t DKBTraceReadEvents(FILE *pFile, const DKBTraceHeader *pHeader, uint64_t *pReadCount, DKBEvent *pEvents, size_t nCount) {
+
+	// *pReadCount counts the records read so far, so a trailer is never taken for events
+	if(pHeader->nEventCount != 0 && nCount > pHeader->nEventCount - *pReadCount)
+		nCount = pHeader->nEventCount - *pReadCount;
+	if(nCount == 0)
+		return 0;
+	size_t nReadCount = fread(pEvents, sizeof(DKBEvent), nCount, pFile);
+	*pReadCount += nReadCount;
+	return nReadCount;
+
+}
+
+int DKBTraceReadJudgements(FILE *pFile, const DKBTraceHeader *pHeader, DKBTraceJudgement *pJudgements) {
+
+	// right after the last record, pJudgements has room for nEventCount of them
+	DKBTraceJudgementHeader aHeader;
+	if(pHeader->nEventCount == 0 || fread(&aHeader, sizeof aHeader, 1, pFile) != 1)
+		return -1;
+	if(aHeader.nMagic != DKB_TRACE_JUDGEMENT_MAGIC || aHeader.nRecordSize != sizeof(DKBTraceJudgement)
+		|| aHeader.nJudgementCount != pHeader->nEventCount)
+		return -1;
+	return (fread(pJudgements, sizeof(DKBTraceJudgement), aHeader.nJudgementCount, pFile) == aHeader.nJudgementCount) ? 0 : -1;
+
+}
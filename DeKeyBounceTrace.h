@@ -0,0 +1,99 @@
+/*
+ * DeKeyBounce
+ * The binary trace format used for capture, replay and synthetic load.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DEKEYBOUNCE_TRACE_H
+#define DEKEYBOUNCE_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "DeKeyBounceEngine.h"
+
+/*
+ * A trace is a DKBTraceHeader followed by DKBEvent records in host byte
+ * order, sorted by nTimestamp. nEventCount may be 0 when the writer could
+ * not seek back (e.g. a pipe), then the records run up to the end of file.
+ * Otherwise readers stop after nEventCount records, and what follows them
+ * is an optional trailer: a flight recorder dump (see DeKeyBounceRecorder)
+ * sets DKB_TRACE_FLAG_DROPPED on the records the engine dropped and adds a
+ * DKBTraceJudgementHeader with one DKBTraceJudgement per record.
+ * The generator, or whoever labeled a capture by hand, tells the genuine
+ * transitions from chatter with DKB_TRACE_FLAG_LABELED and _CHATTER, the
+ * ground truth DeKeyBounceScore judges the verdicts by.
+ */
+
+#define DKB_TRACE_MAGIC 0x54424B44UL /* "DKBT" */
+#define DKB_TRACE_VERSION 1
+#define DKB_TRACE_JUDGEMENT_MAGIC 0x4A424B44UL /* "DKBJ" */
+
+#define DKB_TRACE_FLAG_DROPPED 0x0001 /* in DKBEvent.nFlags */
+#define DKB_TRACE_FLAG_LABELED 0x0002 /* the record is known to be genuine or chatter */
+#define DKB_TRACE_FLAG_CHATTER 0x0004 /* with LABELED, the record is chatter */
+
+typedef struct _DKBTraceHeader {
+
+	uint32_t nMagic;
+	uint16_t nVersion;
+	uint16_t nRecordSize; /* sizeof(DKBEvent) */
+	uint32_t nTicksNumer; /* nanoseconds = ticks * nTicksNumer / nTicksDenom */
+	uint32_t nTicksDenom;
+	uint64_t nEventCount;
+	uint64_t nSeed; /* generator seed, 0 for captured traces */
+
+} DKBTraceHeader;
+
+typedef struct _DKBTraceJudgementHeader {
+
+	uint32_t nMagic;
+	uint16_t nRecordSize; /* sizeof(DKBTraceJudgement) */
+	uint16_t nReserved;
+	uint64_t nJudgementCount; /* nEventCount of the trace */
+
+} DKBTraceJudgementHeader;
+
+typedef struct _DKBTraceJudgement {
+
+	uint64_t nKeyState; /* DKBKeyState.nLastTimestamp right after the verdict */
+	uint64_t nJudgedTime; /* in the ticks of the trace, when the verdict was reached */
+
+} DKBTraceJudgement;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void DKBTraceHeaderInit(DKBTraceHeader *pHeader, uint32_t nTicksNumer, uint32_t nTicksDenom);
+int DKBTraceWriteHeader(FILE *pFile, const DKBTraceHeader *pHeader);
+int DKBTraceReadHeader(FILE *pFile, DKBTraceHeader *pHeader);
+int DKBTraceCheckHeader(const DKBTraceHeader *pHeader);
+int DKBTraceFinish(FILE *pFile, DKBTraceHeader *pHeader, uint64_t nEventCount);
+size_t DKBTraceReadEvents(FILE *pFile, const DKBTraceHeader *pHeader, uint64_t *pReadCount, DKBEvent *pEvents, size_t nCount);
+int DKBTraceReadJudgements(FILE *pFile, const DKBTraceHeader *pHeader, DKBTraceJudgement *pJudgements);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEKEYBOUNCE_TRACE_H */
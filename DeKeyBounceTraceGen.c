@@ -0,0 +1,526 @@
+/*
+ * DeKeyBounce
+ * A generator of synthetic key bounce traces for tests and benchmarks.
+ *
+ * Copyright (c) 2008 Michael Chelnokov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Every session is a typist on its own device: key presses follow a Zipf
+ * distribution over the key set, inter-press intervals follow the typing
+ * speed with bursts and pauses, holds overlap on rollover. Every transition
+ * of a key may chatter: a few extra opposite/same transition pairs spaced by
+ * lognormal intervals, with per-key probability growing over time for the
+ * degraded keys. Timestamps are in nanoseconds. Every record is labeled
+ * genuine or chatter (see DKB_TRACE_FLAG_LABELED) for DeKeyBounceReplay -e.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "DeKeyBounceEngine.h"
+#include "DeKeyBounceTrace.h"
+
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+#define WRITE_BUFFER_COUNT 65536
+#define MAX_BOUNCE_COUNT 8
+
+typedef struct _Random {
+
+	uint64_t aState[4];
+	double fSpareNormal;
+	int hasSpareNormal;
+
+} Random;
+
+typedef struct _KeyModel {
+
+	uint16_t nKeyCode;
+	double fCumulativeWeight;
+	double fBounceProbability;
+	double fBounceIntervalMedian; /* ns */
+
+} KeyModel;
+
+typedef struct _Session {
+
+	Random aRandom;
+	uint16_t nSession;
+	uint8_t nDevice;
+	double fMeanInterval; /* ns between presses */
+	int isBursting;
+	uint64_t nNextPressTime;
+	uint64_t *pHeldUntil; /* per key model, including release chatter */
+
+} Session;
+
+typedef struct _EventHeap {
+
+	DKBEvent *pEvents;
+	size_t nCount;
+	size_t nCapacity;
+
+} EventHeap;
+
+typedef struct _Options {
+
+	uint64_t nSeed;
+	uint64_t nEventLimit;
+	uint64_t nDuration; /* ns */
+	unsigned nSessionCount;
+	unsigned nDeviceCount;
+	unsigned nKeyCount;
+	double fWordsPerMinute;
+	double fRolloverProbability;
+	double fBaseBounceProbability;
+	double fDegradedBounceProbability;
+	unsigned nDegradedKeyCount;
+	double fMeanExtraBounces;
+	double fBounceIntervalMedian; /* ms */
+	double fDegradationPerHour;
+	double fPressSideFraction;
+
+} Options;
+
+static Options theOptions = {
+	1, 1000000, 0, 1, 1, 48, 60.0, 0.15, 0.01, 0.3, 2, 0.5, 1.5, 0.0, 0.3
+};
+static KeyModel *theKeyModels = NULL;
+static EventHeap theHeap = { NULL, 0, 0 };
+static DKBEvent theWriteBuffer[WRITE_BUFFER_COUNT];
+static size_t theWriteBufferCount = 0;
+static uint64_t theWrittenCount = 0;
+static FILE *theOutput = NULL;
+
+static void RandomSeed(Random *pRandom, uint64_t nSeed);
+static uint64_t RandomNext(Random *pRandom);
+static double RandomUniform(Random *pRandom);
+static double RandomExponential(Random *pRandom, double fMean);
+static double RandomNormal(Random *pRandom);
+static double RandomLogNormal(Random *pRandom, double fMedian, double fSigma);
+
+static int HeapPush(EventHeap *pHeap, const DKBEvent *pEvent);
+static void HeapPop(EventHeap *pHeap, DKBEvent *pEvent);
+
+static int InitKeyModels(Random *pRandom);
+static int InitSessions(Session *pSessions);
+static int GenerateKeystroke(Session *pSession);
+static int PushChatter(Session *pSession, const KeyModel *pKey, uint8_t nType, uint64_t nTimestamp, uint64_t nLimit, uint64_t *pEnd);
+static int EmitEvent(const DKBEvent *pEvent);
+static int FlushEvents(void);
+static void Usage(const char *pName);
+
+int main (int argc, char * const argv[]) {
+
+	const char *pOutputPath = NULL;
+	int nOption;
+	while((nOption = getopt(argc, argv, "o:S:n:t:s:d:k:w:r:b:B:D:c:i:g:p:")) != -1) {
+		switch(nOption) {
+		case 'o': pOutputPath = optarg; break;
+		case 'S': theOptions.nSeed = strtoull(optarg, NULL, 10); break;
+		case 'n': theOptions.nEventLimit = strtoull(optarg, NULL, 10); break;
+		case 't': theOptions.nDuration = (uint64_t)(strtod(optarg, NULL) * NS_PER_SEC); break;
+		case 's': theOptions.nSessionCount = strtoul(optarg, NULL, 10); break;
+		case 'd': theOptions.nDeviceCount = strtoul(optarg, NULL, 10); break;
+		case 'k': theOptions.nKeyCount = strtoul(optarg, NULL, 10); break;
+		case 'w': theOptions.fWordsPerMinute = strtod(optarg, NULL); break;
+		case 'r': theOptions.fRolloverProbability = strtod(optarg, NULL); break;
+		case 'b': theOptions.fBaseBounceProbability = strtod(optarg, NULL); break;
+		case 'B': theOptions.fDegradedBounceProbability = strtod(optarg, NULL); break;
+		case 'D': theOptions.nDegradedKeyCount = strtoul(optarg, NULL, 10); break;
+		case 'c': theOptions.fMeanExtraBounces = strtod(optarg, NULL); break;
+		case 'i': theOptions.fBounceIntervalMedian = strtod(optarg, NULL); break;
+		case 'g': theOptions.fDegradationPerHour = strtod(optarg, NULL); break;
+		case 'p': theOptions.fPressSideFraction = strtod(optarg, NULL); break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if(theOptions.nSessionCount == 0 || theOptions.nSessionCount > UINT16_MAX
+		|| theOptions.nDeviceCount == 0 || theOptions.nDeviceCount > 256
+		|| theOptions.nKeyCount == 0 || theOptions.nKeyCount > DKB_KEY_CODE_COUNT
+		|| theOptions.fWordsPerMinute <= 0.0) {
+		Usage(argv[0]);
+		return 1;
+	}
+	if(theOptions.nEventLimit == 0 && theOptions.nDuration == 0) {
+		Usage(argv[0]);
+		return 1; // would never stop
+	}
+
+	theOutput = (pOutputPath != NULL) ? fopen(pOutputPath, "wb") : stdout;
+	if(theOutput == NULL) {
+		perror(pOutputPath);
+		return 1;
+	}
+	DKBTraceHeader aHeader;
+	DKBTraceHeaderInit(&aHeader, 1, 1); // nanoseconds
+	aHeader.nSeed = theOptions.nSeed;
+	Session *pSessions = calloc(theOptions.nSessionCount, sizeof(Session));
+	Random aRandom;
+	RandomSeed(&aRandom, theOptions.nSeed);
+	int isSuccess = 0;
+	do { // just for break
+		if(pSessions == NULL)
+			break;
+		if(DKBTraceWriteHeader(theOutput, &aHeader) != 0)
+			break;
+		if(InitKeyModels(&aRandom) != 0)
+			break;
+		if(InitSessions(pSessions) != 0)
+			break;
+		int isDone = 0;
+		while(!isDone) {
+			Session *pNext = &pSessions[0];
+			unsigned i;
+			for(i = 1; i < theOptions.nSessionCount; i++) {
+				if(pSessions[i].nNextPressTime < pNext->nNextPressTime)
+					pNext = &pSessions[i];
+			}
+			if(theOptions.nDuration != 0 && pNext->nNextPressTime >= theOptions.nDuration)
+				break;
+			while(theHeap.nCount > 0 && theHeap.pEvents[0].nTimestamp <= pNext->nNextPressTime) {
+				DKBEvent aEvent;
+				HeapPop(&theHeap, &aEvent);
+				if(EmitEvent(&aEvent) != 0 || (theOptions.nEventLimit != 0 && theWrittenCount >= theOptions.nEventLimit)) {
+					isDone = 1;
+					break;
+				}
+			}
+			if(!isDone && GenerateKeystroke(pNext) != 0)
+				break;
+		}
+		while(theHeap.nCount > 0 && (theOptions.nEventLimit == 0 || theWrittenCount < theOptions.nEventLimit)) {
+			DKBEvent aEvent;
+			HeapPop(&theHeap, &aEvent);
+			if(EmitEvent(&aEvent) != 0)
+				break;
+		}
+		if(FlushEvents() != 0)
+			break;
+		if(DKBTraceFinish(theOutput, &aHeader, theWrittenCount) != 0)
+			break;
+		isSuccess = 1;
+	} while(0);
+	if(!isSuccess)
+		perror("DeKeyBounceTraceGen");
+
+	if(pSessions != NULL) {
+		unsigned i;
+		for(i = 0; i < theOptions.nSessionCount; i++)
+			free(pSessions[i].pHeldUntil);
+		free(pSessions);
+	}
+	free(theKeyModels);
+	free(theHeap.pEvents);
+	if(theOutput != stdout)
+		fclose(theOutput);
+	return isSuccess ? 0 : 1;
+
+}
+
+static void RandomSeed(Random *pRandom, uint64_t nSeed) {
+
+	int i;
+	for(i = 0; i < 4; i++) { // splitmix64 expansion of the seed
+		uint64_t z = (nSeed += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		pRandom->aState[i] = z ^ (z >> 31);
+	}
+	pRandom->hasSpareNormal = 0;
+
+}
+
+static uint64_t RandomNext(Random *pRandom) { // xoshiro256**
+
+	uint64_t *s = pRandom->aState;
+	uint64_t nResult = s[1] * 5;
+	nResult = ((nResult << 7) | (nResult >> 57)) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = (s[3] << 45) | (s[3] >> 19);
+	return nResult;
+
+}
+
+static double RandomUniform(Random *pRandom) {
+
+	return ((RandomNext(pRandom) >> 11) + 0.5) * (1.0 / 9007199254740992.0); // (0, 1)
+
+}
+
+static double RandomExponential(Random *pRandom, double fMean) {
+
+	return -fMean * log(RandomUniform(pRandom));
+
+}
+
+static double RandomNormal(Random *pRandom) {
+
+	if(pRandom->hasSpareNormal) {
+		pRandom->hasSpareNormal = 0;
+		return pRandom->fSpareNormal;
+	}
+	double fRadius = sqrt(-2.0 * log(RandomUniform(pRandom)));
+	double fAngle = 2.0 * M_PI * RandomUniform(pRandom);
+	pRandom->fSpareNormal = fRadius * sin(fAngle);
+	pRandom->hasSpareNormal = 1;
+	return fRadius * cos(fAngle);
+
+}
+
+static double RandomLogNormal(Random *pRandom, double fMedian, double fSigma) {
+
+	return fMedian * exp(fSigma * RandomNormal(pRandom));
+
+}
+
+static int HeapPush(EventHeap *pHeap, const DKBEvent *pEvent) {
+
+	if(pHeap->nCount == pHeap->nCapacity) {
+		size_t nCapacity = (pHeap->nCapacity != 0) ? pHeap->nCapacity * 2 : 256;
+		DKBEvent *pEvents = realloc(pHeap->pEvents, nCapacity * sizeof(DKBEvent));
+		if(pEvents == NULL)
+			return -1;
+		pHeap->pEvents = pEvents;
+		pHeap->nCapacity = nCapacity;
+	}
+	size_t i = pHeap->nCount++;
+	while(i > 0) {
+		size_t nParent = (i - 1) / 2;
+		if(pHeap->pEvents[nParent].nTimestamp <= pEvent->nTimestamp)
+			break;
+		pHeap->pEvents[i] = pHeap->pEvents[nParent];
+		i = nParent;
+	}
+	pHeap->pEvents[i] = *pEvent;
+	return 0;
+
+}
+
+static void HeapPop(EventHeap *pHeap, DKBEvent *pEvent) {
+
+	*pEvent = pHeap->pEvents[0];
+	DKBEvent aLast = pHeap->pEvents[--pHeap->nCount];
+	size_t i = 0;
+	for(;;) {
+		size_t nChild = 2 * i + 1;
+		if(nChild >= pHeap->nCount)
+			break;
+		if(nChild + 1 < pHeap->nCount && pHeap->pEvents[nChild + 1].nTimestamp < pHeap->pEvents[nChild].nTimestamp)
+			nChild++;
+		if(aLast.nTimestamp <= pHeap->pEvents[nChild].nTimestamp)
+			break;
+		pHeap->pEvents[i] = pHeap->pEvents[nChild];
+		i = nChild;
+	}
+	if(pHeap->nCount > 0)
+		pHeap->pEvents[i] = aLast;
+
+}
+
+static int InitKeyModels(Random *pRandom) {
+
+	unsigned nKeyCount = theOptions.nKeyCount;
+	theKeyModels = calloc(nKeyCount, sizeof(KeyModel));
+	if(theKeyModels == NULL)
+		return -1;
+	unsigned i;
+	for(i = 0; i < nKeyCount; i++)
+		theKeyModels[i].nKeyCode = i;
+	for(i = nKeyCount - 1; i > 0; i--) { // shuffle so that popularity does not follow the key code
+		unsigned j = RandomNext(pRandom) % (i + 1);
+		uint16_t nKeyCode = theKeyModels[i].nKeyCode;
+		theKeyModels[i].nKeyCode = theKeyModels[j].nKeyCode;
+		theKeyModels[j].nKeyCode = nKeyCode;
+	}
+	double fTotal = 0.0;
+	for(i = 0; i < nKeyCount; i++) {
+		fTotal += 1.0 / (i + 1); // Zipf, s = 1
+		theKeyModels[i].fCumulativeWeight = fTotal;
+		theKeyModels[i].fBounceProbability = theOptions.fBaseBounceProbability;
+		theKeyModels[i].fBounceIntervalMedian = theOptions.fBounceIntervalMedian * NS_PER_MS * (0.7 + 0.6 * RandomUniform(pRandom));
+	}
+	for(i = 0; i < nKeyCount; i++)
+		theKeyModels[i].fCumulativeWeight /= fTotal;
+	for(i = 0; i < theOptions.nDegradedKeyCount && i < nKeyCount; i++) {
+		KeyModel *pKey = &theKeyModels[RandomNext(pRandom) % nKeyCount];
+		pKey->fBounceProbability = theOptions.fDegradedBounceProbability;
+	}
+	return 0;
+
+}
+
+static int InitSessions(Session *pSessions) {
+
+	unsigned i;
+	for(i = 0; i < theOptions.nSessionCount; i++) {
+		Session *pSession = &pSessions[i];
+		RandomSeed(&pSession->aRandom, theOptions.nSeed * 0x100000001B3ULL + i + 1);
+		pSession->nSession = i;
+		pSession->nDevice = i % theOptions.nDeviceCount;
+		double fWordsPerMinute = theOptions.fWordsPerMinute * (0.75 + 0.5 * RandomUniform(&pSession->aRandom));
+		pSession->fMeanInterval = 60.0 * NS_PER_SEC / (fWordsPerMinute * 5.0); // five characters per word
+		pSession->nNextPressTime = (uint64_t)RandomExponential(&pSession->aRandom, pSession->fMeanInterval);
+		pSession->pHeldUntil = calloc(theOptions.nKeyCount, sizeof(uint64_t));
+		if(pSession->pHeldUntil == NULL)
+			return -1;
+	}
+	return 0;
+
+}
+
+static int GenerateKeystroke(Session *pSession) {
+
+	Random *pRandom = &pSession->aRandom;
+	uint64_t nPressTime = pSession->nNextPressTime;
+
+	// pick a key which is not held down already
+	unsigned nKey = 0;
+	int nAttempt;
+	for(nAttempt = 0; nAttempt < 4; nAttempt++) {
+		double fPoint = RandomUniform(pRandom);
+		unsigned nLow = 0, nHigh = theOptions.nKeyCount - 1;
+		while(nLow < nHigh) {
+			unsigned nMiddle = (nLow + nHigh) / 2;
+			if(theKeyModels[nMiddle].fCumulativeWeight < fPoint)
+				nLow = nMiddle + 1;
+			else
+				nHigh = nMiddle;
+		}
+		nKey = nLow;
+		if(pSession->pHeldUntil[nKey] < nPressTime)
+			break;
+	}
+	if(pSession->pHeldUntil[nKey] >= nPressTime)
+		nPressTime = pSession->pHeldUntil[nKey] + (uint64_t)RandomLogNormal(pRandom, 80.0 * NS_PER_MS, 0.4); // the typist waits for the key
+	const KeyModel *pKey = &theKeyModels[nKey];
+
+	double fHold = RandomLogNormal(pRandom, 95.0 * NS_PER_MS, 0.3);
+	uint64_t nReleaseTime = nPressTime + (uint64_t)fHold;
+
+	double fBounceProbability = pKey->fBounceProbability * (1.0 + theOptions.fDegradationPerHour * nPressTime / (3600.0 * NS_PER_SEC));
+	uint64_t nChatterEnd = nReleaseTime;
+	DKBEvent aEvent = { nPressTime, pKey->nKeyCode, DKB_EVENT_KEY_DOWN, pSession->nDevice, pSession->nSession, DKB_TRACE_FLAG_LABELED };
+	if(HeapPush(&theHeap, &aEvent) != 0)
+		return -1;
+	if(RandomUniform(pRandom) < fBounceProbability) {
+		if(RandomUniform(pRandom) < theOptions.fPressSideFraction) {
+			uint64_t nPressChatterEnd; // always before the release
+			if(PushChatter(pSession, pKey, DKB_EVENT_KEY_DOWN, nPressTime, nPressTime + (uint64_t)(fHold / 2), &nPressChatterEnd) != 0)
+				return -1;
+		} else {
+			if(PushChatter(pSession, pKey, DKB_EVENT_KEY_UP, nReleaseTime, nReleaseTime + 15 * NS_PER_MS, &nChatterEnd) != 0)
+				return -1;
+		}
+	}
+	aEvent.nTimestamp = nReleaseTime;
+	aEvent.nType = DKB_EVENT_KEY_UP;
+	if(HeapPush(&theHeap, &aEvent) != 0)
+		return -1;
+	pSession->pHeldUntil[nKey] = nChatterEnd;
+
+	// bursts speed the typist up, pauses and rollover shape the next interval
+	if(RandomUniform(pRandom) < 0.05)
+		pSession->isBursting = !pSession->isBursting;
+	double fInterval;
+	if(RandomUniform(pRandom) < theOptions.fRolloverProbability)
+		fInterval = fHold * (0.3 + 0.6 * RandomUniform(pRandom));
+	else
+		fInterval = RandomLogNormal(pRandom, pSession->fMeanInterval * (pSession->isBursting ? 0.5 : 1.0), 0.4);
+	if(RandomUniform(pRandom) < 0.02)
+		fInterval += RandomExponential(pRandom, 1.5 * NS_PER_SEC);
+	pSession->nNextPressTime = nPressTime + 1 + (uint64_t)fInterval;
+	return 0;
+
+}
+
+static int PushChatter(Session *pSession, const KeyModel *pKey, uint8_t nType, uint64_t nTimestamp, uint64_t nLimit, uint64_t *pEnd) {
+
+	Random *pRandom = &pSession->aRandom;
+	unsigned nBounceCount = 1;
+	while(nBounceCount < MAX_BOUNCE_COUNT && RandomUniform(pRandom) < theOptions.fMeanExtraBounces / (1.0 + theOptions.fMeanExtraBounces))
+		nBounceCount++; // geometric
+	DKBEvent aEvent = { 0, pKey->nKeyCode, 0, pSession->nDevice, pSession->nSession, DKB_TRACE_FLAG_LABELED | DKB_TRACE_FLAG_CHATTER };
+	uint64_t nTime = nTimestamp;
+	unsigned i;
+	for(i = 0; i < nBounceCount; i++) {
+		uint64_t nOpposite = nTime + 1 + (uint64_t)RandomLogNormal(pRandom, pKey->fBounceIntervalMedian, 0.6);
+		uint64_t nSame = nOpposite + 1 + (uint64_t)RandomLogNormal(pRandom, pKey->fBounceIntervalMedian, 0.6);
+		if(nSame >= nLimit)
+			break;
+		aEvent.nTimestamp = nOpposite;
+		aEvent.nType = (nType == DKB_EVENT_KEY_DOWN) ? DKB_EVENT_KEY_UP : DKB_EVENT_KEY_DOWN;
+		if(HeapPush(&theHeap, &aEvent) != 0)
+			return -1;
+		aEvent.nTimestamp = nSame;
+		aEvent.nType = nType;
+		if(HeapPush(&theHeap, &aEvent) != 0)
+			return -1;
+		nTime = nSame;
+	}
+	*pEnd = nTime;
+	return 0;
+
+}
+
+static int EmitEvent(const DKBEvent *pEvent) {
+
+	theWriteBuffer[theWriteBufferCount++] = *pEvent;
+	theWrittenCount++;
+	if(theWriteBufferCount == WRITE_BUFFER_COUNT)
+		return FlushEvents();
+	return 0;
+
+}
+
+static int FlushEvents(void) {
+
+	if(theWriteBufferCount == 0)
+		return 0;
+	if(fwrite(theWriteBuffer, sizeof(DKBEvent), theWriteBufferCount, theOutput) != theWriteBufferCount)
+		return -1;
+	theWriteBufferCount = 0;
+	return 0;
+
+}
+
+static void Usage(const char *pName) {
+
+	fprintf(stderr,
+		"usage: %s [-o trace] [-S seed] [-n events] [-t seconds]\n"
+		"\t[-s sessions] [-d devices] [-k keys] [-w wpm] [-r rollover]\n"
+		"\t[-b bounce probability] [-B degraded bounce probability] [-D degraded keys]\n"
+		"\t[-c mean extra bounces] [-i bounce interval ms] [-g degradation per hour]\n"
+		"\t[-p press side chatter fraction]\n", pName);
+
+}